@@ -7,6 +7,12 @@
 #define APM_APMMANAGER_HPP
 
 #include "APMUart.hpp"
+#include <APM/ChargeController.hpp>
+#include <APM/GFDVoter.hpp>
+#include <APM/Handshake.hpp>
+#include <APM/KeyInput.hpp>
+#include <APM/PrechargeMonitor.hpp>
+#include <APM/WarmStart.hpp>
 #include <APM/dev/SIM100.hpp>
 #include <EVT/dev/Timer.hpp>
 #include <EVT/dev/platform/f3xx/f302x8/Timerf302x8.hpp>
@@ -19,6 +25,35 @@ namespace IO = EVT::core::IO;
 
 enum class APMMode { OFF = 0u, ACCESSORY = 1u, ON = 2u };
 
+class SwitchMonitor;
+
+/**
+ * Returns the name of a mode
+ * @param mode the mode
+ * @return the name, for printing
+ */
+const char *getName(APMMode mode);
+
+/**
+ * Timestamps taken while tripping from ON to ACCESSORY on a GFD fault.  All
+ * values are DWT cycle counts.
+ */
+struct TripRecord {
+  // The fault that caused the trip
+  DEV::SIM100::IsolationStateResponse reason =
+      DEV::SIM100::IsolationStateResponse::NoError;
+  // The voted fault was returned to the GFD handler
+  uint32_t detected = 0;
+  // The switch outputs reached the safe state
+  uint32_t outputsSafe = 0;
+  // The indicators and GFD timer were updated
+  uint32_t bookkeepingDone = 0;
+  // The deferred log messages finished printing
+  uint32_t loggingDone = 0;
+  // Number of trips since power on
+  uint32_t count = 0;
+};
+
 class APMManager {
 public:
   static constexpr IO::Pin MC_ON = IO::Pin::PA_0;
@@ -36,18 +71,20 @@ public:
   static constexpr IO::Pin ACCESSORY_INDICATOR = IO::Pin::PB_1;
   static constexpr IO::Pin ON_INDICATOR = IO::Pin::PB_2;
 
-  // Time required for SIM100 to start up before it is ready for operation
-  static constexpr uint32_t SIM100_STARTUP_PERIOD = 5000;
-
-  // Want to poll the SIM100 GFD board for updates every 500 ms
-  static constexpr uint32_t SIM100_POLLING_PERIOD = 500;
+  // Bits of getOutputs(), one per switch and indicator output
+  static constexpr uint8_t OUTPUT_MC_ON = 1u << 0;
+  static constexpr uint8_t OUTPUT_ACCESSORY_SW = 1u << 1;
+  static constexpr uint8_t OUTPUT_CHARGE_SW = 1u << 2;
+  static constexpr uint8_t OUTPUT_VICOR_SW = 1u << 3;
+  static constexpr uint8_t OUTPUT_ACCESSORY_INDICATOR = 1u << 4;
+  static constexpr uint8_t OUTPUT_ON_INDICATOR = 1u << 5;
 
   /**
    * Create a new APMManager
    * Initializes the IO Devices
    * @param baud the baudrate for the UART device
    */
-  explicit APMManager(APMUart &apmUart, DEV::SIM100 &sim100,
+  explicit APMManager(APMUart &apmUart, GFDVoter &gfdVoter,
                       IO::GPIO &accessorySwGpio, IO::GPIO &chargeSwGpio,
                       IO::GPIO &vicorSwGpio,
                       EVT::core::DEV::Timerf302x8 &gfdTimer,
@@ -61,10 +98,10 @@ public:
   [[nodiscard]] APMUart &getApmUart() const;
 
   /**
-   * Returns a reference to the Sim100 object for this class
-   * @return reference to the SIM100 module
+   * Returns a reference to the voter combining the SIM100 units
+   * @return reference to the GFDVoter
    */
-  [[nodiscard]] DEV::SIM100 &getSim100() const;
+  [[nodiscard]] GFDVoter &getGFDVoter() const;
 
   /**
    * Gets a reference of the held GFD Timer.  This is used
@@ -79,6 +116,12 @@ public:
    */
   [[nodiscard]] APMMode getCurrentMode() const;
 
+  /**
+   * Reads back the level of every switch and indicator output
+   * @return one OUTPUT_ bit per output that is high
+   */
+  [[nodiscard]] uint8_t getOutputs() const;
+
   /**
    * Function to handle the transition from OFF mode to Accessory Mode
    * @return 0 on success.
@@ -86,17 +129,70 @@ public:
   int offToAccessoryMode();
 
   /**
-   * Function to transition from Accessory Mode to On Mode
-   * @return 0 on success.
+   * Function to transition from Accessory Mode to On Mode.  If HV sensing
+   * sees the precharge fail, or the MC relay or VICOR_SW does not close, the
+   * MC relay is opened again and the APM stays in ACCESSORY.
+   * @return 0 on success, 1 if the precharge failed or the switches did not
+   * close
    */
   int accessoryToOnMode();
 
   /**
-   * Function to transition from On Mode to Accessory Mode
+   * Puts the APM back into ON mode after a warm restart, skipping the SIM100
+   * start up if they had already finished it.  The bus may have discharged
+   * during a long reset, so the MC relay still precharges it first.  Used in
+   * place of offToAccessoryMode() at boot, only with the key on.
+   * @param snapshot the state saved before the reset
+   * @return 0 on success, 1 if the snapshot does not allow resuming ON, the
+   * precharge failed or the switches did not close
+   */
+  int resumeOnMode(const warm::Snapshot &snapshot);
+
+  /**
+   * Function to transition from On Mode to Accessory Mode.  If ACCESSORY_SW
+   * does not close, VICOR_SW is left closed so the electronics stay powered.
    * @return 0 on success
    */
   int onToAccessoryMode();
 
+  /**
+   * Fast path from ON to ACCESSORY taken when the GFD reports a fault.  The
+   * switch outputs are driven to the ACCESSORY pattern with two port level
+   * writes before anything else happens, and all logging is deferred until
+   * the hardware is safe.  Each phase is timestamped into the trip record.
+   * @param reason the fault reported by the GFD
+   * @param detected cycle count when the fault was detected
+   * @return 0 on success
+   */
+  int tripToAccessoryMode(DEV::SIM100::IsolationStateResponse reason,
+                          uint32_t detected);
+
+  /**
+   * Runs the mode transition for a debounced key event.  Called from the main
+   * loop.
+   * @param event the key event to handle
+   * @return true if a mode transition was performed
+   */
+  bool handleKeyEvent(const KeyEvent &event);
+
+  /**
+   * Checks the switches against their commands, and switches to ACCESSORY if
+   * the MC relay or VICOR_SW opens on its own in ON mode.  Called from the
+   * main loop every SwitchMonitor::SAMPLE_PERIOD ms.
+   */
+  void checkSwitches();
+
+  /**
+   * Returns the timing of the most recent trip
+   * @return reference to the last trip record
+   */
+  [[nodiscard]] const TripRecord &getLastTrip() const;
+
+  /**
+   * Prints the timing of the most recent trip in microseconds
+   */
+  void printLastTrip() const;
+
   /**
    * Check the debug status to determine if SIM100 should be checked for
    * isolation faults.
@@ -111,6 +207,48 @@ public:
    */
   void setCheckGFDIsolationState(bool state);
 
+  /**
+   * Checks whether the SIM100 units have started up and are being polled
+   * @return true once the start up period has passed in ON mode
+   */
+  [[nodiscard]] bool isGFDReady() const;
+
+  /**
+   * Records that the SIM100 units have started up and are being polled.
+   * Called from the GFD start up timer interrupt.
+   */
+  void setGFDReady();
+
+  /**
+   * Sets the handshake used to confirm the other boards follow mode
+   * transitions.  The boards taking part are set by the handshake_nodes
+   * setting.
+   * @param handshake the handshake, or nullptr to not wait for other boards
+   */
+  void setHandshake(Handshake *handshake);
+
+  /**
+   * Sets the controller that charges the backup battery in ON mode.  Without
+   * one, CHARGE_SW is simply closed for as long as the bike is ON.
+   * @param controller the controller, or nullptr if none is fitted
+   */
+  void setChargeController(ChargeController *controller);
+
+  /**
+   * Sets the monitor used to end precharge as soon as the bus is charged.
+   * Without one, the full precharge_time is waited.
+   * @param monitor the monitor, or nullptr if no HV sensing is fitted
+   */
+  void setPrechargeMonitor(PrechargeMonitor *monitor);
+
+  /**
+   * Sets the monitor used to verify that the switches follow each transition
+   * and keep following their commands.  Without one, the switches are
+   * assumed to follow.
+   * @param monitor the monitor, or nullptr to not verify the switches
+   */
+  void setSwitchMonitor(SwitchMonitor *monitor);
+
 private:
   // Holds the current mode of the APMManager device
   APMMode currentMode = APMMode::OFF;
@@ -118,8 +256,8 @@ private:
   // Holds a reference to the APMUart device
   APMUart &apmUart;
 
-  // Holds a reference to the SIM100 GFD device
-  DEV::SIM100 &sim100;
+  // Holds a reference to the voter over the SIM100 GFD devices
+  GFDVoter &gfdVoter;
 
   // GPIO to control the MC relay
   IO::GPIO &mc_relay_GPIO;
@@ -144,6 +282,99 @@ private:
 
   // Debug Boolean to turn off SIM100 GFD Checking
   bool checkGFDIsolationState = true;
+
+  // Confirms the other boards follow mode transitions, if set
+  Handshake *handshake = nullptr;
+
+  // Charges the backup battery, if battery sensing is fitted
+  ChargeController *chargeController = nullptr;
+
+  // Measures precharge of the MC, if HV sensing is fitted
+  PrechargeMonitor *prechargeMonitor = nullptr;
+
+  // Checks the switches follow their commands, if set
+  SwitchMonitor *switchMonitor = nullptr;
+
+  // Timing of the most recent GFD trip
+  TripRecord lastTrip;
+
+  // Whether the SIM100 units have started up and are being polled
+  bool gfdReady = false;
+
+  // Voted isolation state that caused the last trip, NoError after entering
+  // ON
+  DEV::SIM100::IsolationStateResponse lastIsolation =
+      DEV::SIM100::IsolationStateResponse::NoError;
+
+  // Warm restarts since the last mode transition
+  uint8_t restarts = 0;
+
+  /**
+   * Writes an output pin and records the change in the trace
+   * @param gpio the GPIO to write
+   * @param pin the pin of the GPIO
+   * @param state the level to write
+   */
+  void writeOutput(IO::GPIO &gpio, IO::Pin pin, IO::GPIO::State state);
+
+  /**
+   * Asks the other boards to follow a mode transition, if a handshake is set
+   * @param mode the mode being entered
+   */
+  void startHandshake(APMMode mode);
+
+  /**
+   * Waits for the other boards to acknowledge the transition started with
+   * startHandshake().  The transition goes ahead either way; boards that did
+   * not answer in time are reported.
+   */
+  void finishHandshake();
+
+  /**
+   * Starts polling the SIM100 units if isolation checking is enabled
+   * @param ready true if the units have already started up, so polling can
+   * begin straight away
+   */
+  void startIsolationChecking(bool ready);
+
+  /**
+   * Saves the mode, switch states and GFD state for a warm restart
+   */
+  void saveSnapshot();
+
+  /**
+   * Allows or stops charging the backup battery
+   * @param allowed whether the battery may be charged
+   */
+  void setCharging(bool allowed);
+
+  /**
+   * Waits for the MC to precharge the high voltage bus.  Ends as soon as the
+   * monitor sees the bus charged, and otherwise after precharge_time.
+   * @return 0 if the bus is taken to be charged, 1 if the monitor did not see
+   * it charge within precharge_time
+   */
+  int waitForPrecharge();
+
+  /**
+   * Opens the pack switches and takes the other boards back to ACCESSORY
+   * after accessoryToOnMode() gave up
+   */
+  void cancelOnMode();
+
+  /**
+   * Waits for switches to follow their commands, warning about any that do
+   * not
+   * @param switches the switches, as OUTPUT_ bits
+   * @return 0 if they followed or there is no switch monitor, 1 otherwise
+   */
+  int verifySwitches(uint8_t switches);
+
+  /**
+   * Warns about the faults latched on switches
+   * @param switches the switches, as OUTPUT_ bits
+   */
+  void reportSwitchFaults(uint8_t switches);
 };
 
 } // namespace APM
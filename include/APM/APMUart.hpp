@@ -6,6 +6,7 @@
 #ifndef APM_APM_UART_H
 #define APM_APM_UART_H
 
+#include <APM/utils/format.hpp>
 #include <EVT/io/UART.hpp>
 
 namespace IO = EVT::core::IO;
@@ -28,6 +29,13 @@ public:
    */
   void startupMessage() const;
 
+  /**
+   * Prints the next line of the startup message.  Lets the banner stream out
+   * from the main loop a line at a time instead of holding up start up.
+   * @return true once the whole message has been printed
+   */
+  bool printStartupLine();
+
   /**
    * Set the boolean variable to determine whether or not debug
    * statements will be print to the UART device.
@@ -47,6 +55,29 @@ public:
    */
   void printString(const char *message) const;
 
+  /**
+   * Prints formatted text.  The format string is checked against the
+   * arguments at compile time.
+   * @param format the format, created with APM_FORMAT
+   * @param args one argument per placeholder
+   */
+  template <typename Text, typename... Args>
+  void print(format::Format<Text> format, const Args &...args) const {
+    format::write(*apmUart, format, args...);
+  }
+
+  /**
+   * Prints formatted text if debug printing is enabled
+   * @param format the format, created with APM_FORMAT
+   * @param args one argument per placeholder
+   */
+  template <typename Text, typename... Args>
+  void printDebug(format::Format<Text> format, const Args &...args) const {
+    if (apmUart != nullptr && apmDebugPrint) {
+      format::write(*apmUart, format, args...);
+    }
+  }
+
   /**
    * Passthrough for apmUart->getc()
    *
@@ -65,14 +96,15 @@ public:
   char *gets(char *buf, size_t size) const;
 
 private:
-  static constexpr char MINICOM_CLEAR_DISPLAY[5] = "\x1B\x5B\x32\x4A";
-
   // Pointer to the APMManager UART device
   IO::UART *apmUart = nullptr;
 
   // Boolean determining whether or not debug statements will be printed to the
   // user
   bool apmDebugPrint;
+
+  // Next line of the startup message to print
+  size_t startupLine = 0;
 };
 
 } // namespace APM
@@ -0,0 +1,82 @@
+/**
+ * Boot time profiling.  The end of each start up phase is timestamped with the
+ * DWT cycle counter so the time from reset to accessory power can be measured
+ * and the slow phases found.  Times are counted from the start of main(); the
+ * C runtime start up before it only copies .data and clears .bss.
+ */
+
+#ifndef APM_BOOT_HPP
+#define APM_BOOT_HPP
+
+#include <APM/APMUart.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::boot {
+
+/**
+ * Start up phases, in the order they complete
+ */
+enum class BootPhase : uint8_t {
+  // Clocks and HAL set up by IO::init()
+  IO_INIT = 0u,
+  // Switch and indicator GPIO configured
+  GPIO_SETUP = 1u,
+  // Console UART configured
+  UART_SETUP = 2u,
+  // CAN peripheral configured
+  CAN_SETUP = 3u,
+  // SIM100 units, GFD voter, timers and APMManager constructed and the
+  // configuration mounted
+  MANAGER_SETUP = 4u,
+  // Accessory switch closed, or ON mode resumed after a warm restart
+  ACCESSORY = 5u,
+  // Event log mounted and the boot recorded
+  STORAGE = 6u,
+  // Key input, load monitor and periodic tasks started
+  READY = 7u,
+  // Startup banner finished streaming
+  BANNER = 8u
+};
+
+// Number of values in BootPhase
+constexpr size_t NUM_PHASES = 9;
+
+static_assert(NUM_PHASES == static_cast<size_t>(BootPhase::BANNER) + 1,
+              "NUM_PHASES must follow the last BootPhase");
+
+/**
+ * Starts the boot clock.  Must be the first thing called in main(), before the
+ * system clock is raised by IO::init().
+ */
+void start();
+
+/**
+ * Records that a phase has completed.  Only call from the main loop.
+ * @param phase the phase
+ */
+void mark(BootPhase phase);
+
+/**
+ * Returns when a phase completed
+ * @param phase the phase
+ * @return the time since start() in us, or 0 if the phase has not completed
+ */
+uint32_t getTime(BootPhase phase);
+
+/**
+ * Returns the name of a phase
+ * @param phase the phase
+ * @return the name, for printing
+ */
+const char *getName(BootPhase phase);
+
+/**
+ * Prints when each phase completed and how long it took
+ * @param apmUart the UART to print on
+ */
+void print(APMUart &apmUart);
+
+} // namespace APM::boot
+
+#endif // APM_BOOT_HPP
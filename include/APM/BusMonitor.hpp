@@ -0,0 +1,309 @@
+/**
+ * Timestamps the CAN frames the APM sends and receives, to measure request to
+ * response latency, bus load and bus errors
+ */
+
+#ifndef APM_BUSMONITOR_HPP
+#define APM_BUSMONITOR_HPP
+
+#include <APM/APMUart.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/io/CAN.hpp>
+#include <EVT/io/types/CANMessage.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Round trip times of one request and response ID pair.  Times are in DWT
+ * cycles.
+ */
+struct BusLatencyStats {
+  // Name of the pair, for printing
+  const char *name = nullptr;
+  uint32_t requestId = 0;
+  uint32_t responseId = 0;
+  // Responses matched to a request
+  uint32_t count = 0;
+  // Requests sent again before a response arrived
+  uint32_t missed = 0;
+  uint32_t lastCycles = 0;
+  uint32_t minCycles = 0;
+  uint32_t maxCycles = 0;
+  uint64_t totalCycles = 0;
+};
+
+/**
+ * Monitors the vehicle CAN bus as seen from the APM.
+ *
+ * Every place the APM transmits goes through bus::transmit(), and every place
+ * it takes a frame from the receive queue goes through bus::receive() or
+ * calls recordReceive().  A request on a registered pair's request ID starts
+ * a round trip, and the next frame on its response ID ends it.  Receive
+ * times are taken when the frame leaves the queue, which the SIM100 and
+ * handshake code poll in a tight loop while they wait.
+ *
+ * The bits of every frame are counted towards the bus load, at the worst
+ * case bit stuffing.  No acceptance filter is set, so every frame on the bus
+ * reaches the APM unless the receive queue overflows.  Received frames are
+ * only counted when taken from the queue.  In ON mode the main loop leaves
+ * the queue to the GFD poll, which empties it before each poll, so frames
+ * from other nodes back up between polls and are lost once the queue is
+ * full.  The load in ON mode is therefore a lower bound.
+ *
+ * Bus errors are read from the CAN peripheral on every frame and sample: a
+ * new last error code counts as one error frame and entering bus-off as one
+ * bus-off event.  Error frames closer together than the polling are counted
+ * once, so the error count is a lower bound.
+ *
+ * sample() must be called every SAMPLE_PERIOD ms from the main loop.  It
+ * stores the load and errors of the last period so they can be read back
+ * over the last 1 to NUM_SAMPLES periods.
+ */
+class BusMonitor {
+public:
+  // Bit rate of the vehicle bus, the EVT-core default
+  static constexpr uint32_t BIT_RATE = 500000;
+
+  // Interval between calls to sample() in ms
+  static constexpr uint32_t SAMPLE_PERIOD = 1000;
+
+  // Number of samples kept, so the longest window is one minute
+  static constexpr size_t NUM_SAMPLES = 60;
+
+  // Most request and response pairs timed
+  static constexpr size_t MAX_PAIRS = 4;
+
+  // Extended CAN ID the status frames are sent on, next to the metrics
+  static constexpr uint32_t CAN_ID = 0x0A1FF004;
+
+  /**
+   * Clears all statistics and samples.  The registered pairs are kept.
+   */
+  void start();
+
+  /**
+   * Registers a request and response pair to time
+   * @param name name of the pair, for printing
+   * @param requestId ID of the requests the APM sends
+   * @param responseId ID the responses arrive on
+   * @return 0 on success, 1 if MAX_PAIRS are already registered
+   */
+  int addPair(const char *name, uint32_t requestId, uint32_t responseId);
+
+  /**
+   * Records a transmit attempt.  Safe to call from interrupt handlers.
+   * @param message the frame
+   * @param status the result of the transmit
+   */
+  void recordTransmit(IO::CANMessage &message, IO::CAN::CANStatus status);
+
+  /**
+   * Records a frame taken from the receive queue.  Safe to call from
+   * interrupt handlers.
+   * @param message the frame
+   */
+  void recordReceive(IO::CANMessage &message);
+
+  /**
+   * Stores the load and errors since the previous sample.  Called from the
+   * main loop.
+   */
+  void sample();
+
+  /**
+   * Returns the bus load over the most recent samples
+   * @param samples the number of samples to average, 1 to NUM_SAMPLES
+   * @return the load in tenths of a percent
+   */
+  [[nodiscard]] uint32_t getLoad(size_t samples) const;
+
+  /**
+   * Returns the highest load of a single sample since start()
+   * @return the load in tenths of a percent
+   */
+  [[nodiscard]] uint32_t getPeakLoad() const;
+
+  /**
+   * Returns the error frames seen over the most recent samples
+   * @param samples the number of samples to sum, 1 to NUM_SAMPLES
+   * @return the number of error frames
+   */
+  [[nodiscard]] uint32_t getErrors(size_t samples) const;
+
+  /**
+   * Returns the bus-off events over the most recent samples
+   * @param samples the number of samples to sum, 1 to NUM_SAMPLES
+   * @return the number of bus-off events
+   */
+  [[nodiscard]] uint32_t getBusOffs(size_t samples) const;
+
+  /**
+   * Returns the number of registered pairs
+   * @return the number of pairs
+   */
+  [[nodiscard]] size_t getNumPairs() const;
+
+  /**
+   * Copies the round trip times of a pair
+   * @param index the pair, in the order they were added
+   * @param stats filled with the statistics
+   */
+  void getLatencyStats(size_t index, BusLatencyStats &stats) const;
+
+  /**
+   * Prints the bus load, errors, frame counts and round trip times
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+  /**
+   * Sends the status on CAN_ID, all values little endian and saturated.
+   * Byte 0 of each frame says what it holds:
+   *  - 0: bytes 1-2 load over 1 s and bytes 3-4 over 1 min in tenths of a
+   *    percent, byte 5 error frames and byte 6 bus-off events in the last
+   *    minute, byte 7 the transmit error counter
+   *  - 1 + pair index: bytes 1-2 mean and bytes 3-4 max round trip in us,
+   *    bytes 5-6 responses matched, byte 7 requests missed
+   * @param can the CAN device to send on
+   * @return 0 on success
+   */
+  int transmit(IO::CAN &can);
+
+private:
+  /**
+   * Load and errors of one sample period
+   */
+  struct Sample {
+    // Load in tenths of a percent
+    uint16_t load;
+    uint8_t errors;
+    uint8_t busOffs;
+  };
+
+  BusLatencyStats pairs[MAX_PAIRS];
+
+  // Time each pair's outstanding request was sent, in cycles
+  uint32_t requestCycles[MAX_PAIRS] = {};
+
+  // Whether each pair has a request waiting for its response
+  bool pending[MAX_PAIRS] = {};
+
+  // Number of registered pairs
+  size_t numPairs = 0;
+
+  // Totals since start()
+  uint32_t framesSent = 0;
+  uint32_t framesReceived = 0;
+  uint32_t transmitErrors = 0;
+  uint32_t totalErrors = 0;
+  uint32_t totalBusOffs = 0;
+
+  // Counted since the previous sample
+  uint32_t sampleBits = 0;
+  uint32_t sampleErrors = 0;
+  uint32_t sampleBusOffs = 0;
+
+  // Time of the previous sample in ms
+  uint32_t lastSample = 0;
+
+  // Whether the peripheral was bus-off when last polled
+  bool busOff = false;
+
+  // Error counters read when last polled
+  uint8_t transmitErrorCount = 0;
+  uint8_t receiveErrorCount = 0;
+
+  // Samples, oldest overwritten first
+  Sample samples[NUM_SAMPLES] = {};
+
+  // Index the next sample is written to
+  size_t nextSample = 0;
+
+  // Number of valid samples
+  size_t numSamples = 0;
+
+  // Highest single sample since start()
+  uint16_t peakLoad = 0;
+
+  /**
+   * Reads the error state of the CAN peripheral and counts new error frames
+   * and bus-off events.  Must be called with interrupts disabled.
+   */
+  void pollErrors();
+
+  /**
+   * Returns a stored sample
+   * @param age the number of periods before the newest sample, below
+   * numSamples
+   * @return the sample
+   */
+  [[nodiscard]] const Sample &getSample(size_t age) const;
+};
+
+} // namespace APM
+
+// Pointer to the monitor every CAN transmit and receive is recorded with,
+// nullptr when the bus is not being monitored
+extern APM_BOARD_LOCAL APM::BusMonitor *busMonitorPtr;
+
+namespace APM::bus {
+
+// Frames from other nodes the GFD poll can hold for the main loop
+constexpr size_t DEFERRED_FRAMES = 8;
+
+/**
+ * Records a transmit attempt if bus monitoring is enabled
+ * @param message the frame
+ * @param status the result of the transmit
+ */
+inline void recordTransmit(IO::CANMessage &message,
+                           IO::CAN::CANStatus status) {
+  if (busMonitorPtr != nullptr) {
+    busMonitorPtr->recordTransmit(message, status);
+  }
+}
+
+/**
+ * Records a frame taken from the receive queue if bus monitoring is enabled
+ * @param message the frame
+ */
+inline void recordReceive(IO::CANMessage &message) {
+  if (busMonitorPtr != nullptr) {
+    busMonitorPtr->recordReceive(message);
+  }
+}
+
+/**
+ * Transmits a frame with interrupts masked, since the GFD poll interrupt
+ * transmits on the same CAN device, and records it
+ * @param can the CAN device
+ * @param message the frame
+ * @return the result of the transmit
+ */
+IO::CAN::CANStatus transmit(IO::CAN &can, IO::CANMessage &message);
+
+/**
+ * Holds a frame the GFD poll took from the receive queue that is meant for
+ * the rest of the APM, such as a handshake ack or a settings request, so
+ * receive() still returns it.  Once DEFERRED_FRAMES are held the oldest is
+ * dropped and counted.  Safe to call from interrupt handlers.
+ * @param message the frame, already recorded
+ */
+void defer(IO::CANMessage &message);
+
+/**
+ * Takes the next frame without waiting, handing out frames held by defer()
+ * before reading the receive queue, and records it.  For the main loop.
+ * @param can the CAN device
+ * @param message filled with the frame
+ * @return true if a frame was taken
+ */
+bool receive(IO::CAN &can, IO::CANMessage &message);
+
+} // namespace APM::bus
+
+#endif // APM_BUSMONITOR_HPP
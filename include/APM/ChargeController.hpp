@@ -0,0 +1,228 @@
+/**
+ * Class to charge the APM backup battery from the main pack while the bike is
+ * ON, using the backup battery voltage and charge current
+ */
+
+#ifndef APM_CHARGECONTROLLER_HPP
+#define APM_CHARGECONTROLLER_HPP
+
+#include <APM/APMUart.hpp>
+#include <EVT/dev/Timer.hpp>
+#include <EVT/io/ADC.hpp>
+#include <EVT/io/GPIO.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Stages of a charge
+ */
+enum class ChargeState : uint8_t {
+  // Charging not allowed.  Both outputs off.
+  IDLE = 0u,
+  // Full current until the battery reaches ABSORB_VOLTAGE
+  BULK = 1u,
+  // Limited current, held at ABSORB_VOLTAGE until the current falls to
+  // END_CURRENT
+  LIMITED = 2u,
+  // Limited current, held at FLOAT_VOLTAGE
+  FLOAT = 3u,
+  // Battery voltage out of range.  Both outputs off until charging is
+  // allowed again.
+  FAULT = 4u
+};
+
+/**
+ * Returns the name of a charge state
+ * @param state the state
+ * @return the name, for printing
+ */
+const char *getName(ChargeState state);
+
+/**
+ * Closed loop charger for the 12 V sealed lead acid backup battery.
+ *
+ * A timer runs the control loop every CONTROL_PERIOD ms while charging is
+ * allowed, and every MONITOR_PERIOD ms otherwise to keep the state of charge
+ * current.  Each run reads the battery voltage and charge current, which the
+ * ADC converts into RAM by DMA, smooths them with exponential moving
+ * averages and picks the outputs:
+ *
+ *   BULK     CHARGE_SW on, limiter off
+ *   LIMITED  CHARGE_SW on, limiter on, CHARGE_SW off above ABSORB_VOLTAGE
+ *   FLOAT    CHARGE_SW on, limiter on, CHARGE_SW off above FLOAT_VOLTAGE
+ *
+ * Nothing is polled from the main loop.  The state of charge is estimated
+ * from the resting voltage while not charging, counted up from the charge
+ * current while charging, and taken as full once FLOAT is reached.
+ */
+class ChargeController {
+public:
+  // Control loop period in ms while charging is allowed
+  static constexpr uint32_t CONTROL_PERIOD = 100;
+
+  // Sample period in ms while charging is not allowed
+  static constexpr uint32_t MONITOR_PERIOD = 1000;
+
+  // The voltage average weights each new sample by 1 / 2^FILTER_SHIFT
+  static constexpr uint32_t FILTER_SHIFT = 2;
+
+  // The current average weights each new sample by 1 / 2^CURRENT_FILTER_SHIFT,
+  // long enough to average over CHARGE_SW switching on and off
+  static constexpr uint32_t CURRENT_FILTER_SHIFT = 6;
+
+  // Largest raw ADC reading
+  static constexpr uint32_t ADC_FULL_SCALE = 4095;
+
+  // Voltage BULK charges up to and LIMITED holds, in mV
+  static constexpr uint32_t ABSORB_VOLTAGE = 14400;
+
+  // Voltage FLOAT holds, in mV
+  static constexpr uint32_t FLOAT_VOLTAGE = 13600;
+
+  // Band around the held voltage CHARGE_SW switches within, in mV
+  static constexpr uint32_t HYSTERESIS = 100;
+
+  // Voltage FLOAT falls back to BULK below, in mV
+  static constexpr uint32_t BULK_RESTART_VOLTAGE = 12800;
+
+  // Voltages outside which charging stops with a FAULT, in mV
+  static constexpr uint32_t MIN_VOLTAGE = 9000;
+  static constexpr uint32_t MAX_VOLTAGE = 15000;
+
+  // Current LIMITED ends at, in mA.  C/20 of the battery.
+  static constexpr uint32_t END_CURRENT = 350;
+
+  // Battery capacity in mAh
+  static constexpr uint32_t CAPACITY = 7000;
+
+  // Percentage of the charge current stored in the battery
+  static constexpr uint32_t CHARGE_EFFICIENCY = 85;
+
+  /**
+   * Creates the charger
+   * @param voltageSense ADC channel measuring the battery voltage
+   * @param currentSense ADC channel measuring the charge current
+   * @param chargeSwGpio GPIO driving CHARGE_SW
+   * @param limiterGpio GPIO driving CHARGE_LIMITER_ENABLE
+   * @param timer a timer reserved for the control loop
+   * @param voltageFullScale battery voltage at a full scale reading in mV
+   * @param currentFullScale charge current at a full scale reading in mA
+   */
+  ChargeController(IO::ADC &voltageSense, IO::ADC &currentSense,
+                   IO::GPIO &chargeSwGpio, IO::GPIO &limiterGpio,
+                   EVT::core::DEV::Timer &timer, uint32_t voltageFullScale,
+                   uint32_t currentFullScale);
+
+  /**
+   * Turns both outputs off and starts the control loop with charging not
+   * allowed
+   */
+  void start();
+
+  /**
+   * Allows or stops charging.  Stopping turns both outputs off straight away.
+   * Safe to call from interrupt handlers.
+   * @param allowed whether the battery may be charged
+   */
+  void setCharging(bool allowed);
+
+  /**
+   * Runs one step of the control loop.  Called from the timer interrupt.
+   * @param voltage the battery voltage in mV
+   * @param current the charge current in mA
+   */
+  void update(uint32_t voltage, uint32_t current);
+
+  /**
+   * Samples the inputs and runs the control loop.  Called from the timer
+   * interrupt.
+   */
+  void onTimer();
+
+  /**
+   * Returns the current stage of the charge
+   * @return the state
+   */
+  [[nodiscard]] ChargeState getState() const;
+
+  /**
+   * Returns the filtered battery voltage
+   * @return the voltage in mV
+   */
+  [[nodiscard]] uint32_t getVoltage() const;
+
+  /**
+   * Returns the average charge current, including the time CHARGE_SW is off
+   * @return the current in mA
+   */
+  [[nodiscard]] uint32_t getCurrent() const;
+
+  /**
+   * Returns the estimated state of charge
+   * @return the state of charge in percent, 0-100
+   */
+  [[nodiscard]] uint32_t getStateOfCharge() const;
+
+  /**
+   * Prints the charge state, readings and state of charge
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+private:
+  // Battery voltage and charge current inputs
+  IO::ADC &voltageSense;
+  IO::ADC &currentSense;
+
+  // CHARGE_SW and CHARGE_LIMITER_ENABLE outputs
+  IO::GPIO &chargeSwGpio;
+  IO::GPIO &limiterGpio;
+
+  // Timer running the control loop
+  EVT::core::DEV::Timer &timer;
+
+  // Readings at ADC full scale, in mV and mA
+  uint32_t voltageFullScale;
+  uint32_t currentFullScale;
+
+  // Stage of the charge
+  volatile ChargeState state = ChargeState::IDLE;
+
+  // Whether charging is allowed
+  volatile bool allowed = false;
+
+  // Output levels written last
+  bool chargeSwOn = false;
+  bool limiterOn = false;
+
+  // Moving averages, scaled up by 2^FILTER_SHIFT and 2^CURRENT_FILTER_SHIFT
+  // to keep the fraction
+  uint32_t voltageFiltered = 0;
+  uint32_t currentFiltered = 0;
+  bool voltageSeeded = false;
+
+  // Estimated charge held by the battery in mAs
+  uint32_t charge = 0;
+
+  /**
+   * Writes the outputs if they have changed
+   * @param chargeSw level of CHARGE_SW
+   * @param limiter level of CHARGE_LIMITER_ENABLE
+   */
+  void setOutputs(bool chargeSw, bool limiter);
+
+  /**
+   * Updates the estimated charge for one control loop step
+   * @param current the charge current in mA
+   * @param period the time since the last step in ms
+   */
+  void updateCharge(uint32_t current, uint32_t period);
+};
+
+} // namespace APM
+
+#endif // APM_CHARGECONTROLLER_HPP
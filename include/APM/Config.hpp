@@ -0,0 +1,242 @@
+/**
+ * Persistent configuration of the APM timing and GFD settings.  The settings
+ * are kept in a versioned, CRC protected block in flash so they can be tuned
+ * in the field without reflashing the firmware.
+ *
+ * Two flash pages hold a copy each.  A commit writes the new settings to the
+ * page not in use with the CRC programmed last, so a power loss part way
+ * through leaves the previous copy in charge.  At boot both copies are
+ * validated and the newest one is used in place through the flash memory
+ * mapping, with no parsing or copying.  Without a valid copy the compiled in
+ * DEFAULTS are used.
+ */
+
+#ifndef APM_CONFIG_HPP
+#define APM_CONFIG_HPP
+
+#include <APM/dev/Flash.hpp>
+#include <APM/dev/SIM100.hpp>
+#include <EVT/io/CAN.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::config {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * The settings, stored in flash exactly as laid out here
+ */
+struct Config {
+  // CONFIG_MAGIC
+  uint32_t magic;
+  // CONFIG_VERSION of the layout
+  uint16_t version;
+  // sizeof(Config) of the layout
+  uint16_t size;
+  // Number of commits before this one, used to find the newest copy
+  uint32_t sequence;
+  // Time for the SIM100 to start up before it is polled in ms
+  uint32_t sim100StartupPeriod;
+  // Interval between GFD polls in ON mode in ms
+  uint32_t sim100PollingPeriod;
+  // Longest time the MC is given to precharge before the pack is connected in
+  // ms.  Without HV sensing this is always waited in full.
+  uint32_t prechargeTime;
+  // Bus voltage, as a percentage of the pack voltage, that completes
+  // precharge when HV sensing is fitted
+  uint32_t prechargePercent;
+  // Max working voltage sent to the SIM100 units in V
+  uint32_t maxBatteryVoltage;
+  // Whether GFD isolation checking is enabled at boot, 0 or 1
+  uint32_t gfdCheckDefault;
+  // Longest time ON mode may go without a valid isolation reading before the
+  // APM switches to ACCESSORY, in ms
+  uint32_t gfdMaxAge;
+  // Node IDs of the boards that must acknowledge mode transitions, one bit
+  // per node
+  uint32_t handshakeNodes;
+  // Longest wait for the boards to acknowledge a mode transition in ms
+  uint32_t handshakeTimeout;
+  // Signals sent by the telemetry stream, one bit per TelemetrySignal
+  uint32_t telemetrySignals;
+  // Interval between telemetry samples in ms
+  uint32_t telemetryPeriod;
+  uint16_t reserved;
+  // CRC-16 of the preceding fields, programmed last to commit the copy
+  uint16_t crc;
+};
+
+static_assert(sizeof(Config) == 60, "Config must pack to 60 bytes");
+
+/**
+ * Settings that can be changed
+ */
+enum class Field : uint8_t {
+  SIM100_STARTUP_PERIOD = 0u,
+  SIM100_POLLING_PERIOD = 1u,
+  PRECHARGE_TIME = 2u,
+  MAX_BATTERY_VOLTAGE = 3u,
+  GFD_CHECK_DEFAULT = 4u,
+  HANDSHAKE_NODES = 5u,
+  HANDSHAKE_TIMEOUT = 6u,
+  PRECHARGE_PERCENT = 7u,
+  GFD_MAX_AGE = 8u,
+  TELEMETRY_SIGNALS = 9u,
+  TELEMETRY_PERIOD = 10u
+};
+
+// Number of values in Field
+constexpr size_t NUM_FIELDS = 11;
+
+static_assert(NUM_FIELDS == static_cast<size_t>(Field::TELEMETRY_PERIOD) + 1,
+              "NUM_FIELDS must follow the last Field");
+
+/**
+ * Registration of one setting
+ */
+struct FieldInfo {
+  const char *name;
+  // The member of Config holding the setting
+  uint32_t Config::*member;
+  // Range of accepted values, inclusive
+  uint32_t min;
+  uint32_t max;
+};
+
+// Every setting, indexed by Field
+constexpr FieldInfo FIELDS[NUM_FIELDS] = {
+    {"sim100_startup_period", &Config::sim100StartupPeriod, 1000, 30000},
+    {"sim100_polling_period", &Config::sim100PollingPeriod, 100, 5000},
+    {"precharge_time", &Config::prechargeTime, 500, 20000},
+    {"max_battery_voltage", &Config::maxBatteryVoltage, 10, 1000},
+    {"gfd_check_default", &Config::gfdCheckDefault, 0, 1},
+    {"handshake_nodes", &Config::handshakeNodes, 0, UINT32_MAX},
+    {"handshake_timeout", &Config::handshakeTimeout, 10, 5000},
+    {"precharge_percent", &Config::prechargePercent, 50, 99},
+    {"gfd_max_age", &Config::gfdMaxAge, 1000, 60000},
+    {"telemetry_signals", &Config::telemetrySignals, 1, 0x7FF},
+    {"telemetry_period", &Config::telemetryPeriod, 10, 10000},
+};
+
+/**
+ * Checks that no Field was left out of FIELDS
+ * @return true if every entry has a name and a member
+ */
+constexpr bool isFieldTableComplete() {
+  for (const FieldInfo &info : FIELDS) {
+    if (info.name == nullptr || info.member == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(isFieldTableComplete(), "Every Field must be added to FIELDS");
+
+// Identifies a flash page holding a copy of the settings
+constexpr uint32_t CONFIG_MAGIC = 0x434D5041; // "APMC"
+
+// Layout version.  Increment when Config changes, so copies written with the
+// old layout are ignored.
+constexpr uint16_t CONFIG_VERSION = 5;
+
+// Settings used until a valid copy is committed to flash
+constexpr Config DEFAULTS = {
+    CONFIG_MAGIC,
+    CONFIG_VERSION,
+    sizeof(Config),
+    0,
+    5000,
+    500,
+    // MC charges in < 3s according to L.G.  So double time
+    6000,
+    95,
+    DEV::SIM100::DEV1_MAX_BATTERY_VOLTAGE,
+    0,
+    // The SIM100 can go several polls without a new estimate
+    10000,
+    // No boards acknowledge transitions until they are configured
+    0,
+    500,
+    // Mode, outputs, isolation resistance and warning, healthy units and
+    // GFD age
+    0x6F,
+    100,
+    0,
+    0,
+};
+
+// Extended CAN IDs settings are read and written on.  A request holds the
+// Field in byte 0 and, to write it, the new value little endian in bytes 1-4.
+// The response echoes the Field, then the result code of set() in byte 1 and
+// the value now in use in bytes 2-5.
+constexpr uint32_t CAN_REQUEST_ID = 0x0A1FF002;
+constexpr uint32_t CAN_RESPONSE_ID = 0x0A1FF003;
+
+// Shortest time between two writes committed over CAN in ms.  Requests are
+// not authenticated, so any node on the bus can change a setting, and every
+// change erases a flash page.  A write arriving sooner is refused with result
+// code 3, which keeps a misbehaving node from wearing out the two pages
+// (10000 erases each) in less than a day.  Writing the value already in use
+// succeeds without a commit.
+constexpr uint32_t CAN_WRITE_INTERVAL = 5000;
+
+/**
+ * Returns the settings in use.  The reference stays valid, but a commit may
+ * switch it to the other flash page, so do not hold on to it across calls
+ * that could commit.
+ * @return the settings
+ */
+const Config &get();
+
+/**
+ * Returns a single setting
+ * @param field the setting
+ * @return the value in use
+ */
+uint32_t get(Field field);
+
+/**
+ * Validates both copies in flash and uses the newest one
+ * @param flash the flash region, with at least two pages
+ * @return 0 if a copy was found, 1 if the defaults are in use
+ */
+int mount(DEV::Flash &flash);
+
+/**
+ * Changes a setting and commits it to flash
+ * @param field the setting
+ * @param value the new value
+ * @return 0 on success, 1 if the value is out of range, 2 on a flash error,
+ * if the flash overlaps the firmware image or if no flash is mounted
+ */
+int set(Field field, uint32_t value);
+
+/**
+ * Finds a setting by name
+ * @param name the name, not necessarily null terminated
+ * @param length the number of characters in name
+ * @param field set to the setting if found
+ * @return true if the name matched a setting
+ */
+bool findField(const char *name, size_t length, Field &field);
+
+/**
+ * Returns which flash page holds the settings in use
+ * @return the page index in the region, or -1 if the defaults are in use
+ */
+int getActivePage();
+
+/**
+ * Handles a read or write request received on CAN_REQUEST_ID and sends the
+ * response.  Writes are limited to one commit per CAN_WRITE_INTERVAL.
+ * @param can the CAN device to respond on
+ * @param message the received message
+ * @return true if the message was a request
+ */
+bool handleRequest(IO::CAN &can, IO::CANMessage &message);
+
+} // namespace APM::config
+
+#endif // APM_CONFIG_HPP
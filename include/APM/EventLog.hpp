@@ -0,0 +1,203 @@
+/**
+ * Class to keep a persistent log of APM events in flash
+ */
+
+#ifndef APM_EVENTLOG_HPP
+#define APM_EVENTLOG_HPP
+
+#include <APM/dev/Flash.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+/**
+ * Types of events stored in the log
+ */
+enum class EventType : uint8_t {
+  // Device powered on.  code holds the mode resumed by a warm restart, 0 for
+  // a cold start.  value holds the reset cause flags.
+  BOOT = 1u,
+  // APMMode changed.  code holds the new mode, value the previous mode.
+  MODE_TRANSITION = 2u,
+  // GFD trip.  code holds the fault, value the fault to safe time in us.
+  GFD_TRIP = 3u,
+  // SIM100 reported a new state.  code holds the state, value the unit index.
+  SIM100_RESPONSE = 4u,
+  // Generic fault.  code and value are fault specific.
+  FAULT = 5u,
+  // Isolation warning grade changed.  code holds the IsolationWarning, value
+  // the projected time to trip in s.
+  ISOLATION_WARNING = 6u
+};
+
+/**
+ * A single entry in the log.  Stored in flash exactly as laid out here.
+ */
+struct EventRecord {
+  // Position of the record in the log since it was formatted
+  uint32_t sequence;
+  // Tick in ms when the event was recorded
+  uint32_t timestamp;
+  // Event specific value
+  uint32_t value;
+  // EventType of the record
+  uint8_t type;
+  // Event specific code
+  uint8_t code;
+  // CRC-16 of the preceding fields, written last to commit the record
+  uint16_t crc;
+};
+
+static_assert(sizeof(EventRecord) == 16, "EventRecord must pack to 16 bytes");
+
+/**
+ * Append only log of EventRecords spread over a ring of flash pages.
+ *
+ * Each page starts with a header holding a page sequence number.  Records are
+ * appended to the newest page, and when it fills up the next page in the ring
+ * is erased and takes over, so every page is erased equally often.  Appending
+ * is O(1); only one page erase is needed every RECORDS_PER_PAGE appends.
+ *
+ * Mounting reads each page header once to find the newest page, then binary
+ * searches that page for the first free slot.  A record torn by a power loss
+ * is detected by its CRC, skipped when reading, and never overwritten.
+ *
+ * The log does not lock.  Append from a single context (the main loop).
+ */
+class EventLog {
+public:
+  /**
+   * Creates a log on top of a flash region.  mount() must be called before
+   * the log is used.
+   * @param flash the flash region to store the log in.  Must have at least
+   * two pages.
+   */
+  explicit EventLog(DEV::Flash &flash);
+
+  /**
+   * Finds the newest page and the next free slot, formatting the region if it
+   * does not contain a log
+   * @return 0 on success, 1 if the flash could not be formatted, 3 if it
+   * overlaps the firmware image
+   */
+  int mount();
+
+  /**
+   * Erases every page and starts an empty log
+   * @return 0 on success, 1 on a flash error, 3 if the flash overlaps the
+   * firmware image
+   */
+  int format();
+
+  /**
+   * Appends a record to the log
+   * @param type the type of event
+   * @param code event specific code
+   * @param value event specific value
+   * @param timestamp time of the event in ms
+   * @return 0 on success, 1 if the log is not mounted, 2 on a flash error, 3
+   * if the flash overlaps the firmware image
+   */
+  int append(EventType type, uint8_t code, uint32_t value, uint32_t timestamp);
+
+  /**
+   * Returns the number of records held, including torn ones
+   * @return the number of records
+   */
+  [[nodiscard]] size_t getNumRecords() const;
+
+  /**
+   * Reads a record
+   * @param index the index of the record, 0 being the oldest
+   * @param record filled with the record
+   * @return 0 on success, 1 if index is out of range, 2 if the record was
+   * torn by a power loss
+   */
+  int readRecord(size_t index, EventRecord &record) const;
+
+  /**
+   * Returns the number of records that fit in one page
+   * @return records per page
+   */
+  [[nodiscard]] uint32_t getRecordsPerPage() const;
+
+private:
+  // Identifies a page that holds part of the log
+  static constexpr uint32_t PAGE_MAGIC = 0x4C4D5041; // "APML"
+
+  // Value of a word that has never been programmed
+  static constexpr uint32_t ERASED_WORD = 0xFFFFFFFF;
+
+  /**
+   * Header at the start of every page
+   */
+  struct PageHeader {
+    // Number of pages started before this one since the log was formatted
+    uint32_t sequence;
+    // PAGE_MAGIC once the page is ready for records.  Written last.
+    uint32_t magic;
+    uint32_t reserved[2];
+  };
+
+  static_assert(sizeof(PageHeader) == sizeof(EventRecord),
+                "Page header must occupy one record slot");
+
+  // The flash region holding the log
+  DEV::Flash &flash;
+
+  // Number of record slots in a page
+  uint32_t recordsPerPage;
+
+  // Whether mount() has succeeded
+  bool mounted = false;
+
+  // Page records are currently appended to
+  uint32_t activePage = 0;
+
+  // Sequence number of the active page
+  uint32_t activeSequence = 0;
+
+  // Slots used in the active page
+  uint32_t activeUsed = 0;
+
+  // Number of pages holding records, including the active page
+  uint32_t pagesInUse = 0;
+
+  /**
+   * Reads the header of a page
+   * @param page the page to read
+   * @param sequence filled with the page sequence number
+   * @return true if the page holds a valid header
+   */
+  bool readHeader(uint32_t page, uint32_t &sequence) const;
+
+  /**
+   * Erases a page and writes its header
+   * @param page the page to start
+   * @param sequence the sequence number for the page
+   * @return 0 on success, 1 on a flash error, 3 if the flash overlaps the
+   * firmware image
+   */
+  int startPage(uint32_t page, uint32_t sequence);
+
+  /**
+   * Returns the flash offset of a record slot
+   * @param page the page holding the slot
+   * @param slot the slot within the page
+   * @return the byte offset within the flash region
+   */
+  [[nodiscard]] uint32_t slotOffset(uint32_t page, uint32_t slot) const;
+
+  /**
+   * Checks whether a slot has been written
+   * @param page the page holding the slot
+   * @param slot the slot within the page
+   * @return true if any part of the slot has been programmed
+   */
+  [[nodiscard]] bool isSlotUsed(uint32_t page, uint32_t slot) const;
+};
+
+} // namespace APM
+
+#endif // APM_EVENTLOG_HPP
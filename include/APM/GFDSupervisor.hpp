@@ -0,0 +1,145 @@
+/**
+ * Class to make sure ON mode never runs without isolation monitoring, and
+ * that the main loop keeps running, using the independent watchdog
+ */
+
+#ifndef APM_GFDSUPERVISOR_HPP
+#define APM_GFDSUPERVISOR_HPP
+
+#include <APM/APMUart.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/dev/IWDG.hpp>
+#include <cstdint>
+
+namespace APM {
+
+class APMManager;
+
+/**
+ * Supervises the age of the last valid isolation reading.
+ *
+ * check() runs from the main loop every CHECK_PERIOD ms.  While the APM is in
+ * ON mode with GFD checking expected, it compares the time since the GFD
+ * voter last had a valid reading against the gfd_max_age setting and trips
+ * to ACCESSORY once it is exceeded.  This catches a stopped GFD timer, a
+ * stalled bus, units that never produce a new estimate, and checking left
+ * off with the console on a bike configured to check.  The SIM100 start up
+ * period is allowed for on entry to ON.
+ *
+ * check() is also the only place the independent watchdog is refreshed in
+ * normal running, so a main loop that stops running resets the MCU within
+ * WATCHDOG_TIMEOUT.  Bounded waits in the main loop, such as a precharge or
+ * a SIM100 response, refresh it with supervisor::keepAlive() instead.
+ *
+ * Each check is O(1).  With the main loop running, ON mode goes at most
+ * gfd_max_age + CHECK_PERIOD ms without a valid reading once the start up
+ * period has passed.
+ */
+class GFDSupervisor {
+public:
+  // Interval between checks in ms
+  static constexpr uint32_t CHECK_PERIOD = 100;
+
+  // Time without a refresh after which the watchdog resets the MCU in ms.
+  // Longer than the slowest console command.
+  static constexpr uint32_t WATCHDOG_TIMEOUT = 2000;
+
+  // EventType::FAULT code of a switch to ACCESSORY on stale GFD data
+  static constexpr uint8_t STALE_FAULT = 1;
+
+  /**
+   * Creates the supervisor
+   * @param manager the manager whose ON mode is supervised
+   * @param watchdog the independent watchdog, already started
+   */
+  GFDSupervisor(APMManager &manager, EVT::core::DEV::IWDG &watchdog);
+
+  /**
+   * Refreshes the watchdog, then trips to ACCESSORY if the last valid
+   * isolation reading is too old.  Called from the main loop.
+   */
+  void check();
+
+  /**
+   * Refreshes the watchdog without checking.  Only for waits in the main
+   * loop that end on their own.
+   */
+  void keepAlive();
+
+  /**
+   * Returns the time since the last valid reading, as of the last check
+   * @return the age in ms past any start up allowance, 0 when not supervising
+   */
+  [[nodiscard]] uint32_t getAge() const;
+
+  /**
+   * Returns the number of trips to ACCESSORY on stale data
+   * @return the number of trips
+   */
+  [[nodiscard]] uint32_t getTripCount() const;
+
+  /**
+   * Returns the age of the readings at the last trip
+   * @return the age in ms
+   */
+  [[nodiscard]] uint32_t getLastTripAge() const;
+
+  /**
+   * Prints whether ON mode is supervised, the age of the last reading and
+   * the trips
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+private:
+  APMManager &manager;
+
+  EVT::core::DEV::IWDG &watchdog;
+
+  // Whether the last check supervised ON mode
+  bool supervising = false;
+
+  // Reading count of the voter at the last check
+  uint32_t readingCount = 0;
+
+  // Time from which the age is counted in ms
+  uint32_t lastFresh = 0;
+
+  // Time allowed on top of gfd_max_age before the first reading in ms
+  uint32_t allowance = 0;
+
+  // Age as of the last check in ms
+  uint32_t age = 0;
+
+  uint32_t tripCount = 0;
+  uint32_t lastTripAge = 0;
+};
+
+} // namespace APM
+
+// Pointer to the supervisor bounded waits keep the watchdog fed through,
+// nullptr when there is none
+extern APM_BOARD_LOCAL APM::GFDSupervisor *gfdSupervisorPtr;
+
+namespace APM::supervisor {
+
+/**
+ * Refreshes the watchdog if a supervisor is running.  Call from waits in the
+ * main loop that are bounded by a timeout.
+ */
+inline void keepAlive() {
+  if (gfdSupervisorPtr != nullptr) {
+    gfdSupervisorPtr->keepAlive();
+  }
+}
+
+/**
+ * Waits, refreshing the watchdog along the way.  Use in place of
+ * EVT::core::time::wait() for long waits in the main loop.
+ * @param time the time to wait in ms
+ */
+void wait(uint32_t time);
+
+} // namespace APM::supervisor
+
+#endif // APM_GFDSUPERVISOR_HPP
@@ -0,0 +1,237 @@
+/**
+ * Class to combine the isolation readings of several SIM100 GFD boards into a
+ * single trip decision.
+ */
+
+#ifndef APM_GFDVOTER_HPP
+#define APM_GFDVOTER_HPP
+
+#include <APM/IsolationTrend.hpp>
+#include <APM/dev/SIM100.hpp>
+#include <EVT/io/CAN.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Polls N SIM100 units on the same CAN bus and votes on their results.
+ *
+ * Requests are sent to every unit back to back before any response is
+ * collected, so one poll takes as long as the slowest unit rather than the sum
+ * of all units.  SIM100 responses carry no sequence number, so the receive
+ * queue is emptied before the requests go out.  A response to an earlier
+ * poll that arrived after its window is dropped instead of being taken as
+ * fresh.  Frames from other nodes taken from the queue are held for the main
+ * loop with bus::defer().  A unit that goes STALE_POLL_LIMIT polls in a row
+ * without a usable reading (or reports a hardware error) is marked stale and
+ * excluded from the vote until it gives one again.  Answering without a new
+ * estimate or with a frame that does not decode counts the same as not
+ * answering, since neither protects the bike.  If too few units remain for
+ * the configured policy the voter degrades to any-fault on the units that are
+ * left, and if none remain it reports a CANError so the APM still trips.
+ *
+ * The lowest isolation resistance read in each poll feeds an IsolationTrend,
+ * which projects how long it will be until the units trip.
+ */
+class GFDVoter {
+public:
+  // Maximum number of SIM100 units that can be voted on
+  static constexpr size_t MAX_UNITS = 4;
+
+  // Consecutive polls without a usable reading after which a unit is
+  // considered stale
+  static constexpr uint8_t STALE_POLL_LIMIT = 3;
+
+  // Time in ms to collect responses for a single poll
+  static constexpr uint32_t POLL_TIMEOUT = 200;
+
+  // Time in ms to collect the echoes of a max working voltage update, as
+  // long as a blocking SIM100 request waits
+  static constexpr uint32_t SETUP_TIMEOUT = 3000;
+
+  /**
+   * Voting policies for combining the readings of the healthy units
+   */
+  enum class VotingPolicy {
+    // Trip if any healthy unit reports a fault
+    ANY_FAULT = 0u,
+    // Trip if at least two healthy units report a fault
+    TWO_OF_N = 1u
+  };
+
+  /**
+   * Creates a voter over the given units
+   * @param can the CAN device all units are attached to
+   * @param units array of pointers to the SIM100 units.  Only the first
+   * MAX_UNITS entries are used.
+   * @param numUnits the number of entries in units
+   * @param policy the voting policy to apply to healthy units
+   */
+  GFDVoter(IO::CAN &can, DEV::SIM100 **units, size_t numUnits,
+           VotingPolicy policy = VotingPolicy::ANY_FAULT);
+
+  /**
+   * Polls every unit once and returns the voted isolation state.
+   * @return NoError if the vote does not call for a trip.  Otherwise the
+   * fault reported by the faulting units, or CANError if no healthy unit is
+   * left to vote.
+   */
+  DEV::SIM100::IsolationStateResponse poll();
+
+  /**
+   * Restarts every unit
+   * @return 0 on success.  Number of units that failed to restart otherwise
+   */
+  int restartAll();
+
+  /**
+   * Sets the max working voltage of every unit and starts a new isolation
+   * trend for the trip threshold it sets.  The update is sent to every unit
+   * before any echo is collected, so a missing unit costs one SETUP_TIMEOUT
+   * in all.
+   * @param maxVoltage the maximum voltage to apply
+   * @return 0 on success.  Number of units that did not echo maxVoltage
+   * otherwise
+   */
+  int setMaxWorkingVoltage(uint16_t maxVoltage);
+
+  /**
+   * Sets the voting policy
+   * @param newPolicy the policy to apply on the next poll
+   */
+  void setVotingPolicy(VotingPolicy newPolicy);
+
+  /**
+   * Returns the configured voting policy
+   * @return the voting policy
+   */
+  [[nodiscard]] VotingPolicy getVotingPolicy() const;
+
+  /**
+   * Returns the number of units held by the voter
+   * @return the number of units
+   */
+  [[nodiscard]] size_t getNumUnits() const;
+
+  /**
+   * Returns the number of units currently taking part in the vote
+   * @return the number of units that are not stale
+   */
+  [[nodiscard]] size_t getNumHealthyUnits() const;
+
+  /**
+   * Checks whether a unit has been excluded from the vote
+   * @param unit index of the unit
+   * @return true if the unit is stale or the index is out of range
+   */
+  [[nodiscard]] bool isStale(size_t unit) const;
+
+  /**
+   * Returns the last isolation state reported by a unit
+   * @param unit index of the unit
+   * @return the last reported state, CANError if it never responded
+   */
+  [[nodiscard]] DEV::SIM100::IsolationStateResponse
+  getLastState(size_t unit) const;
+
+  /**
+   * Returns the trend of the isolation resistance read by the units
+   * @return the trend
+   */
+  [[nodiscard]] const IsolationTrend &getIsolationTrend() const;
+
+  /**
+   * Returns the number of polls in which at least one unit gave a valid
+   * reading.  Wraps at 2^32.
+   * @return the number of polls
+   */
+  [[nodiscard]] uint32_t getReadingCount() const;
+
+  /**
+   * Returns the time of the last poll in which at least one unit gave a valid
+   * reading
+   * @return the time in ms, 0 if there has been none
+   */
+  [[nodiscard]] uint32_t getLastReadingTime() const;
+
+private:
+  /**
+   * Per unit bookkeeping used for failover
+   */
+  struct UnitStatus {
+    // Last state received from the unit
+    DEV::SIM100::IsolationStateResponse lastState =
+        DEV::SIM100::IsolationStateResponse::CANError;
+    // Number of polls in a row without a usable reading
+    uint8_t missedPolls = 0;
+    // Whether the unit answered during the current poll
+    bool responded = false;
+    // Whether the unit produced a usable reading during the current poll
+    bool voted = false;
+    // Whether the unit reported a hardware error during the current poll
+    bool hardwareError = false;
+  };
+
+  // The CAN device shared by all units
+  IO::CAN &can;
+
+  // The SIM100 units being voted on
+  DEV::SIM100 *units[MAX_UNITS] = {};
+
+  // Status of each unit
+  UnitStatus status[MAX_UNITS];
+
+  // Number of valid entries in units
+  size_t numUnits;
+
+  // Policy used to combine readings
+  VotingPolicy policy;
+
+  // Polls with at least one valid reading, and the time of the last one in
+  // ms.  Written from the GFD poll interrupt.
+  volatile uint32_t readingCount = 0;
+  volatile uint32_t lastReadingTime = 0;
+
+  // Trend of the lowest isolation resistance read in each poll
+  IsolationTrend trend{DEV::SIM100::DEV1_MAX_BATTERY_VOLTAGE};
+
+  /**
+   * Checks whether a frame was sent by one of the units
+   * @param message the frame
+   * @return true if it is on the response ID of a unit
+   */
+  [[nodiscard]] bool isUnitResponse(IO::CANMessage &message) const;
+
+  /**
+   * Takes every frame waiting in the receive queue, so only responses to the
+   * next requests are collected.  Responses are dropped and other frames are
+   * held for the main loop.
+   */
+  void drainQueue();
+
+  /**
+   * Receives responses until every unit has answered or POLL_TIMEOUT elapses,
+   * and adds the lowest isolation resistance among them to the trend.  Other
+   * frames are held for the main loop.
+   */
+  void collectResponses();
+
+  /**
+   * Updates the missed poll counters once a poll has finished.  A unit that
+   * did not vote in the poll missed it, whether or not it answered.
+   */
+  void updateStaleness();
+
+  /**
+   * Combines the readings of the healthy units
+   * @return the voted isolation state
+   */
+  DEV::SIM100::IsolationStateResponse vote() const;
+};
+
+} // namespace APM
+
+#endif // APM_GFDVOTER_HPP
@@ -0,0 +1,133 @@
+/**
+ * Class to confirm that the other boards on the bike have followed a mode
+ * transition of the APM
+ */
+
+#ifndef APM_HANDSHAKE_HPP
+#define APM_HANDSHAKE_HPP
+
+#include <APM/APMUart.hpp>
+#include <EVT/io/CAN.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Broadcasts a mode transition request and collects the acknowledgements of a
+ * set of boards in parallel.
+ *
+ * The request is sent once on REQUEST_ID holding the new mode and a sequence
+ * number.  Board n answers on ACK_ID_BASE + n with the same two bytes, so an
+ * acknowledgement of an older request is never mistaken for the current one.
+ * The boards that have answered are tracked as a bitmask, and waiting ends as
+ * soon as the last expected board answers, so a transition only takes as long
+ * as the slowest board.
+ *
+ * Frames received while waiting that are not acknowledgements are dropped, so
+ * only wait while nothing else is using the CAN receive queue.  Acks the GFD
+ * poll took from the queue are handed back through bus::receive().
+ */
+class Handshake {
+public:
+  // Highest node ID plus one.  Node n is bit n of a node set.
+  static constexpr uint8_t MAX_NODES = 32;
+
+  // Extended CAN ID requests are broadcast on
+  static constexpr uint32_t REQUEST_ID = 0x0A1FF010;
+
+  // Extended CAN ID node 0 acknowledges on.  Node n uses ACK_ID_BASE + n.
+  static constexpr uint32_t ACK_ID_BASE = 0x0A1FF020;
+
+  /**
+   * Creates a handshake over a CAN device
+   * @param can the CAN device the boards are attached to
+   */
+  explicit Handshake(IO::CAN &can);
+
+  /**
+   * Broadcasts a request and starts collecting acknowledgements.  Returns
+   * straight away so other work can overlap the wait.
+   * @param mode the APMMode being entered
+   * @param nodes the set of boards expected to acknowledge
+   * @return 0 on success, 1 if the request could not be sent
+   */
+  int start(uint8_t mode, uint32_t nodes);
+
+  /**
+   * Collects acknowledgements until every expected board has answered or
+   * timeout ms have passed since start()
+   * @param timeout the longest time to wait from start() in ms
+   * @return 0 if every board answered, 1 on a timeout
+   */
+  int wait(uint32_t timeout);
+
+  /**
+   * Records a received frame if it acknowledges the current request
+   * @param message the received frame
+   * @return true if the frame was an acknowledgement of the current request
+   */
+  bool handleMessage(IO::CANMessage &message);
+
+  /**
+   * Returns the set of boards expected to acknowledge the last request
+   * @return the node set
+   */
+  [[nodiscard]] uint32_t getExpectedNodes() const;
+
+  /**
+   * Returns the set of boards that have acknowledged the last request
+   * @return the node set
+   */
+  [[nodiscard]] uint32_t getAckedNodes() const;
+
+  /**
+   * Returns how long a board took to acknowledge the last request
+   * @param node the node ID
+   * @return the time from the request in us, or 0 if it did not answer
+   */
+  [[nodiscard]] uint32_t getLatency(uint8_t node) const;
+
+  /**
+   * Returns how long the last handshake took from request to the last
+   * acknowledgement, or to the timeout
+   * @return the duration in us
+   */
+  [[nodiscard]] uint32_t getDuration() const;
+
+  /**
+   * Prints the outcome of the last handshake and the latency of each board
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+private:
+  // The CAN device the boards are attached to
+  IO::CAN &can;
+
+  // Sequence number of the current request
+  uint8_t sequence = 0;
+
+  // Mode of the current request
+  uint8_t mode = 0;
+
+  // Boards expected to answer and boards that have answered
+  uint32_t expectedNodes = 0;
+  uint32_t ackedNodes = 0;
+
+  // Tick in ms and cycle count when the request was sent
+  uint32_t startTime = 0;
+  uint32_t startCycles = 0;
+
+  // Time from the request to the end of the handshake in us
+  uint32_t duration = 0;
+
+  // Time each board took to answer in us
+  uint32_t latencies[MAX_NODES] = {};
+};
+
+} // namespace APM
+
+#endif // APM_HANDSHAKE_HPP
@@ -0,0 +1,248 @@
+/**
+ * Class to project when the isolation resistance reported by the SIM100 units
+ * will fall to the trip threshold, so a slow loss of isolation is warned about
+ * before the APM has to cut power
+ */
+
+#ifndef APM_ISOLATIONTREND_HPP
+#define APM_ISOLATIONTREND_HPP
+
+#include <APM/APMUart.hpp>
+#include <EVT/io/CAN.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Grades of warning, by the projected time until the isolation resistance
+ * reaches the trip threshold
+ */
+enum class IsolationWarning : uint8_t {
+  // No trip projected within WATCH_TIME
+  NONE = 0u,
+  // Trip projected within WATCH_TIME
+  WATCH = 1u,
+  // Trip projected within WARNING_TIME
+  WARNING = 2u,
+  // Trip projected within CRITICAL_TIME, or the fitted resistance is already
+  // at the threshold
+  CRITICAL = 3u
+};
+
+/**
+ * Returns the name of a warning grade
+ * @param warning the grade
+ * @return the name, for printing
+ */
+const char *getName(IsolationWarning warning);
+
+/**
+ * Latest result of the trend fit
+ */
+struct IsolationEstimate {
+  // Mean reading of the newest sample in kOhm
+  uint32_t resistance = 0;
+  // Fitted resistance at the newest sample in kOhm
+  uint32_t fitted = 0;
+  // Slope of the fit in Ohm per minute, negative when falling
+  int32_t slope = 0;
+  // Projected time until the trip threshold in s, NO_TRIP if none is
+  // projected
+  uint32_t timeToTrip = 0;
+  // Share of the variation in the samples explained by the fit in percent
+  uint8_t fit = 0;
+  // Number of samples in the window
+  uint8_t samples = 0;
+  IsolationWarning warning = IsolationWarning::NONE;
+};
+
+/**
+ * Least squares line through a sliding window of isolation resistance
+ * samples.
+ *
+ * Readings are averaged over SAMPLE_INTERVAL to make one sample, and the
+ * newest NUM_SAMPLES samples are kept in a ring.  The sums the fit needs are
+ * kept up to date as samples enter and leave the ring, with times counted
+ * from the oldest sample so they stay small.  Moving that origin when the
+ * oldest sample leaves is a closed form correction of the sums, so every
+ * reading costs O(1) integer operations and no memory is allocated.  It is
+ * cheap enough to run from the GFD poll interrupt.
+ *
+ * A trip is only projected from a falling line that explains at least
+ * MIN_FIT percent of the variation in at least MIN_SAMPLES samples, so noise
+ * around a steady reading does not raise warnings.  The grade rises as soon
+ * as a sample calls for it and only falls after CLEAR_SAMPLES samples in a
+ * row call for a lower one.
+ */
+class IsolationTrend {
+public:
+  // Samples kept in the window
+  static constexpr size_t NUM_SAMPLES = 32;
+
+  // Samples needed before a trip is projected
+  static constexpr size_t MIN_SAMPLES = 8;
+
+  // Time readings are averaged over to make one sample in ms
+  static constexpr uint32_t SAMPLE_INTERVAL = 10000;
+
+  // Longest time between readings in ms.  A longer gap, such as the time
+  // spent outside ON mode, starts a new window.
+  static constexpr uint32_t MAX_GAP = 3 * SAMPLE_INTERVAL;
+
+  // Readings are limited to this in kOhm.  Far above any trip threshold, and
+  // low enough that the fit cannot overflow 64 bit sums.
+  static constexpr uint32_t MAX_RESISTANCE = 5000;
+
+  // Isolation per volt of the max working voltage at which the SIM100 sets
+  // ISO1, the first status bit the APM trips on, in Ohm per V
+  static constexpr uint32_t TRIP_OHMS_PER_VOLT = 500;
+
+  // Smallest share of the variation the fit must explain in percent
+  static constexpr uint8_t MIN_FIT = 50;
+
+  // Projected times to trip that raise each grade in s
+  static constexpr uint32_t WATCH_TIME = 3600;
+  static constexpr uint32_t WARNING_TIME = 600;
+  static constexpr uint32_t CRITICAL_TIME = 120;
+
+  // Samples in a row calling for a lower grade before it is lowered
+  static constexpr uint8_t CLEAR_SAMPLES = 3;
+
+  // Time to trip reported when no trip is projected
+  static constexpr uint32_t NO_TRIP = UINT32_MAX;
+
+  // Extended CAN ID the warning frames are sent on, next to the bus monitor
+  static constexpr uint32_t CAN_ID = 0x0A1FF005;
+
+  /**
+   * Creates an empty trend for the given max working voltage
+   * @param maxVoltage the max working voltage of the SIM100 units in V
+   */
+  explicit IsolationTrend(uint32_t maxVoltage);
+
+  /**
+   * Sets the max working voltage the trip threshold follows from and starts
+   * a new window
+   * @param maxVoltage the max working voltage of the SIM100 units in V
+   */
+  void setMaxVoltage(uint32_t maxVoltage);
+
+  /**
+   * Drops every sample and the grade
+   */
+  void reset();
+
+  /**
+   * Adds an isolation reading.  Called from the GFD poll interrupt.
+   * @param resistance the isolation resistance in kOhm
+   * @param time the time of the reading in ms
+   */
+  void addReading(uint32_t resistance, uint32_t time);
+
+  /**
+   * Copies the latest result of the fit.  Safe to call while readings are
+   * added from an interrupt.
+   * @param estimate filled with the result
+   */
+  void getEstimate(IsolationEstimate &estimate) const;
+
+  /**
+   * Returns the current warning grade
+   * @return the grade
+   */
+  [[nodiscard]] IsolationWarning getWarning() const;
+
+  /**
+   * Returns the resistance trips are projected to
+   * @return the trip threshold in kOhm
+   */
+  [[nodiscard]] uint32_t getTripResistance() const;
+
+  /**
+   * Prints the readings, fit and projected time to trip
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+  /**
+   * Sends the estimate on CAN_ID, values little endian and saturated.  Byte
+   * 0 holds the grade, bytes 1-2 the resistance in kOhm, bytes 3-4 the time
+   * to trip in s (0xFFFF when none is projected), bytes 5-6 the slope in Ohm
+   * per minute as a signed value and byte 7 the fit in percent.
+   * @param can the CAN device to send on
+   * @return 0 on success
+   */
+  int transmit(IO::CAN &can) const;
+
+private:
+  /**
+   * One averaged sample
+   */
+  struct Sample {
+    // Time of the last reading in the sample, in s since the window started
+    uint32_t time;
+    // Mean reading in kOhm
+    uint32_t resistance;
+  };
+
+  Sample samples[NUM_SAMPLES] = {};
+
+  // Index of the oldest sample
+  size_t oldest = 0;
+
+  // Number of valid samples
+  size_t numSamples = 0;
+
+  // Sums over the window, with times in s from the oldest sample
+  int64_t sumT = 0;
+  int64_t sumY = 0;
+  int64_t sumTT = 0;
+  int64_t sumTY = 0;
+  int64_t sumYY = 0;
+
+  // Time the window started in ms
+  uint32_t windowStart = 0;
+
+  // Readings of the sample being averaged
+  uint32_t intervalStart = 0;
+  uint32_t intervalSum = 0;
+  uint32_t intervalCount = 0;
+
+  // Time of the last reading in ms
+  uint32_t lastReading = 0;
+
+  // Resistance trips are projected to in kOhm
+  uint32_t tripResistance;
+
+  // Samples in a row that called for a lower grade
+  uint8_t lowerCount = 0;
+
+  // Result of the last fit
+  IsolationEstimate estimate;
+
+  /**
+   * Adds a sample to the window, removing the oldest if it is full, and fits
+   * the line again
+   * @param resistance the mean reading in kOhm
+   * @param time the time of the sample in ms
+   */
+  void addSample(uint32_t resistance, uint32_t time);
+
+  /**
+   * Removes the oldest sample and moves the time origin to the next one
+   */
+  void removeOldest();
+
+  /**
+   * Fits the line through the window and grades the projection
+   * @param resistance the newest sample in kOhm
+   */
+  void fit(uint32_t resistance);
+};
+
+} // namespace APM
+
+#endif // APM_ISOLATIONTREND_HPP
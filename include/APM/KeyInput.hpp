@@ -0,0 +1,185 @@
+/**
+ * Class to turn the raw KEY_ON_UC signal into debounced key events
+ */
+
+#ifndef APM_KEYINPUT_HPP
+#define APM_KEYINPUT_HPP
+
+#include <EVT/dev/Timer.hpp>
+#include <EVT/io/GPIO.hpp>
+#include <EVT/io/pin.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * A debounced change of the key input
+ */
+struct KeyEvent {
+  enum class Type {
+    // Key turned on
+    PRESS = 0u,
+    // Key turned off
+    RELEASE = 1u,
+    // Key has stayed on for KeyInput::HOLD_PERIOD
+    HOLD = 2u
+  };
+
+  Type type = Type::PRESS;
+  // Cycle count of the first edge of the bounce that produced this event
+  uint32_t edgeCycles = 0;
+  // Tick in ms of the first edge of the bounce that produced this event
+  uint32_t edgeTime = 0;
+};
+
+/**
+ * Debounces the key input with a timer.
+ *
+ * Both edges of the key GPIO are timestamped in the GPIO interrupt, which then
+ * (re)starts the debounce timer.  Only once the input has been stable for
+ * DEBOUNCE_PERIOD is the level compared against the last stable level, so a
+ * bouncing contact produces a single PRESS or RELEASE.  Events are queued for
+ * the main loop instead of running transitions from interrupt context.
+ */
+class KeyInput {
+public:
+  // Time in ms the input must be stable before a change is accepted
+  static constexpr uint32_t DEBOUNCE_PERIOD = 20;
+
+  // Time in ms the key must stay on before a HOLD event is sent
+  static constexpr uint32_t HOLD_PERIOD = 1000;
+
+  // Number of events that can wait for the main loop
+  static constexpr size_t EVENT_QUEUE_SIZE = 8;
+
+  /**
+   * Creates the key input service
+   * @param keyGpio the GPIO connected to the key signal
+   * @param keyPin the pin of keyGpio, used to identify edges in traces
+   * @param debounceTimer a timer reserved for debouncing
+   */
+  KeyInput(IO::GPIO &keyGpio, IO::Pin keyPin,
+           EVT::core::DEV::Timer &debounceTimer);
+
+  /**
+   * Samples the current key level and enables the edge interrupt.  No event
+   * is sent for the level at start up.
+   */
+  void start();
+
+  /**
+   * Takes the oldest event off the queue
+   * @param event filled with the event if one was waiting
+   * @return true if an event was returned
+   */
+  bool popEvent(KeyEvent &event);
+
+  /**
+   * Returns the last debounced key level
+   * @return true if the key is on
+   */
+  [[nodiscard]] bool isOn() const;
+
+  /**
+   * Records the time from the key edge until the action for the event
+   * finished.  Call once the main loop is done handling the event.
+   * @param event the event that was handled
+   */
+  void recordActionLatency(const KeyEvent &event);
+
+  /**
+   * Returns the key to action latency of the last handled event
+   * @return latency in microseconds
+   */
+  [[nodiscard]] uint32_t getLastLatency() const;
+
+  /**
+   * Returns the largest key to action latency seen
+   * @return latency in microseconds
+   */
+  [[nodiscard]] uint32_t getMaxLatency() const;
+
+  /**
+   * Returns the number of raw edges seen, including bounces
+   * @return number of edges
+   */
+  [[nodiscard]] uint32_t getEdgeCount() const;
+
+  /**
+   * Returns the number of debounced events produced
+   * @return number of events
+   */
+  [[nodiscard]] uint32_t getEventCount() const;
+
+  /**
+   * Returns the number of events lost because the queue was full
+   * @return number of dropped events
+   */
+  [[nodiscard]] uint32_t getDroppedCount() const;
+
+  /**
+   * Handles a raw edge.  Called from the GPIO interrupt.
+   */
+  void onEdge();
+
+  /**
+   * Handles the debounce or hold timer expiring.  Called from the timer
+   * interrupt.
+   */
+  void onTimer();
+
+private:
+  // GPIO connected to the key signal
+  IO::GPIO &keyGpio;
+
+  // Pin of keyGpio
+  IO::Pin keyPin;
+
+  // Timer used for both the debounce and hold periods
+  EVT::core::DEV::Timer &debounceTimer;
+
+  // Queue of events waiting for the main loop
+  KeyEvent queue[EVENT_QUEUE_SIZE];
+
+  // Index the next event will be written to.  Only written by interrupts.
+  volatile size_t queueHead = 0;
+
+  // Index the next event will be read from.  Only written by the main loop.
+  volatile size_t queueTail = 0;
+
+  // Last debounced key level
+  volatile bool stableOn = false;
+
+  // Whether the timer is currently timing a debounce period
+  volatile bool debouncing = false;
+
+  // Timestamps of the first edge in the current bounce
+  uint32_t edgeCycles = 0;
+  uint32_t edgeTime = 0;
+
+  // Timestamps of the debounced PRESS, used for the HOLD event
+  uint32_t pressCycles = 0;
+  uint32_t pressTime = 0;
+
+  // Statistics
+  volatile uint32_t edgeCount = 0;
+  uint32_t eventCount = 0;
+  uint32_t droppedCount = 0;
+  uint32_t lastLatency = 0;
+  uint32_t maxLatency = 0;
+
+  /**
+   * Adds an event to the queue.  Drops the event if the queue is full.
+   * @param type the event type
+   * @param cycles cycle count of the edge that caused the event
+   * @param time tick of the edge that caused the event
+   */
+  void pushEvent(KeyEvent::Type type, uint32_t cycles, uint32_t time);
+};
+
+} // namespace APM
+
+#endif // APM_KEYINPUT_HPP
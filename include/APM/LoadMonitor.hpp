@@ -0,0 +1,252 @@
+/**
+ * Accounts CPU time to the main loop, idle sleep and each APM interrupt
+ * handler, and keeps the CPU load over sliding windows
+ */
+
+#ifndef APM_LOADMONITOR_HPP
+#define APM_LOADMONITOR_HPP
+
+#include <APM/utils/globals.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+/**
+ * Contexts that CPU time is charged to
+ */
+enum class LoadContext : uint8_t {
+  // Main loop work
+  MAIN = 0u,
+  // Main loop asleep in WFI
+  IDLE = 1u,
+  // GFD start up and polling timer interrupts
+  GFD_TIMER = 2u,
+  // Key input edge interrupt
+  KEY_EDGE = 3u,
+  // Key debounce timer interrupt
+  KEY_TIMER = 4u,
+  // Backup battery charge control loop timer interrupt
+  CHARGE_TIMER = 5u
+};
+
+/**
+ * Time charged to one context.  Times are in DWT cycles.
+ */
+struct LoadContextStats {
+  // Cycles spent in the context, excluding interrupts that preempted it
+  uint64_t totalCycles = 0;
+  // Number of times an interrupt context was entered
+  uint32_t entries = 0;
+  // Longest single run of an interrupt context, including preemption
+  uint32_t maxCycles = 0;
+};
+
+/**
+ * Measures CPU occupancy with the DWT cycle counter.
+ *
+ * Every switch between contexts charges the cycles since the previous switch
+ * to the context being left, so each cycle is counted exactly once.  The
+ * interrupt handlers of the APM call enterInterrupt() and exitInterrupt(), and
+ * the PowerManager marks its WFI sleeps with enterIdle() and exitIdle().
+ * Interrupts the APM does not own (SysTick, CAN receive) are charged to the
+ * context they preempted.
+ *
+ * sample() must be called every SAMPLE_PERIOD ms from the main loop.  It
+ * stores the load of the last period so the load over the last 1 to
+ * NUM_SAMPLES periods can be read back.
+ */
+class LoadMonitor {
+public:
+  // Number of contexts in LoadContext
+  static constexpr size_t NUM_CONTEXTS = 6;
+
+  static_assert(NUM_CONTEXTS ==
+                    static_cast<size_t>(LoadContext::CHARGE_TIMER) + 1,
+                "NUM_CONTEXTS must follow the last LoadContext");
+
+  // Deepest interrupt nesting tracked
+  static constexpr size_t MAX_NESTING = 4;
+
+  // Interval between calls to sample() in ms
+  static constexpr uint32_t SAMPLE_PERIOD = 1000;
+
+  // Number of samples kept, so the longest window is one minute
+  static constexpr size_t NUM_SAMPLES = 60;
+
+  /**
+   * Clears all statistics and starts charging time to the main loop
+   */
+  void start();
+
+  /**
+   * Called first thing in an interrupt handler
+   * @param context the context of the handler
+   */
+  void enterInterrupt(LoadContext context);
+
+  /**
+   * Called last thing in an interrupt handler
+   */
+  void exitInterrupt();
+
+  /**
+   * Called by the main loop just before it sleeps
+   */
+  void enterIdle();
+
+  /**
+   * Called by the main loop when it wakes
+   */
+  void exitIdle();
+
+  /**
+   * Records the load since the previous sample.  Called from the main loop.
+   */
+  void sample();
+
+  /**
+   * Returns the CPU load over the most recent samples
+   * @param samples the number of samples to average, 1 to NUM_SAMPLES
+   * @return the load in tenths of a percent, 0-1000
+   */
+  [[nodiscard]] uint32_t getLoad(size_t samples) const;
+
+  /**
+   * Returns the highest load of a single sample since the statistics were
+   * last reset
+   * @return the load in tenths of a percent, 0-1000
+   */
+  [[nodiscard]] uint32_t getPeakLoad() const;
+
+  /**
+   * Copies the time charged to a context
+   * @param context the context
+   * @param stats filled with the statistics
+   */
+  void getContextStats(LoadContext context, LoadContextStats &stats) const;
+
+  /**
+   * Returns the cycles elapsed since the statistics were last reset
+   * @return elapsed cycles
+   */
+  [[nodiscard]] uint64_t getElapsedCycles() const;
+
+  /**
+   * Clears the per context totals and the peak load.  The sliding windows
+   * are kept.
+   */
+  void resetStats();
+
+private:
+  // Context currently running
+  LoadContext current = LoadContext::MAIN;
+
+  // Contexts preempted by the running interrupts
+  LoadContext preempted[MAX_NESTING] = {};
+
+  // Cycle count each running interrupt was entered at
+  uint32_t entryCycles[MAX_NESTING] = {};
+
+  // Number of running interrupts
+  size_t depth = 0;
+
+  // Cycle count of the last context switch
+  uint32_t lastSwitch = 0;
+
+  LoadContextStats contextStats[NUM_CONTEXTS];
+
+  // Busy and total cycles at the previous sample
+  uint64_t sampledBusy = 0;
+  uint64_t sampledTotal = 0;
+
+  // Load of each sample in tenths of a percent, oldest overwritten first
+  uint16_t samples[NUM_SAMPLES] = {};
+
+  // Index the next sample is written to
+  size_t nextSample = 0;
+
+  // Number of valid samples
+  size_t numSamples = 0;
+
+  // Highest single sample since the last reset
+  uint16_t peakLoad = 0;
+
+  /**
+   * Charges the cycles since the last switch to the current context.  Must be
+   * called with interrupts disabled.
+   * @param now the current cycle count
+   */
+  void charge(uint32_t now);
+
+  /**
+   * Returns the cycles charged to every context, and to all but IDLE
+   * @param busy filled with the busy cycles
+   * @return the total cycles
+   */
+  uint64_t sumCycles(uint64_t &busy) const;
+};
+
+} // namespace APM
+
+// Pointer to the monitor updated by the interrupt handlers, nullptr when CPU
+// load is not being measured
+extern APM_BOARD_LOCAL APM::LoadMonitor *loadMonitorPtr;
+
+namespace APM::load {
+
+/**
+ * Marks the start of an interrupt handler if load monitoring is enabled
+ * @param context the context of the handler
+ */
+inline void enterInterrupt(LoadContext context) {
+  if (loadMonitorPtr != nullptr) {
+    loadMonitorPtr->enterInterrupt(context);
+  }
+}
+
+/**
+ * Marks the end of an interrupt handler if load monitoring is enabled
+ */
+inline void exitInterrupt() {
+  if (loadMonitorPtr != nullptr) {
+    loadMonitorPtr->exitInterrupt();
+  }
+}
+
+/**
+ * Marks the main loop going to sleep if load monitoring is enabled
+ */
+inline void enterIdle() {
+  if (loadMonitorPtr != nullptr) {
+    loadMonitorPtr->enterIdle();
+  }
+}
+
+/**
+ * Marks the main loop waking up if load monitoring is enabled
+ */
+inline void exitIdle() {
+  if (loadMonitorPtr != nullptr) {
+    loadMonitorPtr->exitIdle();
+  }
+}
+
+/**
+ * Charges the scope it is declared in to an interrupt context.  Declare it
+ * first in a handler so every early return is covered.
+ */
+class ScopedInterrupt {
+public:
+  explicit ScopedInterrupt(LoadContext context) { enterInterrupt(context); }
+
+  ~ScopedInterrupt() { exitInterrupt(); }
+
+  ScopedInterrupt(const ScopedInterrupt &) = delete;
+
+  ScopedInterrupt &operator=(const ScopedInterrupt &) = delete;
+};
+
+} // namespace APM::load
+
+#endif // APM_LOADMONITOR_HPP
@@ -0,0 +1,222 @@
+/**
+ * Registry of runtime counters and gauges for monitoring fleet health without
+ * a debugger.  Every metric is declared in the Metric enum and registered with
+ * its name and kind in METRICS at compile time, so the registry lives entirely
+ * in statically allocated RAM.  Values can be printed on the console or sent
+ * over CAN.
+ */
+
+#ifndef APM_METRICS_HPP
+#define APM_METRICS_HPP
+
+#include <APM/APMUart.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/io/CAN.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::metrics {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Every metric kept by the APM
+ */
+enum class Metric : uint8_t {
+  // Mode transitions
+  ACCESSORY_TO_ON = 0u,
+  ON_TO_ACCESSORY = 1u,
+  GFD_TRIPS = 2u,
+  // Requests sent to any SIM100 unit
+  SIM100_REQUESTS = 3u,
+  // Blocking SIM100 requests that got no response in time
+  SIM100_TIMEOUTS = 4u,
+  // Isolation state requests repeated because the unit had no new estimate
+  SIM100_RETRIES = 5u,
+  // Units that did not answer a GFD poll
+  SIM100_MISSED_POLLS = 6u,
+  // Frames the CAN peripheral refused to send
+  CAN_TX_ERRORS = 7u,
+  // Isolation fault readings from any unit, whether or not they tripped
+  ISOLATION_FAULTS = 8u,
+  // Key events lost to a full queue
+  KEY_EVENTS_DROPPED = 9u,
+  // Bytes of event log records that could not be written
+  LOG_BYTES_DROPPED = 10u,
+  // Current APMMode
+  MODE = 11u,
+  // SIM100 units currently taking part in the vote
+  HEALTHY_GFD_UNITS = 12u,
+  // CPU load of the last sample period in tenths of a percent
+  CPU_LOAD = 13u,
+  // Deepest stack usage since power on in bytes
+  STACK_HIGH_WATER = 14u,
+  // Time from the start of main() to accessory power at the last boot in us
+  ACCESSORY_BOOT_TIME = 15u,
+  // Mode transitions that went ahead without every board acknowledging
+  HANDSHAKE_TIMEOUTS = 16u,
+  // Time the last complete handshake took in us
+  HANDSHAKE_TIME = 17u,
+  // Time the last measured precharge took in ms
+  PRECHARGE_TIME = 18u,
+  // Precharges that were not seen to complete before the timeout
+  PRECHARGE_TIMEOUTS = 19u,
+  // Backup battery charges stopped by an out of range battery voltage
+  CHARGE_FAULTS = 20u,
+  // Estimated backup battery state of charge in percent
+  BACKUP_BATTERY_SOC = 21u,
+  // Lowest isolation resistance of the last GFD sample in kOhm
+  ISOLATION_RESISTANCE = 22u,
+  // Projected time until an isolation trip in s, 2^32 - 1 if none
+  ISOLATION_TIME_TO_TRIP = 23u,
+  // Current IsolationWarning grade
+  ISOLATION_WARNING = 24u,
+  // Switches to ACCESSORY because no valid isolation reading arrived in time
+  GFD_STALE_TRIPS = 25u,
+  // Power switches found welded closed or stuck open
+  SWITCH_FAULTS = 26u,
+  // Frames from other nodes the GFD poll held for the main loop, dropped for
+  // newer ones before the main loop read them
+  CAN_RX_DROPPED = 27u
+};
+
+// Number of values in Metric
+constexpr size_t NUM_METRICS = 28;
+
+static_assert(NUM_METRICS == static_cast<size_t>(Metric::CAN_RX_DROPPED) + 1,
+              "NUM_METRICS must follow the last Metric");
+
+/**
+ * How a metric behaves
+ */
+enum class MetricKind : uint8_t {
+  // Only ever increases, wrapping at 2^32
+  COUNTER = 0u,
+  // Holds the latest value set
+  GAUGE = 1u
+};
+
+/**
+ * Registration of one metric
+ */
+struct MetricInfo {
+  const char *name;
+  MetricKind kind;
+};
+
+// Registry of every metric, indexed by Metric
+constexpr MetricInfo METRICS[NUM_METRICS] = {
+    {"accessory_to_on", MetricKind::COUNTER},
+    {"on_to_accessory", MetricKind::COUNTER},
+    {"gfd_trips", MetricKind::COUNTER},
+    {"sim100_requests", MetricKind::COUNTER},
+    {"sim100_timeouts", MetricKind::COUNTER},
+    {"sim100_retries", MetricKind::COUNTER},
+    {"sim100_missed_polls", MetricKind::COUNTER},
+    {"can_tx_errors", MetricKind::COUNTER},
+    {"isolation_faults", MetricKind::COUNTER},
+    {"key_events_dropped", MetricKind::COUNTER},
+    {"log_bytes_dropped", MetricKind::COUNTER},
+    {"mode", MetricKind::GAUGE},
+    {"healthy_gfd_units", MetricKind::GAUGE},
+    {"cpu_load", MetricKind::GAUGE},
+    {"stack_high_water", MetricKind::GAUGE},
+    {"accessory_boot_time", MetricKind::GAUGE},
+    {"handshake_timeouts", MetricKind::COUNTER},
+    {"handshake_time", MetricKind::GAUGE},
+    {"precharge_time", MetricKind::GAUGE},
+    {"precharge_timeouts", MetricKind::COUNTER},
+    {"charge_faults", MetricKind::COUNTER},
+    {"backup_battery_soc", MetricKind::GAUGE},
+    {"isolation_resistance", MetricKind::GAUGE},
+    {"isolation_time_to_trip", MetricKind::GAUGE},
+    {"isolation_warning", MetricKind::GAUGE},
+    {"gfd_stale_trips", MetricKind::COUNTER},
+    {"switch_faults", MetricKind::COUNTER},
+    {"can_rx_dropped", MetricKind::COUNTER},
+};
+
+/**
+ * Checks that no Metric was left out of METRICS
+ * @return true if every entry has a name
+ */
+constexpr bool isRegistryComplete() {
+  for (const MetricInfo &info : METRICS) {
+    if (info.name == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(isRegistryComplete(), "Every Metric must be added to METRICS");
+
+// Extended CAN ID the metrics are sent on, next to the span statistics
+constexpr uint32_t CAN_ID = 0x0A1FF001;
+
+// Interval between periodic CAN exports in ms
+constexpr uint32_t EXPORT_PERIOD = 10000;
+
+// Value of every metric, indexed by Metric.  Use the functions below rather
+// than accessing it directly.
+extern APM_BOARD_LOCAL std::atomic<uint32_t> values[NUM_METRICS];
+
+/**
+ * Adds to a counter.  A single atomic add, so it is safe to call from any
+ * interrupt.
+ * @param metric the counter
+ * @param amount the amount to add
+ */
+inline void increment(Metric metric, uint32_t amount = 1) {
+  values[static_cast<uint8_t>(metric)].fetch_add(amount,
+                                                 std::memory_order_relaxed);
+}
+
+/**
+ * Sets a gauge.  Safe to call from any interrupt.
+ * @param metric the gauge
+ * @param value the new value
+ */
+inline void set(Metric metric, uint32_t value) {
+  values[static_cast<uint8_t>(metric)].store(value, std::memory_order_relaxed);
+}
+
+/**
+ * Returns the value of a metric
+ * @param metric the metric
+ * @return the value
+ */
+inline uint32_t get(Metric metric) {
+  return values[static_cast<uint8_t>(metric)].load(std::memory_order_relaxed);
+}
+
+/**
+ * Copies every metric.  The copy is taken with interrupts disabled so all
+ * values are from the same instant.
+ * @param snapshot filled with the values, indexed by Metric
+ */
+void takeSnapshot(uint32_t (&snapshot)[NUM_METRICS]);
+
+/**
+ * Prints a snapshot of every metric
+ * @param apmUart the UART to print on
+ */
+void print(APMUart &apmUart);
+
+/**
+ * Sends a snapshot of every metric on CAN_ID, one frame per metric, all
+ * values little endian:
+ *  - byte 0: the metric
+ *  - byte 1: the MetricKind
+ *  - bytes 2-5: the value
+ *  - bytes 6-7: sequence number of the export, so a receiver can tell the
+ *    frames of one snapshot apart from the next
+ * @param can the CAN device to send on
+ * @return 0 on success
+ */
+int transmit(IO::CAN &can);
+
+} // namespace APM::metrics
+
+#endif // APM_METRICS_HPP
@@ -0,0 +1,145 @@
+/**
+ * Class to put the APM to sleep whenever there is no work to do.  Used to
+ * reduce the drain on the backup battery while the bike is parked.
+ */
+
+#ifndef APM_POWERMANAGER_HPP
+#define APM_POWERMANAGER_HPP
+
+#include <APM/APMManager.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+/**
+ * Runs periodic tasks from the main loop and sleeps (WFI) between them.
+ *
+ * In OFF and ACCESSORY mode the 1 ms SysTick is stretched so that the MCU
+ * sleeps straight through to the next task deadline instead of waking every
+ * millisecond.  Any other interrupt (key input, UART, CAN) still wakes the
+ * MCU early, and the HAL tick is corrected for the time actually slept before
+ * that interrupt's handler runs.  The part of a tick slept before an early
+ * wake is carried into the next tick, so wakes do not make the tick drift.
+ *
+ * In ON mode the GFD timer handler relies on the HAL tick for CAN timeouts,
+ * so the tick is left alone and the MCU only sleeps until the next interrupt.
+ * Those sleeps are timed with the cycle counter and count towards the idle
+ * time as well.
+ */
+class PowerManager {
+public:
+  // Maximum number of periodic tasks that can be registered.  dev1_apm uses
+  // 6, the rest is headroom.
+  static constexpr size_t MAX_TASKS = 8;
+
+  // Longest single sleep in ms.  Bounds how long a byte can sit in the UART
+  // receive register before the console notices it.
+  static constexpr uint32_t MAX_IDLE_PERIOD = 50;
+
+  /**
+   * Registers a task to run from idle() every period ms
+   * @param task the function to run
+   * @param priv pointer passed back to the task
+   * @param period the interval between runs in ms, 0 to register it paused
+   * @return 0 on success, 1 if no task slots are left
+   */
+  int addPeriodicTask(void (*task)(void *priv), void *priv, uint32_t period);
+
+  /**
+   * Changes the interval of a registered task.  Its next run is one new
+   * period from now.
+   * @param task the function the task was registered with
+   * @param period the new interval in ms, 0 to pause the task
+   * @return 0 on success, 1 if the task is not registered
+   */
+  int setTaskPeriod(void (*task)(void *priv), uint32_t period);
+
+  /**
+   * Runs any task that is due, then sleeps until the next deadline if the
+   * mode allows it.  Intended to be called repeatedly from the main loop.
+   * @param mode the current APMManager mode
+   */
+  void idle(APMMode mode);
+
+  /**
+   * Runs any task that is due without sleeping.  For loops that poll for
+   * input which would be lost during a sleep.
+   */
+  void runTasks();
+
+  /**
+   * Returns the percentage of time spent asleep since the statistics were
+   * last reset
+   * @return idle time in percent, 0-100
+   */
+  [[nodiscard]] uint32_t getIdlePercent() const;
+
+  /**
+   * Returns the total time spent asleep since the statistics were last reset
+   * @return idle time in ms
+   */
+  [[nodiscard]] uint32_t getIdleTime() const;
+
+  /**
+   * Restarts the idle time measurement window
+   */
+  void resetIdleStats();
+
+private:
+  /**
+   * A task run at a fixed interval from the main loop
+   */
+  struct PeriodicTask {
+    void (*task)(void *priv) = nullptr;
+    void *priv = nullptr;
+    uint32_t period = 0;
+    uint32_t nextRun = 0;
+  };
+
+  // Registered tasks
+  PeriodicTask tasks[MAX_TASKS];
+
+  // Number of registered tasks
+  size_t numTasks = 0;
+
+  // Tick at which the current idle measurement window started
+  uint32_t windowStart = 0;
+
+  // Time spent asleep during the current window in ms
+  uint32_t idleTime = 0;
+
+  // Time spent asleep in WFI not yet added to idleTime, in cycles
+  uint32_t idleCycles = 0;
+
+  // Shortest first tick ticklessSleep() reprograms SysTick for after an early
+  // wake, in cycles.  Covers the instructions between clearing the counter
+  // and restoring the regular reload.
+  static constexpr uint32_t MIN_TICK_CYCLES = 64;
+
+  /**
+   * Runs all tasks whose deadline has passed
+   * @param now the current tick in ms
+   * @return ms until the next task is due, capped at MAX_IDLE_PERIOD
+   */
+  uint32_t runDueTasks(uint32_t now);
+
+  /**
+   * Adds time spent asleep in WFI to idleTime, keeping the part under 1 ms
+   * for the next call
+   * @param slept the time asleep in cycles
+   */
+  void addIdleCycles(uint32_t slept);
+
+  /**
+   * Sleeps for up to the given time with the SysTick interrupt stretched to
+   * cover the whole period
+   * @param sleepTime the time to sleep in ms
+   * @return the time actually slept in ms
+   */
+  static uint32_t ticklessSleep(uint32_t sleepTime);
+};
+
+} // namespace APM
+
+#endif // APM_POWERMANAGER_HPP
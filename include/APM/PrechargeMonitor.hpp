@@ -0,0 +1,116 @@
+/**
+ * Class to detect when the motor controller has finished precharging the high
+ * voltage bus, so the APM can move to the main pack as soon as it is safe
+ * instead of after a fixed worst case delay
+ */
+
+#ifndef APM_PRECHARGEMONITOR_HPP
+#define APM_PRECHARGEMONITOR_HPP
+
+#include <EVT/io/ADC.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Samples the HV sense inputs for the pack and the MC side of the precharge
+ * resistor and declares precharge complete once the bus has reached a set
+ * percentage of the pack.
+ *
+ * Both inputs are read from the ADC, whose DMA keeps the latest conversion
+ * of each channel in RAM, every SAMPLE_PERIOD us.  Each channel is smoothed
+ * with an exponential moving average of 2^FILTER_SHIFT samples so switching
+ * noise cannot end precharge early.  The two dividers must have the same
+ * ratio, as the readings are only ever compared with each other.
+ */
+class PrechargeMonitor {
+public:
+  // Time between samples in us
+  static constexpr uint32_t SAMPLE_PERIOD = 100;
+
+  // The moving average weights each new sample by 1 / 2^FILTER_SHIFT
+  static constexpr uint32_t FILTER_SHIFT = 4;
+
+  // Smallest filtered pack reading, in ADC counts, taken as the pack being
+  // connected.  Stops a disconnected sense input from reading as charged.
+  static constexpr uint32_t MIN_PACK_READING = 400;
+
+  /**
+   * Creates a monitor over the HV sense inputs
+   * @param busSense ADC channel measuring the MC side of the precharge
+   * @param packSense ADC channel measuring the pack
+   */
+  PrechargeMonitor(IO::ADC &busSense, IO::ADC &packSense);
+
+  /**
+   * Samples the inputs until the bus reaches percent of the pack, or timeout
+   * ms have passed
+   * @param percent the bus voltage, as a percentage of the pack voltage,
+   * that completes precharge
+   * @param timeout the longest time to wait in ms
+   * @return 0 once precharged, 1 on a timeout
+   */
+  int wait(uint32_t percent, uint32_t timeout);
+
+  /**
+   * Filters one sample of each input and checks for completion.  Called by
+   * wait() for every sample.
+   * @param bus raw reading of the bus input
+   * @param pack raw reading of the pack input
+   * @param percent the bus voltage, as a percentage of the pack voltage,
+   * that completes precharge
+   * @return true if precharge is complete
+   */
+  bool update(uint32_t bus, uint32_t pack, uint32_t percent);
+
+  /**
+   * Starts a new measurement, forgetting the previous readings
+   */
+  void reset();
+
+  /**
+   * Returns the filtered bus reading
+   * @return the reading in ADC counts
+   */
+  [[nodiscard]] uint32_t getBusReading() const;
+
+  /**
+   * Returns the filtered pack reading
+   * @return the reading in ADC counts
+   */
+  [[nodiscard]] uint32_t getPackReading() const;
+
+  /**
+   * Returns how long the last wait() took, up to completion or the timeout
+   * @return the duration in ms
+   */
+  [[nodiscard]] uint32_t getDuration() const;
+
+  /**
+   * Returns the number of samples taken by the last wait()
+   * @return the sample count
+   */
+  [[nodiscard]] uint32_t getSampleCount() const;
+
+private:
+  // HV sense inputs
+  IO::ADC &busSense;
+  IO::ADC &packSense;
+
+  // Moving averages, scaled up by 2^FILTER_SHIFT to keep the fraction
+  uint32_t busFiltered = 0;
+  uint32_t packFiltered = 0;
+
+  // Samples taken since reset()
+  uint32_t samples = 0;
+
+  // Time the last wait() took in ms
+  uint32_t duration = 0;
+};
+
+} // namespace APM
+
+#endif // APM_PRECHARGEMONITOR_HPP
@@ -0,0 +1,177 @@
+/**
+ * Span profiling using the Cortex-M DWT cycle counter.  Each instrumented span
+ * keeps a count, min, max, total and a fixed power of two latency histogram in
+ * RAM, which can be printed on the console or sent over CAN.
+ *
+ * Spans are only instrumented when built with APM_SPAN_PROFILING.  Without it
+ * APM_PROFILE_SPAN expands to nothing, so profiling costs no code or cycles.
+ */
+
+#ifndef APM_PROFILE_HPP
+#define APM_PROFILE_HPP
+
+#include <APM/APMUart.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/io/CAN.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::profile {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Code paths that are profiled
+ */
+enum class Span : uint8_t {
+  ACCESSORY_TO_ON = 0u,
+  ON_TO_ACCESSORY = 1u,
+  TRIP_TO_ACCESSORY = 2u,
+  GFD_POLL = 3u
+};
+
+// Number of values in Span
+constexpr size_t NUM_SPANS = 4;
+
+static_assert(NUM_SPANS == static_cast<size_t>(Span::GFD_POLL) + 1,
+              "NUM_SPANS must follow the last Span");
+
+// Number of histogram buckets per span
+constexpr size_t NUM_BUCKETS = 24;
+
+// Durations below 2^FIRST_BUCKET_SHIFT cycles (3.6 us at 72 MHz) land in
+// bucket 0.  Bucket n > 0 holds durations from 2^(n + FIRST_BUCKET_SHIFT - 1)
+// cycles up to twice that, and the last bucket holds everything longer.
+constexpr uint8_t FIRST_BUCKET_SHIFT = 8;
+
+// Extended CAN ID the statistics are sent on.  Kept clear of the SIM100 ID
+// blocks.
+constexpr uint32_t CAN_ID = 0x0A1FF000;
+
+/**
+ * Statistics of one span.  Times are in DWT cycles.
+ */
+struct SpanStats {
+  uint32_t count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+  uint32_t buckets[NUM_BUCKETS];
+};
+
+// Statistics of every span, indexed by Span.  Use getStats() to read them.
+extern APM_BOARD_LOCAL SpanStats spanStats[NUM_SPANS];
+
+/**
+ * Returns the histogram bucket of a duration
+ * @param cycles the duration in cycles
+ * @return the bucket index
+ */
+inline uint8_t getBucket(uint32_t cycles) {
+  uint32_t scaled = cycles >> FIRST_BUCKET_SHIFT;
+  if (scaled == 0) {
+    return 0;
+  }
+  // Compiles to a single CLZ on the Cortex-M4
+  auto bucket = static_cast<uint8_t>(32 - __builtin_clz(scaled));
+  return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+/**
+ * Returns the shortest duration that falls in a bucket
+ * @param bucket the bucket index
+ * @return the lower bound of the bucket in cycles
+ */
+constexpr uint32_t getBucketStart(uint8_t bucket) {
+  return bucket == 0 ? 0 : 1u << (bucket + FIRST_BUCKET_SHIFT - 1);
+}
+
+/**
+ * Adds a duration to the statistics of a span.  Each span must only be
+ * recorded from a single context, either the main loop or one interrupt, so
+ * no locking is needed.
+ * @param span the span
+ * @param cycles the duration in cycles
+ */
+inline void record(Span span, uint32_t cycles) {
+  SpanStats &stats = spanStats[static_cast<uint8_t>(span)];
+  if (cycles < stats.minCycles || stats.count == 0) {
+    stats.minCycles = cycles;
+  }
+  if (cycles > stats.maxCycles) {
+    stats.maxCycles = cycles;
+  }
+  stats.count++;
+  stats.totalCycles += cycles;
+  stats.buckets[getBucket(cycles)]++;
+}
+
+/**
+ * Copies the statistics of a span.  The copy is taken with interrupts
+ * disabled so it is consistent even for spans recorded in interrupts.
+ * @param span the span
+ * @param stats filled with the statistics
+ */
+void getStats(Span span, SpanStats &stats);
+
+/**
+ * Clears the statistics of every span
+ */
+void reset();
+
+/**
+ * Returns the name of a span
+ * @param span the span
+ * @return the name, for printing
+ */
+const char *getName(Span span);
+
+/**
+ * Prints the statistics and histogram of every span that has been recorded
+ * @param apmUart the UART to print on
+ */
+void print(APMUart &apmUart);
+
+/**
+ * Sends the statistics of every recorded span on CAN_ID.  Byte 0 of each frame
+ * is the span and byte 1 a mux selecting the contents, all values little
+ * endian:
+ *  - mux 0: count (4 bytes), mean us (2 bytes, saturated)
+ *  - mux 1: min us (3 bytes), max us (3 bytes), both saturated
+ *  - mux 2 + n: counts of buckets 3n to 3n + 2 (2 bytes each, saturated),
+ *    only sent when one of them is non-zero
+ * @param can the CAN device to send on
+ * @return 0 on success
+ */
+int transmit(IO::CAN &can);
+
+/**
+ * Times the scope it is declared in.  Use APM_PROFILE_SPAN rather than
+ * creating one directly so profiling can be compiled out.
+ */
+class ScopedSpan {
+public:
+  explicit ScopedSpan(Span span) : span(span), start(cycles::now()) {}
+
+  ~ScopedSpan() { record(span, cycles::now() - start); }
+
+  ScopedSpan(const ScopedSpan &) = delete;
+
+  ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+private:
+  Span span;
+  uint32_t start;
+};
+
+} // namespace APM::profile
+
+#ifdef APM_SPAN_PROFILING
+#define APM_PROFILE_SPAN(span)                                                 \
+  APM::profile::ScopedSpan apmProfileSpan(APM::profile::Span::span)
+#else
+#define APM_PROFILE_SPAN(span)
+#endif
+
+#endif // APM_PROFILE_HPP
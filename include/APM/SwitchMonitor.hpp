@@ -0,0 +1,187 @@
+/**
+ * Class to check that the power switches follow the levels APMManager drives
+ * them to, catching switches that are welded closed or stuck open
+ */
+
+#ifndef APM_SWITCHMONITOR_HPP
+#define APM_SWITCHMONITOR_HPP
+
+#include <APM/APMManager.hpp>
+#include <APM/APMUart.hpp>
+#include <APM/utils/pins.hpp>
+#include <EVT/io/pin.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Compares the level each power switch is commanded to, read from the output
+ * data register, with the level sensed on its readback input.
+ *
+ * With APM_SWITCH_SENSE the readback inputs are sense lines on the switched
+ * side of each switch, high while it conducts, and all four are sampled with
+ * a single read of their port.  Without it the input buffer of each output
+ * pin is read instead, which catches a gate drive held by a short or a pin
+ * left unconfigured but not a welded MOSFET.
+ *
+ * Switches are identified by the APMManager::OUTPUT_ bits.  A switch gets its
+ * settle time to follow a new command.  After that, a switch sensed closed
+ * while commanded open is welded, and one sensed open while commanded closed
+ * is stuck open.  Faults stay latched until cleared.
+ *
+ * verify() is called by APMManager straight after the writes of a transition
+ * and polls until the switches follow, so a failed transition is caught
+ * within the settle time.  check() runs from the main loop every
+ * SAMPLE_PERIOD ms and latches a fault once CONFIRM_SAMPLES samples in a row
+ * disagree, so a switch that changes on its own is caught within its settle
+ * time plus (CONFIRM_SAMPLES + 1) * SAMPLE_PERIOD ms.
+ */
+class SwitchMonitor {
+public:
+  // Interval between checks in ms
+  static constexpr uint32_t SAMPLE_PERIOD = 10;
+
+  // Consecutive disagreeing checks that latch a fault.  Rides out a command
+  // changed and changed back between two checks, which check() cannot see.
+  static constexpr uint8_t CONFIRM_SAMPLES = 2;
+
+  // Time a MOSFET switch gets to follow a new command in ms
+  static constexpr uint32_t SWITCH_SETTLE_TIME = 2;
+
+  // Time the MC relay gets to follow a new command in ms
+  static constexpr uint32_t RELAY_SETTLE_TIME = 20;
+
+  // EventType::FAULT codes of a newly latched fault.  The value holds the
+  // APMManager::OUTPUT_ bit of the switch.
+  static constexpr uint8_t WELDED_FAULT = 2;
+  static constexpr uint8_t STUCK_OPEN_FAULT = 3;
+
+  // Number of switches watched
+  static constexpr size_t NUM_SWITCHES = 4;
+
+  // Every switch watched, as APMManager::OUTPUT_ bits
+  static constexpr uint8_t SWITCHES =
+      APMManager::OUTPUT_MC_ON | APMManager::OUTPUT_ACCESSORY_SW |
+      APMManager::OUTPUT_CHARGE_SW | APMManager::OUTPUT_VICOR_SW;
+
+  static_assert(SWITCHES == (1u << NUM_SWITCHES) - 1,
+                "The switches must be the lowest OUTPUT_ bits");
+
+#ifdef APM_SWITCH_SENSE
+  // Sense lines on the switched side of each switch, through dividers with
+  // pull downs so an open switch reads low
+  static constexpr IO::Pin MC_SENSE = IO::Pin::PB_6;
+  static constexpr IO::Pin ACCESSORY_SENSE = IO::Pin::PB_7;
+  static constexpr IO::Pin CHARGE_SENSE = IO::Pin::PB_8;
+  static constexpr IO::Pin VICOR_SENSE = IO::Pin::PB_9;
+#else
+  static constexpr IO::Pin MC_SENSE = APMManager::MC_ON;
+  static constexpr IO::Pin ACCESSORY_SENSE = APMManager::ACCESSORY_SW;
+  static constexpr IO::Pin CHARGE_SENSE = APMManager::CHARGE_SW;
+  static constexpr IO::Pin VICOR_SENSE = APMManager::VICOR_SW;
+#endif
+
+  static_assert(pins::getPort(MC_SENSE) == pins::getPort(ACCESSORY_SENSE) &&
+                    pins::getPort(MC_SENSE) == pins::getPort(CHARGE_SENSE) &&
+                    pins::getPort(MC_SENSE) == pins::getPort(VICOR_SENSE),
+                "Switch sense inputs must share a port to be read at once");
+
+  /**
+   * Waits for switches to follow their commands, latching a fault for any
+   * that do not within their settle time
+   * @param switches the switches to verify, as APMManager::OUTPUT_ bits
+   * @return 0 if they all followed, 1 otherwise
+   */
+  int verify(uint8_t switches);
+
+  /**
+   * Samples every switch and latches faults that have been seen for
+   * CONFIRM_SAMPLES checks.  Called from the main loop.
+   * @return the switches whose fault was latched by this check
+   */
+  uint8_t check();
+
+  /**
+   * Returns the level each switch is commanded to
+   * @return an APMManager::OUTPUT_ bit per switch commanded closed
+   */
+  [[nodiscard]] uint8_t getCommanded() const;
+
+  /**
+   * Returns the level sensed on each switch
+   * @return an APMManager::OUTPUT_ bit per switch sensed closed
+   */
+  [[nodiscard]] uint8_t getSensed() const;
+
+  /**
+   * Returns the switches latched as welded closed
+   * @return the switches, as APMManager::OUTPUT_ bits
+   */
+  [[nodiscard]] uint8_t getWelded() const;
+
+  /**
+   * Returns the switches latched as stuck open
+   * @return the switches, as APMManager::OUTPUT_ bits
+   */
+  [[nodiscard]] uint8_t getStuckOpen() const;
+
+  /**
+   * Clears the latched faults, so a switch that has been repaired or has
+   * come free is watched again
+   */
+  void clear();
+
+  /**
+   * Prints the commanded and sensed level of each switch, the latched faults
+   * and how long the last verify took
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+private:
+  // Commands seen by the last check
+  uint8_t lastCommanded = 0;
+
+  // Whether a check has run yet
+  bool started = false;
+
+  // Time each switch's command last changed in ms, indexed by bit position
+  uint32_t commandTime[NUM_SWITCHES] = {};
+
+  // Consecutive checks each switch disagreed in, indexed by bit position
+  uint8_t mismatches[NUM_SWITCHES] = {};
+
+  uint8_t welded = 0;
+  uint8_t stuckOpen = 0;
+
+  // Faults latched since power on
+  uint32_t faultCount = 0;
+
+  // Time the last verify took to see its switches follow in us, and whether
+  // it failed
+  uint32_t lastVerifyTime = 0;
+  bool lastVerifyFailed = false;
+
+  /**
+   * Latches a fault on the switches that disagree with their commands
+   * @param switches the switches to consider
+   * @param commanded the commands, as APMManager::OUTPUT_ bits
+   * @param sensed the sensed levels, as APMManager::OUTPUT_ bits
+   * @return the switches newly latched
+   */
+  uint8_t latch(uint8_t switches, uint8_t commanded, uint8_t sensed);
+};
+
+/**
+ * Returns the name of a switch
+ * @param output the APMManager::OUTPUT_ bit of the switch
+ * @return the name, for printing
+ */
+const char *getSwitchName(uint8_t output);
+
+} // namespace APM
+
+#endif // APM_SWITCHMONITOR_HPP
@@ -0,0 +1,357 @@
+/**
+ * Binary telemetry stream of the APM signals, for logging high rate data over
+ * the debug UART or CAN without flooding the link with text
+ */
+
+#ifndef APM_TELEMETRY_HPP
+#define APM_TELEMETRY_HPP
+
+#include <APM/APMUart.hpp>
+#include <APM/Config.hpp>
+#include <EVT/io/CAN.hpp>
+#include <EVT/io/UART.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+class APMManager;
+
+/**
+ * Signals that can be streamed.  The telemetry_signals setting holds one bit
+ * per signal.
+ */
+enum class TelemetrySignal : uint8_t {
+  // Current APMMode
+  MODE = 0u,
+  // Level read back from each switch and indicator output, see
+  // APMManager::getOutputs()
+  OUTPUTS = 1u,
+  // Lowest isolation resistance of the last GFD sample in kOhm
+  ISOLATION_RESISTANCE = 2u,
+  // Current IsolationWarning grade
+  ISOLATION_WARNING = 3u,
+  // Projected time until an isolation trip in s, 2^32 - 1 if none
+  ISOLATION_TIME_TO_TRIP = 4u,
+  // SIM100 units currently taking part in the vote
+  HEALTHY_GFD_UNITS = 5u,
+  // Time since the last valid isolation reading in ms, 0 when not supervised
+  GFD_AGE = 6u,
+  // GFD trips since power on
+  GFD_TRIPS = 7u,
+  // CPU load of the last sample period in tenths of a percent
+  CPU_LOAD = 8u,
+  // CAN bus load of the last sample period in tenths of a percent
+  BUS_LOAD = 9u,
+  // Estimated backup battery state of charge in percent
+  BACKUP_BATTERY_SOC = 10u
+};
+
+// Number of values in TelemetrySignal
+constexpr size_t NUM_TELEMETRY_SIGNALS = 11;
+
+static_assert(NUM_TELEMETRY_SIGNALS ==
+                  static_cast<size_t>(TelemetrySignal::BACKUP_BATTERY_SOC) + 1,
+              "NUM_TELEMETRY_SIGNALS must follow the last TelemetrySignal");
+
+// Names of the signals, indexed by TelemetrySignal
+constexpr const char *TELEMETRY_SIGNALS[NUM_TELEMETRY_SIGNALS] = {
+    "mode",
+    "outputs",
+    "isolation_resistance",
+    "isolation_warning",
+    "isolation_time_to_trip",
+    "healthy_gfd_units",
+    "gfd_age",
+    "gfd_trips",
+    "cpu_load",
+    "bus_load",
+    "backup_battery_soc",
+};
+
+/**
+ * Checks that no TelemetrySignal was left out of TELEMETRY_SIGNALS
+ * @return true if every entry has a name
+ */
+constexpr bool isSignalTableComplete() {
+  for (const char *name : TELEMETRY_SIGNALS) {
+    if (name == nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(isSignalTableComplete(),
+              "Every TelemetrySignal must be added to TELEMETRY_SIGNALS");
+
+static_assert(config::FIELDS[static_cast<size_t>(
+                                 config::Field::TELEMETRY_SIGNALS)]
+                      .max == (1u << NUM_TELEMETRY_SIGNALS) - 1,
+              "telemetry_signals must allow exactly one bit per signal");
+
+/**
+ * Links the stream can be sent on
+ */
+enum class TelemetryLink : uint8_t {
+  OFF = 0u,
+  // The debug UART.  The console stays quiet until a key is pressed.
+  UART = 1u,
+  // 8 byte frames on TelemetryStream::CAN_ID
+  CAN = 2u
+};
+
+/**
+ * Streams the signals selected by the telemetry_signals setting every
+ * telemetry_period ms.
+ *
+ * Samples are collected into packets.  The first sample of a packet holds
+ * every selected signal and each later one only the signals that changed,
+ * as the difference from the previous value.  Times and differences are
+ * zigzag varints, so a sample where nothing changed costs 2 bytes and most
+ * changes cost one more byte each.  Every packet stands on its own, so a
+ * lost packet only loses its own samples.
+ *
+ * A packet is laid out as follows, values little endian:
+ *  - bytes 0-1: sequence number
+ *  - varint: the signals in the packet, one bit per TelemetrySignal
+ *  - varint: the sample period in ms
+ *  - per sample:
+ *    - varint: for the first sample its time in ms since power on, for later
+ *      ones the zigzag difference between the time since the previous sample
+ *      and the period
+ *    - varint: the signals that changed, one bit per TelemetrySignal
+ *    - zigzag varint per changed signal, lowest first: the difference from
+ *      the previous sample, or from 0 in the first sample
+ *  - 2 bytes: CRC-16 of everything before it
+ *
+ * Packets are COBS encoded and end in a 0 byte, which appears nowhere else,
+ * so a receiver can join a stream at any point.  The same bytes are sent on
+ * either link.  On CAN they are split into frames of up to 8 bytes, and a
+ * lost frame shows as a bad CRC.  Text printed on the UART while streaming,
+ * such as a warning, costs the packet it lands in.
+ *
+ * A packet is sent once it holds MAX_SAMPLES samples, once its first sample
+ * is MAX_PACKET_TIME ms old, or when the next sample might not fit.  Sending
+ * blocks for the time the packet takes on the UART, at most about 21 ms.
+ */
+class TelemetryStream {
+public:
+  // Largest packet, including the CRC.  Fits one COBS block.
+  static constexpr size_t MAX_PACKET_SIZE = 240;
+
+  // Largest packet once COBS encoded, including the terminating 0
+  static constexpr size_t MAX_FRAME_SIZE = MAX_PACKET_SIZE + 2;
+
+  // Most samples in a packet
+  static constexpr size_t MAX_SAMPLES = 32;
+
+  // Age of the first sample at which a packet is sent regardless in ms
+  static constexpr uint32_t MAX_PACKET_TIME = 1000;
+
+  // Extended CAN ID the stream is sent on, next to the isolation warnings
+  static constexpr uint32_t CAN_ID = 0x0A1FF006;
+
+  /**
+   * Creates a stopped stream
+   * @param manager the manager the mode and outputs are read from
+   * @param uart the debug UART
+   * @param can the CAN device
+   */
+  TelemetryStream(APMManager &manager, IO::UART &uart, IO::CAN &can);
+
+  /**
+   * Starts streaming the signals and period from the settings, ending any
+   * stream already running
+   * @param link the link to send on, OFF to stop
+   */
+  void start(TelemetryLink link);
+
+  /**
+   * Sends any samples collected so far and stops streaming
+   */
+  void stop();
+
+  /**
+   * Adds a sample of every selected signal, and sends the packet if it is
+   * complete.  Called from the main loop every period.
+   */
+  void sample();
+
+  /**
+   * Returns the link the stream is sent on
+   * @return the link, OFF when stopped
+   */
+  [[nodiscard]] TelemetryLink getLink() const;
+
+  /**
+   * Returns the sample period of the stream
+   * @return the period in ms, 0 when stopped
+   */
+  [[nodiscard]] uint32_t getPeriod() const;
+
+  /**
+   * Prints the link, signals and how much has been sent
+   * @param apmUart the UART to print on
+   */
+  void print(APMUart &apmUart) const;
+
+private:
+  APMManager &manager;
+  IO::UART &uart;
+  IO::CAN &can;
+
+  TelemetryLink link = TelemetryLink::OFF;
+
+  // Streamed signals, one bit per TelemetrySignal
+  uint32_t signals = 0;
+
+  // Sample period in ms
+  uint32_t period = 0;
+
+  // Packet being filled, from byte 2.  It is COBS encoded in place, into
+  // bytes 1 on with byte 0 left for a 0 to resynchronise the receiver.
+  uint8_t frame[MAX_FRAME_SIZE + 1] = {};
+
+  // Bytes and samples in the packet being filled
+  size_t packetSize = 0;
+  size_t packetSamples = 0;
+
+  // Largest encoded sample of the selected signals in bytes
+  size_t maxSampleSize = 0;
+
+  // Time of the first and the latest sample in the packet in ms
+  uint32_t firstTime = 0;
+  uint32_t lastTime = 0;
+
+  // Value of each signal in the latest sample, indexed by TelemetrySignal
+  uint32_t lastValues[NUM_TELEMETRY_SIGNALS] = {};
+
+  // Sequence number of the next packet
+  uint16_t sequence = 0;
+
+  // Whether the receiver has to be resynchronised with a 0 byte before the
+  // next packet
+  bool resync = true;
+
+  // Totals since the stream was started
+  uint32_t startTime = 0;
+  uint32_t packetCount = 0;
+  uint32_t sampleCount = 0;
+  uint32_t byteCount = 0;
+  uint32_t sendErrors = 0;
+
+  /**
+   * Reads the present value of a signal
+   * @param signal the signal
+   * @return the value
+   */
+  [[nodiscard]] uint32_t read(TelemetrySignal signal) const;
+
+  /**
+   * Encodes the packet and sends it on the link, then starts a new one
+   */
+  void flush();
+
+  /**
+   * Appends a varint to the packet
+   * @param value the value
+   */
+  void putVarint(uint32_t value);
+
+  /**
+   * Sends bytes of an encoded packet on the link
+   * @param data the bytes
+   * @param size the number of bytes
+   * @return 0 on success, 1 if CAN refused a frame
+   */
+  int send(uint8_t *data, size_t size);
+};
+
+/**
+ * Samples of one packet, as decoded on the host
+ */
+struct TelemetryPacket {
+  // Sequence number, counting every packet sent since power on
+  uint16_t sequence = 0;
+  // Signals in the packet, one bit per TelemetrySignal
+  uint32_t signals = 0;
+  // Sample period in ms
+  uint32_t period = 0;
+  // Number of samples
+  size_t numSamples = 0;
+  // Time of each sample in ms since power on
+  uint32_t times[TelemetryStream::MAX_SAMPLES] = {};
+  // Value of every signal of each sample, indexed by TelemetrySignal.
+  // Signals not in the packet are 0.
+  uint32_t values[TelemetryStream::MAX_SAMPLES][NUM_TELEMETRY_SIGNALS] = {};
+};
+
+/**
+ * Splits a received stream into packets and decodes them.  Used by the host
+ * decoder.
+ */
+class TelemetryDecoder {
+public:
+  /**
+   * Adds the next received byte
+   * @param byte the byte
+   * @return true if it completed a valid packet, which getPacket() returns
+   */
+  bool push(uint8_t byte);
+
+  /**
+   * Returns the last packet decoded
+   * @return the packet
+   */
+  [[nodiscard]] const TelemetryPacket &getPacket() const;
+
+  /**
+   * Returns the number of valid packets decoded
+   * @return the number of packets
+   */
+  [[nodiscard]] uint32_t getPacketCount() const;
+
+  /**
+   * Returns the number of frames that were not a valid packet, such as
+   * console text or a packet with a lost CAN frame
+   * @return the number of frames
+   */
+  [[nodiscard]] uint32_t getBadFrameCount() const;
+
+  /**
+   * Returns the number of packets missing from the sequence numbers
+   * @return the number of packets
+   */
+  [[nodiscard]] uint32_t getLostPacketCount() const;
+
+private:
+  // Bytes of the frame being received
+  uint8_t frame[TelemetryStream::MAX_FRAME_SIZE] = {};
+  size_t frameSize = 0;
+
+  // Whether the frame being received is too long to be a packet
+  bool overflow = false;
+
+  TelemetryPacket packet;
+
+  // Sequence number the next packet should have, once one has been decoded
+  bool synced = false;
+  uint16_t nextSequence = 0;
+
+  uint32_t packetCount = 0;
+  uint32_t badFrameCount = 0;
+  uint32_t lostPacketCount = 0;
+
+  /**
+   * Decodes the received frame into packet
+   * @return 0 on success, 1 if it is not a valid packet
+   */
+  int decodeFrame();
+};
+
+} // namespace APM
+
+#endif // APM_TELEMETRY_HPP
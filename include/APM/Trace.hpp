@@ -0,0 +1,343 @@
+/**
+ * Compact binary trace of the APM inputs and outputs, used to record field
+ * behaviour and replay it off-target
+ */
+
+#ifndef APM_TRACE_HPP
+#define APM_TRACE_HPP
+
+#include <APM/utils/globals.hpp>
+#include <EVT/io/pin.hpp>
+#include <EVT/io/types/CANMessage.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace APM {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Types of events stored in a trace
+ */
+enum class TraceEventType : uint8_t {
+  // CAN frame consumed by the firmware
+  CAN_RX = 1u,
+  // CAN frame transmitted by the firmware
+  CAN_TX = 2u,
+  // Interrupt from an input pin.  level holds the level read in the handler.
+  GPIO_INPUT = 3u,
+  // Output pin changed level
+  GPIO_OUTPUT = 4u,
+  // Timer interrupt.  id holds the TraceTimer.
+  TIMER = 5u
+};
+
+/**
+ * Timers whose interrupts are recorded
+ */
+enum class TraceTimer : uint8_t {
+  GFD_STARTUP = 0u,
+  GFD_POLL = 1u,
+  KEY_DEBOUNCE = 2u,
+  CHARGE_CONTROL = 3u
+};
+
+/**
+ * A single decoded trace event
+ */
+struct TraceEvent {
+  TraceEventType type = TraceEventType::CAN_RX;
+  // Time of the event in us since the trace started
+  uint64_t time = 0;
+  // CAN ID, IO::Pin value or TraceTimer, depending on type
+  uint32_t id = 0;
+  // Whether a CAN ID is extended
+  bool extended = false;
+  // Level of a GPIO event
+  bool level = false;
+  // Number of valid bytes in data
+  uint8_t length = 0;
+  uint8_t data[8] = {};
+};
+
+/**
+ * Encodes trace events into a byte buffer.
+ *
+ * A trace starts with an 8 byte header (magic "APMT", version).  Each event is
+ * then stored as:
+ *  - 1 byte: type in the low nibble, CAN length / GPIO level / timer in the
+ *    high nibble
+ *  - varint: us since the previous event
+ *  - CAN only: varint of (id << 1 | extended), then the payload bytes
+ *  - GPIO only: 1 byte IO::Pin value
+ *
+ * Varints are little endian base 128, so a typical SIM100 response takes 17
+ * bytes instead of the 24 needed for a fixed layout.
+ */
+class TraceWriter {
+public:
+  // Identifies the start of a trace
+  static constexpr uint32_t MAGIC = 0x544D5041; // "APMT"
+
+  // Version of the encoding
+  static constexpr uint8_t VERSION = 1;
+
+  // Size of the trace header
+  static constexpr size_t HEADER_SIZE = 8;
+
+  // Largest encoding of a single event
+  static constexpr size_t MAX_EVENT_SIZE = 1 + 10 + 5 + 8;
+
+  /**
+   * Creates a writer over a buffer
+   * @param buffer the buffer to encode into
+   * @param size the size of the buffer in bytes
+   */
+  TraceWriter(uint8_t *buffer, size_t size);
+
+  /**
+   * Empties the buffer and writes the trace header
+   * @return 0 on success, 1 if the buffer is too small
+   */
+  int start();
+
+  /**
+   * Appends an event.  Events must be written in time order.
+   * @param event the event to encode
+   * @return 0 on success, 1 if the buffer is full.  Nothing is written on
+   * failure.
+   */
+  int write(const TraceEvent &event);
+
+  /**
+   * Empties the buffer but keeps the time of the last event, so a long trace
+   * can be streamed out through a small buffer
+   */
+  void clearBuffer();
+
+  /**
+   * Returns the number of bytes written to the buffer
+   * @return bytes used
+   */
+  [[nodiscard]] size_t getSize() const;
+
+  /**
+   * Returns the encoded bytes
+   * @return pointer to the start of the buffer
+   */
+  [[nodiscard]] const uint8_t *getData() const;
+
+private:
+  uint8_t *buffer;
+  size_t capacity;
+  size_t size = 0;
+
+  // Time of the last event written
+  uint64_t lastTime = 0;
+};
+
+/**
+ * Decodes a trace written by TraceWriter
+ */
+class TraceReader {
+public:
+  /**
+   * Creates a reader over an encoded trace
+   * @param data the encoded trace, starting with the header
+   * @param size the size of the trace in bytes
+   */
+  TraceReader(const uint8_t *data, size_t size);
+
+  /**
+   * Checks the trace header.  Must be called before next().
+   * @return 0 on success, 1 if the data is not a trace of a known version
+   */
+  int start();
+
+  /**
+   * Decodes the next event
+   * @param event filled with the event
+   * @return 0 on success, 1 at the end of the trace, 2 if the data is corrupt
+   */
+  int next(TraceEvent &event);
+
+private:
+  const uint8_t *data;
+  size_t size;
+  size_t offset = 0;
+
+  // Time of the last event read
+  uint64_t lastTime = 0;
+
+  /**
+   * Reads a varint
+   * @param value filled with the decoded value
+   * @return true on success
+   */
+  bool readVarint(uint64_t &value);
+};
+
+/**
+ * Records APM events into a RAM buffer as they happen.
+ *
+ * The recorder is safe to call from interrupts.  Recording stops when the
+ * buffer is full; the events recorded so far remain a valid trace.  Event
+ * times come from the DWT cycle counter, falling back to the millisecond tick
+ * for gaps longer than the counter can hold.
+ */
+class TraceRecorder {
+public:
+  /**
+   * Creates a recorder.  Nothing is recorded until start() is called.
+   * @param buffer buffer to hold the trace
+   * @param size the size of the buffer in bytes
+   */
+  TraceRecorder(uint8_t *buffer, size_t size);
+
+  /**
+   * Clears the buffer and starts a new trace
+   * @return 0 on success, 1 if the buffer is too small
+   */
+  int start();
+
+  /**
+   * Stops recording.  The trace in the buffer is left intact.
+   */
+  void stop();
+
+  /**
+   * Returns whether events are being recorded
+   * @return true while recording
+   */
+  [[nodiscard]] bool isRecording() const;
+
+  /**
+   * Returns the number of events lost because the buffer filled up
+   * @return number of dropped events
+   */
+  [[nodiscard]] uint32_t getDroppedCount() const;
+
+  /**
+   * Returns the encoded trace
+   * @return pointer to the trace
+   */
+  [[nodiscard]] const uint8_t *getData() const;
+
+  /**
+   * Returns the size of the encoded trace
+   * @return size in bytes
+   */
+  [[nodiscard]] size_t getSize() const;
+
+  /**
+   * Records a CAN frame
+   * @param type CAN_RX or CAN_TX
+   * @param message the frame
+   */
+  void recordCAN(TraceEventType type, IO::CANMessage &message);
+
+  /**
+   * Records an input pin interrupt
+   * @param pin the input pin
+   * @param level the level read in the interrupt
+   */
+  void recordInput(IO::Pin pin, bool level);
+
+  /**
+   * Records an output write.  Only changes of level are stored.
+   * @param pin the output pin
+   * @param level the level written
+   */
+  void recordOutput(IO::Pin pin, bool level);
+
+  /**
+   * Records a write to a GPIO port BSRR register as individual output changes
+   * @param port the port index, 0 for GPIOA
+   * @param bsrr the value written to BSRR
+   */
+  void recordPortWrite(uint8_t port, uint32_t bsrr);
+
+  /**
+   * Records a timer interrupt
+   * @param timer the timer that fired
+   */
+  void recordTimer(TraceTimer timer);
+
+private:
+  // Longest gap in ms timed with the cycle counter before it could wrap
+  static constexpr uint32_t CYCLE_TIMING_LIMIT = 50000;
+
+  // Number of GPIO ports whose output levels are tracked
+  static constexpr uint8_t NUM_PORTS = 3;
+
+  TraceWriter writer;
+  volatile bool recording = false;
+  uint32_t droppedCount = 0;
+
+  // Time of the last event in us since start
+  uint64_t time = 0;
+  uint32_t lastCycles = 0;
+  uint32_t lastMillis = 0;
+
+  // Last recorded level of each output pin, and which pins have been recorded
+  uint16_t outputLevels[NUM_PORTS] = {};
+  uint16_t outputKnown[NUM_PORTS] = {};
+
+  /**
+   * Timestamps and stores an event
+   * @param event the event to store.  time is filled in.
+   */
+  void record(TraceEvent &event);
+
+  /**
+   * Records an output change without entering the critical section
+   * @param pin the output pin
+   * @param level the level written
+   */
+  void recordOutputLocked(uint8_t pin, bool level);
+};
+
+} // namespace APM
+
+// Recorder used by the APM::trace hooks.  Null unless a trace is wanted.
+extern APM_BOARD_LOCAL APM::TraceRecorder *traceRecorderPtr;
+
+/**
+ * Hooks called by the APM code.  They do nothing unless traceRecorderPtr is
+ * set, so recording costs one load and branch when disabled.
+ */
+namespace APM::trace {
+
+inline void recordCAN(TraceEventType type, IO::CANMessage &message) {
+  if (traceRecorderPtr != nullptr) {
+    traceRecorderPtr->recordCAN(type, message);
+  }
+}
+
+inline void recordInput(IO::Pin pin, bool level) {
+  if (traceRecorderPtr != nullptr) {
+    traceRecorderPtr->recordInput(pin, level);
+  }
+}
+
+inline void recordOutput(IO::Pin pin, bool level) {
+  if (traceRecorderPtr != nullptr) {
+    traceRecorderPtr->recordOutput(pin, level);
+  }
+}
+
+inline void recordPortWrite(uint8_t port, uint32_t bsrr) {
+  if (traceRecorderPtr != nullptr) {
+    traceRecorderPtr->recordPortWrite(port, bsrr);
+  }
+}
+
+inline void recordTimer(TraceTimer timer) {
+  if (traceRecorderPtr != nullptr) {
+    traceRecorderPtr->recordTimer(timer);
+  }
+}
+
+} // namespace APM::trace
+
+#endif // APM_TRACE_HPP
@@ -0,0 +1,79 @@
+/**
+ * Warm restart support.  A snapshot of the APMManager state is kept in the RTC
+ * backup registers, which hold their contents through watchdog, software and
+ * reset pin resets.  After such a reset the APM can go back to the mode it was
+ * in without waiting for the key to be turned again, and without the SIM100
+ * start up if the units had finished it.
+ *
+ * The backup registers are used instead of a .noinit RAM section because the
+ * linker script belongs to EVT-core and the RAM above .bss is painted for the
+ * stack high-water mark at every boot.
+ */
+
+#ifndef APM_WARMSTART_HPP
+#define APM_WARMSTART_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::warm {
+
+// Bits of Snapshot::switches
+constexpr uint8_t SWITCH_ACCESSORY = 1u << 0;
+constexpr uint8_t SWITCH_CHARGE = 1u << 1;
+constexpr uint8_t SWITCH_VICOR = 1u << 2;
+constexpr uint8_t SWITCH_MC = 1u << 3;
+
+// Number of warm restarts in a row after which the next boot is a cold one,
+// so a fault that keeps resetting the MCU cannot keep HV up forever
+constexpr uint8_t MAX_RESTARTS = 3;
+
+/**
+ * State of the APM saved for a warm restart
+ */
+struct Snapshot {
+  // APMMode at the time of the snapshot
+  uint8_t mode;
+  // Levels of the power switch outputs, SWITCH_* bits
+  uint8_t switches;
+  // Whether the SIM100 units had started up and were being polled
+  uint8_t gfdReady;
+  // Whether GFD isolation checking was enabled
+  uint8_t gfdChecking;
+  // Last voted SIM100::IsolationStateResponse
+  uint8_t isolation;
+  // Warm restarts since the last mode transition
+  uint8_t restarts;
+  uint8_t reserved[2];
+};
+
+static_assert(sizeof(Snapshot) == 8, "Snapshot must pack to 8 bytes");
+
+/**
+ * Enables write access to the backup registers.  Call once at start up before
+ * anything is saved.
+ */
+void init();
+
+/**
+ * Stores a snapshot, replacing the previous one.  Takes about a microsecond,
+ * so it is safe to call on the GFD trip path.
+ * @param snapshot the state to store
+ */
+void save(const Snapshot &snapshot);
+
+/**
+ * Reads back the stored snapshot
+ * @param snapshot filled with the stored state if it is valid
+ * @return 0 on success, 1 if no valid snapshot is stored
+ */
+int load(Snapshot &snapshot);
+
+/**
+ * Invalidates the stored snapshot
+ */
+void clear();
+
+} // namespace APM::warm
+
+#endif // APM_WARMSTART_HPP
@@ -0,0 +1,76 @@
+/**
+ * Interface for a region of page erasable flash memory
+ */
+
+#ifndef APM_DEV_FLASH_HPP
+#define APM_DEV_FLASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::DEV {
+
+/**
+ * A region of flash made of equally sized pages.  Offsets are relative to the
+ * start of the region.
+ *
+ * Follows the STM32F3 programming rules: data is programmed a half word at a
+ * time, and a half word can only be programmed once after its page has been
+ * erased.
+ */
+class Flash {
+public:
+  // Value of every byte after a page erase
+  static constexpr uint8_t ERASED_BYTE = 0xFF;
+
+  /**
+   * Returns the size of one page
+   * @return the page size in bytes
+   */
+  [[nodiscard]] virtual uint32_t getPageSize() const = 0;
+
+  /**
+   * Returns the number of pages in the region
+   * @return the number of pages
+   */
+  [[nodiscard]] virtual uint32_t getNumPages() const = 0;
+
+  /**
+   * Returns where the region is mapped into the address space, so data can be
+   * used in place without copying it out with read()
+   * @return pointer to the first byte of the region
+   */
+  [[nodiscard]] virtual const uint8_t *getAddress() const = 0;
+
+  /**
+   * Copies data out of the region
+   * @param offset the byte offset to start reading from
+   * @param data buffer to copy into
+   * @param size the number of bytes to read
+   * @return 0 on success, 1 if the range is outside of the region
+   */
+  virtual int read(uint32_t offset, void *data, size_t size) const = 0;
+
+  /**
+   * Programs erased flash
+   * @param offset the byte offset to start writing to.  Must be half word
+   * aligned.
+   * @param data the data to program
+   * @param size the number of bytes to program.  Must be a multiple of 2.
+   * @return 0 on success, 1 on a bad range, 2 on a programming error, 3 if
+   * the region overlaps the firmware image, in which case nothing is written
+   */
+  virtual int write(uint32_t offset, const void *data, size_t size) = 0;
+
+  /**
+   * Erases one page, setting every byte to ERASED_BYTE
+   * @param page the index of the page within the region
+   * @return 0 on success, 1 on a bad page, 2 on an erase error, 3 if the
+   * region overlaps the firmware image, in which case nothing is erased
+   */
+  virtual int erasePage(uint32_t page) = 0;
+};
+
+} // namespace APM::DEV
+
+#endif // APM_DEV_FLASH_HPP
@@ -38,10 +38,14 @@ public:
   };
 
   /**
-   *
-   * @param can
+   * Creates a SIM100 bound to a pair of CAN IDs.  Units on a shared bus must
+   * each be configured with a distinct request/response ID pair.
+   * @param can the CAN device the SIM100 is attached to
+   * @param requestId the CAN ID requests are sent to
+   * @param responseId the CAN ID the SIM100 responds on
    */
-  explicit SIM100(IO::CAN &can);
+  explicit SIM100(IO::CAN &can, uint32_t requestId = CAN_REQUEST_ID,
+                  uint32_t responseId = CAN_RESPONSE_ID);
 
   /**
    * Returns the part name into the relevant buf variable.  The max length of
@@ -80,6 +84,75 @@ public:
    */
   int restartSIM100();
 
+  /**
+   * Transmits an isolation state request without waiting for the response.
+   * Used to interleave polls across several units on the same bus.
+   * @return 0 on success.  Error code on failure
+   */
+  int requestIsolationState();
+
+  /**
+   * Checks whether a received message is this unit's response to an isolation
+   * state request.
+   * @param message the received CAN message
+   * @return true if the message should be passed to decodeIsolationState
+   */
+  bool isIsolationStateResponse(IO::CANMessage &message) const;
+
+  /**
+   * Classifies an isolation state response message.
+   * @param responseMessage the response from the SIM100
+   * @param queryAgain set true if the SIM100 reported no new estimate or high
+   * uncertainty, in which case the result should be requested again
+   * @return the isolation state contained in the message
+   */
+  static IsolationStateResponse
+  decodeIsolationState(IO::CANMessage &responseMessage, bool &queryAgain);
+
+  /**
+   * Reads the isolation resistance from an isolation state response.  The
+   * SIM100 sends it big endian in bytes 2-3, after the status byte.
+   * @param responseMessage the response from the SIM100
+   * @return the isolation resistance in kOhm, 0 if the message is too short
+   */
+  static uint16_t decodeIsolationResistance(IO::CANMessage &responseMessage);
+
+  /**
+   * Transmits a max working voltage update without waiting for the echo.
+   * Used to update several units on the same bus at once.
+   * @param maxVoltage the maximum voltage to apply
+   * @return 0 on success.  Error code on failure
+   */
+  int requestMaxWorkingVoltage(uint16_t maxVoltage);
+
+  /**
+   * Checks whether a received message is this unit's echo of a max working
+   * voltage update.
+   * @param message the received CAN message
+   * @return true if the message should be passed to decodeMaxWorkingVoltage
+   */
+  bool isMaxWorkingVoltageResponse(IO::CANMessage &message) const;
+
+  /**
+   * Reads the max working voltage echoed by the SIM100, big endian in bytes
+   * 1-2
+   * @param responseMessage the response from the SIM100
+   * @return the voltage in V, 0 if the message is too short
+   */
+  static uint16_t decodeMaxWorkingVoltage(IO::CANMessage &responseMessage);
+
+  /**
+   * Returns the CAN ID this unit listens for requests on
+   * @return the request CAN ID
+   */
+  [[nodiscard]] uint32_t getRequestId() const;
+
+  /**
+   * Returns the CAN ID this unit responds on
+   * @return the response CAN ID
+   */
+  [[nodiscard]] uint32_t getResponseId() const;
+
 private:
   /**
    * Enumeration to map the Request_mux byte of the CAN message to the request
@@ -123,6 +196,20 @@ private:
   // The CAN device to send and receive CAN messages with
   IO::CAN &can;
 
+  // CAN ID requests are sent to
+  uint32_t requestId;
+
+  // CAN ID responses are received on
+  uint32_t responseId;
+
+  /**
+   * Transmits a message to the SIM100 without waiting for a response
+   * @param dataLength the length of the CAN message to send
+   * @param payload the payload of the CAN message to send
+   * @return 0 if successful
+   */
+  int transmit(uint8_t dataLength, uint8_t *payload);
+
   /**
    * Sends the requested CAN Message.  To be used for Data request messages. Not
    * for state control commands Returns a pointer to the response message from
@@ -147,6 +234,13 @@ private:
                   IO::CANMessage &responseMessage, bool expectResponse = true);
 };
 
+/**
+ * Returns the name of an isolation state
+ * @param state the state
+ * @return the name, for printing
+ */
+const char *getName(SIM100::IsolationStateResponse state);
+
 } // namespace APM::DEV
 
 #endif // EVT_SIM100_H
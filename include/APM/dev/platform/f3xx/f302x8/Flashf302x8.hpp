@@ -0,0 +1,103 @@
+/**
+ * Flash implementation for the STM32F302x8 internal flash
+ */
+
+#ifndef APM_DEV_FLASHF302X8_HPP
+#define APM_DEV_FLASHF302X8_HPP
+
+#include <APM/dev/Flash.hpp>
+
+namespace APM::DEV {
+
+/**
+ * Gives access to a range of pages of the STM32F302x8 internal flash.  The
+ * pages must not overlap the firmware image.  Nothing in the linker script
+ * reserves them, so write() and erasePage() return 3 once the image has grown
+ * into the region, and users check overlapsImage() before mounting.
+ *
+ * The F302 has a single flash bank, so the core stalls on instruction fetches
+ * while a page is being erased (20-40 ms) or a half word programmed (~50 us).
+ */
+class Flashf302x8 : public Flash {
+public:
+  // Address of the start of internal flash
+  static constexpr uint32_t START_ADDRESS = 0x08000000;
+
+  // Size of a single flash page in bytes
+  static constexpr uint32_t PAGE_SIZE = 2048;
+
+  // Number of pages in the 64 KB part
+  static constexpr uint32_t TOTAL_PAGES = 32;
+
+  /**
+   * Creates access to a range of flash pages
+   * @param firstPage the index of the first page in the region
+   * @param numPages the number of pages in the region
+   */
+  Flashf302x8(uint32_t firstPage, uint32_t numPages);
+
+  /**
+   * Checks whether the firmware image extends into the region
+   * @return true if the region starts before the end of the image
+   */
+  [[nodiscard]] bool overlapsImage() const;
+
+  /**
+   * Returns the address just past the firmware image, which ends with the
+   * initial values of .data
+   * @return the end address of the image
+   */
+  [[nodiscard]] static uint32_t getImageEnd();
+
+  [[nodiscard]] uint32_t getPageSize() const override;
+
+  [[nodiscard]] uint32_t getNumPages() const override;
+
+  [[nodiscard]] const uint8_t *getAddress() const override;
+
+  int read(uint32_t offset, void *data, size_t size) const override;
+
+  int write(uint32_t offset, const void *data, size_t size) override;
+
+  int erasePage(uint32_t page) override;
+
+private:
+  // Keys written to FLASH_KEYR to unlock the FLASH_CR register
+  static constexpr uint32_t UNLOCK_KEY_1 = 0x45670123;
+  static constexpr uint32_t UNLOCK_KEY_2 = 0xCDEF89AB;
+
+  // Address of the first byte of the region
+  uint32_t startAddress;
+
+  // Number of pages in the region
+  uint32_t numPages;
+
+  /**
+   * Checks that a range lies within the region
+   * @param offset the start of the range
+   * @param size the length of the range
+   * @return true if the whole range is inside the region
+   */
+  [[nodiscard]] bool inRange(uint32_t offset, size_t size) const;
+
+  /**
+   * Unlocks the flash control register
+   */
+  static void unlock();
+
+  /**
+   * Locks the flash control register
+   */
+  static void lock();
+
+  /**
+   * Waits for the current flash operation to finish and clears its flags
+   * @return 0 on success, 2 if a programming or write protection error
+   * occurred
+   */
+  static int waitForOperation();
+};
+
+} // namespace APM::DEV
+
+#endif // APM_DEV_FLASHF302X8_HPP
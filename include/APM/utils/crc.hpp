@@ -0,0 +1,24 @@
+/**
+ * Checksum helpers used to validate data stored in flash and RAM
+ */
+
+#ifndef APM_UTILS_CRC_HPP
+#define APM_UTILS_CRC_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace APM::crc {
+
+/**
+ * Computes the CRC-16/CCITT-FALSE of a block of data
+ * @param data the data to checksum
+ * @param size the number of bytes in data
+ * @param crc the starting value, used to continue a previous calculation
+ * @return the CRC of the data
+ */
+uint16_t crc16(const void *data, size_t size, uint16_t crc = 0xFFFF);
+
+} // namespace APM::crc
+
+#endif // APM_UTILS_CRC_HPP
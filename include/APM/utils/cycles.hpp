@@ -0,0 +1,37 @@
+/**
+ * Helpers for timestamping code using the Cortex-M DWT cycle counter.  Reading
+ * the counter is a single load so it is safe to use in interrupt handlers and
+ * on the fault path.
+ */
+
+#ifndef APM_UTILS_CYCLES_HPP
+#define APM_UTILS_CYCLES_HPP
+
+#include <HALf3/stm32f3xx.h>
+#include <cstdint>
+
+namespace APM::cycles {
+
+/**
+ * Enables the DWT cycle counter.  Must be called once at start up before any
+ * timestamps are taken.
+ */
+void init();
+
+/**
+ * Returns the current value of the free running cycle counter.  The counter
+ * wraps, so only differences between two timestamps are meaningful.
+ * @return the current cycle count
+ */
+inline uint32_t now() { return DWT->CYCCNT; }
+
+/**
+ * Converts a number of core clock cycles to microseconds
+ * @param cycles the number of cycles elapsed
+ * @return the elapsed time in microseconds
+ */
+uint32_t toMicros(uint32_t cycles);
+
+} // namespace APM::cycles
+
+#endif // APM_UTILS_CYCLES_HPP
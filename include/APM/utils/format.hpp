@@ -0,0 +1,350 @@
+/**
+ * Type safe text formatting without printf.  Format strings are parsed into
+ * literal segments and placeholders at compile time, so a malformed string or
+ * a wrong argument count or type fails the build, and at run time the text is
+ * written straight to the UART with no format string scanning or varargs.
+ *
+ * Placeholders are written {} with an optional spec inside the braces:
+ *
+ *   { [<] [0] [width] [x|X] }
+ *
+ *  - '<' left aligns within the width, the default is right aligned
+ *  - '0' pads integers with zeros instead of spaces
+ *  - width is the minimum number of characters, up to 255
+ *  - 'x' or 'X' prints integers in lower or upper case hexadecimal
+ *
+ * "{{" and "}}" print a single brace.  Arguments may be integers, characters,
+ * strings, and enums that have a getName() function found by argument
+ * dependent lookup, such as APMMode.
+ *
+ * Format strings are wrapped with the APM_FORMAT macro:
+ *
+ *   apmUart.print(APM_FORMAT("Mode: {}, trips: {}\n\r"), mode, count);
+ */
+
+#ifndef APM_UTILS_FORMAT_HPP
+#define APM_UTILS_FORMAT_HPP
+
+#include <EVT/io/UART.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace APM::format {
+
+/**
+ * Options of one placeholder
+ */
+struct Spec {
+  bool leftAlign = false;
+  bool zeroPad = false;
+  uint8_t width = 0;
+  uint8_t base = 10;
+  bool upperCase = false;
+};
+
+/**
+ * A run of literal text, followed by a placeholder if hasArg is set
+ */
+struct Segment {
+  // Offset and length of the literal text in the format string
+  uint16_t start = 0;
+  uint16_t length = 0;
+  bool hasArg = false;
+  Spec spec;
+};
+
+/**
+ * Outcome of parsing a format string
+ */
+struct ParseResult {
+  bool valid = true;
+  size_t numSegments = 0;
+  size_t numArgs = 0;
+};
+
+/**
+ * Splits a format string into segments.  Called once to count the segments
+ * and again to fill them in, both at compile time.
+ * @param text the format string
+ * @param segments filled with the segments, or nullptr to only count them
+ * @return whether the string is valid, and the number of segments and
+ * placeholders
+ */
+constexpr ParseResult parse(const char *text, Segment *segments = nullptr) {
+  ParseResult result;
+  size_t start = 0;
+  size_t position = 0;
+
+  auto addSegment = [&](size_t end, bool hasArg, const Spec &spec) {
+    if (segments != nullptr) {
+      Segment &segment = segments[result.numSegments];
+      segment.start = static_cast<uint16_t>(start);
+      segment.length = static_cast<uint16_t>(end - start);
+      segment.hasArg = hasArg;
+      segment.spec = spec;
+    }
+    result.numSegments++;
+  };
+
+  while (text[position] != '\0') {
+    char c = text[position];
+    if (c == '}') {
+      if (text[position + 1] != '}') {
+        result.valid = false;
+        return result;
+      }
+      // Keep the first brace, skip the second
+      addSegment(position + 1, false, Spec());
+      position += 2;
+      start = position;
+      continue;
+    }
+    if (c != '{') {
+      position++;
+      continue;
+    }
+    if (text[position + 1] == '{') {
+      addSegment(position + 1, false, Spec());
+      position += 2;
+      start = position;
+      continue;
+    }
+
+    size_t end = position;
+    Spec spec;
+    position++;
+    if (text[position] == '<') {
+      spec.leftAlign = true;
+      position++;
+    }
+    if (text[position] == '0') {
+      spec.zeroPad = true;
+      position++;
+    }
+    unsigned width = 0;
+    while (text[position] >= '0' && text[position] <= '9') {
+      width = width * 10 + static_cast<unsigned>(text[position] - '0');
+      position++;
+    }
+    if (width > 255) {
+      result.valid = false;
+      return result;
+    }
+    spec.width = static_cast<uint8_t>(width);
+    if (text[position] == 'x' || text[position] == 'X') {
+      spec.base = 16;
+      spec.upperCase = text[position] == 'X';
+      position++;
+    }
+    if (text[position] != '}') {
+      result.valid = false;
+      return result;
+    }
+    position++;
+
+    addSegment(end, true, spec);
+    result.numArgs++;
+    start = position;
+  }
+
+  addSegment(position, false, Spec());
+  return result;
+}
+
+/**
+ * A format string parsed at compile time.  Created by APM_FORMAT.
+ * @tparam Text class with a static constexpr get() returning the string
+ */
+template <typename Text>
+struct Format {
+  static constexpr const char *TEXT = Text::get();
+  static constexpr ParseResult RESULT = parse(TEXT);
+  static_assert(RESULT.valid, "Malformed format string");
+
+  /**
+   * Returns the segments of the string
+   * @return the segments
+   */
+  static constexpr std::array<Segment, RESULT.numSegments> getSegments() {
+    std::array<Segment, RESULT.numSegments> segments{};
+    parse(TEXT, segments.data());
+    return segments;
+  }
+
+  static constexpr std::array<Segment, RESULT.numSegments> SEGMENTS =
+      getSegments();
+};
+
+/**
+ * How an argument is stored and printed
+ */
+enum class ArgType : uint8_t {
+  NONE = 0u,
+  SIGNED = 1u,
+  UNSIGNED = 2u,
+  SIGNED64 = 3u,
+  UNSIGNED64 = 4u,
+  CHAR = 5u,
+  STRING = 6u
+};
+
+/**
+ * An argument with its type erased, so the writing code is not instantiated
+ * for every combination of argument types
+ */
+struct Arg {
+  ArgType type = ArgType::NONE;
+  union {
+    int32_t s32;
+    uint32_t u32;
+    int64_t s64;
+    uint64_t u64;
+    char c;
+    const char *string;
+  };
+
+  Arg() : u64(0) {}
+};
+
+/**
+ * Detects enums that have a getName() to print them with
+ */
+template <typename T, typename = void>
+struct HasName : std::false_type {};
+
+template <typename T>
+struct HasName<T, std::void_t<decltype(getName(std::declval<T>()))>>
+    : std::true_type {};
+
+/**
+ * Returns how an argument type is printed
+ * @tparam T the decayed argument type
+ * @return the argument type, or NONE if it cannot be printed
+ */
+template <typename T>
+constexpr ArgType getArgType() {
+  if constexpr (std::is_same_v<T, char>) {
+    return ArgType::CHAR;
+  } else if constexpr (std::is_same_v<T, const char *> ||
+                       std::is_same_v<T, char *>) {
+    return ArgType::STRING;
+  } else if constexpr (std::is_enum_v<T>) {
+    return HasName<T>::value ? ArgType::STRING : ArgType::NONE;
+  } else if constexpr (std::is_integral_v<T>) {
+    if constexpr (sizeof(T) > sizeof(uint32_t)) {
+      return std::is_signed_v<T> ? ArgType::SIGNED64 : ArgType::UNSIGNED64;
+    } else {
+      return std::is_signed_v<T> ? ArgType::SIGNED : ArgType::UNSIGNED;
+    }
+  } else {
+    return ArgType::NONE;
+  }
+}
+
+/**
+ * Type erases an argument
+ * @param value the argument
+ * @return the stored argument
+ */
+template <typename T>
+Arg makeArg(const T &value) {
+  using Type = std::decay_t<T>;
+  constexpr ArgType type = getArgType<Type>();
+  Arg arg;
+  arg.type = type;
+
+  if constexpr (type == ArgType::CHAR) {
+    arg.c = value;
+  } else if constexpr (type == ArgType::STRING) {
+    if constexpr (std::is_enum_v<Type>) {
+      arg.string = getName(value);
+    } else {
+      arg.string = value;
+    }
+  } else if constexpr (type == ArgType::SIGNED) {
+    arg.s32 = static_cast<int32_t>(value);
+  } else if constexpr (type == ArgType::UNSIGNED) {
+    arg.u32 = static_cast<uint32_t>(value);
+  } else if constexpr (type == ArgType::SIGNED64) {
+    arg.s64 = static_cast<int64_t>(value);
+  } else if constexpr (type == ArgType::UNSIGNED64) {
+    arg.u64 = static_cast<uint64_t>(value);
+  }
+  return arg;
+}
+
+/**
+ * Checks every argument can be printed with its placeholder
+ * @tparam F the parsed format
+ * @tparam Args the argument types
+ * @return true if the arguments match
+ */
+template <typename F, typename... Args>
+constexpr bool checkArgs() {
+  constexpr ArgType types[] = {getArgType<std::decay_t<Args>>()...,
+                               ArgType::NONE};
+  size_t arg = 0;
+  for (const Segment &segment : F::SEGMENTS) {
+    if (!segment.hasArg) {
+      continue;
+    }
+    ArgType type = types[arg++];
+    if (type == ArgType::NONE) {
+      return false;
+    }
+    bool isInteger = type != ArgType::CHAR && type != ArgType::STRING;
+    if ((segment.spec.base != 10 || segment.spec.zeroPad) && !isInteger) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Writes formatted text to a UART.  Use APMUart::print() instead of calling
+ * this directly.
+ * @param uart the UART to write to
+ * @param text the format string
+ * @param segments the parsed segments of the string
+ * @param numSegments the number of segments
+ * @param args the arguments, one per placeholder
+ */
+void write(EVT::core::IO::UART &uart, const char *text,
+           const Segment *segments, size_t numSegments, const Arg *args);
+
+/**
+ * Checks the arguments against a format at compile time and writes the text
+ * @param uart the UART to write to
+ * @param format the format, created with APM_FORMAT
+ * @param args the arguments
+ */
+template <typename Text, typename... Args>
+void write(EVT::core::IO::UART &uart, Format<Text> format,
+           const Args &...args) {
+  using F = Format<Text>;
+  static_assert(F::RESULT.numArgs == sizeof...(Args),
+                "Number of arguments does not match the format string");
+  static_assert(checkArgs<F, Args...>(),
+                "Argument cannot be printed with its placeholder");
+
+  // One extra entry so the array is never empty
+  const Arg argArray[sizeof...(Args) + 1] = {makeArg(args)...};
+  write(uart, F::TEXT, F::SEGMENTS.data(), F::SEGMENTS.size(), argArray);
+}
+
+} // namespace APM::format
+
+/**
+ * Creates a format from a string literal, parsed at compile time
+ */
+#define APM_FORMAT(text)                                                       \
+  [] {                                                                         \
+    struct Text {                                                              \
+      static constexpr const char *get() { return text; }                      \
+    };                                                                         \
+    return APM::format::Format<Text>();                                        \
+  }()
+
+#endif // APM_UTILS_FORMAT_HPP
@@ -0,0 +1,20 @@
+/**
+ * Storage class for the globals that tie interrupt handlers to the firmware
+ * objects of a board.
+ *
+ * On the target there is one board, so these are plain globals.  The host
+ * simulation (APM_HOST_SIMULATION) runs one simulated board per thread, so
+ * each thread gets its own copy and boards on different threads never see
+ * each other's objects.
+ */
+
+#ifndef APM_UTILS_GLOBALS_HPP
+#define APM_UTILS_GLOBALS_HPP
+
+#ifdef APM_HOST_SIMULATION
+#define APM_BOARD_LOCAL thread_local
+#else
+#define APM_BOARD_LOCAL
+#endif
+
+#endif // APM_UTILS_GLOBALS_HPP
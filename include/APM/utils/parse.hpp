@@ -0,0 +1,22 @@
+/**
+ * Helpers for parsing the arguments of console commands
+ */
+
+#ifndef APM_UTILS_PARSE_HPP
+#define APM_UTILS_PARSE_HPP
+
+#include <cstdint>
+
+namespace APM::parse {
+
+/**
+ * Parses a decimal number
+ * @param text the digits, ending at a null
+ * @param value set to the number
+ * @return true if text held a number that fits in 32 bits
+ */
+bool toUnsigned(const char *text, uint32_t &value);
+
+} // namespace APM::parse
+
+#endif // APM_UTILS_PARSE_HPP
@@ -0,0 +1,54 @@
+/**
+ * Helpers for reaching the GPIO port registers behind an EVT-core pin, for
+ * code that reads or writes several pins of a port in a single access
+ */
+
+#ifndef APM_UTILS_PINS_HPP
+#define APM_UTILS_PINS_HPP
+
+#include <EVT/io/pin.hpp>
+#include <HALf3/stm32f3xx.h>
+#include <cstdint>
+
+namespace APM::pins {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * Returns the GPIO port index of a pin.  EVT-core stores the port in the upper
+ * nibble of IO::Pin and the pin number in the lower nibble.
+ * @param pin the pin to decode
+ * @return 0 for port A, 1 for port B, etc.
+ */
+constexpr uint8_t getPort(IO::Pin pin) {
+  return static_cast<uint8_t>(pin) >> 4;
+}
+
+/**
+ * Returns the bit of a pin within its GPIO port registers
+ * @param pin the pin to decode
+ * @return the single bit mask for the pin
+ */
+constexpr uint32_t getMask(IO::Pin pin) {
+  return 1u << (static_cast<uint8_t>(pin) & 0x0F);
+}
+
+/**
+ * Returns the registers of the port a pin is on
+ * @param pin the pin
+ * @return GPIOA, GPIOB or GPIOC
+ */
+inline GPIO_TypeDef *getRegisters(IO::Pin pin) {
+  switch (getPort(pin)) {
+  case 0:
+    return GPIOA;
+  case 1:
+    return GPIOB;
+  default:
+    return GPIOC;
+  }
+}
+
+} // namespace APM::pins
+
+#endif // APM_UTILS_PINS_HPP
@@ -0,0 +1,37 @@
+/**
+ * Stack high-water measurement by painting.  The free RAM between the end of
+ * .bss and the stack is filled with a known pattern at start up, and the
+ * deepest point the stack reached is found later by looking for the first
+ * word that was overwritten.  Interrupt handlers share the main stack, so the
+ * measurement includes their usage.
+ */
+
+#ifndef APM_UTILS_STACK_HPP
+#define APM_UTILS_STACK_HPP
+
+#include <cstdint>
+
+namespace APM::stack {
+
+/**
+ * Fills the unused stack with the paint pattern.  Must be called once, as
+ * early in main() as possible.
+ */
+void paint();
+
+/**
+ * Returns the most stack used since paint() was called
+ * @return the high-water mark in bytes
+ */
+uint32_t getHighWater();
+
+/**
+ * Returns the RAM available to the stack, from the end of .bss to the top of
+ * RAM
+ * @return the size in bytes
+ */
+uint32_t getSize();
+
+} // namespace APM::stack
+
+#endif // APM_UTILS_STACK_HPP
@@ -3,16 +3,29 @@
  */
 
 #include <APM/APMManager.hpp>
+#include <APM/Config.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/LoadMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Profile.hpp>
+#include <APM/SwitchMonitor.hpp>
+#include <APM/Trace.hpp>
+#include <APM/WarmStart.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/globals.hpp>
+#include <APM/utils/pins.hpp>
 #include <EVT/io/GPIO.hpp>
-#include <EVT/utils/time.hpp>
 
-APM::APMManager *apmManagerPtr1 = nullptr;
+APM_BOARD_LOCAL APM::APMManager *apmManagerPtr1 = nullptr;
 
 /**
  * Handler for timer to poll the SIM100 board to check for isolation faults
  * @param htim pointer to the timer device struct
  */
 void sim100IsolationCheckIRQHandler(void *htim) {
+  APM::load::ScopedInterrupt loadScope(APM::LoadContext::GFD_TIMER);
+  APM_PROFILE_SPAN(GFD_POLL);
+  APM::trace::recordTimer(APM::TraceTimer::GFD_POLL);
   if (!apmManagerPtr1->isIsolationChecking()) {
     // Do not perform GFD Checking
     return;
@@ -24,10 +37,11 @@ void sim100IsolationCheckIRQHandler(void *htim) {
     timer.stopTimer();
     return;
   }
-  auto sim100State = apmManagerPtr1->getSim100().getIsolationState();
+  auto sim100State = apmManagerPtr1->getGFDVoter().poll();
+  uint32_t detected = APM::cycles::now();
   if (sim100State != APM::DEV::SIM100::IsolationStateResponse::NoError) {
-    apmManagerPtr1->getApmUart().printDebugString("SIM100 Error Occurred\n\r");
-    apmManagerPtr1->onToAccessoryMode();
+    apmManagerPtr1->tripToAccessoryMode(sim100State, detected);
+    return;
   }
   apmManagerPtr1->getApmUart().printDebugString("SIM100 No Error\n\r");
 }
@@ -35,27 +49,59 @@ void sim100IsolationCheckIRQHandler(void *htim) {
 /**
  * Method to trigger an interrupt once sufficient time has passed for the SIM100
  * GFD to start up. Will update the timer to poll the SIM100 for isolation
- * faults using update rate APMManager.SIM100_POLLING_PERIOD
+ * faults using the configured sim100_polling_period
  * @param htim Pointer to the timer struct for which the interrupt was
  * triggered.
  */
 void sim100StartupTimerIRQHandler(void *htim) {
+  APM::load::ScopedInterrupt loadScope(APM::LoadContext::GFD_TIMER);
+  APM::trace::recordTimer(APM::TraceTimer::GFD_STARTUP);
   // Start the SIM100 polling check
   auto &timer = apmManagerPtr1->getGFDTimer();
   timer.stopTimer();
-  timer.setPeriod(APM::APMManager::SIM100_POLLING_PERIOD);
+  timer.setPeriod(APM::config::get().sim100PollingPeriod);
   timer.startTimer(sim100IsolationCheckIRQHandler);
+  apmManagerPtr1->setGFDReady();
 }
 
 namespace APM {
 
-APMManager::APMManager(APMUart &apmUart, DEV::SIM100 &sim100,
+namespace {
+
+static_assert(pins::getPort(APMManager::ACCESSORY_SW) == 0 &&
+                  pins::getPort(APMManager::CHARGE_SW) == 0 &&
+                  pins::getPort(APMManager::VICOR_SW) == 0 &&
+                  pins::getPort(APMManager::MC_ON) == 0,
+              "Trip path expects all power switches on GPIOA");
+static_assert(pins::getPort(APMManager::ACCESSORY_INDICATOR) == 1 &&
+                  pins::getPort(APMManager::ON_INDICATOR) == 1,
+              "Trip path expects both indicators on GPIOB");
+
+// First trip write: close ACCESSORY_SW and open CHARGE_SW so the electronics
+// are on the backup battery before pack power is removed
+constexpr uint32_t TRIP_BATTERY_BSRR =
+    pins::getMask(APMManager::ACCESSORY_SW) |
+    (pins::getMask(APMManager::CHARGE_SW) << 16);
+
+// Second trip write: open VICOR_SW and drop the MC relay
+constexpr uint32_t TRIP_PACK_BSRR =
+    (pins::getMask(APMManager::VICOR_SW) | pins::getMask(APMManager::MC_ON))
+    << 16;
+
+// Indicator write: ACCESSORY LED on, ON LED off
+constexpr uint32_t TRIP_INDICATOR_BSRR =
+    pins::getMask(APMManager::ACCESSORY_INDICATOR) |
+    (pins::getMask(APMManager::ON_INDICATOR) << 16);
+
+} // namespace
+
+APMManager::APMManager(APMUart &apmUart, GFDVoter &gfdVoter,
                        IO::GPIO &accessorySwGpio, IO::GPIO &chargeSwGpio,
                        IO::GPIO &vicorSwGpio,
                        EVT::core::DEV::Timerf302x8 &gfdTimer,
                        IO::GPIO &accessoryLed, IO::GPIO &onLed,
                        IO::GPIO &mcRelayGpio)
-    : apmUart(apmUart), sim100(sim100), mc_relay_GPIO(mcRelayGpio),
+    : apmUart(apmUart), gfdVoter(gfdVoter), mc_relay_GPIO(mcRelayGpio),
       accessorySW_GPIO(accessorySwGpio), chargeSW_GPIO(chargeSwGpio),
       vicorSW_GPIO(vicorSwGpio), accessory_LED(accessoryLed), on_LED(onLed),
       gfdTimer(gfdTimer) {
@@ -64,12 +110,16 @@ APMManager::APMManager(APMUart &apmUart, DEV::SIM100 &sim100,
 
 int APMManager::offToAccessoryMode() {
   apmUart.printDebugString("Transitioning from OFF -> ACCESSORY\n\r");
-  accessorySW_GPIO.writePin(IO::GPIO::State::HIGH);
+  writeOutput(accessorySW_GPIO, ACCESSORY_SW, IO::GPIO::State::HIGH);
   // TODO: Send Accessory Mode CAN Message and start sending on timer
   // (interrupt)
   currentMode = APMMode::ACCESSORY;
-  accessory_LED.writePin(EVT::core::IO::GPIO::State::HIGH);
-  on_LED.writePin(EVT::core::IO::GPIO::State::LOW);
+  metrics::set(metrics::Metric::MODE, static_cast<uint32_t>(currentMode));
+  writeOutput(accessory_LED, ACCESSORY_INDICATOR, IO::GPIO::State::HIGH);
+  writeOutput(on_LED, ON_INDICATOR, IO::GPIO::State::LOW);
+
+  restarts = 0;
+  saveSnapshot();
 
   apmUart.printDebugString("Accessory_SW Closed\n\r");
   apmUart.printDebugString("Entered Accessory Mode\n\r");
@@ -79,73 +129,144 @@ int APMManager::offToAccessoryMode() {
 }
 
 int APMManager::accessoryToOnMode() {
-  mc_relay_GPIO.writePin(EVT::core::IO::GPIO::State::HIGH);
+  APM_PROFILE_SPAN(ACCESSORY_TO_ON);
+  writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::HIGH);
   apmUart.printDebugString("Providing Power to MC\n\r");
 
+  // The other boards get ready for ON while the MC precharges
+  startHandshake(APMMode::ON);
+
   // Wait for MC to provide high voltage to APM
   // Precharging and closing main contactors
-  EVT::core::time::wait(
-      6000); // MC charges in < 3s according to L.G.  So double time
-
-  // TODO: Implement more robust check for high voltage
-  // Asked APM Electrical team to add either voltage sensing IC or optocoupler
-  // to step down high voltage to give APM feedback on high voltage status. Also
-  // could use MC CAN message once motor controller choice is finalized.
+  if (waitForPrecharge() != 0) {
+    apmUart.printString("WARN: Precharge failed, staying in ACCESSORY\n\r");
+    cancelOnMode();
+    return 1;
+  }
 
   apmUart.printDebugString("Transitioning from ACCESSORY -> ON\n\r");
-  vicorSW_GPIO.writePin(IO::GPIO::State::HIGH);
+  writeOutput(vicorSW_GPIO, VICOR_SW, IO::GPIO::State::HIGH);
   apmUart.printDebugString("Vicor_SW Closed\n\r");
-  accessorySW_GPIO.writePin(IO::GPIO::State::LOW);
+
+  // The electronics lose power if ACCESSORY_SW opens without VICOR_SW closed
+  if (verifySwitches(OUTPUT_MC_ON | OUTPUT_VICOR_SW) != 0) {
+    apmUart.printString("WARN: Pack switches did not close, staying in "
+                        "ACCESSORY\n\r");
+    cancelOnMode();
+    return 1;
+  }
+
+  writeOutput(accessorySW_GPIO, ACCESSORY_SW, IO::GPIO::State::LOW);
   apmUart.printDebugString("Accessory_SW Opened\n\r");
-  chargeSW_GPIO.writePin(IO::GPIO::State::HIGH);
+  static_cast<void>(verifySwitches(OUTPUT_ACCESSORY_SW));
+  setCharging(true);
   apmUart.printDebugString("Charge_SW Closed\n\r");
 
   // TODO: Send CAN Message for ON Mode on timer
 
+  // Collected before the GFD set up, which also reads the CAN queue
+  finishHandshake();
+
   currentMode = APMMode::ON;
-  accessory_LED.writePin(EVT::core::IO::GPIO::State::LOW);
-  on_LED.writePin(EVT::core::IO::GPIO::State::HIGH);
+  metrics::increment(metrics::Metric::ACCESSORY_TO_ON);
+  metrics::set(metrics::Metric::MODE, static_cast<uint32_t>(currentMode));
+  writeOutput(accessory_LED, ACCESSORY_INDICATOR, IO::GPIO::State::LOW);
+  writeOutput(on_LED, ON_INDICATOR, IO::GPIO::State::HIGH);
 
   apmUart.printDebugString("Entered On Mode\n\r");
   apmUart.printDebugString("---------------------------------------------\n\r");
 
   // Set up GFD with interrupts.
-  if (isIsolationChecking()) {
-    sim100.restartSIM100();
-    EVT::core::time::wait(100); // TODO: Remove once CAN Open support is added.
-    sim100.setMaxWorkingVoltage(DEV::SIM100::DEV1_MAX_BATTERY_VOLTAGE);
-    this->gfdTimer.setPeriod(SIM100_STARTUP_PERIOD);
-    this->gfdTimer.startTimer(sim100StartupTimerIRQHandler);
-  } else {
-    this->gfdTimer.stopTimer(); // Stop timer just in case it is already running
+  lastIsolation = DEV::SIM100::IsolationStateResponse::NoError;
+  restarts = 0;
+  startIsolationChecking(false);
+
+  return 0;
+}
+
+int APMManager::resumeOnMode(const warm::Snapshot &snapshot) {
+  constexpr uint8_t ON_SWITCHES = warm::SWITCH_VICOR | warm::SWITCH_MC;
+  if (snapshot.mode != static_cast<uint8_t>(APMMode::ON) ||
+      (snapshot.switches & ON_SWITCHES) != ON_SWITCHES ||
+      snapshot.isolation != static_cast<uint8_t>(
+                                DEV::SIM100::IsolationStateResponse::NoError) ||
+      snapshot.restarts >= warm::MAX_RESTARTS) {
+    return 1;
+  }
+
+  // Same order as accessoryToOnMode.  The reset may have taken long enough
+  // for the bus to discharge, so the full precharge wait is kept.  HV sensing
+  // ends it early when the bus is still charged.
+  writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::HIGH);
+  if (waitForPrecharge() != 0) {
+    writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::LOW);
+    return 1;
+  }
+  writeOutput(vicorSW_GPIO, VICOR_SW, IO::GPIO::State::HIGH);
+  if (verifySwitches(OUTPUT_MC_ON | OUTPUT_VICOR_SW) != 0) {
+    writeOutput(vicorSW_GPIO, VICOR_SW, IO::GPIO::State::LOW);
+    writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::LOW);
+    return 1;
   }
+  writeOutput(accessorySW_GPIO, ACCESSORY_SW, IO::GPIO::State::LOW);
+  setCharging(true);
+
+  currentMode = APMMode::ON;
+  metrics::set(metrics::Metric::MODE, static_cast<uint32_t>(currentMode));
+  writeOutput(accessory_LED, ACCESSORY_INDICATOR, IO::GPIO::State::LOW);
+  writeOutput(on_LED, ON_INDICATOR, IO::GPIO::State::HIGH);
+
+  // The SIM100 units were not reset with the APM, so they only need their
+  // start up period again if they had not finished it
+  checkGFDIsolationState = snapshot.gfdChecking != 0;
+  lastIsolation = DEV::SIM100::IsolationStateResponse::NoError;
+  restarts = snapshot.restarts + 1;
+  startIsolationChecking(snapshot.gfdReady != 0);
 
   return 0;
 }
 
 int APMManager::onToAccessoryMode() {
+  APM_PROFILE_SPAN(ON_TO_ACCESSORY);
   // Turn off GFD Isolation Check
   this->gfdTimer.stopTimer();
 
-  // TODO: Send Accessory Mode CAN Message
   // Alerts other boards to begin transition to accessory mode
+  startHandshake(APMMode::ACCESSORY);
 
-  chargeSW_GPIO.writePin(IO::GPIO::State::LOW);
+  setCharging(false);
   apmUart.printDebugString("Charge_SW opened\n\r");
-  accessorySW_GPIO.writePin(IO::GPIO::State::HIGH);
+  writeOutput(accessorySW_GPIO, ACCESSORY_SW, IO::GPIO::State::HIGH);
   apmUart.printDebugString("Accessory_SW closed\n\r");
-  vicorSW_GPIO.writePin(IO::GPIO::State::LOW);
-  apmUart.printDebugString("Vicor_SW opened\n\r");
 
-  mc_relay_GPIO.writePin(EVT::core::IO::GPIO::State::LOW);
+  // Without ACCESSORY_SW the electronics would lose power with VICOR_SW, so
+  // they stay on the pack.  The MC is disconnected either way.
+  uint8_t opened = OUTPUT_MC_ON;
+  if (verifySwitches(OUTPUT_ACCESSORY_SW) == 0) {
+    writeOutput(vicorSW_GPIO, VICOR_SW, IO::GPIO::State::LOW);
+    apmUart.printDebugString("Vicor_SW opened\n\r");
+    opened |= OUTPUT_VICOR_SW;
+  } else {
+    apmUart.printString("WARN: Accessory_SW did not close, leaving Vicor_SW "
+                        "closed\n\r");
+  }
+
+  writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::LOW);
   apmUart.printDebugString("Closing MC Relay\n\r");
+  static_cast<void>(verifySwitches(opened));
 
-  // TODO: Wait for CAN handshakes to verify all other boards
-  // have returned to accessory mode
+  // Verify all other boards have returned to accessory mode
+  finishHandshake();
 
   currentMode = APMMode::ACCESSORY;
-  accessory_LED.writePin(EVT::core::IO::GPIO::State::HIGH);
-  on_LED.writePin(EVT::core::IO::GPIO::State::LOW);
+  metrics::increment(metrics::Metric::ON_TO_ACCESSORY);
+  metrics::set(metrics::Metric::MODE, static_cast<uint32_t>(currentMode));
+  writeOutput(accessory_LED, ACCESSORY_INDICATOR, IO::GPIO::State::HIGH);
+  writeOutput(on_LED, ON_INDICATOR, IO::GPIO::State::LOW);
+
+  gfdReady = false;
+  restarts = 0;
+  saveSnapshot();
 
   // TODO: Enable Accessory Mode Message on Timer
 
@@ -155,11 +276,170 @@ int APMManager::onToAccessoryMode() {
   return 0;
 }
 
+int APMManager::tripToAccessoryMode(DEV::SIM100::IsolationStateResponse reason,
+                                    uint32_t detected) {
+  APM_PROFILE_SPAN(TRIP_TO_ACCESSORY);
+  // BSRR writes are atomic, so every switch in a group changes on the same bus
+  // cycle and no read-modify-write can race with other GPIO users.  The trip
+  // can come from the main loop, so interrupts are held off until the charge
+  // control loop is stopped and its timer cannot close CHARGE_SW again.
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  GPIOA->BSRR = TRIP_BATTERY_BSRR;
+  GPIOA->BSRR = TRIP_PACK_BSRR;
+  uint32_t outputsSafe = cycles::now();
+  if (chargeController != nullptr) {
+    chargeController->setCharging(false);
+  }
+  __set_PRIMASK(primask);
+
+  this->gfdTimer.stopTimer();
+  GPIOB->BSRR = TRIP_INDICATOR_BSRR;
+  currentMode = APMMode::ACCESSORY;
+
+  // A reset from here on must not resume ON
+  gfdReady = false;
+  lastIsolation = reason;
+  restarts = 0;
+  saveSnapshot();
+  uint32_t bookkeepingDone = cycles::now();
+
+  trace::recordPortWrite(0, TRIP_BATTERY_BSRR);
+  trace::recordPortWrite(0, TRIP_PACK_BSRR);
+  trace::recordPortWrite(1, TRIP_INDICATOR_BSRR);
+
+  lastTrip.reason = reason;
+  lastTrip.detected = detected;
+  lastTrip.outputsSafe = outputsSafe;
+  lastTrip.bookkeepingDone = bookkeepingDone;
+  lastTrip.count++;
+  metrics::increment(metrics::Metric::GFD_TRIPS);
+  metrics::set(metrics::Metric::MODE, static_cast<uint32_t>(currentMode));
+
+  // Tell the other boards without waiting for them.  Their acknowledgements
+  // are ignored, since the next handshake uses a new sequence number.
+  startHandshake(APMMode::ACCESSORY);
+
+  // Hardware is safe, logging can take as long as it needs
+  apmUart.printDebugString("SIM100 Error Occurred\n\r");
+  apmUart.printDebugString("Charge_SW opened\n\r");
+  apmUart.printDebugString("Accessory_SW closed\n\r");
+  apmUart.printDebugString("Vicor_SW opened\n\r");
+  apmUart.printDebugString("Opening MC Relay\n\r");
+  apmUart.printDebugString("Entered Accessory Mode\n\r");
+  apmUart.printDebugString("---------------------------------------------\n\r");
+  lastTrip.loggingDone = cycles::now();
+
+  return 0;
+}
+
+bool APMManager::handleKeyEvent(const KeyEvent &event) {
+  switch (event.type) {
+  case KeyEvent::Type::PRESS:
+    apmUart.printDebugString("Key turned on\n\r");
+    if (currentMode == APMMode::ACCESSORY) {
+      accessoryToOnMode();
+      return true;
+    }
+    apmUart.printString(
+        "WARN: On button pressed while bike was not in ACCESSORY mode\n\r");
+    break;
+  case KeyEvent::Type::RELEASE:
+    apmUart.printDebugString("Key turned off\n\r");
+    if (currentMode == APMMode::ON) {
+      onToAccessoryMode();
+      return true;
+    }
+    break;
+  case KeyEvent::Type::HOLD:
+    apmUart.printDebugString("Key held\n\r");
+    break;
+  }
+
+  return false;
+}
+
+void APMManager::checkSwitches() {
+  if (switchMonitor == nullptr) {
+    return;
+  }
+
+  uint8_t faults = switchMonitor->check();
+  if (faults == 0) {
+    return;
+  }
+  reportSwitchFaults(faults);
+
+  // The bike cannot stay ON without pack power.  Closing ACCESSORY_SW keeps
+  // the electronics powered.
+  constexpr uint8_t PACK_SWITCHES = OUTPUT_MC_ON | OUTPUT_VICOR_SW;
+  if (currentMode == APMMode::ON &&
+      (faults & switchMonitor->getStuckOpen() & PACK_SWITCHES) != 0) {
+    apmUart.printString("WARN: Lost pack power, switching to ACCESSORY\n\r");
+    onToAccessoryMode();
+  }
+}
+
+const TripRecord &APMManager::getLastTrip() const { return lastTrip; }
+
+void APMManager::printLastTrip() const {
+  if (lastTrip.count == 0) {
+    apmUart.printString("No GFD trips recorded\n\r");
+    return;
+  }
+
+  apmUart.print(APM_FORMAT("GFD trips: {}, last reason: {}\n\r"),
+                lastTrip.count, lastTrip.reason);
+  apmUart.print(APM_FORMAT("\tFault -> outputs safe: {} us\n\r"),
+                cycles::toMicros(lastTrip.outputsSafe - lastTrip.detected));
+  apmUart.print(
+      APM_FORMAT("\tOutputs safe -> mode updated: {} us\n\r"),
+      cycles::toMicros(lastTrip.bookkeepingDone - lastTrip.outputsSafe));
+  apmUart.print(
+      APM_FORMAT("\tMode updated -> logging done: {} us\n\r"),
+      cycles::toMicros(lastTrip.loggingDone - lastTrip.bookkeepingDone));
+}
+
 APMUart &APMManager::getApmUart() const { return apmUart; }
 
 APMMode APMManager::getCurrentMode() const { return currentMode; }
 
-DEV::SIM100 &APMManager::getSim100() const { return sim100; }
+uint8_t APMManager::getOutputs() const {
+  struct Output {
+    IO::GPIO &gpio;
+    uint8_t bit;
+  };
+  const Output outputs[] = {
+      {mc_relay_GPIO, OUTPUT_MC_ON},
+      {accessorySW_GPIO, OUTPUT_ACCESSORY_SW},
+      {chargeSW_GPIO, OUTPUT_CHARGE_SW},
+      {vicorSW_GPIO, OUTPUT_VICOR_SW},
+      {accessory_LED, OUTPUT_ACCESSORY_INDICATOR},
+      {on_LED, OUTPUT_ON_INDICATOR},
+  };
+
+  uint8_t levels = 0;
+  for (const Output &output : outputs) {
+    if (output.gpio.readPin() == IO::GPIO::State::HIGH) {
+      levels |= output.bit;
+    }
+  }
+  return levels;
+}
+
+const char *getName(APMMode mode) {
+  switch (mode) {
+  case APMMode::OFF:
+    return "OFF";
+  case APMMode::ACCESSORY:
+    return "ACCESSORY";
+  case APMMode::ON:
+    return "ON";
+  }
+  return "unknown";
+}
+
+GFDVoter &APMManager::getGFDVoter() const { return gfdVoter; }
 
 EVT::core::DEV::Timer &APMManager::getGFDTimer() const { return gfdTimer; }
 
@@ -169,6 +449,169 @@ bool APMManager::isIsolationChecking() const {
 
 void APMManager::setCheckGFDIsolationState(bool state) {
   this->checkGFDIsolationState = state;
+  saveSnapshot();
+}
+
+bool APMManager::isGFDReady() const { return gfdReady; }
+
+void APMManager::setGFDReady() {
+  gfdReady = true;
+  saveSnapshot();
+}
+
+void APMManager::startIsolationChecking(bool ready) {
+  if (!isIsolationChecking()) {
+    this->gfdTimer.stopTimer(); // Stop timer just in case it is already running
+    gfdReady = false;
+    saveSnapshot();
+    return;
+  }
+
+  if (ready) {
+    gfdReady = true;
+    saveSnapshot();
+    this->gfdTimer.setPeriod(config::get().sim100PollingPeriod);
+    this->gfdTimer.startTimer(sim100IsolationCheckIRQHandler);
+    return;
+  }
+
+  gfdReady = false;
+  saveSnapshot();
+  gfdVoter.restartAll();
+  supervisor::wait(100); // TODO: Remove once CAN Open support is added.
+  gfdVoter.setMaxWorkingVoltage(
+      static_cast<uint16_t>(config::get().maxBatteryVoltage));
+  this->gfdTimer.setPeriod(config::get().sim100StartupPeriod);
+  this->gfdTimer.startTimer(sim100StartupTimerIRQHandler);
+}
+
+void APMManager::saveSnapshot() {
+  uint32_t outputs = GPIOA->ODR;
+  warm::Snapshot snapshot = {};
+  snapshot.mode = static_cast<uint8_t>(currentMode);
+  snapshot.switches =
+      ((outputs & pins::getMask(ACCESSORY_SW)) != 0 ? warm::SWITCH_ACCESSORY
+                                                     : 0) |
+      ((outputs & pins::getMask(CHARGE_SW)) != 0 ? warm::SWITCH_CHARGE : 0) |
+      ((outputs & pins::getMask(VICOR_SW)) != 0 ? warm::SWITCH_VICOR : 0) |
+      ((outputs & pins::getMask(MC_ON)) != 0 ? warm::SWITCH_MC : 0);
+  snapshot.gfdReady = gfdReady;
+  snapshot.gfdChecking = checkGFDIsolationState;
+  snapshot.isolation = static_cast<uint8_t>(lastIsolation);
+  snapshot.restarts = restarts;
+  warm::save(snapshot);
+}
+
+void APMManager::setHandshake(Handshake *newHandshake) {
+  handshake = newHandshake;
+}
+
+void APMManager::startHandshake(APMMode mode) {
+  if (handshake == nullptr) {
+    return;
+  }
+  if (handshake->start(static_cast<uint8_t>(mode),
+                       config::get().handshakeNodes) != 0) {
+    apmUart.printDebugString("Failed to send mode transition request\n\r");
+  }
+}
+
+void APMManager::finishHandshake() {
+  if (handshake == nullptr) {
+    return;
+  }
+  if (handshake->wait(config::get().handshakeTimeout) != 0) {
+    apmUart.print(APM_FORMAT("WARN: Boards {08X} did not acknowledge the "
+                             "transition\n\r"),
+                  handshake->getExpectedNodes() & ~handshake->getAckedNodes());
+  }
+}
+
+void APMManager::setChargeController(ChargeController *controller) {
+  chargeController = controller;
+}
+
+void APMManager::setCharging(bool allowed) {
+  if (chargeController != nullptr) {
+    chargeController->setCharging(allowed);
+    return;
+  }
+  writeOutput(chargeSW_GPIO, CHARGE_SW,
+              allowed ? IO::GPIO::State::HIGH : IO::GPIO::State::LOW);
+}
+
+void APMManager::setPrechargeMonitor(PrechargeMonitor *monitor) {
+  prechargeMonitor = monitor;
+}
+
+void APMManager::setSwitchMonitor(SwitchMonitor *monitor) {
+  switchMonitor = monitor;
+}
+
+int APMManager::waitForPrecharge() {
+  const config::Config &settings = config::get();
+
+  // TODO: Use the MC CAN status as well once the motor controller choice is
+  // finalized
+  if (prechargeMonitor == nullptr) {
+    supervisor::wait(settings.prechargeTime);
+    return 0;
+  }
+
+  if (prechargeMonitor->wait(settings.prechargePercent,
+                             settings.prechargeTime) != 0) {
+    metrics::increment(metrics::Metric::PRECHARGE_TIMEOUTS);
+    apmUart.print(APM_FORMAT("WARN: Precharge not seen after {} ms, bus {} "
+                             "of pack {}\n\r"),
+                  settings.prechargeTime, prechargeMonitor->getBusReading(),
+                  prechargeMonitor->getPackReading());
+    return 1;
+  }
+
+  metrics::set(metrics::Metric::PRECHARGE_TIME,
+               prechargeMonitor->getDuration());
+  apmUart.printDebug(APM_FORMAT("Precharged in {} ms\n\r"),
+                     prechargeMonitor->getDuration());
+  return 0;
+}
+
+void APMManager::cancelOnMode() {
+  writeOutput(vicorSW_GPIO, VICOR_SW, IO::GPIO::State::LOW);
+  writeOutput(mc_relay_GPIO, MC_ON, IO::GPIO::State::LOW);
+  static_cast<void>(verifySwitches(OUTPUT_MC_ON | OUTPUT_VICOR_SW));
+
+  // The other boards were told to go ON.  Their acknowledgements are ignored,
+  // since this handshake uses a new sequence number.
+  startHandshake(APMMode::ACCESSORY);
+  finishHandshake();
+}
+
+int APMManager::verifySwitches(uint8_t switches) {
+  if (switchMonitor == nullptr || switchMonitor->verify(switches) == 0) {
+    return 0;
+  }
+  reportSwitchFaults(switches);
+  return 1;
+}
+
+void APMManager::reportSwitchFaults(uint8_t switches) {
+  uint8_t welded = switchMonitor->getWelded() & switches;
+  uint8_t stuckOpen = switchMonitor->getStuckOpen() & switches;
+  for (uint8_t bit = 1; bit <= SwitchMonitor::SWITCHES; bit <<= 1) {
+    if ((welded & bit) != 0) {
+      apmUart.print(APM_FORMAT("WARN: {} switch welded closed\n\r"),
+                    getSwitchName(bit));
+    } else if ((stuckOpen & bit) != 0) {
+      apmUart.print(APM_FORMAT("WARN: {} switch stuck open\n\r"),
+                    getSwitchName(bit));
+    }
+  }
+}
+
+void APMManager::writeOutput(IO::GPIO &gpio, IO::Pin pin,
+                             IO::GPIO::State state) {
+  gpio.writePin(state);
+  trace::recordOutput(pin, state == IO::GPIO::State::HIGH);
 }
 
 } // namespace APM
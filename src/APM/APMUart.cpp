@@ -11,38 +11,61 @@ APMUart::APMUart(IO::UART *apmUart, bool apmDebugPrint) {
   this->apmDebugPrint = apmDebugPrint;
 }
 
+namespace {
+
+// Escape sequence for minicom terminal to clear display
+constexpr char MINICOM_CLEAR_DISPLAY[] = "\x1B\x5B\x32\x4A";
+
+// Lines of the startup banner, printed one per call by printStartupLine()
 // clang-format off
+const char *const STARTUP_LINES[] = {
+    MINICOM_CLEAR_DISPLAY,
+    "\n\r",
+    "                       @@@@@@@@@@@@@@@@@@@@@@@@@@                      @@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n\r",
+    "                      @@@@@@@@@@@@@@@@@@@@@@@@@@                     @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@ \n\r",
+    "                    (@@@@@@                                                     @@@@@@              \n\r",
+    "        ////       @@@@@@                                                      @@@@@@               \n\r",
+    "      //*//       @@@@@@                                                      @@@@@@                \n\r",
+    "  ////////////   @@@@@@@@@@@@@@@@@@   //////////*//         ////*/////////   @@@@@@   ./////////*/  \n\r",
+    "    ////*       @@@@@@                         /*///      //////            @@@@@@                  \n\r",
+    "   ////        @@@@@@                          /*///   //////             @@@@@@                    \n\r",
+    "              @@@@@@                           /*/*/ /*/*/*              @@@@@@                     \n\r",
+    "            @@@@@@@@@@@@@@@@@@@@@@@@@@@         *///////                @@@@@@                      \n\r",
+    "           @@@@@@@@@@@@@@@@@@@@@@@@@@@          */////                 @@@@@@                       \n\r",
+    "\nDEV1 APMManager Initializing...\n\n\r",
+};
+// clang-format on
+
+constexpr size_t NUM_STARTUP_LINES =
+    sizeof(STARTUP_LINES) / sizeof(STARTUP_LINES[0]);
+
+} // namespace
+
 void APMUart::startupMessage() const {
-    apmUart->printf("%s\n\r", MINICOM_CLEAR_DISPLAY);    // Escape sequence for minicom terminal to clear display
-
-    apmUart->printf("                       @@@@@@@@@@@@@@@@@@@@@@@@@@                      @@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n\r");
-    apmUart->printf("                      @@@@@@@@@@@@@@@@@@@@@@@@@@                     @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@ \n\r");
-    apmUart->printf("                    (@@@@@@                                                     @@@@@@              \n\r");
-    apmUart->printf("        ////       @@@@@@                                                      @@@@@@               \n\r");
-    apmUart->printf("      //*//       @@@@@@                                                      @@@@@@                \n\r");
-    apmUart->printf("  ////////////   @@@@@@@@@@@@@@@@@@   //////////*//         ////*/////////   @@@@@@   ./////////*/  \n\r");
-    apmUart->printf("    ////*       @@@@@@                         /*///      //////            @@@@@@                  \n\r");
-    apmUart->printf("   ////        @@@@@@                          /*///   //////             @@@@@@                    \n\r");
-    apmUart->printf("              @@@@@@                           /*/*/ /*/*/*              @@@@@@                     \n\r");
-    apmUart->printf("            @@@@@@@@@@@@@@@@@@@@@@@@@@@         *///////                @@@@@@                      \n\r");
-    apmUart->printf("           @@@@@@@@@@@@@@@@@@@@@@@@@@@          */////                 @@@@@@                       \n\r");
-
-    apmUart->printf("\nDEV1 APMManager Initializing...\n\n\r");
+  for (const char *line : STARTUP_LINES) {
+    apmUart->puts(line);
+  }
+}
+
+bool APMUart::printStartupLine() {
+  if (startupLine < NUM_STARTUP_LINES) {
+    apmUart->puts(STARTUP_LINES[startupLine++]);
+  }
+  return startupLine >= NUM_STARTUP_LINES;
 }
-// clang-format on
 
 void APMUart::setDebugPrint(bool debugPrint) { apmDebugPrint = debugPrint; }
 
 void APMUart::printDebugString(const char *message) const {
   if (apmUart != nullptr) {
     if (apmDebugPrint) {
-      apmUart->printf("%s", message);
+      apmUart->puts(message);
     }
   }
 }
 
 void APMUart::printString(const char *message) const {
-  apmUart->printf("%s", message);
+  apmUart->puts(message);
 }
 
 char APMUart::getc() const { return apmUart->getc(); }
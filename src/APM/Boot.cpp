@@ -0,0 +1,95 @@
+/**
+ * Source code for boot time profiling
+ */
+
+#include <APM/Boot.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/globals.hpp>
+
+namespace APM::boot {
+
+namespace {
+
+// Time each phase completed in us since start(), 0 if it has not
+APM_BOARD_LOCAL uint32_t phaseTimes[NUM_PHASES] = {};
+
+// Cycle count and time of the last mark
+APM_BOARD_LOCAL uint32_t lastCycles = 0;
+APM_BOARD_LOCAL uint32_t lastTime = 0;
+
+// Core clock in MHz when the last mark was taken
+APM_BOARD_LOCAL uint32_t lastClockMHz = 0;
+
+} // namespace
+
+void start() {
+  cycles::init();
+  for (uint32_t &time : phaseTimes) {
+    time = 0;
+  }
+  lastCycles = cycles::now();
+  lastTime = 0;
+  lastClockMHz = SystemCoreClock / 1000000;
+}
+
+void mark(BootPhase phase) {
+  uint32_t now = cycles::now();
+
+  // IO::init() raises the core clock from the 8 MHz HSI to 72 MHz, so each
+  // phase is converted with the clock it started at.  Only the last few
+  // instructions of IO::init() run at the new clock.
+  if (lastClockMHz != 0) {
+    lastTime += (now - lastCycles) / lastClockMHz;
+  }
+  lastCycles = now;
+  lastClockMHz = SystemCoreClock / 1000000;
+
+  // Keep 0 free to mean the phase has not completed
+  phaseTimes[static_cast<uint8_t>(phase)] = lastTime != 0 ? lastTime : 1;
+}
+
+uint32_t getTime(BootPhase phase) {
+  return phaseTimes[static_cast<uint8_t>(phase)];
+}
+
+const char *getName(BootPhase phase) {
+  switch (phase) {
+  case BootPhase::IO_INIT:
+    return "IO init";
+  case BootPhase::GPIO_SETUP:
+    return "GPIO setup";
+  case BootPhase::UART_SETUP:
+    return "UART setup";
+  case BootPhase::CAN_SETUP:
+    return "CAN setup";
+  case BootPhase::MANAGER_SETUP:
+    return "Manager setup";
+  case BootPhase::ACCESSORY:
+    return "Accessory on";
+  case BootPhase::STORAGE:
+    return "Storage";
+  case BootPhase::READY:
+    return "Ready";
+  case BootPhase::BANNER:
+    return "Banner";
+  }
+  return "unknown";
+}
+
+void print(APMUart &apmUart) {
+  uint32_t previous = 0;
+
+  for (uint8_t i = 0; i < NUM_PHASES; i++) {
+    auto phase = static_cast<BootPhase>(i);
+    uint32_t time = getTime(phase);
+    if (time == 0) {
+      apmUart.print(APM_FORMAT("\t{<14} pending\n\r"), phase);
+      continue;
+    }
+    apmUart.print(APM_FORMAT("\t{<14} at {8} us  took {8} us\n\r"), phase,
+                  time, time - previous);
+    previous = time;
+  }
+}
+
+} // namespace APM::boot
@@ -0,0 +1,408 @@
+/**
+ * Source code for BusMonitor class
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
+
+APM_BOARD_LOCAL APM::BusMonitor *busMonitorPtr = nullptr;
+
+namespace APM {
+
+namespace {
+
+/**
+ * Returns the registers of the CAN peripheral
+ * @return the registers
+ */
+CAN_TypeDef *getRegisters() {
+  return reinterpret_cast<CAN_TypeDef *>(CAN_BASE);
+}
+
+/**
+ * Returns the length of a frame on the bus, including the interframe space
+ * and the most stuff bits the frame could need
+ * @param message the frame
+ * @return the length in bits
+ */
+uint32_t getFrameBits(IO::CANMessage &message) {
+  uint32_t dataBits = 8u * message.getDataLength();
+  if (message.isCANExtended()) {
+    return 67 + dataBits + (54 + dataBits - 1) / 4;
+  }
+  return 47 + dataBits + (34 + dataBits - 1) / 4;
+}
+
+/**
+ * Limits a count to one byte
+ * @param count the count
+ * @return the count, at most 255
+ */
+uint8_t saturate(uint32_t count) {
+  return static_cast<uint8_t>(count < UINT8_MAX ? count : UINT8_MAX);
+}
+
+/**
+ * Stores a value little endian, saturated to the number of bytes
+ * @param out the buffer to write
+ * @param value the value
+ * @param bytes the number of bytes to write
+ */
+void putSaturated(uint8_t *out, uint64_t value, uint8_t bytes) {
+  uint64_t limit = (1ull << (8 * bytes)) - 1;
+  if (value > limit) {
+    value = limit;
+  }
+  for (uint8_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+} // namespace
+
+void BusMonitor::start() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  for (size_t i = 0; i < numPairs; i++) {
+    BusLatencyStats &stats = pairs[i];
+    stats = {stats.name, stats.requestId, stats.responseId};
+    pending[i] = false;
+  }
+  framesSent = 0;
+  framesReceived = 0;
+  transmitErrors = 0;
+  totalErrors = 0;
+  totalBusOffs = 0;
+  sampleBits = 0;
+  sampleErrors = 0;
+  sampleBusOffs = 0;
+  lastSample = EVT::core::time::millis();
+  nextSample = 0;
+  numSamples = 0;
+  peakLoad = 0;
+
+  // Start from the present error state, so earlier errors are not counted
+  uint32_t esr = getRegisters()->ESR;
+  busOff = (esr & CAN_ESR_BOFF) != 0;
+  getRegisters()->ESR = CAN_ESR_LEC;
+
+  __set_PRIMASK(primask);
+}
+
+int BusMonitor::addPair(const char *name, uint32_t requestId,
+                        uint32_t responseId) {
+  if (numPairs >= MAX_PAIRS) {
+    return 1;
+  }
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  pairs[numPairs] = {name, requestId, responseId};
+  pending[numPairs] = false;
+  numPairs++;
+  __set_PRIMASK(primask);
+  return 0;
+}
+
+void BusMonitor::recordTransmit(IO::CANMessage &message,
+                                IO::CAN::CANStatus status) {
+  uint32_t now = cycles::now();
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  pollErrors();
+  if (status != IO::CAN::CANStatus::OK) {
+    transmitErrors++;
+    __set_PRIMASK(primask);
+    return;
+  }
+
+  framesSent++;
+  sampleBits += getFrameBits(message);
+
+  uint32_t id = message.getId();
+  for (size_t i = 0; i < numPairs; i++) {
+    if (pairs[i].requestId != id) {
+      continue;
+    }
+    if (pending[i]) {
+      pairs[i].missed++;
+    }
+    pending[i] = true;
+    requestCycles[i] = now;
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void BusMonitor::recordReceive(IO::CANMessage &message) {
+  uint32_t now = cycles::now();
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  pollErrors();
+  framesReceived++;
+  sampleBits += getFrameBits(message);
+
+  uint32_t id = message.getId();
+  for (size_t i = 0; i < numPairs; i++) {
+    if (pairs[i].responseId != id || !pending[i]) {
+      continue;
+    }
+    pending[i] = false;
+
+    BusLatencyStats &stats = pairs[i];
+    uint32_t latency = now - requestCycles[i];
+    if (stats.count == 0 || latency < stats.minCycles) {
+      stats.minCycles = latency;
+    }
+    if (latency > stats.maxCycles) {
+      stats.maxCycles = latency;
+    }
+    stats.lastCycles = latency;
+    stats.totalCycles += latency;
+    stats.count++;
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void BusMonitor::sample() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  pollErrors();
+  uint32_t bits = sampleBits;
+  uint32_t errors = sampleErrors;
+  uint32_t busOffs = sampleBusOffs;
+  sampleBits = 0;
+  sampleErrors = 0;
+  sampleBusOffs = 0;
+  __set_PRIMASK(primask);
+
+  uint32_t now = EVT::core::time::millis();
+  uint32_t elapsed = now - lastSample;
+  lastSample = now;
+  if (elapsed == 0) {
+    return;
+  }
+
+  // Bits sent as a share of the bits the bus could carry in the period
+  uint64_t capacity = static_cast<uint64_t>(BIT_RATE) * elapsed / 1000;
+  uint64_t load = static_cast<uint64_t>(bits) * 1000 / capacity;
+
+  Sample &sample = samples[nextSample];
+  sample.load = static_cast<uint16_t>(load < 1000 ? load : 1000);
+  sample.errors = saturate(errors);
+  sample.busOffs = saturate(busOffs);
+  nextSample = (nextSample + 1) % NUM_SAMPLES;
+  if (numSamples < NUM_SAMPLES) {
+    numSamples++;
+  }
+  if (sample.load > peakLoad) {
+    peakLoad = sample.load;
+  }
+}
+
+uint32_t BusMonitor::getLoad(size_t count) const {
+  if (count > numSamples) {
+    count = numSamples;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  uint32_t sum = 0;
+  for (size_t age = 0; age < count; age++) {
+    sum += getSample(age).load;
+  }
+  return sum / count;
+}
+
+uint32_t BusMonitor::getPeakLoad() const { return peakLoad; }
+
+uint32_t BusMonitor::getErrors(size_t count) const {
+  uint32_t sum = 0;
+  for (size_t age = 0; age < count && age < numSamples; age++) {
+    sum += getSample(age).errors;
+  }
+  return sum;
+}
+
+uint32_t BusMonitor::getBusOffs(size_t count) const {
+  uint32_t sum = 0;
+  for (size_t age = 0; age < count && age < numSamples; age++) {
+    sum += getSample(age).busOffs;
+  }
+  return sum;
+}
+
+size_t BusMonitor::getNumPairs() const { return numPairs; }
+
+void BusMonitor::getLatencyStats(size_t index, BusLatencyStats &stats) const {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  stats = index < numPairs ? pairs[index] : BusLatencyStats{};
+  __set_PRIMASK(primask);
+}
+
+void BusMonitor::print(APMUart &apmUart) const {
+  // Windows of 1 s, 10 s and 1 min
+  uint32_t loads[] = {getLoad(1), getLoad(10), getLoad(NUM_SAMPLES),
+                      getPeakLoad()};
+  apmUart.print(APM_FORMAT("CAN bus load: 1 s {}.{}%, 10 s {}.{}%, "
+                           "1 min {}.{}%, peak {}.{}%\n\r"),
+                loads[0] / 10, loads[0] % 10, loads[1] / 10, loads[1] % 10,
+                loads[2] / 10, loads[2] % 10, loads[3] / 10, loads[3] % 10);
+  apmUart.print(APM_FORMAT("Error frames: 1 min {}, total {}.  Bus-off: "
+                           "1 min {}, total {}{}\n\r"),
+                getErrors(NUM_SAMPLES), totalErrors, getBusOffs(NUM_SAMPLES),
+                totalBusOffs, busOff ? ", bus-off now" : "");
+  apmUart.print(APM_FORMAT("Error counters: transmit {}, receive {}\n\r"),
+                transmitErrorCount, receiveErrorCount);
+  apmUart.print(APM_FORMAT("Frames sent {}, received {}, refused {}\n\r"),
+                framesSent, framesReceived, transmitErrors);
+
+  for (size_t i = 0; i < numPairs; i++) {
+    BusLatencyStats stats;
+    getLatencyStats(i, stats);
+    apmUart.print(APM_FORMAT("\t{<10} 0x{08X} -> 0x{08X}: "), stats.name,
+                  stats.requestId, stats.responseId);
+    if (stats.count == 0) {
+      apmUart.print(APM_FORMAT("no responses, {} missed\n\r"), stats.missed);
+      continue;
+    }
+    apmUart.print(APM_FORMAT("n={} last={} min={} mean={} max={} us, "
+                             "{} missed\n\r"),
+                  stats.count, cycles::toMicros(stats.lastCycles),
+                  cycles::toMicros(stats.minCycles),
+                  cycles::toMicros(
+                      static_cast<uint32_t>(stats.totalCycles / stats.count)),
+                  cycles::toMicros(stats.maxCycles), stats.missed);
+  }
+}
+
+int BusMonitor::transmit(IO::CAN &can) {
+  uint8_t payload[8] = {0};
+  putSaturated(&payload[1], getLoad(1), 2);
+  putSaturated(&payload[3], getLoad(NUM_SAMPLES), 2);
+  putSaturated(&payload[5], getErrors(NUM_SAMPLES), 1);
+  putSaturated(&payload[6], getBusOffs(NUM_SAMPLES), 1);
+  payload[7] = transmitErrorCount;
+
+  for (size_t i = 0; i <= numPairs; i++) {
+    if (i > 0) {
+      BusLatencyStats stats;
+      getLatencyStats(i - 1, stats);
+      uint64_t mean = stats.count == 0 ? 0 : stats.totalCycles / stats.count;
+      payload[0] = static_cast<uint8_t>(i);
+      putSaturated(&payload[1], cycles::toMicros(static_cast<uint32_t>(mean)),
+                   2);
+      putSaturated(&payload[3], cycles::toMicros(stats.maxCycles), 2);
+      putSaturated(&payload[5], stats.count, 2);
+      putSaturated(&payload[7], stats.missed, 1);
+    }
+
+    IO::CANMessage message(CAN_ID, sizeof(payload), payload, true);
+    IO::CAN::CANStatus status = bus::transmit(can, message);
+
+    if (status != IO::CAN::CANStatus::OK) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void BusMonitor::pollErrors() {
+  CAN_TypeDef *registers = getRegisters();
+  uint32_t esr = registers->ESR;
+
+  // The peripheral writes the code of each error it detects.  Setting the
+  // field to the unused code 7 shows when the next error is written.
+  uint32_t lastError = esr & CAN_ESR_LEC;
+  if (lastError != 0 && lastError != CAN_ESR_LEC) {
+    totalErrors++;
+    sampleErrors++;
+    registers->ESR = CAN_ESR_LEC;
+  }
+
+  bool nowBusOff = (esr & CAN_ESR_BOFF) != 0;
+  if (nowBusOff && !busOff) {
+    totalBusOffs++;
+    sampleBusOffs++;
+  }
+  busOff = nowBusOff;
+
+  transmitErrorCount = static_cast<uint8_t>(esr >> 16);
+  receiveErrorCount = static_cast<uint8_t>(esr >> 24);
+}
+
+const BusMonitor::Sample &BusMonitor::getSample(size_t age) const {
+  size_t index = (nextSample + NUM_SAMPLES - 1 - age) % NUM_SAMPLES;
+  return samples[index];
+}
+
+namespace bus {
+
+namespace {
+
+// Frames held by defer(), oldest first from deferredHead
+APM_BOARD_LOCAL IO::CANMessage deferred[DEFERRED_FRAMES];
+APM_BOARD_LOCAL size_t deferredHead = 0;
+APM_BOARD_LOCAL size_t deferredCount = 0;
+
+} // namespace
+
+IO::CAN::CANStatus transmit(IO::CAN &can, IO::CANMessage &message) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  IO::CAN::CANStatus status = can.transmit(message);
+  recordTransmit(message, status);
+  __set_PRIMASK(primask);
+  return status;
+}
+
+void defer(IO::CANMessage &message) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  // The newest frames are the ones still worth answering
+  if (deferredCount == DEFERRED_FRAMES) {
+    deferredHead = (deferredHead + 1) % DEFERRED_FRAMES;
+    deferredCount--;
+    metrics::increment(metrics::Metric::CAN_RX_DROPPED);
+  }
+  deferred[(deferredHead + deferredCount) % DEFERRED_FRAMES] = message;
+  deferredCount++;
+  __set_PRIMASK(primask);
+}
+
+bool receive(IO::CAN &can, IO::CANMessage &message) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  bool held = deferredCount > 0;
+  if (held) {
+    message = deferred[deferredHead];
+    deferredHead = (deferredHead + 1) % DEFERRED_FRAMES;
+    deferredCount--;
+  }
+  __set_PRIMASK(primask);
+  if (held) {
+    return true;
+  }
+
+  if (can.receive(&message, false) == nullptr) {
+    return false;
+  }
+  trace::recordCAN(TraceEventType::CAN_RX, message);
+  recordReceive(message);
+  return true;
+}
+
+} // namespace bus
+
+} // namespace APM
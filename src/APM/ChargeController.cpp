@@ -0,0 +1,259 @@
+/**
+ * Source code for ChargeController class
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/ChargeController.hpp>
+#include <APM/LoadMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
+#include <APM/utils/globals.hpp>
+#include <HALf3/stm32f3xx.h>
+
+APM_BOARD_LOCAL APM::ChargeController *chargeControllerPtr = nullptr;
+
+/**
+ * Handler for the charge control loop timer
+ * @param htim pointer to the timer struct for which the interrupt was
+ * triggered.
+ */
+void chargeTimerIRQHandler(void *htim) {
+  APM::load::ScopedInterrupt loadScope(APM::LoadContext::CHARGE_TIMER);
+  APM::trace::recordTimer(APM::TraceTimer::CHARGE_CONTROL);
+  chargeControllerPtr->onTimer();
+}
+
+namespace APM {
+
+namespace {
+
+// Resting voltage of the battery in mV at 0%, 10%, ... 100% charge
+constexpr uint32_t REST_VOLTAGES[] = {11310, 11510, 11660, 11810,
+                                      11960, 12100, 12240, 12370,
+                                      12500, 12620, 12730};
+
+// Number of entries in REST_VOLTAGES
+constexpr size_t NUM_REST_VOLTAGES =
+    sizeof(REST_VOLTAGES) / sizeof(REST_VOLTAGES[0]);
+
+// Charge held by a full battery in mAs
+constexpr uint32_t FULL_CHARGE = ChargeController::CAPACITY * 3600;
+
+// While not charging, the estimate moves 1 / 2^REST_SHIFT of the way to the
+// resting voltage estimate each sample.  Smooths over load changes and the
+// surface charge left after charging.
+constexpr uint32_t REST_SHIFT = 6;
+
+/**
+ * Estimates the charge held from the resting voltage
+ * @param voltage the battery voltage in mV
+ * @return the charge in mAs
+ */
+uint32_t getRestCharge(uint32_t voltage) {
+  if (voltage <= REST_VOLTAGES[0]) {
+    return 0;
+  }
+  for (size_t i = 1; i < NUM_REST_VOLTAGES; i++) {
+    if (voltage < REST_VOLTAGES[i]) {
+      uint32_t low = REST_VOLTAGES[i - 1];
+      uint32_t step = FULL_CHARGE / (NUM_REST_VOLTAGES - 1);
+      return (i - 1) * step + (voltage - low) * step / (REST_VOLTAGES[i] - low);
+    }
+  }
+  return FULL_CHARGE;
+}
+
+} // namespace
+
+ChargeController::ChargeController(IO::ADC &voltageSense,
+                                   IO::ADC &currentSense,
+                                   IO::GPIO &chargeSwGpio,
+                                   IO::GPIO &limiterGpio,
+                                   EVT::core::DEV::Timer &timer,
+                                   uint32_t voltageFullScale,
+                                   uint32_t currentFullScale)
+    : voltageSense(voltageSense), currentSense(currentSense),
+      chargeSwGpio(chargeSwGpio), limiterGpio(limiterGpio), timer(timer),
+      voltageFullScale(voltageFullScale), currentFullScale(currentFullScale) {
+  chargeControllerPtr = this;
+}
+
+void ChargeController::start() {
+  timer.stopTimer();
+  allowed = false;
+  state = ChargeState::IDLE;
+  chargeSwOn = true;
+  limiterOn = true;
+  setOutputs(false, false);
+
+  timer.setPeriod(MONITOR_PERIOD);
+  timer.startTimer(chargeTimerIRQHandler);
+}
+
+void ChargeController::setCharging(bool newAllowed) {
+  // Also called from the GFD trip, which can preempt the control loop
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (newAllowed != allowed) {
+    allowed = newAllowed;
+    if (allowed) {
+      state = ChargeState::BULK;
+    } else {
+      state = ChargeState::IDLE;
+      setOutputs(false, false);
+    }
+
+    timer.stopTimer();
+    timer.setPeriod(allowed ? CONTROL_PERIOD : MONITOR_PERIOD);
+    timer.startTimer(chargeTimerIRQHandler);
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void ChargeController::onTimer() {
+  uint32_t voltage = voltageSense.readRaw() * voltageFullScale / ADC_FULL_SCALE;
+  uint32_t current = currentSense.readRaw() * currentFullScale / ADC_FULL_SCALE;
+  update(voltage, current);
+}
+
+void ChargeController::update(uint32_t voltage, uint32_t current) {
+  // Seed the averages with the first sample, so they do not have to climb up
+  // from 0 first
+  if (!voltageSeeded) {
+    voltageFiltered = voltage << FILTER_SHIFT;
+    voltageSeeded = true;
+    charge = getRestCharge(voltage);
+  } else {
+    voltageFiltered += voltage - (voltageFiltered >> FILTER_SHIFT);
+  }
+
+  // Averaged over the time CHARGE_SW is off as well, so the average falls as
+  // the battery needs CHARGE_SW on for less of the time to hold its voltage
+  currentFiltered += current - (currentFiltered >> CURRENT_FILTER_SHIFT);
+
+  updateCharge(current, allowed ? CONTROL_PERIOD : MONITOR_PERIOD);
+
+  if (!allowed || state == ChargeState::FAULT) {
+    return;
+  }
+
+  uint32_t filteredVoltage = getVoltage();
+  if (filteredVoltage < MIN_VOLTAGE || filteredVoltage >= MAX_VOLTAGE) {
+    state = ChargeState::FAULT;
+    setOutputs(false, false);
+    metrics::increment(metrics::Metric::CHARGE_FAULTS);
+    return;
+  }
+
+  switch (state) {
+  case ChargeState::BULK:
+    if (filteredVoltage >= ABSORB_VOLTAGE) {
+      state = ChargeState::LIMITED;
+      setOutputs(true, true);
+    } else {
+      setOutputs(true, false);
+    }
+    break;
+  case ChargeState::LIMITED:
+    if (getCurrent() <= END_CURRENT &&
+        filteredVoltage + HYSTERESIS >= ABSORB_VOLTAGE) {
+      state = ChargeState::FLOAT;
+      charge = FULL_CHARGE;
+      setOutputs(false, true);
+    } else if (filteredVoltage >= ABSORB_VOLTAGE + HYSTERESIS) {
+      setOutputs(false, true);
+    } else if (filteredVoltage < ABSORB_VOLTAGE) {
+      setOutputs(true, true);
+    }
+    break;
+  case ChargeState::FLOAT:
+    if (filteredVoltage < BULK_RESTART_VOLTAGE) {
+      state = ChargeState::BULK;
+      setOutputs(true, false);
+    } else if (filteredVoltage >= FLOAT_VOLTAGE + HYSTERESIS) {
+      setOutputs(false, true);
+    } else if (filteredVoltage < FLOAT_VOLTAGE - HYSTERESIS) {
+      setOutputs(true, true);
+    }
+    break;
+  case ChargeState::IDLE:
+  case ChargeState::FAULT:
+    break;
+  }
+}
+
+ChargeState ChargeController::getState() const { return state; }
+
+uint32_t ChargeController::getVoltage() const {
+  return voltageFiltered >> FILTER_SHIFT;
+}
+
+uint32_t ChargeController::getCurrent() const {
+  return currentFiltered >> CURRENT_FILTER_SHIFT;
+}
+
+uint32_t ChargeController::getStateOfCharge() const {
+  return charge / (FULL_CHARGE / 100);
+}
+
+void ChargeController::print(APMUart &apmUart) const {
+  apmUart.print(APM_FORMAT("Backup battery: {}, {} mV, {} mA, {}% charged\n\r"),
+                getState(), getVoltage(), getCurrent(), getStateOfCharge());
+  apmUart.print(APM_FORMAT("\tCharge_SW {}, limiter {}\n\r"),
+                chargeSwOn ? "on" : "off", limiterOn ? "on" : "off");
+}
+
+void ChargeController::setOutputs(bool chargeSw, bool limiter) {
+  if (chargeSw != chargeSwOn) {
+    chargeSwOn = chargeSw;
+    chargeSwGpio.writePin(chargeSw ? IO::GPIO::State::HIGH
+                                   : IO::GPIO::State::LOW);
+    trace::recordOutput(APMManager::CHARGE_SW, chargeSw);
+  }
+  if (limiter != limiterOn) {
+    limiterOn = limiter;
+    limiterGpio.writePin(limiter ? IO::GPIO::State::HIGH
+                                 : IO::GPIO::State::LOW);
+    trace::recordOutput(APMManager::CHARGE_LIMITER_ENABLE, limiter);
+  }
+}
+
+void ChargeController::updateCharge(uint32_t current, uint32_t period) {
+  if (state == ChargeState::FLOAT) {
+    charge = FULL_CHARGE;
+  } else if (allowed) {
+    // Count up from the estimate charging started with.  Full is only taken
+    // from the end of LIMITED.
+    uint32_t added = current * period / 1000 * CHARGE_EFFICIENCY / 100;
+    charge = charge + added < FULL_CHARGE ? charge + added : FULL_CHARGE - 1;
+  } else {
+    uint32_t target = getRestCharge(getVoltage());
+    if (target > charge) {
+      charge += (target - charge) >> REST_SHIFT;
+    } else {
+      charge -= (charge - target) >> REST_SHIFT;
+    }
+  }
+
+  metrics::set(metrics::Metric::BACKUP_BATTERY_SOC, getStateOfCharge());
+}
+
+const char *getName(ChargeState state) {
+  switch (state) {
+  case ChargeState::IDLE:
+    return "IDLE";
+  case ChargeState::BULK:
+    return "BULK";
+  case ChargeState::LIMITED:
+    return "LIMITED";
+  case ChargeState::FLOAT:
+    return "FLOAT";
+  case ChargeState::FAULT:
+    return "FAULT";
+  }
+  return "unknown";
+}
+
+} // namespace APM
@@ -0,0 +1,193 @@
+/**
+ * Source code for the persistent configuration
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/Config.hpp>
+#include <APM/utils/crc.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/utils/time.hpp>
+#include <cstring>
+
+namespace APM::config {
+
+namespace {
+
+// Number of bytes covered by the CRC
+constexpr size_t BODY_SIZE = offsetof(Config, crc);
+
+// The settings in use, either DEFAULTS or a copy in flash.  A single word, so
+// interrupt handlers always see one copy or the other.
+APM_BOARD_LOCAL const Config *active = &DEFAULTS;
+
+// Flash region holding the two copies, nullptr until mounted
+APM_BOARD_LOCAL DEV::Flash *configFlash = nullptr;
+
+// Page of the copy in use, -1 for DEFAULTS
+APM_BOARD_LOCAL int activePage = -1;
+
+// Time of the last write committed over CAN in ms, and whether there was one
+APM_BOARD_LOCAL uint32_t lastCanWrite = 0;
+APM_BOARD_LOCAL bool canWritten = false;
+
+/**
+ * Returns the copy stored in a page, if it is valid
+ * @param flash the flash region
+ * @param page the page index
+ * @return the copy, or nullptr if the page does not hold a valid one
+ */
+const Config *getCopy(const DEV::Flash &flash, uint32_t page) {
+  const uint8_t *address = flash.getAddress() + page * flash.getPageSize();
+  const auto *copy = reinterpret_cast<const Config *>(address);
+
+  if (copy->magic != CONFIG_MAGIC || copy->version != CONFIG_VERSION ||
+      copy->size != sizeof(Config)) {
+    return nullptr;
+  }
+  if (crc::crc16(copy, BODY_SIZE) != copy->crc) {
+    return nullptr;
+  }
+  return copy;
+}
+
+/**
+ * Writes settings to the page not in use and switches to them once they are
+ * fully programmed
+ * @param config the settings to write.  The sequence and CRC are filled in.
+ * @return 0 on success, 2 on a flash error or if the region overlaps the
+ * firmware image
+ */
+int commit(Config &config) {
+  uint32_t page = activePage == 0 ? 1 : 0;
+  config.sequence = active->sequence + 1;
+  config.crc = crc::crc16(&config, BODY_SIZE);
+
+  // The CRC goes in last, so a copy torn by a power loss fails validation and
+  // the previous copy stays in use.  A region the firmware image has grown
+  // into (flash code 3) is reported as a flash error too, since result 3 on
+  // CAN already means a refused write.
+  uint32_t offset = page * configFlash->getPageSize();
+  if (configFlash->erasePage(page) != 0 ||
+      configFlash->write(offset, &config, BODY_SIZE) != 0 ||
+      configFlash->write(offset + BODY_SIZE, &config.crc,
+                         sizeof(config.crc)) != 0) {
+    return 2;
+  }
+
+  const Config *copy = getCopy(*configFlash, page);
+  if (copy == nullptr) {
+    return 2;
+  }
+  active = copy;
+  activePage = static_cast<int>(page);
+  return 0;
+}
+
+} // namespace
+
+const Config &get() { return *active; }
+
+uint32_t get(Field field) {
+  return active->*FIELDS[static_cast<uint8_t>(field)].member;
+}
+
+int mount(DEV::Flash &flash) {
+  configFlash = &flash;
+  active = &DEFAULTS;
+  activePage = -1;
+
+  if (flash.getNumPages() < 2 || flash.getPageSize() < sizeof(Config)) {
+    configFlash = nullptr;
+    return 1;
+  }
+
+  for (uint32_t page = 0; page < 2; page++) {
+    const Config *copy = getCopy(flash, page);
+    if (copy == nullptr) {
+      continue;
+    }
+    if (activePage < 0 ||
+        static_cast<int32_t>(copy->sequence - active->sequence) > 0) {
+      active = copy;
+      activePage = static_cast<int>(page);
+    }
+  }
+
+  return activePage < 0 ? 1 : 0;
+}
+
+int set(Field field, uint32_t value) {
+  auto index = static_cast<uint8_t>(field);
+  if (index >= NUM_FIELDS) {
+    return 1;
+  }
+  const FieldInfo &info = FIELDS[index];
+  if (value < info.min || value > info.max) {
+    return 1;
+  }
+  if (configFlash == nullptr) {
+    return 2;
+  }
+
+  Config config = *active;
+  config.*info.member = value;
+  return commit(config);
+}
+
+bool findField(const char *name, size_t length, Field &field) {
+  for (uint8_t i = 0; i < NUM_FIELDS; i++) {
+    const char *fieldName = FIELDS[i].name;
+    if (strlen(fieldName) == length && strncmp(fieldName, name, length) == 0) {
+      field = static_cast<Field>(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+int getActivePage() { return activePage; }
+
+bool handleRequest(IO::CAN &can, IO::CANMessage &message) {
+  if (message.getId() != CAN_REQUEST_ID || message.getDataLength() < 1) {
+    return false;
+  }
+
+  uint8_t *request = message.getPayload();
+  uint8_t index = request[0];
+  uint8_t result = 1;
+  if (index < NUM_FIELDS) {
+    if (message.getDataLength() >= 5) {
+      auto field = static_cast<Field>(index);
+      uint32_t value = request[1] | (request[2] << 8) | (request[3] << 16) |
+                       (static_cast<uint32_t>(request[4]) << 24);
+      uint32_t now = EVT::core::time::millis();
+      if (value == get(field)) {
+        result = 0;
+      } else if (canWritten && now - lastCanWrite < CAN_WRITE_INTERVAL) {
+        result = 3;
+      } else {
+        result = static_cast<uint8_t>(set(field, value));
+        if (result == 0) {
+          lastCanWrite = now;
+          canWritten = true;
+        }
+      }
+    } else {
+      result = 0;
+    }
+  }
+
+  uint32_t value = index < NUM_FIELDS ? get(static_cast<Field>(index)) : 0;
+  uint8_t payload[6] = {index,
+                        result,
+                        static_cast<uint8_t>(value),
+                        static_cast<uint8_t>(value >> 8),
+                        static_cast<uint8_t>(value >> 16),
+                        static_cast<uint8_t>(value >> 24)};
+  IO::CANMessage response(CAN_RESPONSE_ID, sizeof(payload), payload, true);
+
+  static_cast<void>(bus::transmit(can, response));
+  return true;
+}
+
+} // namespace APM::config
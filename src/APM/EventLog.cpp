@@ -0,0 +1,222 @@
+/**
+ * Source code for EventLog class
+ */
+
+#include <APM/EventLog.hpp>
+#include <APM/utils/crc.hpp>
+#include <cstddef>
+
+namespace APM {
+
+namespace {
+
+// Number of bytes covered by the record CRC
+constexpr size_t RECORD_BODY_SIZE = offsetof(EventRecord, crc);
+
+} // namespace
+
+EventLog::EventLog(DEV::Flash &flash)
+    : flash(flash),
+      recordsPerPage(flash.getPageSize() / sizeof(EventRecord) - 1) {}
+
+int EventLog::mount() {
+  uint32_t numPages = flash.getNumPages();
+  mounted = false;
+
+  if (numPages < 2) {
+    return 1;
+  }
+
+  // The newest page is the one with the highest sequence number
+  bool found = false;
+  for (uint32_t page = 0; page < numPages; page++) {
+    uint32_t sequence;
+    if (!readHeader(page, sequence)) {
+      continue;
+    }
+
+    if (!found || static_cast<int32_t>(sequence - activeSequence) > 0) {
+      found = true;
+      activePage = page;
+      activeSequence = sequence;
+    }
+  }
+
+  if (!found) {
+    return format();
+  }
+
+  // Records are written in order, so the used slots form a prefix of the page
+  uint32_t low = 0;
+  uint32_t high = recordsPerPage;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (isSlotUsed(activePage, mid)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  activeUsed = low;
+
+  // Walk back through the ring while the pages are consecutive
+  pagesInUse = 1;
+  while (pagesInUse < numPages) {
+    uint32_t page = (activePage + numPages - pagesInUse) % numPages;
+    uint32_t sequence;
+    if (!readHeader(page, sequence) ||
+        sequence != activeSequence - pagesInUse) {
+      break;
+    }
+    pagesInUse++;
+  }
+
+  mounted = true;
+  return 0;
+}
+
+int EventLog::format() {
+  mounted = false;
+
+  for (uint32_t page = 1; page < flash.getNumPages(); page++) {
+    int status = flash.erasePage(page);
+    if (status != 0) {
+      return status == 3 ? 3 : 1;
+    }
+  }
+
+  int status = startPage(0, 0);
+  if (status != 0) {
+    return status;
+  }
+
+  activePage = 0;
+  activeSequence = 0;
+  activeUsed = 0;
+  pagesInUse = 1;
+  mounted = true;
+
+  return 0;
+}
+
+int EventLog::append(EventType type, uint8_t code, uint32_t value,
+                     uint32_t timestamp) {
+  if (!mounted) {
+    return 1;
+  }
+
+  if (activeUsed == recordsPerPage) {
+    uint32_t numPages = flash.getNumPages();
+    uint32_t nextPage = (activePage + 1) % numPages;
+
+    // Overwrites the oldest page once the ring is full
+    int status = startPage(nextPage, activeSequence + 1);
+    if (status != 0) {
+      return status == 3 ? 3 : 2;
+    }
+
+    activePage = nextPage;
+    activeSequence++;
+    activeUsed = 0;
+    if (pagesInUse < numPages) {
+      pagesInUse++;
+    }
+  }
+
+  EventRecord record;
+  record.sequence = activeSequence * recordsPerPage + activeUsed;
+  record.timestamp = timestamp;
+  record.value = value;
+  record.type = static_cast<uint8_t>(type);
+  record.code = code;
+  record.crc = crc::crc16(&record, RECORD_BODY_SIZE);
+
+  // Claim the slot first.  A slot that failed to program cannot be reused.
+  uint32_t offset = slotOffset(activePage, activeUsed);
+  activeUsed++;
+
+  // The CRC is programmed last so a partially written record fails its check
+  int status = flash.write(offset, &record, RECORD_BODY_SIZE);
+  if (status == 0) {
+    status = flash.write(offset + RECORD_BODY_SIZE, &record.crc,
+                         sizeof(record.crc));
+  }
+  if (status != 0) {
+    return status == 3 ? 3 : 2;
+  }
+
+  return 0;
+}
+
+size_t EventLog::getNumRecords() const {
+  if (!mounted) {
+    return 0;
+  }
+  return (pagesInUse - 1) * recordsPerPage + activeUsed;
+}
+
+int EventLog::readRecord(size_t index, EventRecord &record) const {
+  if (index >= getNumRecords()) {
+    return 1;
+  }
+
+  uint32_t numPages = flash.getNumPages();
+  uint32_t oldestPage = (activePage + numPages - (pagesInUse - 1)) % numPages;
+  uint32_t page = (oldestPage + index / recordsPerPage) % numPages;
+  uint32_t slot = index % recordsPerPage;
+
+  if (flash.read(slotOffset(page, slot), &record, sizeof(record)) != 0) {
+    return 1;
+  }
+
+  if (crc::crc16(&record, RECORD_BODY_SIZE) != record.crc) {
+    return 2;
+  }
+
+  return 0;
+}
+
+uint32_t EventLog::getRecordsPerPage() const { return recordsPerPage; }
+
+bool EventLog::readHeader(uint32_t page, uint32_t &sequence) const {
+  PageHeader header;
+  if (flash.read(page * flash.getPageSize(), &header, sizeof(header)) != 0) {
+    return false;
+  }
+
+  sequence = header.sequence;
+  return header.magic == PAGE_MAGIC && header.sequence != ERASED_WORD;
+}
+
+int EventLog::startPage(uint32_t page, uint32_t sequence) {
+  uint32_t offset = page * flash.getPageSize();
+  uint32_t magic = PAGE_MAGIC;
+
+  int status = flash.erasePage(page);
+  if (status != 0) {
+    return status == 3 ? 3 : 1;
+  }
+
+  // The magic is written last so a page interrupted here is ignored on mount
+  if (flash.write(offset + offsetof(PageHeader, sequence), &sequence,
+                  sizeof(sequence)) != 0 ||
+      flash.write(offset + offsetof(PageHeader, magic), &magic,
+                  sizeof(magic)) != 0) {
+    return 1;
+  }
+
+  return 0;
+}
+
+uint32_t EventLog::slotOffset(uint32_t page, uint32_t slot) const {
+  // Slot 0 of every page holds the page header
+  return page * flash.getPageSize() + (slot + 1) * sizeof(EventRecord);
+}
+
+bool EventLog::isSlotUsed(uint32_t page, uint32_t slot) const {
+  uint32_t sequence = ERASED_WORD;
+  flash.read(slotOffset(page, slot), &sequence, sizeof(sequence));
+  return sequence != ERASED_WORD;
+}
+
+} // namespace APM
@@ -0,0 +1,119 @@
+/**
+ * Source code for GFDSupervisor class
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/Config.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
+
+APM_BOARD_LOCAL APM::GFDSupervisor *gfdSupervisorPtr = nullptr;
+
+namespace APM {
+
+GFDSupervisor::GFDSupervisor(APMManager &manager,
+                             EVT::core::DEV::IWDG &watchdog)
+    : manager(manager), watchdog(watchdog) {}
+
+void GFDSupervisor::check() {
+  watchdog.refresh();
+
+  const config::Config &settings = config::get();
+  GFDVoter &voter = manager.getGFDVoter();
+  uint32_t now = EVT::core::time::millis();
+
+  // The GFD poll interrupt changes the mode and the readings
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  bool required = manager.getCurrentMode() == APMMode::ON &&
+                  (settings.gfdCheckDefault != 0 ||
+                   manager.isIsolationChecking());
+  uint32_t count = voter.getReadingCount();
+
+  if (!required) {
+    supervising = false;
+    readingCount = count;
+    age = 0;
+    __set_PRIMASK(primask);
+    return;
+  }
+
+  if (!supervising) {
+    // Just entered ON, or checking was just turned on
+    supervising = true;
+    lastFresh = now;
+    allowance = manager.isGFDReady() ? 0 : settings.sim100StartupPeriod;
+  } else if (count != readingCount) {
+    lastFresh = voter.getLastReadingTime();
+    allowance = 0;
+  }
+  readingCount = count;
+
+  uint32_t elapsed = now - lastFresh;
+  age = elapsed > allowance ? elapsed - allowance : 0;
+  if (age <= settings.gfdMaxAge) {
+    __set_PRIMASK(primask);
+    return;
+  }
+
+  // Only the decision is made with interrupts masked.  Stopping the GFD
+  // timer keeps the poll interrupt from tripping as well once they are
+  // unmasked, and the trip itself saves the snapshot, sends the handshake and
+  // logs, none of which may hold off SysTick or the charge control timer.
+  uint32_t detected = cycles::now();
+  manager.getGFDTimer().stopTimer();
+  supervising = false;
+  tripCount++;
+  lastTripAge = age;
+  __set_PRIMASK(primask);
+
+  manager.tripToAccessoryMode(DEV::SIM100::IsolationStateResponse::CANError,
+                              detected);
+  metrics::increment(metrics::Metric::GFD_STALE_TRIPS);
+  manager.getApmUart().print(APM_FORMAT("WARN: No isolation reading for {} "
+                                        "ms, switched to ACCESSORY\n\r"),
+                             lastTripAge);
+}
+
+void GFDSupervisor::keepAlive() { watchdog.refresh(); }
+
+uint32_t GFDSupervisor::getAge() const { return age; }
+
+uint32_t GFDSupervisor::getTripCount() const { return tripCount; }
+
+uint32_t GFDSupervisor::getLastTripAge() const { return lastTripAge; }
+
+void GFDSupervisor::print(APMUart &apmUart) const {
+  if (supervising) {
+    apmUart.print(APM_FORMAT("GFD supervisor: last reading {} ms ago, limit "
+                             "{} ms\n\r"),
+                  age, config::get().gfdMaxAge);
+  } else {
+    apmUart.printString("GFD supervisor: not supervising\n\r");
+  }
+  apmUart.print(APM_FORMAT("Stale data trips: {}, last after {} ms\n\r"),
+                tripCount, lastTripAge);
+}
+
+namespace supervisor {
+
+void wait(uint32_t time) {
+  uint32_t startTime = EVT::core::time::millis();
+  uint32_t elapsed = 0;
+  while (elapsed < time) {
+    keepAlive();
+    uint32_t remaining = time - elapsed;
+    EVT::core::time::wait(remaining < GFDSupervisor::CHECK_PERIOD
+                              ? remaining
+                              : GFDSupervisor::CHECK_PERIOD);
+    elapsed = EVT::core::time::millis() - startTime;
+  }
+}
+
+} // namespace supervisor
+
+} // namespace APM
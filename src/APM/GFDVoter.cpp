@@ -0,0 +1,300 @@
+/**
+ * Source code for GFDVoter class
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/GFDVoter.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
+#include <EVT/utils/time.hpp>
+
+namespace APM {
+
+using IsolationStateResponse = DEV::SIM100::IsolationStateResponse;
+
+GFDVoter::GFDVoter(IO::CAN &can, DEV::SIM100 **units, size_t numUnits,
+                   VotingPolicy policy)
+    : can(can), numUnits(numUnits < MAX_UNITS ? numUnits : MAX_UNITS),
+      policy(policy) {
+  for (size_t i = 0; i < this->numUnits; i++) {
+    this->units[i] = units[i];
+  }
+}
+
+IsolationStateResponse GFDVoter::poll() {
+  drainQueue();
+
+  // Send every request before waiting on any response so the units measure
+  // in parallel
+  for (size_t i = 0; i < numUnits; i++) {
+    status[i].responded = false;
+    status[i].voted = false;
+    status[i].hardwareError = false;
+    units[i]->requestIsolationState();
+  }
+
+  collectResponses();
+  updateStaleness();
+
+  for (size_t i = 0; i < numUnits; i++) {
+    if (status[i].voted) {
+      lastReadingTime = EVT::core::time::millis();
+      readingCount = readingCount + 1;
+      break;
+    }
+  }
+  metrics::set(metrics::Metric::HEALTHY_GFD_UNITS,
+               static_cast<uint32_t>(getNumHealthyUnits()));
+
+  IsolationEstimate estimate;
+  trend.getEstimate(estimate);
+  metrics::set(metrics::Metric::ISOLATION_RESISTANCE, estimate.resistance);
+  metrics::set(metrics::Metric::ISOLATION_TIME_TO_TRIP, estimate.timeToTrip);
+  metrics::set(metrics::Metric::ISOLATION_WARNING,
+               static_cast<uint32_t>(estimate.warning));
+
+  return vote();
+}
+
+bool GFDVoter::isUnitResponse(IO::CANMessage &message) const {
+  for (size_t i = 0; i < numUnits; i++) {
+    if (message.getId() == units[i]->getResponseId()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void GFDVoter::drainQueue() {
+  IO::CANMessage message;
+  while (can.receive(&message, false) != nullptr) {
+    trace::recordCAN(TraceEventType::CAN_RX, message);
+    bus::recordReceive(message);
+    if (!isUnitResponse(message)) {
+      bus::defer(message);
+    }
+  }
+}
+
+void GFDVoter::collectResponses() {
+  IO::CANMessage message;
+  size_t pending = numUnits;
+  uint32_t lowestResistance = UINT32_MAX;
+  uint32_t startTime = EVT::core::time::millis();
+
+  while (pending > 0 && EVT::core::time::millis() - startTime < POLL_TIMEOUT) {
+    if (can.receive(&message, false) == nullptr) {
+      continue;
+    }
+    trace::recordCAN(TraceEventType::CAN_RX, message);
+    bus::recordReceive(message);
+    if (!isUnitResponse(message)) {
+      bus::defer(message);
+      continue;
+    }
+
+    for (size_t i = 0; i < numUnits; i++) {
+      if (status[i].responded || !units[i]->isIsolationStateResponse(message)) {
+        continue;
+      }
+
+      bool queryAgain = false;
+      auto state = DEV::SIM100::decodeIsolationState(message, queryAgain);
+      status[i].responded = true;
+      pending--;
+      if (state == IsolationStateResponse::IsolationError) {
+        metrics::increment(metrics::Metric::ISOLATION_FAULTS);
+      }
+
+      if (state == IsolationStateResponse::HardwareError) {
+        // A unit reporting a hardware error cannot be trusted to vote, so
+        // fail over to the remaining units immediately
+        status[i].lastState = state;
+        status[i].hardwareError = true;
+        break;
+      }
+
+      // A unit without a fresh estimate is alive but does not vote this poll.
+      // It will be asked again on the next poll.
+      if (!queryAgain && state != IsolationStateResponse::CANError) {
+        status[i].lastState = state;
+        status[i].voted = true;
+      }
+
+      // The resistance is only measured while the pack voltage is in range
+      uint32_t resistance = DEV::SIM100::decodeIsolationResistance(message);
+      if (!queryAgain &&
+          (state == IsolationStateResponse::NoError ||
+           state == IsolationStateResponse::IsolationError) &&
+          resistance < lowestResistance) {
+        lowestResistance = resistance;
+      }
+      break;
+    }
+  }
+
+  // The unit reading lowest is the one that will trip first
+  if (lowestResistance != UINT32_MAX) {
+    trend.addReading(lowestResistance, EVT::core::time::millis());
+  }
+
+  if (pending > 0) {
+    metrics::increment(metrics::Metric::SIM100_MISSED_POLLS,
+                       static_cast<uint32_t>(pending));
+  }
+}
+
+void GFDVoter::updateStaleness() {
+  for (size_t i = 0; i < numUnits; i++) {
+    if (status[i].hardwareError) {
+      status[i].missedPolls = STALE_POLL_LIMIT;
+    } else if (status[i].voted) {
+      status[i].missedPolls = 0;
+    } else if (status[i].missedPolls < STALE_POLL_LIMIT) {
+      status[i].missedPolls++;
+    }
+  }
+}
+
+IsolationStateResponse GFDVoter::vote() const {
+  size_t healthy = 0;
+  size_t voters = 0;
+  size_t faults = 0;
+  auto faultState = IsolationStateResponse::NoError;
+
+  for (size_t i = 0; i < numUnits; i++) {
+    if (isStale(i)) {
+      continue;
+    }
+    healthy++;
+
+    if (!status[i].voted) {
+      continue;
+    }
+    voters++;
+
+    if (status[i].lastState != IsolationStateResponse::NoError) {
+      if (faults == 0) {
+        faultState = status[i].lastState;
+      }
+      faults++;
+    }
+  }
+
+  // No unit left to provide protection
+  if (healthy == 0) {
+    return IsolationStateResponse::CANError;
+  }
+
+  // Fall back to any-fault when there are not enough readings for 2-of-N
+  size_t required = 1;
+  if (policy == VotingPolicy::TWO_OF_N && voters >= 2) {
+    required = 2;
+  }
+
+  if (faults >= required) {
+    return faultState;
+  }
+
+  return IsolationStateResponse::NoError;
+}
+
+int GFDVoter::restartAll() {
+  int failures = 0;
+  for (size_t i = 0; i < numUnits; i++) {
+    if (units[i]->restartSIM100() != 0) {
+      failures++;
+    }
+    // Give every unit a fresh chance to join the vote after a restart
+    status[i] = UnitStatus();
+  }
+  return failures;
+}
+
+int GFDVoter::setMaxWorkingVoltage(uint16_t maxVoltage) {
+  trend.setMaxVoltage(maxVoltage);
+  drainQueue();
+
+  bool waiting[MAX_UNITS] = {};
+  size_t pending = 0;
+  for (size_t i = 0; i < numUnits; i++) {
+    if (units[i]->requestMaxWorkingVoltage(maxVoltage) == 0) {
+      waiting[i] = true;
+      pending++;
+    }
+  }
+
+  int failures = static_cast<int>(numUnits - pending);
+  IO::CANMessage message;
+  uint32_t startTime = EVT::core::time::millis();
+
+  while (pending > 0 && EVT::core::time::millis() - startTime < SETUP_TIMEOUT) {
+    supervisor::keepAlive();
+    if (can.receive(&message, false) == nullptr) {
+      continue;
+    }
+    trace::recordCAN(TraceEventType::CAN_RX, message);
+    bus::recordReceive(message);
+    if (!isUnitResponse(message)) {
+      bus::defer(message);
+      continue;
+    }
+
+    for (size_t i = 0; i < numUnits; i++) {
+      if (!waiting[i] || !units[i]->isMaxWorkingVoltageResponse(message)) {
+        continue;
+      }
+      waiting[i] = false;
+      pending--;
+      if (DEV::SIM100::decodeMaxWorkingVoltage(message) != maxVoltage) {
+        failures++;
+      }
+      break;
+    }
+  }
+
+  if (pending > 0) {
+    metrics::increment(metrics::Metric::SIM100_TIMEOUTS,
+                       static_cast<uint32_t>(pending));
+  }
+  return failures + static_cast<int>(pending);
+}
+
+void GFDVoter::setVotingPolicy(VotingPolicy newPolicy) { policy = newPolicy; }
+
+GFDVoter::VotingPolicy GFDVoter::getVotingPolicy() const { return policy; }
+
+size_t GFDVoter::getNumUnits() const { return numUnits; }
+
+size_t GFDVoter::getNumHealthyUnits() const {
+  size_t healthy = 0;
+  for (size_t i = 0; i < numUnits; i++) {
+    if (!isStale(i)) {
+      healthy++;
+    }
+  }
+  return healthy;
+}
+
+bool GFDVoter::isStale(size_t unit) const {
+  if (unit >= numUnits) {
+    return true;
+  }
+  return status[unit].missedPolls >= STALE_POLL_LIMIT;
+}
+
+IsolationStateResponse GFDVoter::getLastState(size_t unit) const {
+  if (unit >= numUnits) {
+    return IsolationStateResponse::CANError;
+  }
+  return status[unit].lastState;
+}
+
+const IsolationTrend &GFDVoter::getIsolationTrend() const { return trend; }
+
+uint32_t GFDVoter::getReadingCount() const { return readingCount; }
+
+uint32_t GFDVoter::getLastReadingTime() const { return lastReadingTime; }
+
+} // namespace APM
@@ -0,0 +1,122 @@
+/**
+ * Source code for Handshake class
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/BusMonitor.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/Handshake.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+
+namespace APM {
+
+Handshake::Handshake(IO::CAN &can) : can(can) {}
+
+int Handshake::start(uint8_t newMode, uint32_t nodes) {
+  sequence++;
+  mode = newMode;
+  expectedNodes = nodes;
+  ackedNodes = 0;
+  duration = 0;
+  for (uint32_t &latency : latencies) {
+    latency = 0;
+  }
+
+  uint8_t payload[2] = {mode, sequence};
+  IO::CANMessage request(REQUEST_ID, sizeof(payload), payload, true);
+  startTime = EVT::core::time::millis();
+  startCycles = cycles::now();
+
+  IO::CAN::CANStatus status = bus::transmit(can, request);
+
+  if (status != IO::CAN::CANStatus::OK) {
+    metrics::increment(metrics::Metric::CAN_TX_ERRORS);
+    return 1;
+  }
+  trace::recordCAN(TraceEventType::CAN_TX, request);
+  return 0;
+}
+
+int Handshake::wait(uint32_t timeout) {
+  IO::CANMessage message;
+
+  while (ackedNodes != expectedNodes &&
+         EVT::core::time::millis() - startTime < timeout) {
+    supervisor::keepAlive();
+    if (!bus::receive(can, message)) {
+      continue;
+    }
+    handleMessage(message);
+  }
+
+  if (ackedNodes != expectedNodes) {
+    duration = cycles::toMicros(cycles::now() - startCycles);
+    metrics::increment(metrics::Metric::HANDSHAKE_TIMEOUTS);
+    return 1;
+  }
+  metrics::set(metrics::Metric::HANDSHAKE_TIME, duration);
+  return 0;
+}
+
+bool Handshake::handleMessage(IO::CANMessage &message) {
+  uint32_t id = message.getId();
+  if (id < ACK_ID_BASE || id >= ACK_ID_BASE + MAX_NODES ||
+      message.getDataLength() < 2) {
+    return false;
+  }
+
+  uint8_t *payload = message.getPayload();
+  if (payload[0] != mode || payload[1] != sequence) {
+    return false;
+  }
+
+  uint32_t node = 1u << (id - ACK_ID_BASE);
+  if ((expectedNodes & node) == 0 || (ackedNodes & node) != 0) {
+    return false;
+  }
+
+  uint32_t latency = cycles::toMicros(cycles::now() - startCycles);
+  latencies[id - ACK_ID_BASE] = latency;
+  ackedNodes |= node;
+  if (ackedNodes == expectedNodes) {
+    duration = latency;
+  }
+  return true;
+}
+
+uint32_t Handshake::getExpectedNodes() const { return expectedNodes; }
+
+uint32_t Handshake::getAckedNodes() const { return ackedNodes; }
+
+uint32_t Handshake::getLatency(uint8_t node) const {
+  return node < MAX_NODES ? latencies[node] : 0;
+}
+
+uint32_t Handshake::getDuration() const { return duration; }
+
+void Handshake::print(APMUart &apmUart) const {
+  if (expectedNodes == 0) {
+    apmUart.printString("No boards to handshake with\n\r");
+    return;
+  }
+
+  apmUart.print(APM_FORMAT("Handshake to {}: {} of {} boards in {} us\n\r"),
+                static_cast<APMMode>(mode), __builtin_popcount(ackedNodes),
+                __builtin_popcount(expectedNodes), duration);
+  for (uint8_t node = 0; node < MAX_NODES; node++) {
+    uint32_t bit = 1u << node;
+    if ((expectedNodes & bit) == 0) {
+      continue;
+    }
+    if ((ackedNodes & bit) == 0) {
+      apmUart.print(APM_FORMAT("\tnode {}: no answer\n\r"), node);
+    } else {
+      apmUart.print(APM_FORMAT("\tnode {}: {} us\n\r"), node, latencies[node]);
+    }
+  }
+}
+
+} // namespace APM
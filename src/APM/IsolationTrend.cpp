@@ -0,0 +1,269 @@
+/**
+ * Source code for IsolationTrend class
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/IsolationTrend.hpp>
+#include <HALf3/stm32f3xx.h>
+
+namespace APM {
+
+namespace {
+
+/**
+ * Returns the grade a projected time to trip calls for
+ * @param timeToTrip the projected time in s
+ * @return the grade
+ */
+IsolationWarning gradeTimeToTrip(uint32_t timeToTrip) {
+  if (timeToTrip <= IsolationTrend::CRITICAL_TIME) {
+    return IsolationWarning::CRITICAL;
+  }
+  if (timeToTrip <= IsolationTrend::WARNING_TIME) {
+    return IsolationWarning::WARNING;
+  }
+  if (timeToTrip <= IsolationTrend::WATCH_TIME) {
+    return IsolationWarning::WATCH;
+  }
+  return IsolationWarning::NONE;
+}
+
+/**
+ * Stores a value little endian, limited to the range of the field
+ * @param out the buffer to write
+ * @param value the value
+ * @param min the smallest value the field holds
+ * @param max the largest value the field holds
+ * @param bytes the number of bytes to write
+ */
+void putClamped(uint8_t *out, int64_t value, int64_t min, int64_t max,
+                uint8_t bytes) {
+  if (value < min) {
+    value = min;
+  } else if (value > max) {
+    value = max;
+  }
+  auto bits = static_cast<uint64_t>(value);
+  for (uint8_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+}
+
+} // namespace
+
+const char *getName(IsolationWarning warning) {
+  switch (warning) {
+  case IsolationWarning::NONE:
+    return "NONE";
+  case IsolationWarning::WATCH:
+    return "WATCH";
+  case IsolationWarning::WARNING:
+    return "WARNING";
+  case IsolationWarning::CRITICAL:
+    return "CRITICAL";
+  }
+  return "UNKNOWN";
+}
+
+IsolationTrend::IsolationTrend(uint32_t maxVoltage) {
+  setMaxVoltage(maxVoltage);
+}
+
+void IsolationTrend::setMaxVoltage(uint32_t maxVoltage) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  tripResistance = maxVoltage * TRIP_OHMS_PER_VOLT / 1000;
+  reset();
+  __set_PRIMASK(primask);
+}
+
+void IsolationTrend::reset() {
+  oldest = 0;
+  numSamples = 0;
+  sumT = 0;
+  sumY = 0;
+  sumTT = 0;
+  sumTY = 0;
+  sumYY = 0;
+  intervalCount = 0;
+  lowerCount = 0;
+  estimate = {};
+  estimate.timeToTrip = NO_TRIP;
+}
+
+void IsolationTrend::addReading(uint32_t resistance, uint32_t time) {
+  if (resistance > MAX_RESISTANCE) {
+    resistance = MAX_RESISTANCE;
+  }
+
+  bool empty = numSamples == 0 && intervalCount == 0;
+  if (!empty && time - lastReading > MAX_GAP) {
+    reset();
+    empty = true;
+  }
+
+  if (empty) {
+    windowStart = time;
+  } else if (time - intervalStart >= SAMPLE_INTERVAL) {
+    addSample(intervalSum / intervalCount, lastReading);
+    intervalCount = 0;
+  }
+
+  if (intervalCount == 0) {
+    intervalStart = time;
+    intervalSum = 0;
+  }
+  intervalSum += resistance;
+  intervalCount++;
+  lastReading = time;
+}
+
+void IsolationTrend::getEstimate(IsolationEstimate &estimate) const {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  estimate = this->estimate;
+  __set_PRIMASK(primask);
+}
+
+IsolationWarning IsolationTrend::getWarning() const {
+  return estimate.warning;
+}
+
+uint32_t IsolationTrend::getTripResistance() const { return tripResistance; }
+
+void IsolationTrend::print(APMUart &apmUart) const {
+  IsolationEstimate estimate;
+  getEstimate(estimate);
+
+  if (estimate.samples == 0) {
+    apmUart.printString("Isolation trend: no samples yet\n\r");
+    return;
+  }
+
+  apmUart.print(APM_FORMAT("Isolation: {} kOhm, fitted {} kOhm, slope {} "
+                           "Ohm/min, fit {}%, {} samples\n\r"),
+                estimate.resistance, estimate.fitted, estimate.slope,
+                estimate.fit, estimate.samples);
+  if (estimate.timeToTrip == NO_TRIP) {
+    apmUart.print(APM_FORMAT("No trip at {} kOhm projected, warning {}\n\r"),
+                  tripResistance, getName(estimate.warning));
+  } else {
+    apmUart.print(APM_FORMAT("Trip at {} kOhm projected in {} s, "
+                             "warning {}\n\r"),
+                  tripResistance, estimate.timeToTrip,
+                  getName(estimate.warning));
+  }
+}
+
+int IsolationTrend::transmit(IO::CAN &can) const {
+  IsolationEstimate estimate;
+  getEstimate(estimate);
+
+  uint8_t payload[8];
+  payload[0] = static_cast<uint8_t>(estimate.warning);
+  putClamped(&payload[1], estimate.resistance, 0, UINT16_MAX, 2);
+  putClamped(&payload[3], estimate.timeToTrip, 0, UINT16_MAX, 2);
+  putClamped(&payload[5], estimate.slope, INT16_MIN, INT16_MAX, 2);
+  payload[7] = estimate.fit;
+
+  IO::CANMessage message(CAN_ID, sizeof(payload), payload, true);
+  IO::CAN::CANStatus status = bus::transmit(can, message);
+
+  return status == IO::CAN::CANStatus::OK ? 0 : 1;
+}
+
+void IsolationTrend::addSample(uint32_t resistance, uint32_t time) {
+  if (numSamples == NUM_SAMPLES) {
+    removeOldest();
+  }
+
+  Sample &sample = samples[(oldest + numSamples) % NUM_SAMPLES];
+  sample.time = (time - windowStart) / 1000;
+  sample.resistance = resistance;
+  numSamples++;
+
+  int64_t t = sample.time - samples[oldest].time;
+  int64_t y = resistance;
+  sumT += t;
+  sumY += y;
+  sumTT += t * t;
+  sumTY += t * y;
+  sumYY += y * y;
+
+  fit(resistance);
+}
+
+void IsolationTrend::removeOldest() {
+  int64_t y = samples[oldest].resistance;
+  uint32_t oldOrigin = samples[oldest].time;
+  oldest = (oldest + 1) % NUM_SAMPLES;
+  numSamples--;
+
+  // The oldest sample sits at t = 0, so it only adds to the sums of y
+  sumY -= y;
+  sumYY -= y * y;
+
+  // Count every time from the new oldest sample.  With every t moved back
+  // by d, sum(t - d)^2 = sumTT - 2 d sumT + n d^2 and
+  // sum((t - d) y) = sumTY - d sumY.
+  auto n = static_cast<int64_t>(numSamples);
+  int64_t d = samples[oldest].time - oldOrigin;
+  sumTT += n * d * d - 2 * d * sumT;
+  sumTY -= d * sumY;
+  sumT -= n * d;
+}
+
+void IsolationTrend::fit(uint32_t resistance) {
+  auto n = static_cast<int64_t>(numSamples);
+  int64_t newest = samples[(oldest + numSamples - 1) % NUM_SAMPLES].time -
+                   samples[oldest].time;
+
+  // Scaled covariance and variances, n^2 times the population values
+  int64_t covTY = n * sumTY - sumT * sumY;
+  int64_t varT = n * sumTT - sumT * sumT;
+  int64_t varY = n * sumYY - sumY * sumY;
+
+  IsolationEstimate result;
+  result.resistance = resistance;
+  result.fitted = resistance;
+  result.timeToTrip = NO_TRIP;
+  result.samples = static_cast<uint8_t>(numSamples);
+
+  if (varT > 0) {
+    int64_t fitted = (sumY * varT + covTY * (n * newest - sumT)) / (n * varT);
+    result.fitted = static_cast<uint32_t>(fitted > 0 ? fitted : 0);
+    result.slope = static_cast<int32_t>(covTY * 60000 / varT);
+
+    // r^2 = covTY^2 / (varT varY).  covTY^2 can not exceed the product, which
+    // MAX_RESISTANCE keeps below 2^63.
+    uint64_t product = static_cast<uint64_t>(varT) * varY;
+    if (product >= 100) {
+      auto fit = static_cast<uint64_t>(covTY * covTY) / (product / 100);
+      result.fit = static_cast<uint8_t>(fit < 100 ? fit : 100);
+    }
+  }
+
+  if (numSamples >= MIN_SAMPLES) {
+    if (result.fitted <= tripResistance) {
+      result.timeToTrip = 0;
+    } else if (covTY < 0 && result.fit >= MIN_FIT) {
+      // Time for the fitted line to fall to the threshold
+      int64_t time = (result.fitted - tripResistance) * varT / -covTY;
+      result.timeToTrip =
+          static_cast<uint32_t>(time < NO_TRIP ? time : NO_TRIP - 1);
+    }
+  }
+
+  // Raise the grade at once, but lower it only once it has stayed lower
+  IsolationWarning warning = gradeTimeToTrip(result.timeToTrip);
+  if (warning < estimate.warning && ++lowerCount < CLEAR_SAMPLES) {
+    warning = estimate.warning;
+  } else {
+    lowerCount = 0;
+  }
+  result.warning = warning;
+
+  estimate = result;
+}
+
+} // namespace APM
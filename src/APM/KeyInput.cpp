@@ -0,0 +1,147 @@
+/**
+ * Source code for KeyInput class
+ */
+
+#include <APM/KeyInput.hpp>
+#include <APM/LoadMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/globals.hpp>
+#include <EVT/utils/time.hpp>
+
+APM_BOARD_LOCAL APM::KeyInput *keyInputPtr = nullptr;
+
+/**
+ * Handler for both edges of the key GPIO
+ * @param gpio the GPIO that triggered the interrupt
+ */
+void keyEdgeIRQHandler(EVT::core::IO::GPIO *gpio) {
+  APM::load::ScopedInterrupt loadScope(APM::LoadContext::KEY_EDGE);
+  keyInputPtr->onEdge();
+}
+
+/**
+ * Handler for the debounce timer
+ * @param htim pointer to the timer struct for which the interrupt was
+ * triggered.
+ */
+void keyTimerIRQHandler(void *htim) {
+  APM::load::ScopedInterrupt loadScope(APM::LoadContext::KEY_TIMER);
+  APM::trace::recordTimer(APM::TraceTimer::KEY_DEBOUNCE);
+  keyInputPtr->onTimer();
+}
+
+namespace APM {
+
+KeyInput::KeyInput(IO::GPIO &keyGpio, IO::Pin keyPin,
+                   EVT::core::DEV::Timer &debounceTimer)
+    : keyGpio(keyGpio), keyPin(keyPin), debounceTimer(debounceTimer) {
+  keyInputPtr = this;
+}
+
+void KeyInput::start() {
+  debounceTimer.stopTimer();
+  stableOn = keyGpio.readPin() == IO::GPIO::State::HIGH;
+  keyGpio.registerIRQ(IO::GPIO::TriggerEdge::RISING_FALLING,
+                      keyEdgeIRQHandler);
+}
+
+void KeyInput::onEdge() {
+  uint32_t nowCycles = cycles::now();
+  edgeCount++;
+  if (traceRecorderPtr != nullptr) {
+    // Only read the level back when a trace is being recorded
+    traceRecorderPtr->recordInput(keyPin, keyGpio.readPin() ==
+                                              IO::GPIO::State::HIGH);
+  }
+
+  // Keep the time of the first edge so bounces do not hide the real latency
+  if (!debouncing) {
+    edgeCycles = nowCycles;
+    edgeTime = EVT::core::time::millis();
+    debouncing = true;
+  }
+
+  // Every bounce restarts the debounce period
+  debounceTimer.stopTimer();
+  debounceTimer.setPeriod(DEBOUNCE_PERIOD);
+  debounceTimer.startTimer(keyTimerIRQHandler);
+}
+
+void KeyInput::onTimer() {
+  debounceTimer.stopTimer();
+
+  if (!debouncing) {
+    // Hold period finished without any edges
+    if (stableOn) {
+      pushEvent(KeyEvent::Type::HOLD, pressCycles, pressTime);
+    }
+    return;
+  }
+
+  debouncing = false;
+  bool on = keyGpio.readPin() == IO::GPIO::State::HIGH;
+  if (on == stableOn) {
+    // Bounced back to the previous level
+    return;
+  }
+  stableOn = on;
+
+  if (on) {
+    pressCycles = edgeCycles;
+    pressTime = edgeTime;
+    pushEvent(KeyEvent::Type::PRESS, edgeCycles, edgeTime);
+
+    debounceTimer.setPeriod(HOLD_PERIOD);
+    debounceTimer.startTimer(keyTimerIRQHandler);
+  } else {
+    pushEvent(KeyEvent::Type::RELEASE, edgeCycles, edgeTime);
+  }
+}
+
+void KeyInput::pushEvent(KeyEvent::Type type, uint32_t cycles, uint32_t time) {
+  size_t next = (queueHead + 1) % EVENT_QUEUE_SIZE;
+  if (next == queueTail) {
+    droppedCount++;
+    metrics::increment(metrics::Metric::KEY_EVENTS_DROPPED);
+    return;
+  }
+
+  queue[queueHead].type = type;
+  queue[queueHead].edgeCycles = cycles;
+  queue[queueHead].edgeTime = time;
+  queueHead = next;
+  eventCount++;
+}
+
+bool KeyInput::popEvent(KeyEvent &event) {
+  if (queueTail == queueHead) {
+    return false;
+  }
+
+  event = queue[queueTail];
+  queueTail = (queueTail + 1) % EVENT_QUEUE_SIZE;
+  return true;
+}
+
+bool KeyInput::isOn() const { return stableOn; }
+
+void KeyInput::recordActionLatency(const KeyEvent &event) {
+  lastLatency = cycles::toMicros(cycles::now() - event.edgeCycles);
+  if (lastLatency > maxLatency) {
+    maxLatency = lastLatency;
+  }
+}
+
+uint32_t KeyInput::getLastLatency() const { return lastLatency; }
+
+uint32_t KeyInput::getMaxLatency() const { return maxLatency; }
+
+uint32_t KeyInput::getEdgeCount() const { return edgeCount; }
+
+uint32_t KeyInput::getEventCount() const { return eventCount; }
+
+uint32_t KeyInput::getDroppedCount() const { return droppedCount; }
+
+} // namespace APM
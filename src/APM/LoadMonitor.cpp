@@ -0,0 +1,187 @@
+/**
+ * Source code for LoadMonitor class
+ */
+
+#include <APM/LoadMonitor.hpp>
+#include <APM/utils/cycles.hpp>
+#include <HALf3/stm32f3xx.h>
+
+APM_BOARD_LOCAL APM::LoadMonitor *loadMonitorPtr = nullptr;
+
+namespace APM {
+
+void LoadMonitor::start() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  current = LoadContext::MAIN;
+  depth = 0;
+  lastSwitch = cycles::now();
+  for (LoadContextStats &stats : contextStats) {
+    stats = {};
+  }
+  sampledBusy = 0;
+  sampledTotal = 0;
+  nextSample = 0;
+  numSamples = 0;
+  peakLoad = 0;
+
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::enterInterrupt(LoadContext context) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint32_t now = cycles::now();
+  charge(now);
+  if (depth < MAX_NESTING) {
+    preempted[depth] = current;
+    entryCycles[depth] = now;
+  }
+  depth++;
+  current = context;
+  contextStats[static_cast<uint8_t>(context)].entries++;
+
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::exitInterrupt() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  if (depth == 0) {
+    // Unbalanced exit, leave the accounting as it is
+    __set_PRIMASK(primask);
+    return;
+  }
+
+  uint32_t now = cycles::now();
+  charge(now);
+  depth--;
+  if (depth < MAX_NESTING) {
+    LoadContextStats &stats = contextStats[static_cast<uint8_t>(current)];
+    uint32_t duration = now - entryCycles[depth];
+    if (duration > stats.maxCycles) {
+      stats.maxCycles = duration;
+    }
+    current = preempted[depth];
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::enterIdle() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  charge(cycles::now());
+  current = LoadContext::IDLE;
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::exitIdle() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  charge(cycles::now());
+  current = LoadContext::MAIN;
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::sample() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  charge(cycles::now());
+  uint64_t busy;
+  uint64_t total = sumCycles(busy);
+  __set_PRIMASK(primask);
+
+  uint64_t busyDelta = busy - sampledBusy;
+  uint64_t totalDelta = total - sampledTotal;
+  sampledBusy = busy;
+  sampledTotal = total;
+  if (totalDelta == 0) {
+    return;
+  }
+
+  auto load = static_cast<uint16_t>(busyDelta * 1000 / totalDelta);
+  samples[nextSample] = load;
+  nextSample = (nextSample + 1) % NUM_SAMPLES;
+  if (numSamples < NUM_SAMPLES) {
+    numSamples++;
+  }
+  if (load > peakLoad) {
+    peakLoad = load;
+  }
+}
+
+uint32_t LoadMonitor::getLoad(size_t count) const {
+  if (count > numSamples) {
+    count = numSamples;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  uint32_t sum = 0;
+  size_t index = nextSample;
+  for (size_t i = 0; i < count; i++) {
+    index = index == 0 ? NUM_SAMPLES - 1 : index - 1;
+    sum += samples[index];
+  }
+  return sum / count;
+}
+
+uint32_t LoadMonitor::getPeakLoad() const { return peakLoad; }
+
+void LoadMonitor::getContextStats(LoadContext context,
+                                  LoadContextStats &stats) const {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  stats = contextStats[static_cast<uint8_t>(context)];
+  __set_PRIMASK(primask);
+}
+
+uint64_t LoadMonitor::getElapsedCycles() const {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  uint64_t busy;
+  uint64_t total = sumCycles(busy);
+  // Include the time not yet charged to the running context
+  total += cycles::now() - lastSwitch;
+  __set_PRIMASK(primask);
+  return total;
+}
+
+void LoadMonitor::resetStats() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  charge(cycles::now());
+  for (LoadContextStats &stats : contextStats) {
+    stats = {};
+  }
+  sampledBusy = 0;
+  sampledTotal = 0;
+  peakLoad = 0;
+
+  __set_PRIMASK(primask);
+}
+
+void LoadMonitor::charge(uint32_t now) {
+  contextStats[static_cast<uint8_t>(current)].totalCycles += now - lastSwitch;
+  lastSwitch = now;
+}
+
+uint64_t LoadMonitor::sumCycles(uint64_t &busy) const {
+  uint64_t total = 0;
+  busy = 0;
+  for (size_t i = 0; i < NUM_CONTEXTS; i++) {
+    total += contextStats[i].totalCycles;
+    if (i != static_cast<size_t>(LoadContext::IDLE)) {
+      busy += contextStats[i].totalCycles;
+    }
+  }
+  return total;
+}
+
+} // namespace APM
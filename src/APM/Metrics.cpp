@@ -0,0 +1,79 @@
+/**
+ * Source code for the metrics registry
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <HALf3/stm32f3xx.h>
+
+namespace APM::metrics {
+
+APM_BOARD_LOCAL std::atomic<uint32_t> values[NUM_METRICS] = {};
+
+namespace {
+
+// Sequence number of the next CAN export
+APM_BOARD_LOCAL uint16_t exportSequence = 0;
+
+/**
+ * Sends one export frame on CAN_ID, counting a failed transmit as a CAN
+ * transmit error
+ * @param can the CAN device
+ * @param payload the 8 byte payload
+ * @return 0 on success
+ */
+int sendFrame(IO::CAN &can, uint8_t *payload) {
+  IO::CANMessage message(CAN_ID, 8, payload, true);
+  IO::CAN::CANStatus status = bus::transmit(can, message);
+
+  if (status != IO::CAN::CANStatus::OK) {
+    increment(Metric::CAN_TX_ERRORS);
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace
+
+void takeSnapshot(uint32_t (&snapshot)[NUM_METRICS]) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (size_t i = 0; i < NUM_METRICS; i++) {
+    snapshot[i] = values[i].load(std::memory_order_relaxed);
+  }
+  __set_PRIMASK(primask);
+}
+
+void print(APMUart &apmUart) {
+  uint32_t snapshot[NUM_METRICS];
+  takeSnapshot(snapshot);
+
+  for (size_t i = 0; i < NUM_METRICS; i++) {
+    apmUart.print(APM_FORMAT("\t{<20} {}\n\r"), METRICS[i].name, snapshot[i]);
+  }
+}
+
+int transmit(IO::CAN &can) {
+  uint32_t snapshot[NUM_METRICS];
+  takeSnapshot(snapshot);
+  uint16_t sequence = exportSequence++;
+
+  for (size_t i = 0; i < NUM_METRICS; i++) {
+    uint32_t value = snapshot[i];
+    uint8_t payload[8] = {static_cast<uint8_t>(i),
+                          static_cast<uint8_t>(METRICS[i].kind),
+                          static_cast<uint8_t>(value),
+                          static_cast<uint8_t>(value >> 8),
+                          static_cast<uint8_t>(value >> 16),
+                          static_cast<uint8_t>(value >> 24),
+                          static_cast<uint8_t>(sequence),
+                          static_cast<uint8_t>(sequence >> 8)};
+    if (sendFrame(can, payload) != 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+} // namespace APM::metrics
@@ -0,0 +1,201 @@
+/**
+ * Source code for PowerManager class
+ */
+
+#include <APM/LoadMonitor.hpp>
+#include <APM/PowerManager.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx_hal.h>
+
+namespace APM {
+
+int PowerManager::addPeriodicTask(void (*task)(void *), void *priv,
+                                  uint32_t period) {
+  if (numTasks >= MAX_TASKS || task == nullptr) {
+    return 1;
+  }
+
+  tasks[numTasks].task = task;
+  tasks[numTasks].priv = priv;
+  tasks[numTasks].period = period;
+  tasks[numTasks].nextRun = EVT::core::time::millis() + period;
+  numTasks++;
+
+  return 0;
+}
+
+int PowerManager::setTaskPeriod(void (*task)(void *), uint32_t period) {
+  for (size_t i = 0; i < numTasks; i++) {
+    if (tasks[i].task == task) {
+      tasks[i].period = period;
+      tasks[i].nextRun = EVT::core::time::millis() + period;
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void PowerManager::idle(APMMode mode) {
+  uint32_t sleepTime = runDueTasks(EVT::core::time::millis());
+
+  // The GFD handler needs a running tick in ON mode, and a sleep shorter than
+  // two ticks is not worth reprogramming SysTick for.  Sleep until the next
+  // interrupt instead, which is at most one tick away.
+  // Interrupts are held off across the WFI so the time taken by the handler
+  // that wakes the MCU is not counted as idle.
+  if (mode == APMMode::ON || sleepTime < 2) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    load::enterIdle();
+    uint32_t start = cycles::now();
+    __DSB();
+    __WFI();
+    __ISB();
+    uint32_t slept = cycles::now() - start;
+    load::exitIdle();
+    __set_PRIMASK(primask);
+
+    addIdleCycles(slept);
+    return;
+  }
+
+  idleTime += ticklessSleep(sleepTime);
+}
+
+void PowerManager::runTasks() {
+  static_cast<void>(runDueTasks(EVT::core::time::millis()));
+}
+
+uint32_t PowerManager::runDueTasks(uint32_t now) {
+  uint32_t sleepTime = MAX_IDLE_PERIOD;
+
+  for (size_t i = 0; i < numTasks; i++) {
+    PeriodicTask &periodicTask = tasks[i];
+    if (periodicTask.period == 0) {
+      continue;
+    }
+
+    if (static_cast<int32_t>(now - periodicTask.nextRun) >= 0) {
+      periodicTask.task(periodicTask.priv);
+      periodicTask.nextRun += periodicTask.period;
+
+      // Skip missed runs instead of running the task back to back
+      if (static_cast<int32_t>(now - periodicTask.nextRun) >= 0) {
+        periodicTask.nextRun = now + periodicTask.period;
+      }
+    }
+
+    uint32_t untilNextRun = periodicTask.nextRun - now;
+    if (untilNextRun < sleepTime) {
+      sleepTime = untilNextRun;
+    }
+  }
+
+  return sleepTime;
+}
+
+uint32_t PowerManager::ticklessSleep(uint32_t sleepTime) {
+  uint32_t cyclesPerTick = SystemCoreClock / 1000;
+  uint32_t maxSleepTime = SysTick_LOAD_RELOAD_Msk / cyclesPerTick;
+  if (sleepTime > maxSleepTime) {
+    sleepTime = maxSleepTime;
+  }
+
+  // Hold off interrupt handlers until the tick has been corrected.  WFI still
+  // wakes the core on a pending interrupt while PRIMASK is set.
+  __disable_irq();
+
+  // Reading CTRL clears COUNTFLAG
+  uint32_t ctrl = SysTick->CTRL;
+  SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+
+  // Finish the current tick, then sleep through the remaining ones
+  uint32_t reload = SysTick->VAL + (sleepTime - 1) * cyclesPerTick;
+  SysTick->LOAD = reload;
+  SysTick->VAL = 0;
+  SysTick->CTRL = ctrl | SysTick_CTRL_ENABLE_Msk;
+
+  load::enterIdle();
+  __DSB();
+  __WFI();
+  __ISB();
+  load::exitIdle();
+
+  // Read CTRL again once the counter is stopped, in case it reached zero
+  // between the two accesses
+  ctrl = SysTick->CTRL;
+  SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+  uint32_t countFlag = (ctrl | SysTick->CTRL) & SysTick_CTRL_COUNTFLAG_Msk;
+
+  uint32_t slept;
+  uint32_t skippedTicks;
+  uint32_t untilTick = cyclesPerTick;
+  if (countFlag) {
+    // Slept the whole period.  The pending SysTick interrupt adds the last
+    // tick once interrupts are enabled again.
+    slept = sleepTime;
+    skippedTicks = sleepTime - 1;
+  } else {
+    // Woken early by another interrupt.  The stretched tick ends on a tick
+    // boundary, so the ticks still ahead of it were not slept and the rest
+    // of the current one is what is left of it.
+    uint32_t remaining = SysTick->VAL;
+    uint32_t ticksLeft = (remaining + cyclesPerTick - 1) / cyclesPerTick;
+    slept = sleepTime - ticksLeft;
+    skippedTicks = slept;
+    untilTick = remaining - (ticksLeft - 1) * cyclesPerTick;
+
+    // Too close to the boundary to reprogram the counter in time, so count
+    // the tick now
+    if (untilTick < MIN_TICK_CYCLES) {
+      skippedTicks++;
+      untilTick = cyclesPerTick;
+    }
+  }
+
+  for (uint32_t i = 0; i < skippedTicks; i++) {
+    HAL_IncTick();
+  }
+
+  // Back to the regular 1 ms tick.  The first tick only covers the part of
+  // the current tick that was not slept, so early wakes do not make the HAL
+  // tick fall behind.  The counter takes LOAD on its first clock after VAL is
+  // cleared, after which the regular reload applies from the next tick on.
+  SysTick->LOAD = untilTick - 1;
+  SysTick->VAL = 0;
+  SysTick->CTRL = ctrl | SysTick_CTRL_ENABLE_Msk;
+  while (SysTick->VAL == 0) {
+  }
+  SysTick->LOAD = cyclesPerTick - 1;
+
+  __enable_irq();
+
+  return slept;
+}
+
+void PowerManager::addIdleCycles(uint32_t slept) {
+  uint32_t cyclesPerMs = SystemCoreClock / 1000;
+  idleCycles += slept;
+  idleTime += idleCycles / cyclesPerMs;
+  idleCycles %= cyclesPerMs;
+}
+
+uint32_t PowerManager::getIdlePercent() const {
+  uint32_t elapsed = EVT::core::time::millis() - windowStart;
+  if (elapsed == 0) {
+    return 0;
+  }
+  return static_cast<uint32_t>((static_cast<uint64_t>(idleTime) * 100) /
+                               elapsed);
+}
+
+uint32_t PowerManager::getIdleTime() const { return idleTime; }
+
+void PowerManager::resetIdleStats() {
+  windowStart = EVT::core::time::millis();
+  idleTime = 0;
+  idleCycles = 0;
+}
+
+} // namespace APM
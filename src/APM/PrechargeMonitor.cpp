@@ -0,0 +1,79 @@
+/**
+ * Source code for PrechargeMonitor class
+ */
+
+#include <APM/GFDSupervisor.hpp>
+#include <APM/PrechargeMonitor.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+
+namespace APM {
+
+PrechargeMonitor::PrechargeMonitor(IO::ADC &busSense, IO::ADC &packSense)
+    : busSense(busSense), packSense(packSense) {}
+
+int PrechargeMonitor::wait(uint32_t percent, uint32_t timeout) {
+  uint32_t samplePeriod = SystemCoreClock / 1000000 * SAMPLE_PERIOD;
+  uint32_t startTime = EVT::core::time::millis();
+  uint32_t lastSample = cycles::now() - samplePeriod;
+  reset();
+
+  while (EVT::core::time::millis() - startTime < timeout) {
+    uint32_t now = cycles::now();
+    if (now - lastSample < samplePeriod) {
+      continue;
+    }
+    lastSample = now;
+    supervisor::keepAlive();
+
+    if (update(busSense.readRaw(), packSense.readRaw(), percent)) {
+      duration = EVT::core::time::millis() - startTime;
+      return 0;
+    }
+  }
+
+  duration = EVT::core::time::millis() - startTime;
+  return 1;
+}
+
+bool PrechargeMonitor::update(uint32_t bus, uint32_t pack, uint32_t percent) {
+  // Seed the averages with the first sample, so they do not have to climb up
+  // from 0 first
+  if (samples == 0) {
+    busFiltered = bus << FILTER_SHIFT;
+    packFiltered = pack << FILTER_SHIFT;
+  } else {
+    busFiltered += bus - (busFiltered >> FILTER_SHIFT);
+    packFiltered += pack - (packFiltered >> FILTER_SHIFT);
+  }
+  samples++;
+
+  // A single sample could be a spike, so give the averages a full window
+  if (samples < (1u << FILTER_SHIFT)) {
+    return false;
+  }
+  if (getPackReading() < MIN_PACK_READING) {
+    return false;
+  }
+  return busFiltered * 100 >= packFiltered * percent;
+}
+
+void PrechargeMonitor::reset() {
+  busFiltered = 0;
+  packFiltered = 0;
+  samples = 0;
+}
+
+uint32_t PrechargeMonitor::getBusReading() const {
+  return busFiltered >> FILTER_SHIFT;
+}
+
+uint32_t PrechargeMonitor::getPackReading() const {
+  return packFiltered >> FILTER_SHIFT;
+}
+
+uint32_t PrechargeMonitor::getDuration() const { return duration; }
+
+uint32_t PrechargeMonitor::getSampleCount() const { return samples; }
+
+} // namespace APM
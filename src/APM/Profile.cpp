@@ -0,0 +1,166 @@
+/**
+ * Source code for span profiling
+ */
+
+#include <APM/BusMonitor.hpp>
+#include <APM/Profile.hpp>
+#include <HALf3/stm32f3xx.h>
+
+namespace APM::profile {
+
+APM_BOARD_LOCAL SpanStats spanStats[NUM_SPANS] = {};
+
+namespace {
+
+/**
+ * Converts cycles to microseconds, saturated to a number of bits
+ * @param cycles the duration in cycles
+ * @param bits the width of the result
+ * @return the duration in us
+ */
+uint32_t toSaturatedMicros(uint64_t cycles, uint8_t bits) {
+  uint64_t limit = (1ull << bits) - 1;
+  uint64_t cyclesPerMicro = SystemCoreClock / 1000000;
+  uint64_t micros = cyclesPerMicro == 0 ? 0 : cycles / cyclesPerMicro;
+  return static_cast<uint32_t>(micros < limit ? micros : limit);
+}
+
+/**
+ * Stores a value little endian
+ * @param out the buffer to write
+ * @param value the value
+ * @param bytes the number of bytes to write
+ */
+void putLittleEndian(uint8_t *out, uint32_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+/**
+ * Sends a frame with interrupts disabled, since the GFD poll interrupt also
+ * transmits on the same CAN device
+ * @param can the CAN device
+ * @param payload the 8 byte payload
+ * @return 0 on success
+ */
+int sendFrame(IO::CAN &can, uint8_t *payload) {
+  IO::CANMessage message(CAN_ID, 8, payload, true);
+  IO::CAN::CANStatus status = bus::transmit(can, message);
+
+  return status == IO::CAN::CANStatus::OK ? 0 : 1;
+}
+
+} // namespace
+
+void getStats(Span span, SpanStats &stats) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  stats = spanStats[static_cast<uint8_t>(span)];
+  __set_PRIMASK(primask);
+}
+
+void reset() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  for (SpanStats &stats : spanStats) {
+    stats = {};
+  }
+  __set_PRIMASK(primask);
+}
+
+const char *getName(Span span) {
+  switch (span) {
+  case Span::ACCESSORY_TO_ON:
+    return "ACCESSORY -> ON";
+  case Span::ON_TO_ACCESSORY:
+    return "ON -> ACCESSORY";
+  case Span::TRIP_TO_ACCESSORY:
+    return "GFD trip";
+  case Span::GFD_POLL:
+    return "GFD poll";
+  }
+  return "unknown";
+}
+
+void print(APMUart &apmUart) {
+  bool any = false;
+
+  for (uint8_t i = 0; i < NUM_SPANS; i++) {
+    auto span = static_cast<Span>(i);
+    SpanStats stats;
+    getStats(span, stats);
+    if (stats.count == 0) {
+      continue;
+    }
+    any = true;
+
+    apmUart.print(APM_FORMAT("{}: n={} min={} us mean={} us max={} us\n\r"),
+                  getName(span), stats.count,
+                  cycles::toMicros(stats.minCycles),
+                  toSaturatedMicros(stats.totalCycles / stats.count, 32),
+                  cycles::toMicros(stats.maxCycles));
+
+    for (uint8_t bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      if (stats.buckets[bucket] == 0) {
+        continue;
+      }
+      apmUart.print(APM_FORMAT("\t>= {} us: {}\n\r"),
+                    cycles::toMicros(getBucketStart(bucket)),
+                    stats.buckets[bucket]);
+    }
+  }
+
+  if (!any) {
+    apmUart.printString("No spans recorded\n\r");
+  }
+}
+
+int transmit(IO::CAN &can) {
+  constexpr uint8_t BUCKETS_PER_FRAME = 3;
+
+  for (uint8_t i = 0; i < NUM_SPANS; i++) {
+    SpanStats stats;
+    getStats(static_cast<Span>(i), stats);
+    if (stats.count == 0) {
+      continue;
+    }
+
+    uint8_t payload[8] = {i, 0};
+    putLittleEndian(&payload[2], stats.count, 4);
+    putLittleEndian(&payload[6],
+                    toSaturatedMicros(stats.totalCycles / stats.count, 16), 2);
+    if (sendFrame(can, payload) != 0) {
+      return 1;
+    }
+
+    payload[1] = 1;
+    putLittleEndian(&payload[2], toSaturatedMicros(stats.minCycles, 24), 3);
+    putLittleEndian(&payload[5], toSaturatedMicros(stats.maxCycles, 24), 3);
+    if (sendFrame(can, payload) != 0) {
+      return 1;
+    }
+
+    for (uint8_t first = 0; first < NUM_BUCKETS; first += BUCKETS_PER_FRAME) {
+      bool nonZero = false;
+      payload[1] = static_cast<uint8_t>(2 + first / BUCKETS_PER_FRAME);
+      for (uint8_t j = 0; j < BUCKETS_PER_FRAME; j++) {
+        uint32_t count = stats.buckets[first + j];
+        nonZero |= count != 0;
+        putLittleEndian(&payload[2 + 2 * j], count < 0xFFFF ? count : 0xFFFF,
+                        2);
+      }
+      if (!nonZero) {
+        continue;
+      }
+
+      if (sendFrame(can, payload) != 0) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+} // namespace APM::profile
@@ -0,0 +1,226 @@
+/**
+ * Source code for SwitchMonitor class
+ */
+
+#include <APM/Metrics.hpp>
+#include <APM/SwitchMonitor.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
+
+namespace APM {
+
+namespace {
+
+/**
+ * A watched switch
+ */
+struct WatchedSwitch {
+  // APMManager::OUTPUT_ bit of the switch
+  uint8_t output;
+  // Pin driving the switch
+  IO::Pin pin;
+  // Pin reading the switch back
+  IO::Pin sense;
+  // Time the switch gets to follow a new command in ms
+  uint32_t settleTime;
+  const char *name;
+};
+
+// Every watched switch, indexed by the bit position of its output bit
+constexpr WatchedSwitch WATCHED[SwitchMonitor::NUM_SWITCHES] = {
+    {APMManager::OUTPUT_MC_ON, APMManager::MC_ON, SwitchMonitor::MC_SENSE,
+     SwitchMonitor::RELAY_SETTLE_TIME, "MC relay"},
+    {APMManager::OUTPUT_ACCESSORY_SW, APMManager::ACCESSORY_SW,
+     SwitchMonitor::ACCESSORY_SENSE, SwitchMonitor::SWITCH_SETTLE_TIME,
+     "Accessory"},
+    {APMManager::OUTPUT_CHARGE_SW, APMManager::CHARGE_SW,
+     SwitchMonitor::CHARGE_SENSE, SwitchMonitor::SWITCH_SETTLE_TIME, "Charge"},
+    {APMManager::OUTPUT_VICOR_SW, APMManager::VICOR_SW,
+     SwitchMonitor::VICOR_SENSE, SwitchMonitor::SWITCH_SETTLE_TIME, "Vicor"},
+};
+
+/**
+ * Checks that WATCHED is indexed by the bit position of each output bit
+ * @return true if every entry is in place
+ */
+constexpr bool isTableOrdered() {
+  for (size_t i = 0; i < SwitchMonitor::NUM_SWITCHES; i++) {
+    if (WATCHED[i].output != 1u << i) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(isTableOrdered(), "WATCHED must follow the OUTPUT_ bits");
+static_assert(pins::getPort(APMManager::MC_ON) ==
+                      pins::getPort(APMManager::ACCESSORY_SW) &&
+                  pins::getPort(APMManager::MC_ON) ==
+                      pins::getPort(APMManager::CHARGE_SW) &&
+                  pins::getPort(APMManager::MC_ON) ==
+                      pins::getPort(APMManager::VICOR_SW),
+              "Switch outputs must share a port to be read at once");
+
+/**
+ * Counts the switches in a set of output bits
+ * @param switches the switches
+ * @return the number of bits set
+ */
+uint32_t countSwitches(uint8_t switches) {
+  uint32_t count = 0;
+  for (; switches != 0; switches &= switches - 1) {
+    count++;
+  }
+  return count;
+}
+
+} // namespace
+
+int SwitchMonitor::verify(uint8_t switches) {
+  uint32_t settleTime = 0;
+  for (const WatchedSwitch &watched : WATCHED) {
+    if ((switches & watched.output) != 0 && watched.settleTime > settleTime) {
+      settleTime = watched.settleTime;
+    }
+  }
+
+  uint8_t commanded = getCommanded();
+  uint32_t start = cycles::now();
+  uint32_t startTime = EVT::core::time::millis();
+  while (true) {
+    uint8_t sensed = getSensed();
+    uint8_t wrong = (commanded ^ sensed) & switches;
+    if (wrong == 0) {
+      lastVerifyTime = cycles::toMicros(cycles::now() - start);
+      lastVerifyFailed = false;
+      return 0;
+    }
+
+    if (EVT::core::time::millis() - startTime >= settleTime) {
+      lastVerifyTime = cycles::toMicros(cycles::now() - start);
+      lastVerifyFailed = true;
+      latch(wrong, commanded, sensed);
+      return 1;
+    }
+    EVT::core::time::wait(1);
+  }
+}
+
+uint8_t SwitchMonitor::check() {
+  uint32_t now = EVT::core::time::millis();
+  uint8_t commanded = getCommanded();
+  uint8_t sensed = getSensed();
+  uint8_t changed = started ? commanded ^ lastCommanded : SWITCHES;
+  started = true;
+  lastCommanded = commanded;
+
+  uint8_t confirmed = 0;
+  for (size_t i = 0; i < NUM_SWITCHES; i++) {
+    const WatchedSwitch &watched = WATCHED[i];
+    if ((changed & watched.output) != 0) {
+      commandTime[i] = now;
+      mismatches[i] = 0;
+      continue;
+    }
+
+    if (((commanded ^ sensed) & watched.output) == 0 ||
+        now - commandTime[i] < watched.settleTime) {
+      mismatches[i] = 0;
+      continue;
+    }
+
+    if (mismatches[i] < CONFIRM_SAMPLES) {
+      mismatches[i]++;
+    }
+    if (mismatches[i] >= CONFIRM_SAMPLES) {
+      confirmed |= watched.output;
+    }
+  }
+
+  return latch(confirmed, commanded, sensed);
+}
+
+uint8_t SwitchMonitor::getCommanded() const {
+  uint32_t levels = pins::getRegisters(APMManager::MC_ON)->ODR;
+  uint8_t commanded = 0;
+  for (const WatchedSwitch &watched : WATCHED) {
+    if ((levels & pins::getMask(watched.pin)) != 0) {
+      commanded |= watched.output;
+    }
+  }
+  return commanded;
+}
+
+uint8_t SwitchMonitor::getSensed() const {
+  uint32_t levels = pins::getRegisters(MC_SENSE)->IDR;
+  uint8_t sensed = 0;
+  for (const WatchedSwitch &watched : WATCHED) {
+    if ((levels & pins::getMask(watched.sense)) != 0) {
+      sensed |= watched.output;
+    }
+  }
+  return sensed;
+}
+
+uint8_t SwitchMonitor::getWelded() const { return welded; }
+
+uint8_t SwitchMonitor::getStuckOpen() const { return stuckOpen; }
+
+void SwitchMonitor::clear() {
+  welded = 0;
+  stuckOpen = 0;
+  for (uint8_t &count : mismatches) {
+    count = 0;
+  }
+}
+
+void SwitchMonitor::print(APMUart &apmUart) const {
+  uint8_t commanded = getCommanded();
+  uint8_t sensed = getSensed();
+
+  apmUart.printString("Switch    Commanded Sensed Fault\n\r");
+  for (const WatchedSwitch &watched : WATCHED) {
+    const char *fault = "-";
+    if ((welded & watched.output) != 0) {
+      fault = "welded";
+    } else if ((stuckOpen & watched.output) != 0) {
+      fault = "stuck open";
+    }
+    apmUart.print(APM_FORMAT("{<9} {<9} {<6} {}\n\r"), watched.name,
+                  (commanded & watched.output) != 0 ? "closed" : "open",
+                  (sensed & watched.output) != 0 ? "closed" : "open", fault);
+  }
+
+  apmUart.print(APM_FORMAT("Faults latched: {}, last verify {} after {} "
+                           "us\n\r"),
+                faultCount, lastVerifyFailed ? "failed" : "passed",
+                lastVerifyTime);
+}
+
+uint8_t SwitchMonitor::latch(uint8_t switches, uint8_t commanded,
+                             uint8_t sensed) {
+  uint8_t newlyWelded = switches & ~commanded & sensed & ~welded;
+  uint8_t newlyStuckOpen = switches & commanded & ~sensed & ~stuckOpen;
+  welded |= newlyWelded;
+  stuckOpen |= newlyStuckOpen;
+
+  uint8_t latched = newlyWelded | newlyStuckOpen;
+  uint32_t count = countSwitches(latched);
+  if (count != 0) {
+    faultCount += count;
+    metrics::increment(metrics::Metric::SWITCH_FAULTS, count);
+  }
+  return latched;
+}
+
+const char *getSwitchName(uint8_t output) {
+  for (const WatchedSwitch &watched : WATCHED) {
+    if (watched.output == output) {
+      return watched.name;
+    }
+  }
+  return "unknown";
+}
+
+} // namespace APM
@@ -0,0 +1,443 @@
+/**
+ * Source code for the telemetry stream and decoder
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/BusMonitor.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Telemetry.hpp>
+#include <APM/utils/crc.hpp>
+#include <EVT/utils/time.hpp>
+
+namespace APM {
+
+namespace {
+
+// Bytes of the CRC at the end of a packet
+constexpr size_t CRC_SIZE = 2;
+
+// Longest varint of a 32 bit value in bytes
+constexpr size_t MAX_VARINT_SIZE = 5;
+
+// Mask of every signal
+constexpr uint32_t ALL_SIGNALS = (1u << NUM_TELEMETRY_SIGNALS) - 1;
+
+/**
+ * Maps a signed value onto an unsigned one, small magnitudes first, so it
+ * makes a short varint
+ * @param value the value
+ * @return the zigzag encoding
+ */
+uint32_t zigzag(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+/**
+ * Reverses zigzag()
+ * @param value the zigzag encoding
+ * @return the value
+ */
+int32_t unzigzag(uint32_t value) {
+  return static_cast<int32_t>((value >> 1) ^ (0u - (value & 1u)));
+}
+
+/**
+ * Returns the number of bytes a value takes as a varint
+ * @param value the value
+ * @return the number of bytes
+ */
+size_t getVarintSize(uint32_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+/**
+ * Reads a varint of at most 32 bits
+ * @param data the buffer
+ * @param size the number of bytes in data
+ * @param offset the offset of the varint, moved past it
+ * @param value set to the value
+ * @return true on success, false if the varint is cut short or too long
+ */
+bool readVarint(const uint8_t *data, size_t size, size_t &offset,
+                uint32_t &value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (offset >= size) {
+      return false;
+    }
+    uint8_t byte = data[offset++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Returns the name of a link
+ * @param link the link
+ * @return the name, for printing
+ */
+const char *getName(TelemetryLink link) {
+  switch (link) {
+  case TelemetryLink::OFF:
+    return "OFF";
+  case TelemetryLink::UART:
+    return "UART";
+  case TelemetryLink::CAN:
+    return "CAN";
+  }
+  return "UNKNOWN";
+}
+
+} // namespace
+
+TelemetryStream::TelemetryStream(APMManager &manager, IO::UART &uart,
+                                 IO::CAN &can)
+    : manager(manager), uart(uart), can(can) {}
+
+void TelemetryStream::start(TelemetryLink link) {
+  stop();
+  if (link == TelemetryLink::OFF) {
+    return;
+  }
+
+  const config::Config &settings = config::get();
+  signals = settings.telemetrySignals & ALL_SIGNALS;
+  period = settings.telemetryPeriod;
+
+  // The time, the changed signals and the largest difference of each signal
+  maxSampleSize = MAX_VARINT_SIZE + getVarintSize(signals);
+  for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+    if ((signals & (1u << i)) != 0) {
+      maxSampleSize += MAX_VARINT_SIZE;
+    }
+  }
+
+  packetSize = 0;
+  packetSamples = 0;
+  resync = true;
+  startTime = EVT::core::time::millis();
+  packetCount = 0;
+  sampleCount = 0;
+  byteCount = 0;
+  sendErrors = 0;
+  this->link = link;
+}
+
+void TelemetryStream::stop() {
+  if (link == TelemetryLink::OFF) {
+    return;
+  }
+  if (packetSamples > 0) {
+    flush();
+  }
+  link = TelemetryLink::OFF;
+  period = 0;
+}
+
+void TelemetryStream::sample() {
+  if (link == TelemetryLink::OFF) {
+    return;
+  }
+
+  uint32_t now = EVT::core::time::millis();
+  if (packetSamples == 0) {
+    frame[2] = static_cast<uint8_t>(sequence);
+    frame[3] = static_cast<uint8_t>(sequence >> 8);
+    packetSize = 2;
+    putVarint(signals);
+    putVarint(period);
+    putVarint(now);
+    firstTime = now;
+    for (uint32_t &value : lastValues) {
+      value = 0;
+    }
+  } else {
+    putVarint(zigzag(static_cast<int32_t>(now - lastTime - period)));
+  }
+  lastTime = now;
+
+  uint32_t values[NUM_TELEMETRY_SIGNALS];
+  uint32_t changed = 0;
+  for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+    if ((signals & (1u << i)) == 0) {
+      continue;
+    }
+    values[i] = read(static_cast<TelemetrySignal>(i));
+    if (values[i] != lastValues[i]) {
+      changed |= 1u << i;
+    }
+  }
+
+  putVarint(changed);
+  for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+    if ((changed & (1u << i)) != 0) {
+      putVarint(zigzag(static_cast<int32_t>(values[i] - lastValues[i])));
+      lastValues[i] = values[i];
+    }
+  }
+  packetSamples++;
+  sampleCount++;
+
+  if (packetSamples >= MAX_SAMPLES || now - firstTime >= MAX_PACKET_TIME ||
+      packetSize + maxSampleSize + CRC_SIZE > MAX_PACKET_SIZE) {
+    flush();
+  }
+}
+
+TelemetryLink TelemetryStream::getLink() const { return link; }
+
+uint32_t TelemetryStream::getPeriod() const { return period; }
+
+void TelemetryStream::print(APMUart &apmUart) const {
+  if (link == TelemetryLink::OFF) {
+    apmUart.printString("Telemetry: stopped\n\r");
+  } else {
+    apmUart.print(APM_FORMAT("Telemetry: streaming on {} every {} ms\n\r"),
+                  getName(link), period);
+  }
+
+  uint32_t selected =
+      link == TelemetryLink::OFF ? config::get().telemetrySignals : signals;
+  apmUart.printString("Signals:");
+  for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+    if ((selected & (1u << i)) != 0) {
+      apmUart.print(APM_FORMAT(" {}"), TELEMETRY_SIGNALS[i]);
+    }
+  }
+  apmUart.printString("\n\r");
+
+  // Up to the last sample, so the rate of a stopped stream is kept
+  uint32_t elapsed = lastTime - startTime;
+  uint32_t rate = 0;
+  if (sampleCount != 0 && elapsed != 0) {
+    rate = static_cast<uint32_t>(static_cast<uint64_t>(byteCount) * 1000 /
+                                 elapsed);
+  }
+  apmUart.print(APM_FORMAT("Sent {} packets, {} samples, {} bytes ({} "
+                           "bytes/s), {} send errors\n\r"),
+                packetCount, sampleCount, byteCount, rate, sendErrors);
+}
+
+uint32_t TelemetryStream::read(TelemetrySignal signal) const {
+  switch (signal) {
+  case TelemetrySignal::MODE:
+    return metrics::get(metrics::Metric::MODE);
+  case TelemetrySignal::OUTPUTS:
+    return manager.getOutputs();
+  case TelemetrySignal::ISOLATION_RESISTANCE:
+    return metrics::get(metrics::Metric::ISOLATION_RESISTANCE);
+  case TelemetrySignal::ISOLATION_WARNING:
+    return metrics::get(metrics::Metric::ISOLATION_WARNING);
+  case TelemetrySignal::ISOLATION_TIME_TO_TRIP:
+    return metrics::get(metrics::Metric::ISOLATION_TIME_TO_TRIP);
+  case TelemetrySignal::HEALTHY_GFD_UNITS:
+    return metrics::get(metrics::Metric::HEALTHY_GFD_UNITS);
+  case TelemetrySignal::GFD_AGE:
+    return gfdSupervisorPtr == nullptr ? 0 : gfdSupervisorPtr->getAge();
+  case TelemetrySignal::GFD_TRIPS:
+    return metrics::get(metrics::Metric::GFD_TRIPS);
+  case TelemetrySignal::CPU_LOAD:
+    return metrics::get(metrics::Metric::CPU_LOAD);
+  case TelemetrySignal::BUS_LOAD:
+    return busMonitorPtr == nullptr ? 0 : busMonitorPtr->getLoad(1);
+  case TelemetrySignal::BACKUP_BATTERY_SOC:
+    return metrics::get(metrics::Metric::BACKUP_BATTERY_SOC);
+  }
+  return 0;
+}
+
+void TelemetryStream::flush() {
+  uint16_t crc = crc::crc16(&frame[2], packetSize);
+  frame[2 + packetSize++] = static_cast<uint8_t>(crc);
+  frame[2 + packetSize++] = static_cast<uint8_t>(crc >> 8);
+
+  // COBS: every 0 in the packet, and the code byte in front of it, holds the
+  // distance to the next 0.  The packet fits one block, so no other codes are
+  // needed.
+  size_t end = 2 + packetSize;
+  frame[end] = 0;
+  size_t next = end;
+  for (size_t i = end - 1; i >= 2; i--) {
+    if (frame[i] == 0) {
+      frame[i] = static_cast<uint8_t>(next - i);
+      next = i;
+    }
+  }
+  frame[1] = static_cast<uint8_t>(next - 1);
+
+  size_t first = resync ? 0 : 1;
+  frame[0] = 0;
+  resync = false;
+  if (send(&frame[first], end + 1 - first) == 0) {
+    byteCount += end + 1 - first;
+  }
+
+  packetCount++;
+  sequence++;
+  packetSize = 0;
+  packetSamples = 0;
+}
+
+void TelemetryStream::putVarint(uint32_t value) {
+  while (value >= 0x80) {
+    frame[2 + packetSize++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  frame[2 + packetSize++] = static_cast<uint8_t>(value);
+}
+
+int TelemetryStream::send(uint8_t *data, size_t size) {
+  if (link == TelemetryLink::UART) {
+    uart.writeBytes(data, size);
+    return 0;
+  }
+
+  for (size_t offset = 0; offset < size; offset += 8) {
+    size_t length = size - offset < 8 ? size - offset : 8;
+    IO::CANMessage message(CAN_ID, static_cast<uint8_t>(length),
+                           &data[offset], true);
+
+    IO::CAN::CANStatus status = bus::transmit(can, message);
+
+    // The rest of the packet is useless to the receiver
+    if (status != IO::CAN::CANStatus::OK) {
+      sendErrors++;
+      resync = true;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+bool TelemetryDecoder::push(uint8_t byte) {
+  if (byte != 0) {
+    if (frameSize < sizeof(frame)) {
+      frame[frameSize++] = byte;
+    } else {
+      overflow = true;
+    }
+    return false;
+  }
+
+  // A 0 on its own only resynchronises
+  if (frameSize == 0 && !overflow) {
+    return false;
+  }
+
+  bool valid = !overflow && decodeFrame() == 0;
+  frameSize = 0;
+  overflow = false;
+  if (!valid) {
+    badFrameCount++;
+    return false;
+  }
+
+  if (synced) {
+    lostPacketCount +=
+        static_cast<uint16_t>(packet.sequence - nextSequence);
+  }
+  synced = true;
+  nextSequence = packet.sequence + 1;
+  packetCount++;
+  return true;
+}
+
+const TelemetryPacket &TelemetryDecoder::getPacket() const { return packet; }
+
+uint32_t TelemetryDecoder::getPacketCount() const { return packetCount; }
+
+uint32_t TelemetryDecoder::getBadFrameCount() const { return badFrameCount; }
+
+uint32_t TelemetryDecoder::getLostPacketCount() const {
+  return lostPacketCount;
+}
+
+int TelemetryDecoder::decodeFrame() {
+  // Undo the COBS encoding in place.  Every code is followed by code - 1
+  // bytes, then a 0 unless it is the last block.
+  size_t size = 0;
+  for (size_t offset = 0; offset < frameSize;) {
+    uint8_t code = frame[offset++];
+    if (offset + code - 1 > frameSize) {
+      return 1;
+    }
+    for (uint8_t i = 1; i < code; i++) {
+      frame[size++] = frame[offset++];
+    }
+    if (code != 0xFF && offset < frameSize) {
+      frame[size++] = 0;
+    }
+  }
+
+  if (size < 2 + CRC_SIZE) {
+    return 1;
+  }
+  size -= CRC_SIZE;
+  uint16_t crc = frame[size] | (frame[size + 1] << 8);
+  if (crc::crc16(frame, size) != crc) {
+    return 1;
+  }
+
+  packet.sequence = static_cast<uint16_t>(frame[0] | (frame[1] << 8));
+  size_t offset = 2;
+  if (!readVarint(frame, size, offset, packet.signals) ||
+      packet.signals == 0 || (packet.signals & ~ALL_SIGNALS) != 0 ||
+      !readVarint(frame, size, offset, packet.period)) {
+    return 1;
+  }
+
+  packet.numSamples = 0;
+  uint32_t time = 0;
+  uint32_t values[NUM_TELEMETRY_SIGNALS] = {};
+  while (offset < size) {
+    if (packet.numSamples == TelemetryStream::MAX_SAMPLES) {
+      return 1;
+    }
+
+    uint32_t field;
+    if (!readVarint(frame, size, offset, field)) {
+      return 1;
+    }
+    if (packet.numSamples == 0) {
+      time = field;
+    } else {
+      time += packet.period + static_cast<uint32_t>(unzigzag(field));
+    }
+
+    uint32_t changed;
+    if (!readVarint(frame, size, offset, changed) ||
+        (changed & ~packet.signals) != 0) {
+      return 1;
+    }
+    for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+      if ((changed & (1u << i)) == 0) {
+        continue;
+      }
+      uint32_t delta;
+      if (!readVarint(frame, size, offset, delta)) {
+        return 1;
+      }
+      values[i] += static_cast<uint32_t>(unzigzag(delta));
+    }
+
+    packet.times[packet.numSamples] = time;
+    for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+      packet.values[packet.numSamples][i] = values[i];
+    }
+    packet.numSamples++;
+  }
+
+  return packet.numSamples == 0 ? 1 : 0;
+}
+
+} // namespace APM
@@ -0,0 +1,359 @@
+/**
+ * Source code for the trace writer, reader and recorder
+ */
+
+#include <APM/Trace.hpp>
+#include <APM/utils/cycles.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
+
+APM_BOARD_LOCAL APM::TraceRecorder *traceRecorderPtr = nullptr;
+
+namespace APM {
+
+namespace {
+
+/**
+ * Encodes a value as a varint
+ * @param out buffer with room for at least 10 bytes
+ * @param value the value to encode
+ * @return the number of bytes written
+ */
+size_t encodeVarint(uint8_t *out, uint64_t value) {
+  size_t length = 0;
+  while (value >= 0x80) {
+    out[length++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  out[length++] = static_cast<uint8_t>(value);
+  return length;
+}
+
+/**
+ * Returns whether an event type carries a GPIO pin
+ * @param type the event type
+ * @return true for GPIO events
+ */
+constexpr bool isGPIOEvent(TraceEventType type) {
+  return type == TraceEventType::GPIO_INPUT ||
+         type == TraceEventType::GPIO_OUTPUT;
+}
+
+/**
+ * Returns whether an event type carries a CAN frame
+ * @param type the event type
+ * @return true for CAN events
+ */
+constexpr bool isCANEvent(TraceEventType type) {
+  return type == TraceEventType::CAN_RX || type == TraceEventType::CAN_TX;
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(uint8_t *buffer, size_t size)
+    : buffer(buffer), capacity(size) {}
+
+int TraceWriter::start() {
+  size = 0;
+  lastTime = 0;
+
+  if (capacity < HEADER_SIZE) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    buffer[i] = static_cast<uint8_t>(MAGIC >> (8 * i));
+  }
+  buffer[4] = VERSION;
+  buffer[5] = 0;
+  buffer[6] = 0;
+  buffer[7] = 0;
+  size = HEADER_SIZE;
+
+  return 0;
+}
+
+int TraceWriter::write(const TraceEvent &event) {
+  uint8_t encoded[MAX_EVENT_SIZE];
+  size_t length = 0;
+  uint8_t aux = 0;
+
+  if (isCANEvent(event.type)) {
+    aux = event.length > 8 ? 8 : event.length;
+  } else if (isGPIOEvent(event.type)) {
+    aux = event.level ? 1 : 0;
+  } else {
+    aux = static_cast<uint8_t>(event.id & 0x0F);
+  }
+
+  encoded[length++] = static_cast<uint8_t>(event.type) | (aux << 4);
+  length += encodeVarint(&encoded[length], event.time - lastTime);
+
+  if (isCANEvent(event.type)) {
+    uint64_t idField = (static_cast<uint64_t>(event.id) << 1) |
+                       (event.extended ? 1u : 0u);
+    length += encodeVarint(&encoded[length], idField);
+    for (uint8_t i = 0; i < aux; i++) {
+      encoded[length++] = event.data[i];
+    }
+  } else if (isGPIOEvent(event.type)) {
+    encoded[length++] = static_cast<uint8_t>(event.id);
+  }
+
+  if (capacity - size < length) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    buffer[size + i] = encoded[i];
+  }
+  size += length;
+  lastTime = event.time;
+
+  return 0;
+}
+
+void TraceWriter::clearBuffer() { size = 0; }
+
+size_t TraceWriter::getSize() const { return size; }
+
+const uint8_t *TraceWriter::getData() const { return buffer; }
+
+TraceReader::TraceReader(const uint8_t *data, size_t size)
+    : data(data), size(size) {}
+
+int TraceReader::start() {
+  offset = 0;
+  lastTime = 0;
+
+  if (size < TraceWriter::HEADER_SIZE) {
+    return 1;
+  }
+
+  uint32_t magic = 0;
+  for (size_t i = 0; i < 4; i++) {
+    magic |= static_cast<uint32_t>(data[i]) << (8 * i);
+  }
+  if (magic != TraceWriter::MAGIC || data[4] != TraceWriter::VERSION) {
+    return 1;
+  }
+
+  offset = TraceWriter::HEADER_SIZE;
+  return 0;
+}
+
+int TraceReader::next(TraceEvent &event) {
+  if (offset >= size) {
+    return 1;
+  }
+
+  uint8_t typeByte = data[offset++];
+  uint8_t aux = typeByte >> 4;
+  event.type = static_cast<TraceEventType>(typeByte & 0x0F);
+
+  uint64_t delta;
+  if (!readVarint(delta)) {
+    return 2;
+  }
+  lastTime += delta;
+  event.time = lastTime;
+  event.extended = false;
+  event.level = false;
+  event.length = 0;
+
+  switch (event.type) {
+  case TraceEventType::CAN_RX:
+  case TraceEventType::CAN_TX: {
+    uint64_t idField;
+    if (aux > 8 || !readVarint(idField) || size - offset < aux) {
+      return 2;
+    }
+    event.id = static_cast<uint32_t>(idField >> 1);
+    event.extended = (idField & 1u) != 0;
+    event.length = aux;
+    for (uint8_t i = 0; i < aux; i++) {
+      event.data[i] = data[offset++];
+    }
+    break;
+  }
+  case TraceEventType::GPIO_INPUT:
+  case TraceEventType::GPIO_OUTPUT:
+    if (offset >= size) {
+      return 2;
+    }
+    event.id = data[offset++];
+    event.level = aux != 0;
+    break;
+  case TraceEventType::TIMER:
+    event.id = aux;
+    break;
+  default:
+    return 2;
+  }
+
+  return 0;
+}
+
+bool TraceReader::readVarint(uint64_t &value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 64; shift += 7) {
+    if (offset >= size) {
+      return false;
+    }
+    uint8_t byte = data[offset++];
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+TraceRecorder::TraceRecorder(uint8_t *buffer, size_t size)
+    : writer(buffer, size) {}
+
+int TraceRecorder::start() {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  int status = writer.start();
+  recording = status == 0;
+  droppedCount = 0;
+  time = 0;
+  lastCycles = cycles::now();
+  lastMillis = EVT::core::time::millis();
+  for (uint8_t port = 0; port < NUM_PORTS; port++) {
+    outputLevels[port] = 0;
+    outputKnown[port] = 0;
+  }
+
+  __set_PRIMASK(primask);
+  return status;
+}
+
+void TraceRecorder::stop() { recording = false; }
+
+bool TraceRecorder::isRecording() const { return recording; }
+
+uint32_t TraceRecorder::getDroppedCount() const { return droppedCount; }
+
+const uint8_t *TraceRecorder::getData() const { return writer.getData(); }
+
+size_t TraceRecorder::getSize() const { return writer.getSize(); }
+
+void TraceRecorder::recordCAN(TraceEventType type, IO::CANMessage &message) {
+  TraceEvent event;
+  event.type = type;
+  event.id = message.getId();
+  event.extended = message.isCANExtended();
+  uint8_t length = message.getDataLength();
+  event.length = length > 8 ? 8 : length;
+  uint8_t *payload = message.getPayload();
+  for (uint8_t i = 0; i < event.length; i++) {
+    event.data[i] = payload[i];
+  }
+  record(event);
+}
+
+void TraceRecorder::recordInput(IO::Pin pin, bool level) {
+  TraceEvent event;
+  event.type = TraceEventType::GPIO_INPUT;
+  event.id = static_cast<uint8_t>(pin);
+  event.level = level;
+  record(event);
+}
+
+void TraceRecorder::recordOutput(IO::Pin pin, bool level) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  recordOutputLocked(static_cast<uint8_t>(pin), level);
+  __set_PRIMASK(primask);
+}
+
+void TraceRecorder::recordPortWrite(uint8_t port, uint32_t bsrr) {
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  // Set bits take priority over reset bits, as in the hardware
+  for (uint8_t bit = 0; bit < 16; bit++) {
+    uint8_t pin = static_cast<uint8_t>((port << 4) | bit);
+    if (bsrr & (1u << bit)) {
+      recordOutputLocked(pin, true);
+    } else if (bsrr & (1u << (bit + 16))) {
+      recordOutputLocked(pin, false);
+    }
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void TraceRecorder::recordTimer(TraceTimer timer) {
+  TraceEvent event;
+  event.type = TraceEventType::TIMER;
+  event.id = static_cast<uint8_t>(timer);
+  record(event);
+}
+
+void TraceRecorder::record(TraceEvent &event) {
+  if (!recording) {
+    return;
+  }
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+
+  uint32_t nowCycles = cycles::now();
+  uint32_t nowMillis = EVT::core::time::millis();
+  if (nowMillis - lastMillis < CYCLE_TIMING_LIMIT) {
+    // Carry the cycles left over from the conversion so rounding does not
+    // accumulate over a long trace
+    uint32_t micros = cycles::toMicros(nowCycles - lastCycles);
+    time += micros;
+    lastCycles += micros * (SystemCoreClock / 1000000);
+  } else {
+    time += static_cast<uint64_t>(nowMillis - lastMillis) * 1000;
+    lastCycles = nowCycles;
+  }
+  lastMillis = nowMillis;
+
+  event.time = time;
+  if (writer.write(event) != 0) {
+    droppedCount++;
+    recording = false;
+  }
+
+  __set_PRIMASK(primask);
+}
+
+void TraceRecorder::recordOutputLocked(uint8_t pin, bool level) {
+  uint8_t port = pin >> 4;
+  auto mask = static_cast<uint16_t>(1u << (pin & 0x0F));
+  if (port >= NUM_PORTS) {
+    return;
+  }
+
+  bool known = (outputKnown[port] & mask) != 0;
+  bool previous = (outputLevels[port] & mask) != 0;
+  if (known && previous == level) {
+    return;
+  }
+
+  TraceEvent event;
+  event.type = TraceEventType::GPIO_OUTPUT;
+  event.id = pin;
+  event.level = level;
+  record(event);
+
+  // Only remember the level once it made it into the trace, so an output
+  // change is not lost while recording is stopped
+  if (recording) {
+    outputKnown[port] |= mask;
+    if (level) {
+      outputLevels[port] |= mask;
+    } else {
+      outputLevels[port] &= static_cast<uint16_t>(~mask);
+    }
+  }
+}
+
+} // namespace APM
@@ -0,0 +1,80 @@
+/**
+ * Source code for warm restart support
+ */
+
+#include <APM/WarmStart.hpp>
+#include <APM/utils/crc.hpp>
+#include <HALf3/stm32f3xx.h>
+#include <cstring>
+
+namespace APM::warm {
+
+namespace {
+
+// Identifies a stored snapshot and its layout.  Change it when Snapshot
+// changes, so a snapshot written by older firmware is ignored.
+constexpr uint32_t SNAPSHOT_MAGIC = 0x314D5257; // "WRM1"
+
+/**
+ * Layout of the snapshot in the backup registers
+ */
+struct Stored {
+  uint32_t magic;
+  Snapshot snapshot;
+  // CRC-16 of the preceding fields
+  uint32_t crc;
+};
+
+// Number of backup registers used
+constexpr size_t NUM_WORDS = sizeof(Stored) / sizeof(uint32_t);
+
+static_assert(NUM_WORDS == 4, "Snapshot must fit in four backup registers");
+
+/**
+ * Returns the backup register a word of the snapshot is kept in.  The
+ * registers are consecutive words from BKP0R.
+ * @param index the word index
+ * @return the register
+ */
+volatile uint32_t &getRegister(size_t index) { return (&RTC->BKP0R)[index]; }
+
+} // namespace
+
+void init() {
+  RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+  PWR->CR |= PWR_CR_DBP;
+}
+
+void save(const Snapshot &snapshot) {
+  Stored stored = {};
+  stored.magic = SNAPSHOT_MAGIC;
+  stored.snapshot = snapshot;
+  stored.crc = crc::crc16(&stored, offsetof(Stored, crc));
+
+  uint32_t words[NUM_WORDS];
+  memcpy(words, &stored, sizeof(stored));
+  for (size_t i = 0; i < NUM_WORDS; i++) {
+    getRegister(i) = words[i];
+  }
+}
+
+int load(Snapshot &snapshot) {
+  uint32_t words[NUM_WORDS];
+  for (size_t i = 0; i < NUM_WORDS; i++) {
+    words[i] = getRegister(i);
+  }
+
+  Stored stored;
+  memcpy(&stored, words, sizeof(stored));
+  if (stored.magic != SNAPSHOT_MAGIC ||
+      stored.crc != crc::crc16(&stored, offsetof(Stored, crc))) {
+    return 1;
+  }
+
+  snapshot = stored.snapshot;
+  return 0;
+}
+
+void clear() { getRegister(0) = 0; }
+
+} // namespace APM::warm
@@ -2,6 +2,10 @@
  * Contains the source for class SIM100
  */
 
+#include <APM/BusMonitor.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/Trace.hpp>
 #include <APM/dev/SIM100.hpp>
 #include <EVT/utils/time.hpp>
 #include <cstring>
@@ -10,7 +14,8 @@ namespace APM::DEV {
 
 namespace IO = EVT::core::IO;
 
-SIM100::SIM100(IO::CAN &can) : can(can) {}
+SIM100::SIM100(IO::CAN &can, uint32_t requestId, uint32_t responseId)
+    : can(can), requestId(requestId), responseId(responseId) {}
 
 int SIM100::sendDataRequestMessage(RequestMux requestType,
                                    IO::CANMessage &responseMessage) {
@@ -21,6 +26,18 @@ int SIM100::sendDataRequestMessage(RequestMux requestType,
   return sendMessage(payloadSize, &payload[0], responseMessage);
 }
 
+int SIM100::transmit(uint8_t dataLength, uint8_t *payload) {
+  IO::CANMessage requestMessage(requestId, dataLength, &payload[0], true);
+  IO::CAN::CANStatus status = bus::transmit(can, requestMessage);
+  if (status != IO::CAN::CANStatus::OK) {
+    metrics::increment(metrics::Metric::CAN_TX_ERRORS);
+    return 1;
+  }
+  metrics::increment(metrics::Metric::SIM100_REQUESTS);
+  trace::recordCAN(TraceEventType::CAN_TX, requestMessage);
+  return 0;
+}
+
 int SIM100::sendMessage(uint8_t dataLength, uint8_t *payload,
                         IO::CANMessage &responseMessage, bool expectResponse) {
   if (dataLength < 1) {
@@ -28,29 +45,34 @@ int SIM100::sendMessage(uint8_t dataLength, uint8_t *payload,
   }
 
   uint8_t requestMuxByte = payload[0];
-  // TODO: Rework CAN completely.  Currently will not work!
-  //     IO::CANMessage requestMessage(SIM100::CAN_REQUEST_ID, dataLength,
-  //     &payload[0]);
-  //    can.transmit(requestMessage);
+  if (transmit(dataLength, payload) != 0) {
+    return 1;
+  }
+
+  if (!expectResponse) {
+    return 0;
+  }
+
   /* TODO: Implement CAN filtering to only receive SIM100 CAN messages here.
      This entire function will be updated for better handling with CAN Open
      integration so this is a temporary fix */
-  // TODO: Just exit the function if not expecting an ack
-  //    if (!expectResponse) {
-  //        return 0;
-  //    }
-  //
-  //    auto response = can.receive(&responseMessage, true);
-  //    while (response == nullptr || responseMessage.getId() != CAN_RESPONSE_ID
-  //    ||
-  //           responseMessage.getPayload()[0] != requestMuxByte) {
-  //        response = can.receive(&responseMessage, false);
-  //        EVT::core::time::wait(500);
-  //        // TODO: Implement timeout and return something accordingly.  Also
-  //        better error handling
-  //    }
+  uint32_t startTime = EVT::core::time::millis();
+  while (EVT::core::time::millis() - startTime < RESPONSE_TIMEOUT) {
+    supervisor::keepAlive();
+    if (can.receive(&responseMessage, false) == nullptr) {
+      continue;
+    }
+    trace::recordCAN(TraceEventType::CAN_RX, responseMessage);
+    bus::recordReceive(responseMessage);
 
-  return 0;
+    if (responseMessage.getId() == responseId &&
+        responseMessage.getPayload()[0] == requestMuxByte) {
+      return 0;
+    }
+  }
+
+  metrics::increment(metrics::Metric::SIM100_TIMEOUTS);
+  return 2;
 }
 
 int SIM100::getPartName(char *buf, size_t size) {
@@ -139,9 +161,7 @@ uint16_t SIM100::setMaxWorkingVoltage(uint16_t maxVoltage) {
 
 SIM100::IsolationStateResponse SIM100::getIsolationState() {
   IO::CANMessage responseMessage;
-  uint8_t *responsePayload;
-  uint8_t statusByte;
-
+  IsolationStateResponse state;
   bool queryAgain = false;
 
   do {
@@ -150,35 +170,55 @@ SIM100::IsolationStateResponse SIM100::getIsolationState() {
       return IsolationStateResponse::CANError;
     }
 
-    if (responseMessage.getDataLength() !=
-        8) { // Expect 1 MUX byte and 7 data bytes
-      return IsolationStateResponse::CANError;
+    state = decodeIsolationState(responseMessage, queryAgain);
+
+    // Try to receive isolation state again if no new estimates or high
+    // uncertainty
+    if (queryAgain) {
+      metrics::increment(metrics::Metric::SIM100_RETRIES);
+      EVT::core::time::wait(100);
     }
+  } while (queryAgain);
 
-    responsePayload = responseMessage.getPayload();
+  return state;
+}
 
-    // Read Status bits
-    statusByte = responsePayload[1];
+int SIM100::requestIsolationState() {
+  uint8_t payload[1] = {static_cast<uint8_t>(RequestMux::ISOLATION_STATE)};
+  return transmit(1, &payload[0]);
+}
 
-    // Check for hardware error
-    if (statusByte &
-        (1 << static_cast<uint8_t>(SIM100::StatusBitShift::HARDWARE_ERROR))) {
-      return IsolationStateResponse::HardwareError; // Diagnose and service the
-                                                    // system
-    }
+bool SIM100::isIsolationStateResponse(IO::CANMessage &message) const {
+  return message.getId() == responseId && message.getDataLength() >= 1 &&
+         message.getPayload()[0] ==
+             static_cast<uint8_t>(RequestMux::ISOLATION_STATE);
+}
 
-    queryAgain =
-        (statusByte & (1 << static_cast<uint8_t>(
-                           SIM100::StatusBitShift::NO_NEW_ESTIMATES))) ||
-        (statusByte &
-         (1 << static_cast<uint8_t>(SIM100::StatusBitShift::HIGH_UNCERTAINTY)));
+SIM100::IsolationStateResponse
+SIM100::decodeIsolationState(IO::CANMessage &responseMessage,
+                             bool &queryAgain) {
+  queryAgain = false;
 
-    if (queryAgain) {
-      EVT::core::time::wait(100);
-    }
-  } while (queryAgain);
-  // Try to receive isolation state again if no new estimates or high
-  // uncertainty
+  if (responseMessage.getDataLength() !=
+      8) { // Expect 1 MUX byte and 7 data bytes
+    return IsolationStateResponse::CANError;
+  }
+
+  // Read Status bits
+  uint8_t statusByte = responseMessage.getPayload()[1];
+
+  // Check for hardware error
+  if (statusByte &
+      (1 << static_cast<uint8_t>(SIM100::StatusBitShift::HARDWARE_ERROR))) {
+    return IsolationStateResponse::HardwareError; // Diagnose and service the
+                                                  // system
+  }
+
+  queryAgain =
+      (statusByte &
+       (1 << static_cast<uint8_t>(SIM100::StatusBitShift::NO_NEW_ESTIMATES))) ||
+      (statusByte &
+       (1 << static_cast<uint8_t>(SIM100::StatusBitShift::HIGH_UNCERTAINTY)));
 
   if (statusByte & (1 << static_cast<uint8_t>(
                         SIM100::StatusBitShift::HIGH_BATTERY_VOLTAGE))) {
@@ -199,6 +239,41 @@ SIM100::IsolationStateResponse SIM100::getIsolationState() {
   return IsolationStateResponse::NoError;
 }
 
+uint16_t SIM100::decodeIsolationResistance(IO::CANMessage &responseMessage) {
+  if (responseMessage.getDataLength() < 4) {
+    return 0;
+  }
+
+  uint8_t *payload = responseMessage.getPayload();
+  return static_cast<uint16_t>((payload[2] << 8) | payload[3]);
+}
+
+int SIM100::requestMaxWorkingVoltage(uint16_t maxVoltage) {
+  uint8_t payload[3] = {
+      static_cast<uint8_t>(RequestMux::SET_MAX_BATTERY_VOLTAGE),
+      static_cast<uint8_t>(maxVoltage >> 8), static_cast<uint8_t>(maxVoltage)};
+  return transmit(3, &payload[0]);
+}
+
+bool SIM100::isMaxWorkingVoltageResponse(IO::CANMessage &message) const {
+  return message.getId() == responseId && message.getDataLength() >= 1 &&
+         message.getPayload()[0] ==
+             static_cast<uint8_t>(RequestMux::SET_MAX_BATTERY_VOLTAGE);
+}
+
+uint16_t SIM100::decodeMaxWorkingVoltage(IO::CANMessage &responseMessage) {
+  if (responseMessage.getDataLength() < 3) {
+    return 0;
+  }
+
+  uint8_t *payload = responseMessage.getPayload();
+  return static_cast<uint16_t>((payload[1] << 8) | payload[2]);
+}
+
+uint32_t SIM100::getRequestId() const { return requestId; }
+
+uint32_t SIM100::getResponseId() const { return responseId; }
+
 int SIM100::restartSIM100() {
   constexpr uint8_t payloadSize =
       5; // 1 byte for request type.  4 bytes for expected command
@@ -257,4 +332,22 @@ int SIM100::getVersion(char *buf, size_t size) {
   return 0;
 }
 
+const char *getName(SIM100::IsolationStateResponse state) {
+  switch (state) {
+  case SIM100::IsolationStateResponse::CANError:
+    return "CAN error";
+  case SIM100::IsolationStateResponse::HardwareError:
+    return "hardware error";
+  case SIM100::IsolationStateResponse::HighBatteryVoltage:
+    return "high battery voltage";
+  case SIM100::IsolationStateResponse::LowBatteryVoltage:
+    return "low battery voltage";
+  case SIM100::IsolationStateResponse::IsolationError:
+    return "isolation error";
+  case SIM100::IsolationStateResponse::NoError:
+    return "no error";
+  }
+  return "unknown";
+}
+
 } // namespace APM::DEV
@@ -0,0 +1,123 @@
+/**
+ * Source code for Flashf302x8 class
+ */
+
+#include <APM/dev/platform/f3xx/f302x8/Flashf302x8.hpp>
+#include <HALf3/stm32f3xx.h>
+#include <cstring>
+
+// Defined by the linker script for the start up code, which copies the
+// initial values of .data from _sidata in flash to _sdata - _edata in RAM
+extern "C" {
+extern uint8_t _sidata[];
+extern uint8_t _sdata[];
+extern uint8_t _edata[];
+}
+
+namespace APM::DEV {
+
+Flashf302x8::Flashf302x8(uint32_t firstPage, uint32_t numPages)
+    : startAddress(START_ADDRESS + firstPage * PAGE_SIZE), numPages(numPages) {
+}
+
+bool Flashf302x8::overlapsImage() const {
+  return startAddress < getImageEnd();
+}
+
+uint32_t Flashf302x8::getImageEnd() {
+  return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(_sidata) +
+                               (_edata - _sdata));
+}
+
+uint32_t Flashf302x8::getPageSize() const { return PAGE_SIZE; }
+
+uint32_t Flashf302x8::getNumPages() const { return numPages; }
+
+const uint8_t *Flashf302x8::getAddress() const {
+  return reinterpret_cast<const uint8_t *>(startAddress);
+}
+
+int Flashf302x8::read(uint32_t offset, void *data, size_t size) const {
+  if (!inRange(offset, size)) {
+    return 1;
+  }
+
+  // Flash is memory mapped, so reading is a plain copy
+  memcpy(data, reinterpret_cast<const void *>(startAddress + offset), size);
+  return 0;
+}
+
+int Flashf302x8::write(uint32_t offset, const void *data, size_t size) {
+  if (!inRange(offset, size) || (offset % 2) != 0 || (size % 2) != 0) {
+    return 1;
+  }
+  if (overlapsImage()) {
+    return 3;
+  }
+
+  auto *bytes = static_cast<const uint8_t *>(data);
+  int status = 0;
+
+  unlock();
+  for (size_t i = 0; i < size && status == 0; i += 2) {
+    uint16_t halfWord = bytes[i] | (bytes[i + 1] << 8);
+
+    FLASH->CR |= FLASH_CR_PG;
+    *reinterpret_cast<volatile uint16_t *>(startAddress + offset + i) =
+        halfWord;
+    status = waitForOperation();
+    FLASH->CR &= ~FLASH_CR_PG;
+  }
+  lock();
+
+  return status;
+}
+
+int Flashf302x8::erasePage(uint32_t page) {
+  if (page >= numPages) {
+    return 1;
+  }
+  if (overlapsImage()) {
+    return 3;
+  }
+
+  unlock();
+  FLASH->CR |= FLASH_CR_PER;
+  FLASH->AR = startAddress + page * PAGE_SIZE;
+  FLASH->CR |= FLASH_CR_STRT;
+  int status = waitForOperation();
+  FLASH->CR &= ~FLASH_CR_PER;
+  lock();
+
+  return status;
+}
+
+bool Flashf302x8::inRange(uint32_t offset, size_t size) const {
+  uint32_t regionSize = numPages * PAGE_SIZE;
+  return offset <= regionSize && size <= regionSize - offset;
+}
+
+void Flashf302x8::unlock() {
+  if (FLASH->CR & FLASH_CR_LOCK) {
+    FLASH->KEYR = UNLOCK_KEY_1;
+    FLASH->KEYR = UNLOCK_KEY_2;
+  }
+}
+
+void Flashf302x8::lock() { FLASH->CR |= FLASH_CR_LOCK; }
+
+int Flashf302x8::waitForOperation() {
+  while (FLASH->SR & FLASH_SR_BSY) {
+  }
+
+  if (FLASH->SR & (FLASH_SR_PGERR | FLASH_SR_WRPERR)) {
+    // Flags are cleared by writing 1
+    FLASH->SR = FLASH_SR_PGERR | FLASH_SR_WRPERR;
+    return 2;
+  }
+
+  FLASH->SR = FLASH_SR_EOP;
+  return 0;
+}
+
+} // namespace APM::DEV
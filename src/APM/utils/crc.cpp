@@ -0,0 +1,26 @@
+/**
+ * Source code for the checksum helpers
+ */
+
+#include <APM/utils/crc.hpp>
+
+namespace APM::crc {
+
+uint16_t crc16(const void *data, size_t size, uint16_t crc) {
+  auto *bytes = static_cast<const uint8_t *>(data);
+
+  for (size_t i = 0; i < size; i++) {
+    crc ^= static_cast<uint16_t>(bytes[i]) << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      if (crc & 0x8000) {
+        crc = static_cast<uint16_t>((crc << 1) ^ 0x1021);
+      } else {
+        crc = static_cast<uint16_t>(crc << 1);
+      }
+    }
+  }
+
+  return crc;
+}
+
+} // namespace APM::crc
@@ -0,0 +1,23 @@
+/**
+ * Source code for the DWT cycle counter helpers
+ */
+
+#include <APM/utils/cycles.hpp>
+
+namespace APM::cycles {
+
+void init() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t toMicros(uint32_t cycles) {
+  uint32_t cyclesPerMicro = SystemCoreClock / 1000000;
+  if (cyclesPerMicro == 0) {
+    return 0;
+  }
+  return cycles / cyclesPerMicro;
+}
+
+} // namespace APM::cycles
@@ -0,0 +1,177 @@
+/**
+ * Source code for the text formatter
+ */
+
+#include <APM/utils/format.hpp>
+#include <cstring>
+
+namespace APM::format {
+
+namespace {
+
+// Longest integer: 20 digits for 64 bit values plus a sign
+constexpr size_t MAX_DIGITS = 21;
+
+/**
+ * Writes bytes to the UART.  EVT-core takes a non-const pointer but does not
+ * modify the data.
+ * @param uart the UART
+ * @param data the bytes
+ * @param length the number of bytes
+ */
+void writeBytes(EVT::core::IO::UART &uart, const char *data, size_t length) {
+  if (length > 0) {
+    uart.writeBytes(reinterpret_cast<uint8_t *>(const_cast<char *>(data)),
+                    length);
+  }
+}
+
+/**
+ * Writes a character a number of times
+ * @param uart the UART
+ * @param c the character
+ * @param count the number of copies
+ */
+void writePadding(EVT::core::IO::UART &uart, char c, size_t count) {
+  char padding[16];
+  memset(padding, c, sizeof(padding));
+  while (count > 0) {
+    size_t chunk = count < sizeof(padding) ? count : sizeof(padding);
+    writeBytes(uart, padding, chunk);
+    count -= chunk;
+  }
+}
+
+/**
+ * Converts an unsigned value to digits, using 32 bit division when the value
+ * fits since 64 bit division is a library call on the Cortex-M4
+ * @param value the value
+ * @param base 10 or 16
+ * @param upperCase use upper case hexadecimal digits
+ * @param end one past the last character of the output buffer
+ * @return pointer to the first digit
+ */
+char *toDigits(uint64_t value, uint8_t base, bool upperCase, char *end) {
+  const char *digits = upperCase ? "0123456789ABCDEF" : "0123456789abcdef";
+  char *position = end;
+
+  while (value > UINT32_MAX) {
+    *--position = digits[value % base];
+    value /= base;
+  }
+  auto small = static_cast<uint32_t>(value);
+  do {
+    *--position = digits[small % base];
+    small /= base;
+  } while (small != 0);
+
+  return position;
+}
+
+/**
+ * Writes text padded to the width of a spec
+ * @param uart the UART
+ * @param spec the placeholder spec
+ * @param data the text
+ * @param length the length of the text
+ */
+void writePadded(EVT::core::IO::UART &uart, const Spec &spec,
+                 const char *data, size_t length) {
+  size_t padding = spec.width > length ? spec.width - length : 0;
+  if (!spec.leftAlign) {
+    writePadding(uart, ' ', padding);
+  }
+  writeBytes(uart, data, length);
+  if (spec.leftAlign) {
+    writePadding(uart, ' ', padding);
+  }
+}
+
+/**
+ * Writes an integer
+ * @param uart the UART
+ * @param spec the placeholder spec
+ * @param magnitude the absolute value
+ * @param negative whether the value is negative
+ */
+void writeInteger(EVT::core::IO::UART &uart, const Spec &spec,
+                  uint64_t magnitude, bool negative) {
+  char buffer[MAX_DIGITS];
+  char *end = buffer + sizeof(buffer);
+  char *first = toDigits(magnitude, spec.base, spec.upperCase, end);
+  auto length = static_cast<size_t>(end - first);
+
+  if (!spec.zeroPad || spec.leftAlign) {
+    if (negative) {
+      *--first = '-';
+      length++;
+    }
+    writePadded(uart, spec, first, length);
+    return;
+  }
+
+  // Zeros go between the sign and the digits
+  size_t total = length + (negative ? 1 : 0);
+  if (negative) {
+    writeBytes(uart, "-", 1);
+  }
+  writePadding(uart, '0', spec.width > total ? spec.width - total : 0);
+  writeBytes(uart, first, length);
+}
+
+/**
+ * Writes one argument
+ * @param uart the UART
+ * @param spec the placeholder spec
+ * @param arg the argument
+ */
+void writeArg(EVT::core::IO::UART &uart, const Spec &spec, const Arg &arg) {
+  switch (arg.type) {
+  case ArgType::SIGNED: {
+    bool negative = arg.s32 < 0;
+    uint32_t magnitude = negative ? 0u - static_cast<uint32_t>(arg.s32)
+                                  : static_cast<uint32_t>(arg.s32);
+    writeInteger(uart, spec, magnitude, negative);
+    break;
+  }
+  case ArgType::UNSIGNED:
+    writeInteger(uart, spec, arg.u32, false);
+    break;
+  case ArgType::SIGNED64: {
+    bool negative = arg.s64 < 0;
+    uint64_t magnitude = negative ? 0u - static_cast<uint64_t>(arg.s64)
+                                  : static_cast<uint64_t>(arg.s64);
+    writeInteger(uart, spec, magnitude, negative);
+    break;
+  }
+  case ArgType::UNSIGNED64:
+    writeInteger(uart, spec, arg.u64, false);
+    break;
+  case ArgType::CHAR:
+    writePadded(uart, spec, &arg.c, 1);
+    break;
+  case ArgType::STRING: {
+    const char *string = arg.string != nullptr ? arg.string : "(null)";
+    writePadded(uart, spec, string, strlen(string));
+    break;
+  }
+  case ArgType::NONE:
+    break;
+  }
+}
+
+} // namespace
+
+void write(EVT::core::IO::UART &uart, const char *text,
+           const Segment *segments, size_t numSegments, const Arg *args) {
+  size_t arg = 0;
+  for (size_t i = 0; i < numSegments; i++) {
+    const Segment &segment = segments[i];
+    writeBytes(uart, &text[segment.start], segment.length);
+    if (segment.hasArg) {
+      writeArg(uart, segment.spec, args[arg++]);
+    }
+  }
+}
+
+} // namespace APM::format
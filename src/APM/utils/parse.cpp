@@ -0,0 +1,27 @@
+/**
+ * Source code for the console argument parsing helpers
+ */
+
+#include <APM/utils/parse.hpp>
+
+namespace APM::parse {
+
+bool toUnsigned(const char *text, uint32_t &value) {
+  uint64_t result = 0;
+  if (*text == '\0') {
+    return false;
+  }
+  for (; *text != '\0'; text++) {
+    if (*text < '0' || *text > '9') {
+      return false;
+    }
+    result = result * 10 + static_cast<uint32_t>(*text - '0');
+    if (result > UINT32_MAX) {
+      return false;
+    }
+  }
+  value = static_cast<uint32_t>(result);
+  return true;
+}
+
+} // namespace APM::parse
@@ -0,0 +1,46 @@
+/**
+ * Source code for the stack painting helpers
+ */
+
+#include <APM/utils/stack.hpp>
+#include <HALf3/stm32f3xx.h>
+
+// Provided by the linker script: end of .bss and the initial stack pointer
+extern "C" uint32_t _ebss;
+extern "C" uint32_t _estack;
+
+namespace APM::stack {
+
+namespace {
+
+// Value written to unused stack words
+constexpr uint32_t PAINT_PATTERN = 0xC5C5C5C5;
+
+// Bytes below the current stack pointer left unpainted, so the frame of
+// paint() itself is never overwritten
+constexpr uint32_t PAINT_GUARD = 64;
+
+} // namespace
+
+void paint() {
+  auto *word = &_ebss;
+  auto *end = reinterpret_cast<uint32_t *>(__get_MSP() - PAINT_GUARD);
+  while (word < end) {
+    *word++ = PAINT_PATTERN;
+  }
+}
+
+uint32_t getHighWater() {
+  const uint32_t *word = &_ebss;
+  const uint32_t *top = &_estack;
+  while (word < top && *word == PAINT_PATTERN) {
+    word++;
+  }
+  return static_cast<uint32_t>(top - word) * sizeof(uint32_t);
+}
+
+uint32_t getSize() {
+  return static_cast<uint32_t>(&_estack - &_ebss) * sizeof(uint32_t);
+}
+
+} // namespace APM::stack
@@ -1,11 +1,23 @@
 /**
  * This is a basic sample for interfacing with the GFD board
+ *
+ * Besides sending single requests, it can soak a SIM100 with thousands of
+ * isolation state, part name and max working voltage requests, back to back
+ * or at a fixed rate, and print latency histograms and the timeouts and
+ * requeries seen, to qualify units and CAN wiring before they go on a bike.
  */
 
+#include <APM/Metrics.hpp>
+#include <APM/Profile.hpp>
 #include <APM/dev/SIM100.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/format.hpp>
+#include <APM/utils/parse.hpp>
 #include <EVT/io/UART.hpp>
 #include <EVT/io/manager.hpp>
 #include <EVT/io/pin.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
 #include <cstring>
 
 #pragma clang diagnostic push
@@ -15,6 +27,337 @@ namespace IO = EVT::core::IO;
 constexpr int BAUD_RATE = 115200;
 constexpr int BUF_SIZE = 256;
 
+// USART behind IO::Pin::UART_TX, checked for a key press during a soak
+USART_TypeDef *const CONSOLE_USART = USART2;
+
+// Soak rounds run when no count is given
+constexpr uint32_t DEFAULT_ROUNDS = 1000;
+
+// Most rounds a single soak accepts
+constexpr uint32_t MAX_ROUNDS = 1000000;
+
+// Longest period between the starts of soak rounds in ms
+constexpr uint32_t MAX_PERIOD = 60000;
+
+// Rounds between progress lines of a soak
+constexpr uint32_t PROGRESS_ROUNDS = 100;
+
+// Voltage sent by the soak's max working voltage requests, the value the
+// unit is left configured with on the bike
+constexpr uint16_t SOAK_VOLTAGE = APM::DEV::SIM100::DEV1_MAX_BATTERY_VOLTAGE;
+
+/**
+ * Requests a soak can send, one per round each
+ */
+enum class Request : uint8_t {
+  ISOLATION_STATE = 0u,
+  PART_NAME = 1u,
+  MAX_VOLTAGE = 2u
+};
+
+// Number of values in Request
+constexpr uint8_t NUM_REQUESTS = 3;
+
+// Letter selecting each request on the soak command line, indexed by Request
+constexpr char REQUEST_KEYS[NUM_REQUESTS + 1] = "inm";
+
+// Buffer size getPartName() needs, 16 characters and a null
+constexpr size_t PART_NAME_SIZE = 17;
+
+// Number of IsolationStateResponse values, which start at 1
+constexpr uint8_t NUM_ISOLATION_STATES = 7;
+
+/**
+ * Results of one kind of request over a soak
+ */
+struct RequestStats {
+  const char *name;
+  uint32_t calls;
+  // Calls that timed out, failed to send or returned a bad response
+  uint32_t failures;
+  // Responses that did not arrive within SIM100::RESPONSE_TIMEOUT
+  uint32_t timeouts;
+  // Frames the CAN peripheral refused to send
+  uint32_t txErrors;
+  // Requests repeated on no new estimate or high uncertainty, and the calls
+  // that needed at least one
+  uint32_t requeries;
+  uint32_t requeriedCalls;
+  // Time of each call, including any requeries, in cycles
+  APM::profile::SpanStats latency;
+};
+
+/**
+ * Checks whether a character is waiting in the console UART without
+ * consuming it
+ * @return true if a key was pressed
+ */
+bool consoleHasInput() { return (CONSOLE_USART->ISR & USART_ISR_RXNE) != 0; }
+
+/**
+ * Adds the time of a call to its statistics
+ * @param stats the statistics to update
+ * @param cycles the duration in cycles
+ */
+void addSample(APM::profile::SpanStats &stats, uint32_t cycles) {
+  if (stats.count == 0 || cycles < stats.minCycles) {
+    stats.minCycles = cycles;
+  }
+  if (cycles > stats.maxCycles) {
+    stats.maxCycles = cycles;
+  }
+  stats.totalCycles += cycles;
+  stats.count++;
+  stats.buckets[APM::profile::getBucket(cycles)]++;
+}
+
+/**
+ * Parses the arguments of the soak command, "s [rounds] [period] [requests]"
+ * @param args the text after the command letter
+ * @param rounds set to the number of rounds
+ * @param period set to the time between the starts of rounds in ms
+ * @param requests set to the requests to send, one bit per Request
+ * @return true if the arguments were valid
+ */
+bool parseSoakArgs(char *args, uint32_t &rounds, uint32_t &period,
+                   uint8_t &requests) {
+  rounds = DEFAULT_ROUNDS;
+  period = 0;
+  requests = (1u << NUM_REQUESTS) - 1;
+
+  char *arg = strtok(args, " ");
+  if (arg != nullptr) {
+    if (!APM::parse::toUnsigned(arg, rounds) || rounds == 0 ||
+        rounds > MAX_ROUNDS) {
+      return false;
+    }
+    arg = strtok(nullptr, " ");
+  }
+  if (arg != nullptr) {
+    if (!APM::parse::toUnsigned(arg, period) || period > MAX_PERIOD) {
+      return false;
+    }
+    arg = strtok(nullptr, " ");
+  }
+  if (arg != nullptr) {
+    requests = 0;
+    for (const char *key = arg; *key != '\0'; key++) {
+      const char *match = strchr(REQUEST_KEYS, *key);
+      if (match == nullptr) {
+        return false;
+      }
+      requests |= 1u << (match - REQUEST_KEYS);
+    }
+    if (strtok(nullptr, " ") != nullptr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Sends one request and records how it went
+ * @param sim100 the SIM100 to send to
+ * @param request the request to send
+ * @param stats the results of this kind of request
+ * @param isolationStates count of each isolation state received, indexed by
+ * IsolationStateResponse
+ * @param partName the part name of the first successful part name request,
+ * which later ones must match, or empty
+ */
+void sendRequest(APM::DEV::SIM100 &sim100, Request request,
+                 RequestStats &stats, uint32_t *isolationStates,
+                 char *partName) {
+  using APM::metrics::Metric;
+  uint32_t timeouts = APM::metrics::get(Metric::SIM100_TIMEOUTS);
+  uint32_t txErrors = APM::metrics::get(Metric::CAN_TX_ERRORS);
+  uint32_t requeries = APM::metrics::get(Metric::SIM100_RETRIES);
+  char name[PART_NAME_SIZE];
+  bool ok = false;
+
+  uint32_t start = APM::cycles::now();
+  switch (request) {
+  case Request::ISOLATION_STATE: {
+    auto state = sim100.getIsolationState();
+    isolationStates[static_cast<uint8_t>(state)]++;
+    ok = state != APM::DEV::SIM100::IsolationStateResponse::CANError;
+    break;
+  }
+  case Request::PART_NAME:
+    ok = sim100.getPartName(name, sizeof(name)) == 0;
+    break;
+  case Request::MAX_VOLTAGE:
+    ok = sim100.setMaxWorkingVoltage(SOAK_VOLTAGE) == SOAK_VOLTAGE;
+    break;
+  }
+  addSample(stats.latency, APM::cycles::now() - start);
+
+  timeouts = APM::metrics::get(Metric::SIM100_TIMEOUTS) - timeouts;
+  txErrors = APM::metrics::get(Metric::CAN_TX_ERRORS) - txErrors;
+  requeries = APM::metrics::get(Metric::SIM100_RETRIES) - requeries;
+
+  // A part name request carries on after a lost frame with a stale response,
+  // so a changed name is counted as a failure too
+  if (ok && request == Request::PART_NAME) {
+    if (partName[0] == '\0') {
+      strcpy(partName, name);
+    } else if (strcmp(partName, name) != 0) {
+      ok = false;
+    }
+  }
+
+  stats.calls++;
+  if (!ok || timeouts != 0 || txErrors != 0) {
+    stats.failures++;
+  }
+  stats.timeouts += timeouts;
+  stats.txErrors += txErrors;
+  stats.requeries += requeries;
+  if (requeries != 0) {
+    stats.requeriedCalls++;
+  }
+}
+
+/**
+ * Prints the results of a soak
+ * @param uart the UART to print on
+ * @param stats the results of each request, indexed by Request
+ * @param isolationStates count of each isolation state received
+ * @param partName the part name read, or empty
+ */
+void printSoak(IO::UART &uart, const RequestStats *stats,
+               const uint32_t *isolationStates, const char *partName) {
+  using APM::cycles::toMicros;
+
+  uart.puts("request     calls failures timeouts tx errs requeries"
+            "   min us  mean us   max us\n\r");
+  for (uint8_t i = 0; i < NUM_REQUESTS; i++) {
+    const RequestStats &request = stats[i];
+    if (request.calls == 0) {
+      continue;
+    }
+    const APM::profile::SpanStats &latency = request.latency;
+    APM::format::write(uart, APM_FORMAT("{<9} {7} {8} {8} {7} {9}"),
+                       request.name, request.calls, request.failures,
+                       request.timeouts, request.txErrors, request.requeries);
+    APM::format::write(
+        uart, APM_FORMAT(" {8} {8} {8}\n\r"), toMicros(latency.minCycles),
+        toMicros(static_cast<uint32_t>(latency.totalCycles / latency.count)),
+        toMicros(latency.maxCycles));
+  }
+
+  const RequestStats &isolation =
+      stats[static_cast<uint8_t>(Request::ISOLATION_STATE)];
+  if (isolation.calls != 0) {
+    uint32_t permille = isolation.requeriedCalls * 1000 / isolation.calls;
+    APM::format::write(uart,
+                       APM_FORMAT("\n\rIsolation requeried on {} of {} calls "
+                                  "({}.{}%), {} requeries\n\r"),
+                       isolation.requeriedCalls, isolation.calls,
+                       permille / 10, permille % 10, isolation.requeries);
+    for (uint8_t i = 1; i < NUM_ISOLATION_STATES; i++) {
+      if (isolationStates[i] != 0) {
+        APM::format::write(
+            uart, APM_FORMAT("\t{}: {}\n\r"),
+            static_cast<APM::DEV::SIM100::IsolationStateResponse>(i),
+            isolationStates[i]);
+      }
+    }
+  }
+  if (partName[0] != '\0') {
+    APM::format::write(uart, APM_FORMAT("Part name: {}\n\r"), partName);
+  }
+
+  for (uint8_t i = 0; i < NUM_REQUESTS; i++) {
+    const RequestStats &request = stats[i];
+    if (request.calls == 0) {
+      continue;
+    }
+    APM::format::write(uart, APM_FORMAT("\n\r{} latency\n\r"), request.name);
+    for (uint8_t bucket = 0; bucket < APM::profile::NUM_BUCKETS; bucket++) {
+      if (request.latency.buckets[bucket] == 0) {
+        continue;
+      }
+      APM::format::write(
+          uart, APM_FORMAT("\t>= {} us: {}\n\r"),
+          toMicros(APM::profile::getBucketStart(bucket)),
+          request.latency.buckets[bucket]);
+    }
+  }
+}
+
+/**
+ * Sends rounds of requests to a SIM100 and prints the results.  Each round
+ * sends every selected request once, in the order of Request.  A key press
+ * ends the soak early.
+ * @param uart the UART to print on
+ * @param sim100 the SIM100 to soak
+ * @param rounds the number of rounds
+ * @param period the time between the starts of rounds in ms, 0 to send them
+ * back to back
+ * @param requests the requests to send, one bit per Request
+ */
+void soak(IO::UART &uart, APM::DEV::SIM100 &sim100, uint32_t rounds,
+          uint32_t period, uint8_t requests) {
+  RequestStats stats[NUM_REQUESTS] = {
+      {"isolation", 0, 0, 0, 0, 0, 0, {}},
+      {"part name", 0, 0, 0, 0, 0, 0, {}},
+      {"max volts", 0, 0, 0, 0, 0, 0, {}},
+  };
+  uint32_t isolationStates[NUM_ISOLATION_STATES] = {};
+  char partName[PART_NAME_SIZE] = {};
+  uint32_t overruns = 0;
+
+  APM::format::write(uart,
+                     APM_FORMAT("Soaking for {} rounds, {} ms apart.  "
+                                "Press any key to stop\n\r"),
+                     rounds, period);
+
+  uint32_t startTime = EVT::core::time::millis();
+  uint32_t roundStart = startTime;
+  uint32_t round = 0;
+  while (round < rounds && !consoleHasInput()) {
+    if (period != 0 && round != 0) {
+      uint32_t elapsed = EVT::core::time::millis() - roundStart;
+      if (elapsed < period) {
+        EVT::core::time::wait(period - elapsed);
+      } else {
+        overruns++;
+      }
+    }
+    roundStart = EVT::core::time::millis();
+
+    for (uint8_t i = 0; i < NUM_REQUESTS; i++) {
+      if ((requests & (1u << i)) != 0) {
+        sendRequest(sim100, static_cast<Request>(i), stats[i], isolationStates,
+                    partName);
+      }
+    }
+    round++;
+
+    if (round % PROGRESS_ROUNDS == 0 && round != rounds) {
+      uint32_t failures = 0;
+      for (const RequestStats &request : stats) {
+        failures += request.failures;
+      }
+      APM::format::write(uart, APM_FORMAT("{} rounds, {} failures\n\r"),
+                         round, failures);
+    }
+  }
+
+  if (consoleHasInput()) {
+    // The key only stops the soak
+    static_cast<void>(uart.getc());
+  }
+
+  APM::format::write(uart,
+                     APM_FORMAT("\n\rSoak: {} of {} rounds in {} ms, {} "
+                                "overruns of the {} ms period\n\r"),
+                     round, rounds, EVT::core::time::millis() - startTime,
+                     overruns, period);
+  printSoak(uart, stats, isolationStates, partName);
+}
+
 int main() {
   // Initialize system
   IO::init();
@@ -26,36 +369,47 @@ int main() {
   // Setup SIM100 Device
   auto sim100 = APM::DEV::SIM100(can);
 
+  // Times the soak requests
+  APM::cycles::init();
+
   // String to store user input
   char buf[BUF_SIZE];
 
-  uart.printf("\n\n\r");
+  uart.puts("\n\n\r");
 
   while (true) {
     // Read user input
-    uart.printf("Enter Command\n\r");
-    uart.printf("Enter 'h' for help message\n\r");
-    uart.printf(">> ");
+    uart.puts("Enter Command\n\r");
+    uart.puts("Enter 'h' for help message\n\r");
+    uart.puts(">> ");
 
     memset(buf, 0, BUF_SIZE);
     uart.gets(buf, BUF_SIZE);
 
-    uart.printf("\n\r");
+    uart.puts("\n\r");
 
     if (strncmp("h", buf, BUF_SIZE) == 0) {
-      uart.printf("List of possible commands\n\r");
-      uart.printf("\t'h': Help Message\n\r");
-      uart.printf("\t'n': Get the SIM100 Manufacturer Name\n\r");
-      uart.printf("\t'm': Set the maximum voltage.  Uses DEV1_MAX_VOLTAGE\n\r");
-      uart.printf("\t'i': Read the isolation status.\n\r");
-      uart.printf("\t'r': Restarts the SIM100 device.\n\r");
-      uart.printf("\r'v': Gets the SIM100 firmware version\n\r");
+      uart.puts("List of possible commands\n\r");
+      uart.puts("\t'h': Help Message\n\r");
+      uart.puts("\t'n': Get the SIM100 Manufacturer Name\n\r");
+      uart.puts("\t'm': Set the maximum voltage.  Uses DEV1_MAX_VOLTAGE\n\r");
+      uart.puts("\t'i': Read the isolation status.\n\r");
+      uart.puts("\t'r': Restarts the SIM100 device.\n\r");
+      uart.puts("\r'v': Gets the SIM100 firmware version\n\r");
+      APM::format::write(
+          uart,
+          APM_FORMAT("\t's [rounds] [period] [requests]': Soak the SIM100 "
+                     "with {} rounds of requests.  The period is the ms "
+                     "between rounds, 0 for back to back.  Requests are any "
+                     "of 'i' (isolation), 'n' (part name) and 'm' (max "
+                     "voltage {} V), all by default\n\r"),
+          DEFAULT_ROUNDS, SOAK_VOLTAGE);
     } else if (strncmp("n", buf, BUF_SIZE) == 0) {
-      uart.printf("Getting Device Manufacturer name\n\r");
+      uart.puts("Getting Device Manufacturer name\n\r");
       if (sim100.getPartName(buf, BUF_SIZE) != 0) {
-        uart.printf("An error occurred when retrieving the device name\n\r");
+        uart.puts("An error occurred when retrieving the device name\n\r");
       } else {
-        uart.printf("The device name is: %s\n\r", buf);
+        APM::format::write(uart, APM_FORMAT("The device name is: {}\n\r"), buf);
       }
 
     } else if (strncmp("m", buf, BUF_SIZE) == 0) {
@@ -63,44 +417,63 @@ int main() {
       //            APM::DEV::SIM100::DEV1_MAX_BATTERY_VOLTAGE;
       uint16_t setVoltage = 50;
       uint16_t receivedVoltage = 0;
-      uart.printf("Setting GFD Max Voltage to %d V\n\r", setVoltage);
+      APM::format::write(uart,
+                         APM_FORMAT("Setting GFD Max Voltage to {} V\n\r"),
+                         setVoltage);
 
       receivedVoltage = sim100.setMaxWorkingVoltage(setVoltage);
       if (setVoltage != receivedVoltage) {
-        uart.printf(
-            "An error occurred when setting the max working voltage\n\r");
-        uart.printf("Expected: %d\n\r", setVoltage);
-        uart.printf("Received: %d\n\r", receivedVoltage);
+        uart.puts("An error occurred when setting the max working voltage\n\r");
+        APM::format::write(uart, APM_FORMAT("Expected: {}\n\r"), setVoltage);
+        APM::format::write(uart, APM_FORMAT("Received: {}\n\r"),
+                           receivedVoltage);
       } else {
-        uart.printf("Successfully set max voltage: %d\n\r", receivedVoltage);
+        APM::format::write(uart,
+                           APM_FORMAT("Successfully set max voltage: {}\n\r"),
+                           receivedVoltage);
       }
     } else if (strncmp("i", buf, BUF_SIZE) == 0) {
-      uart.printf("Reading the isolation status of the SIM100 board\n\r");
+      uart.puts("Reading the isolation status of the SIM100 board\n\r");
       auto errorCode = sim100.getIsolationState();
       if (errorCode == APM::DEV::SIM100::IsolationStateResponse::NoError) {
-        uart.printf("No Errors detected!\n\r");
+        uart.puts("No Errors detected!\n\r");
       } else {
-        uart.printf("Error detected: %d\n\r", static_cast<uint8_t>(errorCode));
+        APM::format::write(uart, APM_FORMAT("Error detected: {} ({})\n\r"),
+                           errorCode, static_cast<uint8_t>(errorCode));
       }
     } else if (strncmp("r", buf, BUF_SIZE) == 0) {
-      uart.printf("Restarting SIM100\n\r");
+      uart.puts("Restarting SIM100\n\r");
       if (sim100.restartSIM100() == 0) {
-        uart.printf("Restart successful!!\n\r");
+        uart.puts("Restart successful!!\n\r");
       } else {
-        uart.printf("Restart failed.\n\r");
+        uart.puts("Restart failed.\n\r");
       }
     } else if (strncmp("v", buf, BUF_SIZE) == 0) {
-      uart.printf("Reading Version Number\n\r");
+      uart.puts("Reading Version Number\n\r");
       if (sim100.getVersion(buf, BUF_SIZE) != 0) {
-        uart.printf("An error occurred when retrieving the device version\n\r");
+        uart.puts("An error occurred when retrieving the device version\n\r");
+      } else {
+        APM::format::write(uart, APM_FORMAT("The device version is: {}\n\r"),
+                           buf);
+      }
+    } else if (buf[0] == 's' && (buf[1] == '\0' || buf[1] == ' ')) {
+      uint32_t rounds;
+      uint32_t period;
+      uint8_t requests;
+      if (!parseSoakArgs(&buf[1], rounds, period, requests)) {
+        APM::format::write(uart,
+                           APM_FORMAT("Usage: s [rounds] [period] [requests],"
+                                      " 1 to {} rounds, 0 to {} ms, requests "
+                                      "from \"{}\"\n\r"),
+                           MAX_ROUNDS, MAX_PERIOD, REQUEST_KEYS);
       } else {
-        uart.printf("The device version is: %s\n\r", buf);
+        soak(uart, sim100, rounds, period, requests);
       }
     } else {
-      uart.printf("Unrecognized command\n\r");
+      uart.puts("Unrecognized command\n\r");
     }
 
-    uart.printf("\n\r");
+    uart.puts("\n\r");
   }
 }
 
@@ -5,12 +5,36 @@
 
 #include <APM/APMManager.hpp>
 #include <APM/APMUart.hpp>
+#include <APM/Boot.hpp>
+#include <APM/BusMonitor.hpp>
+#include <APM/ChargeController.hpp>
+#include <APM/Config.hpp>
+#include <APM/EventLog.hpp>
+#include <APM/GFDSupervisor.hpp>
+#include <APM/GFDVoter.hpp>
+#include <APM/IsolationTrend.hpp>
+#include <APM/KeyInput.hpp>
+#include <APM/LoadMonitor.hpp>
+#include <APM/Metrics.hpp>
+#include <APM/PowerManager.hpp>
+#include <APM/PrechargeMonitor.hpp>
+#include <APM/Profile.hpp>
+#include <APM/SwitchMonitor.hpp>
+#include <APM/Telemetry.hpp>
+#include <APM/Trace.hpp>
+#include <APM/WarmStart.hpp>
 #include <APM/dev/SIM100.hpp>
+#include <APM/dev/platform/f3xx/f302x8/Flashf302x8.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/parse.hpp>
+#include <APM/utils/stack.hpp>
+#include <EVT/dev/platform/f3xx/f302x8/IWDGf302x8.hpp>
 #include <EVT/dev/platform/f3xx/f302x8/Timerf302x8.hpp>
 #include <EVT/io/UART.hpp>
 #include <EVT/io/manager.hpp>
 #include <EVT/io/pin.hpp>
-#include <cstdio>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
 #include <cstring>
 
 // Pointer to the APM Manager
@@ -26,40 +50,595 @@ constexpr int BUF_SIZE = 256;
 constexpr IO::Pin CAN_TX = IO::Pin::PA_12;
 constexpr IO::Pin CAN_RX = IO::Pin::PA_11;
 
+#ifdef APM_REDUNDANT_GFD
+// CAN IDs of the redundant SIM100.  The unit must be configured to use the
+// next ID block so it can share the bus with the primary unit.
+constexpr uint32_t SIM100_B_REQUEST_ID = 0x0A100201;
+constexpr uint32_t SIM100_B_RESPONSE_ID = 0x0A100200;
+#endif
+
+// Flash pages holding the event log (0x0800D000 - 0x0800EFFF)
+constexpr uint32_t EVENT_LOG_FIRST_PAGE = 26;
+constexpr uint32_t EVENT_LOG_NUM_PAGES = 4;
+
+// Flash pages holding the two copies of the configuration (0x0800F000 -
+// 0x0800FFFF)
+constexpr uint32_t CONFIG_FIRST_PAGE = 30;
+constexpr uint32_t CONFIG_NUM_PAGES = 2;
+
+#ifdef APM_PRECHARGE_SENSE
+// HV sense dividers on the MC side of the precharge resistor and on the pack
+constexpr IO::Pin HV_BUS_SENSE = IO::Pin::PA_1;
+constexpr IO::Pin HV_PACK_SENSE = IO::Pin::PB_0;
+#endif
+
+#ifdef APM_CHARGE_CONTROL
+// Backup battery voltage divider and charge current sense amplifier
+constexpr IO::Pin BACKUP_VOLTAGE_SENSE = IO::Pin::PC_0;
+constexpr IO::Pin BACKUP_CURRENT_SENSE = IO::Pin::PC_1;
+
+// Backup battery voltage in mV and charge current in mA at ADC full scale
+constexpr uint32_t BACKUP_VOLTAGE_FULL_SCALE = 16500;
+constexpr uint32_t BACKUP_CURRENT_FULL_SCALE = 3300;
+#endif
+
+// Number of records printed by the 'l' command
+constexpr size_t EVENT_LOG_PRINT_COUNT = 16;
+
 #ifdef NUCLEO_COMPILATION
 constexpr IO::Pin UART_TX = IO::Pin::UART_TX;
 constexpr IO::Pin UART_RX = IO::Pin::UART_RX;
+USART_TypeDef *const CONSOLE_USART = USART2;
 #else
 constexpr IO::Pin UART_TX = IO::Pin::PB_10;
 constexpr IO::Pin UART_RX = IO::Pin::PB_11;
+USART_TypeDef *const CONSOLE_USART = USART3;
 #endif
 
 char buf[BUF_SIZE];
 
-void handleOnButtonInterrupt(IO::GPIO *gpio) {
-  auto apmUart = apmManagerPtr->getApmUart();
+// Sleeps the MCU between console input and periodic work
+PowerManager powerManager;
+
+// CPU time spent in the main loop, asleep and in each interrupt handler
+LoadMonitor loadMonitor;
+
+// CAN bus load, errors and SIM100 response times
+BusMonitor busMonitor;
+
+// Checks the power switches follow the levels they are driven to
+SwitchMonitor switchMonitor;
+
+// Persistent log of mode transitions and faults
+DEV::Flashf302x8 eventLogFlash(EVENT_LOG_FIRST_PAGE, EVENT_LOG_NUM_PAGES);
+EventLog eventLog(eventLogFlash);
+
+// Settings that can be tuned without reflashing
+DEV::Flashf302x8 configFlash(CONFIG_FIRST_PAGE, CONFIG_NUM_PAGES);
+
+/**
+ * State last written to the event log, used to detect changes
+ */
+struct LoggedState {
+  APMMode mode = APMMode::OFF;
+  uint32_t tripCount = 0;
+  DEV::SIM100::IsolationStateResponse sim100States[GFDVoter::MAX_UNITS] = {};
+  IsolationWarning isolationWarning = IsolationWarning::NONE;
+  uint32_t staleTrips = 0;
+  uint8_t weldedSwitches = 0;
+  uint8_t stuckOpenSwitches = 0;
+};
+
+LoggedState loggedState;
+
+#ifdef APM_TRACE_CAPTURE
+// RAM buffer for a trace of CAN frames, key edges, timers and outputs.  Dump
+// it with the 'r' command and replay it with the trace_replay host tool.
+constexpr size_t TRACE_BUFFER_SIZE = 4096;
+
+// Number of trace bytes printed per line by the 'r' command
+constexpr size_t TRACE_DUMP_LINE = 32;
+
+uint8_t traceBuffer[TRACE_BUFFER_SIZE];
+TraceRecorder traceRecorder(traceBuffer, TRACE_BUFFER_SIZE);
+
+/**
+ * Prints the recorded trace as hex and starts a new one.  The host tool
+ * accepts the text between the BEGIN and END lines as a trace file.
+ * @param apmUart the UART to print on
+ */
+void dumpTrace(APMUart *apmUart) {
+  traceRecorder.stop();
+  const uint8_t *data = traceRecorder.getData();
+  size_t size = traceRecorder.getSize();
+
+  apmUart->print(APM_FORMAT("TRACE BEGIN {} dropped={}\n\r"), size,
+                 traceRecorder.getDroppedCount());
+
+  for (size_t offset = 0; offset < size; offset += TRACE_DUMP_LINE) {
+    for (size_t i = offset; i < size && i < offset + TRACE_DUMP_LINE; i++) {
+      apmUart->print(APM_FORMAT("{02X}"), data[i]);
+    }
+    apmUart->printString("\n\r");
+  }
+  apmUart->printString("TRACE END\n\r");
+
+  traceRecorder.start();
+}
+#endif
+
+/**
+ * Checks whether a character is waiting in the debug UART without consuming
+ * it, so the main loop can sleep instead of blocking in gets()
+ * @return true if a character has been received
+ */
+bool consoleHasInput() { return (CONSOLE_USART->ISR & USART_ISR_RXNE) != 0; }
+
+/**
+ * Handles every key event waiting in the queue
+ * @param keyInput the key input service to drain
+ */
+void serviceKeyInput(KeyInput &keyInput) {
+  KeyEvent keyEvent;
+  while (keyInput.popEvent(keyEvent)) {
+    if (apmManagerPtr->handleKeyEvent(keyEvent)) {
+      keyInput.recordActionLatency(keyEvent);
+    }
+  }
+}
+
+/**
+ * Appends a record to the event log, counting the bytes lost if it fails
+ * @param type the event type
+ * @param code the event specific code
+ * @param value the event specific value
+ * @param timestamp the time of the event in ms
+ */
+void logEvent(EventType type, uint8_t code, uint32_t value,
+              uint32_t timestamp) {
+  if (eventLog.append(type, code, value, timestamp) != 0) {
+    metrics::increment(metrics::Metric::LOG_BYTES_DROPPED,
+                       sizeof(EventRecord));
+  }
+}
+
+/**
+ * Appends any change in mode, GFD trips and SIM100 states to the event log.
+ * Called from the main loop so flash is never written from an interrupt.
+ */
+void recordEvents() {
+  uint32_t now = EVT::core::time::millis();
+
+  const TripRecord &trip = apmManagerPtr->getLastTrip();
+  if (trip.count != loggedState.tripCount) {
+    loggedState.tripCount = trip.count;
+    logEvent(EventType::GFD_TRIP, static_cast<uint8_t>(trip.reason),
+             cycles::toMicros(trip.outputsSafe - trip.detected), now);
+  }
+
+  APMMode mode = apmManagerPtr->getCurrentMode();
+  if (mode != loggedState.mode) {
+    logEvent(EventType::MODE_TRANSITION, static_cast<uint8_t>(mode),
+             static_cast<uint32_t>(loggedState.mode), now);
+    loggedState.mode = mode;
+  }
+
+  uint32_t staleTrips = gfdSupervisorPtr->getTripCount();
+  if (staleTrips != loggedState.staleTrips) {
+    loggedState.staleTrips = staleTrips;
+    logEvent(EventType::FAULT, GFDSupervisor::STALE_FAULT,
+             gfdSupervisorPtr->getLastTripAge(), now);
+  }
+
+  // One record per switch, when its fault is first latched
+  uint8_t welded = switchMonitor.getWelded();
+  uint8_t stuckOpen = switchMonitor.getStuckOpen();
+  for (uint8_t bit = 1; bit <= SwitchMonitor::SWITCHES; bit <<= 1) {
+    if ((welded & ~loggedState.weldedSwitches & bit) != 0) {
+      logEvent(EventType::FAULT, SwitchMonitor::WELDED_FAULT, bit, now);
+    }
+    if ((stuckOpen & ~loggedState.stuckOpenSwitches & bit) != 0) {
+      logEvent(EventType::FAULT, SwitchMonitor::STUCK_OPEN_FAULT, bit, now);
+    }
+  }
+  loggedState.weldedSwitches = welded;
+  loggedState.stuckOpenSwitches = stuckOpen;
+
+  GFDVoter &voter = apmManagerPtr->getGFDVoter();
+  for (size_t unit = 0; unit < voter.getNumUnits(); unit++) {
+    auto state = voter.getLastState(unit);
+    if (state != loggedState.sim100States[unit]) {
+      loggedState.sim100States[unit] = state;
+      logEvent(EventType::SIM100_RESPONSE, static_cast<uint8_t>(state), unit,
+               now);
+    }
+  }
+}
+
+/**
+ * Reads a command line from the console.  Key input, the event log and every
+ * periodic task, including the GFD supervisor and its watchdog, keep running
+ * while the rest of the line is typed.
+ * @param apmUart the UART to read from
+ * @param keyInput the key input service to drain
+ * @param line filled with the line, without the line ending
+ * @param size the size of line
+ */
+void readLine(APMUart *apmUart, KeyInput &keyInput, char *line, size_t size) {
+  size_t length = 0;
+
+  while (true) {
+    // Poll without sleeping, so characters typed back to back are not lost
+    if (!consoleHasInput()) {
+      serviceKeyInput(keyInput);
+      recordEvents();
+      powerManager.runTasks();
+      continue;
+    }
+
+    char c = apmUart->getc();
+    if (c == '\r' || c == '\n') {
+      break;
+    }
+    if (length + 1 < size) {
+      line[length++] = c;
+    }
+  }
+
+  line[length] = '\0';
+}
+
+/**
+ * Warns on the console and over CAN when the isolation trend changes grade,
+ * and logs the change.  Called from the main loop.
+ * @param apmUart the UART to print on
+ * @param can the CAN device to send the warning on
+ */
+void reportIsolationWarning(APMUart *apmUart, IO::CAN &can) {
+  const IsolationTrend &trend =
+      apmManagerPtr->getGFDVoter().getIsolationTrend();
+  IsolationEstimate estimate;
+  trend.getEstimate(estimate);
+  if (estimate.warning == loggedState.isolationWarning) {
+    return;
+  }
+  loggedState.isolationWarning = estimate.warning;
 
-  apmUart.printDebugString("On button pressed\n\r");
+  logEvent(EventType::ISOLATION_WARNING,
+           static_cast<uint8_t>(estimate.warning), estimate.timeToTrip,
+           EVT::core::time::millis());
+  trend.transmit(can);
 
-  if (apmManagerPtr->getCurrentMode() == APMMode::ACCESSORY) {
-    apmManagerPtr->accessoryToOnMode();
+  if (estimate.timeToTrip == IsolationTrend::NO_TRIP) {
+    apmUart->print(APM_FORMAT("Isolation warning {}: {} kOhm, no trip "
+                              "projected\n\r"),
+                   getName(estimate.warning), estimate.resistance);
   } else {
-    apmUart.printString(
-        "WARN: On button pressed while bike was not in ACCESSORY mode\n\r");
+    apmUart->print(APM_FORMAT("WARN: Isolation {}: {} kOhm, trip at {} kOhm "
+                              "projected in {} s\n\r"),
+                   getName(estimate.warning), estimate.resistance,
+                   trend.getTripResistance(), estimate.timeToTrip);
   }
 }
 
 /**
- * Prompt to the user for interfacing with the board over UART Debug
- * @param uart reference to the IO::UART object for interfacing with the user
- * @return 0 on success, 1 if a failure has occurred
+ * Prints the newest records of the event log
+ * @param apmUart the UART to print on
+ */
+void printEventLog(APMUart *apmUart) {
+  size_t numRecords = eventLog.getNumRecords();
+  size_t first =
+      numRecords > EVENT_LOG_PRINT_COUNT ? numRecords - EVENT_LOG_PRINT_COUNT
+                                         : 0;
+
+  apmUart->print(APM_FORMAT("Event log: {} records\n\r"), numRecords);
+
+  for (size_t i = first; i < numRecords; i++) {
+    EventRecord record;
+    if (eventLog.readRecord(i, record) != 0) {
+      apmUart->printString("\t<torn record>\n\r");
+      continue;
+    }
+
+    apmUart->print(APM_FORMAT("\t#{} t={} type={} code={} value={}\n\r"),
+                   record.sequence, record.timestamp, record.type, record.code,
+                   record.value);
+  }
+}
+
+/**
+ * Periodic task storing the CPU load of the last sample period
+ * @param priv unused
+ */
+void sampleLoad(void *priv) {
+  loadMonitor.sample();
+  metrics::set(metrics::Metric::CPU_LOAD, loadMonitor.getLoad(1));
+}
+
+/**
+ * Periodic task checking the age of the isolation readings and feeding the
+ * watchdog
+ * @param priv the GFD supervisor
+ */
+void superviseGFD(void *priv) { static_cast<GFDSupervisor *>(priv)->check(); }
+
+/**
+ * Periodic task checking the switches follow their commands
+ * @param priv the APM manager
+ */
+void checkSwitches(void *priv) {
+  static_cast<APMManager *>(priv)->checkSwitches();
+}
+
+/**
+ * Periodic task storing the CAN bus load and errors of the last sample period
+ * @param priv unused
+ */
+void sampleBus(void *priv) { busMonitor.sample(); }
+
+/**
+ * Periodic task sending a snapshot of the metrics and the CAN bus status over
+ * CAN
+ * @param priv the CAN device to send on
+ */
+void exportMetrics(void *priv) {
+  auto &can = *static_cast<IO::CAN *>(priv);
+  metrics::set(metrics::Metric::STACK_HIGH_WATER, stack::getHighWater());
+  metrics::transmit(can);
+  busMonitor.transmit(can);
+  apmManagerPtr->getGFDVoter().getIsolationTrend().transmit(can);
+}
+
+/**
+ * Periodic task adding a sample to the telemetry stream.  Paused while the
+ * stream is stopped.
+ * @param priv the telemetry stream
+ */
+void sendTelemetry(void *priv) {
+  static_cast<TelemetryStream *>(priv)->sample();
+}
+
+/**
+ * Registers a periodic task.  The APM cannot run safely without any of them,
+ * the GFD supervisor feeding the watchdog least of all, so running out of
+ * slots drops to ACCESSORY, reports it and stops.
+ * @param apmUart the UART to report on
+ * @param task the function to run
+ * @param priv pointer passed back to the task
+ * @param period the interval between runs in ms, 0 to register it paused
+ */
+void addTask(APMUart *apmUart, void (*task)(void *priv), void *priv,
+             uint32_t period) {
+  if (powerManager.addPeriodicTask(task, priv, period) == 0) {
+    return;
+  }
+
+  if (apmManagerPtr->getCurrentMode() == APMMode::ON) {
+    apmManagerPtr->onToAccessoryMode();
+  }
+  apmUart->printString("ERROR: Out of periodic task slots, raise "
+                       "PowerManager::MAX_TASKS\n\r");
+  while (true) {
+    __WFI();
+  }
+}
+
+/**
+ * Starts or stops the telemetry stream
+ * @param apmUart the UART to print on
+ * @param telemetry the stream
+ * @param link "uart", "can" or "off"
+ */
+void setTelemetryLink(APMUart *apmUart, TelemetryStream &telemetry,
+                      const char *link) {
+  if (strcmp(link, "uart") == 0) {
+    apmUart->printString("Streaming telemetry on UART, press any key to "
+                         "stop\n\r");
+    telemetry.start(TelemetryLink::UART);
+  } else if (strcmp(link, "can") == 0) {
+    telemetry.start(TelemetryLink::CAN);
+    apmUart->print(APM_FORMAT("Streaming telemetry on CAN every {} ms\n\r"),
+                   telemetry.getPeriod());
+  } else if (strcmp(link, "off") == 0) {
+    telemetry.stop();
+    telemetry.print(*apmUart);
+  } else {
+    apmUart->printString("Use 'y uart', 'y can' or 'y off'\n\r");
+    return;
+  }
+  powerManager.setTaskPeriod(sendTelemetry, telemetry.getPeriod());
+}
+
+/**
+ * Stops a telemetry stream on the UART once a key is pressed
+ * @param apmUart the UART
+ * @param telemetry the stream
+ */
+void stopUartTelemetry(APMUart *apmUart, TelemetryStream &telemetry) {
+  // The key only stops the stream
+  static_cast<void>(apmUart->getc());
+  telemetry.stop();
+  powerManager.setTaskPeriod(sendTelemetry, 0);
+  apmUart->printString("\n\rTelemetry stopped\n\r");
+  telemetry.print(*apmUart);
+}
+
+/**
+ * Prints the share of CPU time and the longest run of a context
+ * @param apmUart the UART to print on
+ * @param name the name of the context
+ * @param context the context
+ * @param elapsed the cycles elapsed since the statistics were reset
+ */
+void printLoadContext(APMUart *apmUart, const char *name, LoadContext context,
+                      uint64_t elapsed) {
+  LoadContextStats stats;
+  loadMonitor.getContextStats(context, stats);
+  uint32_t permille = 0;
+  if (elapsed != 0) {
+    permille = static_cast<uint32_t>(stats.totalCycles * 1000 / elapsed);
+  }
+
+  apmUart->print(APM_FORMAT("\t{<10} {3}.{}%  entries {}  max {} us\n\r"),
+                 name, permille / 10, permille % 10, stats.entries,
+                 cycles::toMicros(stats.maxCycles));
+}
+
+/**
+ * Prints the CPU load, the time spent in each context since the last call and
+ * the stack high-water mark
+ * @param apmUart the UART to print on
  */
-int userPrompt(const APMManager &apmDevice, APMUart *apmUart) {
+void printLoad(APMUart *apmUart) {
+  // Windows of 1 s, 10 s and 1 min
+  uint32_t loads[] = {loadMonitor.getLoad(1), loadMonitor.getLoad(10),
+                      loadMonitor.getLoad(LoadMonitor::NUM_SAMPLES),
+                      loadMonitor.getPeakLoad()};
+  apmUart->print(APM_FORMAT("CPU load: 1 s {}.{}%, 10 s {}.{}%, 1 min {}.{}%, "
+                            "peak {}.{}%\n\r"),
+                 loads[0] / 10, loads[0] % 10, loads[1] / 10, loads[1] % 10,
+                 loads[2] / 10, loads[2] % 10, loads[3] / 10, loads[3] % 10);
+
+  uint64_t elapsed = loadMonitor.getElapsedCycles();
+  printLoadContext(apmUart, "main", LoadContext::MAIN, elapsed);
+  printLoadContext(apmUart, "idle", LoadContext::IDLE, elapsed);
+  printLoadContext(apmUart, "GFD timer", LoadContext::GFD_TIMER, elapsed);
+  printLoadContext(apmUart, "key edge", LoadContext::KEY_EDGE, elapsed);
+  printLoadContext(apmUart, "key timer", LoadContext::KEY_TIMER, elapsed);
+  printLoadContext(apmUart, "charge timer", LoadContext::CHARGE_TIMER,
+                   elapsed);
+  loadMonitor.resetStats();
+
+  apmUart->print(APM_FORMAT("Stack: {} of {} bytes used at most\n\r"),
+                 stack::getHighWater(), stack::getSize());
+}
+
+/**
+ * Prints the command prompt to the user
+ * @param apmUart the UART to print the prompt on
+ */
+void printPrompt(APMUart *apmUart) {
   apmUart->printString("\n\rPlease enter a command\n\r");
   apmUart->printString("Enter 'h' for help\n\r");
   apmUart->printString(">> ");
+}
 
-  apmUart->gets(buf, BUF_SIZE);
+/**
+ * Prints how long start up took and any problem found during it, then the
+ * prompt
+ * @param apmUart the UART to print on
+ * @param eventLogMounted whether the event log was recovered
+ * @param resumed whether ON mode was resumed after a warm restart
+ */
+void printBootSummary(APMUart *apmUart, bool eventLogMounted, bool resumed) {
+  if (eventLogFlash.overlapsImage()) {
+    apmUart->print(APM_FORMAT("WARN: Firmware image ends at 0x{08X}, over the "
+                              "event log pages\n\r"),
+                   DEV::Flashf302x8::getImageEnd());
+  }
+  if (configFlash.overlapsImage()) {
+    apmUart->print(APM_FORMAT("WARN: Firmware image ends at 0x{08X}, over the "
+                              "settings pages, using defaults\n\r"),
+                   DEV::Flashf302x8::getImageEnd());
+  }
+  if (!eventLogMounted) {
+    apmUart->printString("WARN: Event log could not be mounted\n\r");
+  }
+  if (resumed) {
+    apmUart->print(APM_FORMAT("ON mode resumed {} us after reset\n\r"),
+                   boot::getTime(boot::BootPhase::ACCESSORY));
+  } else {
+    apmUart->print(APM_FORMAT("Accessory power {} us after reset\n\r"),
+                   boot::getTime(boot::BootPhase::ACCESSORY));
+  }
+  printPrompt(apmUart);
+}
+
+/**
+ * Prints every setting and where the settings came from
+ * @param apmUart the UART to print on
+ */
+void printConfig(APMUart *apmUart) {
+  const config::Config &settings = config::get();
+  if (config::getActivePage() < 0) {
+    apmUart->printString("Settings: defaults\n\r");
+  } else {
+    apmUart->print(APM_FORMAT("Settings: flash page {}, commit {}\n\r"),
+                   config::getActivePage(), settings.sequence);
+  }
+
+  for (const config::FieldInfo &info : config::FIELDS) {
+    apmUart->print(APM_FORMAT("\t{<22} {<6} ({} - {})\n\r"), info.name,
+                   settings.*info.member, info.min, info.max);
+  }
+}
+
+/**
+ * Changes a setting from a "<name> <value>" console argument
+ * @param apmDevice the APM manager, to check the mode
+ * @param apmUart the UART to print on
+ * @param argument the text after the command
+ */
+void setConfig(const APMManager &apmDevice, APMUart *apmUart,
+               const char *argument) {
+  const char *separator = strchr(argument, ' ');
+  config::Field field;
+  uint32_t value;
+  if (separator == nullptr ||
+      !config::findField(argument, separator - argument, field) ||
+      !parse::toUnsigned(separator + 1, value)) {
+    apmUart->printString("Usage: f <name> <value>\n\r");
+    return;
+  }
+
+  if (apmDevice.getCurrentMode() == APMMode::ON) {
+    apmUart->printString("Settings cannot be changed in ON mode\n\r");
+    return;
+  }
+
+  switch (config::set(field, value)) {
+  case 0:
+    apmUart->print(APM_FORMAT("{} set to {}\n\r"),
+                   config::FIELDS[static_cast<uint8_t>(field)].name, value);
+    break;
+  case 1:
+    apmUart->printString("Value out of range\n\r");
+    break;
+  default:
+    apmUart->printString("Failed to write the settings to flash\n\r");
+    break;
+  }
+}
+
+/**
+ * Answers any setting requests waiting on CAN.  Only called outside ON mode,
+ * when the GFD poll is not using the receive queue.  Requests the GFD poll
+ * held back are answered too, unless newer frames pushed them out.
+ * @param can the CAN device
+ */
+void serviceConfigRequests(IO::CAN &can) {
+  IO::CANMessage message;
+  while (bus::receive(can, message)) {
+    config::handleRequest(can, message);
+  }
+}
+
+/**
+ * Prompt to the user for interfacing with the board over UART Debug.  Reads
+ * and handles a single command.
+ * @param uart reference to the IO::UART object for interfacing with the user
+ * @param handshake the handshake of the last mode transition
+ * @param chargeController the backup battery charger, or nullptr if none is
+ * fitted
+ * @param can the CAN device span statistics are sent on
+ * @param telemetry the telemetry stream
+ * @return 0 on success, 1 if a failure has occurred
+ */
+int userPrompt(const APMManager &apmDevice, APMUart *apmUart,
+               KeyInput &keyInput, const Handshake &handshake,
+               const ChargeController *chargeController, IO::CAN &can,
+               TelemetryStream &telemetry) {
+  readLine(apmUart, keyInput, buf, BUF_SIZE);
   apmUart->printString("\n\r");
 
   if (strncmp("h", buf, BUF_SIZE) == 0) {
@@ -71,22 +650,41 @@ int userPrompt(const APMManager &apmDevice, APMUart *apmUart) {
     apmUart->printString(
         "\t'm': Get Mode.  Returns accessory or on respectively\n\r");
     apmUart->printString("\t'g': Toggle GFD Checking.  Used for debugging\n\r");
+    apmUart->printString("\t't': Print timing of the last GFD trip\n\r");
+    apmUart->printString("\t'p': Print idle time percentage\n\r");
+    apmUart->printString("\t'k': Print key input statistics\n\r");
+    apmUart->printString("\t'l': Print the newest event log records\n\r");
+    apmUart->printString(
+        "\t'u': Print CPU load, interrupt time and stack usage\n\r");
+    apmUart->printString("\t'n': Print metrics counters and gauges\n\r");
+    apmUart->printString("\t'v': Print CAN bus load, errors and SIM100 "
+                         "response times\n\r");
+    apmUart->printString("\t'i': Print the isolation resistance trend\n\r");
+    apmUart->printString("\t'w': Print the age of the last isolation "
+                         "reading\n\r");
+    apmUart->printString("\t'b': Print the boot time of each start up "
+                         "phase\n\r");
+    apmUart->printString("\t'x': Print the board handshake of the last "
+                         "transition\n\r");
+    apmUart->printString("\t'e': Print the backup battery charge state\n\r");
+    apmUart->printString("\t'o': Print the switch readback.  'o clear' "
+                         "clears latched switch faults\n\r");
+    apmUart->printString("\t'f': Print the settings.  'f <name> <value>' "
+                         "changes one\n\r");
+    apmUart->printString("\t'y': Print the telemetry stream.  'y uart', "
+                         "'y can' or 'y off'\n\r");
+    apmUart->printString("\t     starts or stops it\n\r");
+#ifdef APM_TRACE_CAPTURE
+    apmUart->printString("\t'r': Dump the trace and start a new one\n\r");
+#endif
+#ifdef APM_SPAN_PROFILING
+    apmUart->printString("\t's': Print span timing histograms\n\r");
+    apmUart->printString("\t'c': Send span timing statistics over CAN\n\r");
+    apmUart->printString("\t'z': Clear span timing statistics\n\r");
+#endif
   } else if (strncmp("m", buf, BUF_SIZE) == 0) {
-    char modeString[10];
-    switch (apmDevice.getCurrentMode()) {
-    case APMMode::OFF:
-      strncpy(modeString, "OFF", 10);
-      break;
-    case APMMode::ACCESSORY:
-      strncpy(modeString, "ACCESSORY", 10);
-      break;
-    case APMMode::ON:
-      strncpy(modeString, "ON", 10);
-      break;
-    }
-
-    snprintf(buf, BUF_SIZE, "Current APMManager Mode: %s\n\r", modeString);
-    apmUart->printString(buf);
+    apmUart->print(APM_FORMAT("Current APMManager Mode: {}\n\r"),
+                   apmDevice.getCurrentMode());
   } else if (strncmp("d", buf, BUF_SIZE) == 0) {
     apmUart->printString("Entering Debug Mode.  Will print out all debug "
                          "messages to terminal\n\r");
@@ -96,6 +694,8 @@ int userPrompt(const APMManager &apmDevice, APMUart *apmUart) {
     //        apmUart -> getc();
     //        apmUart -> setDebugPrint(false);
     while (true) {
+      serviceKeyInput(keyInput);
+      powerManager.idle(apmDevice.getCurrentMode());
     } // TODO: Update to wait for user input once UART interrupts are
       // implemented
       // Currently it requires an entire device reset to exit blocking mode.
@@ -103,9 +703,74 @@ int userPrompt(const APMManager &apmDevice, APMUart *apmUart) {
     bool previousState = apmManagerPtr->isIsolationChecking();
     bool newState = !previousState;
     apmManagerPtr->setCheckGFDIsolationState(newState);
-    snprintf(buf, BUF_SIZE, "GFD Isolation Checking has been turned %s\n\r",
-             (newState ? "ON" : "OFF"));
-    apmUart->printString(buf);
+    apmUart->print(APM_FORMAT("GFD Isolation Checking has been turned {}\n\r"),
+                   newState ? "ON" : "OFF");
+  } else if (strncmp("t", buf, BUF_SIZE) == 0) {
+    apmDevice.printLastTrip();
+  } else if (strncmp("p", buf, BUF_SIZE) == 0) {
+    apmUart->print(APM_FORMAT("Idle: {}% ({} ms asleep)\n\r"),
+                   powerManager.getIdlePercent(), powerManager.getIdleTime());
+    powerManager.resetIdleStats();
+  } else if (strncmp("k", buf, BUF_SIZE) == 0) {
+    apmUart->print(APM_FORMAT("Key edges: {}, events: {}, dropped: {}\n\r"),
+                   keyInput.getEdgeCount(), keyInput.getEventCount(),
+                   keyInput.getDroppedCount());
+    apmUart->print(
+        APM_FORMAT("Key to action latency: last {} us, max {} us\n\r"),
+        keyInput.getLastLatency(), keyInput.getMaxLatency());
+  } else if (strncmp("l", buf, BUF_SIZE) == 0) {
+    printEventLog(apmUart);
+  } else if (strncmp("u", buf, BUF_SIZE) == 0) {
+    printLoad(apmUart);
+  } else if (strncmp("n", buf, BUF_SIZE) == 0) {
+    metrics::set(metrics::Metric::STACK_HIGH_WATER, stack::getHighWater());
+    apmUart->printString("Metrics:\n\r");
+    metrics::print(*apmUart);
+  } else if (strncmp("v", buf, BUF_SIZE) == 0) {
+    busMonitor.print(*apmUart);
+  } else if (strncmp("i", buf, BUF_SIZE) == 0) {
+    apmDevice.getGFDVoter().getIsolationTrend().print(*apmUart);
+  } else if (strncmp("w", buf, BUF_SIZE) == 0) {
+    gfdSupervisorPtr->print(*apmUart);
+  } else if (strncmp("x", buf, BUF_SIZE) == 0) {
+    handshake.print(*apmUart);
+  } else if (strncmp("e", buf, BUF_SIZE) == 0) {
+    if (chargeController == nullptr) {
+      apmUart->printString("No backup battery charger fitted\n\r");
+    } else {
+      chargeController->print(*apmUart);
+    }
+  } else if (strncmp("o", buf, BUF_SIZE) == 0) {
+    switchMonitor.print(*apmUart);
+  } else if (strncmp("o clear", buf, BUF_SIZE) == 0) {
+    switchMonitor.clear();
+    apmUart->printString("Switch faults cleared\n\r");
+  } else if (strncmp("f", buf, BUF_SIZE) == 0) {
+    printConfig(apmUart);
+  } else if (strncmp("f ", buf, 2) == 0) {
+    setConfig(apmDevice, apmUart, &buf[2]);
+  } else if (strncmp("y", buf, BUF_SIZE) == 0) {
+    telemetry.print(*apmUart);
+  } else if (strncmp("y ", buf, 2) == 0) {
+    setTelemetryLink(apmUart, telemetry, &buf[2]);
+  } else if (strncmp("b", buf, BUF_SIZE) == 0) {
+    apmUart->printString("Boot profile:\n\r");
+    boot::print(*apmUart);
+#ifdef APM_TRACE_CAPTURE
+  } else if (strncmp("r", buf, BUF_SIZE) == 0) {
+    dumpTrace(apmUart);
+#endif
+#ifdef APM_SPAN_PROFILING
+  } else if (strncmp("s", buf, BUF_SIZE) == 0) {
+    profile::print(*apmUart);
+  } else if (strncmp("c", buf, BUF_SIZE) == 0) {
+    if (profile::transmit(can) != 0) {
+      apmUart->printString("Failed to send span statistics\n\r");
+    }
+  } else if (strncmp("z", buf, BUF_SIZE) == 0) {
+    profile::reset();
+    apmUart->printString("Span statistics cleared\n\r");
+#endif
   } else {
     apmUart->printString("Unrecognized Command\n\r");
   }
@@ -116,9 +781,22 @@ int userPrompt(const APMManager &apmDevice, APMUart *apmUart) {
 } // namespace APM
 
 int main() {
+  // Time every start up phase from here on
+  APM::boot::start();
+
   // Initialize IO Objects
   IO::init();
-  IO::UART &uart = IO::getUART<APM::UART_TX, APM::UART_RX>(APM::BAUD_RATE);
+  APM::boot::mark(APM::boot::BootPhase::IO_INIT);
+
+  // Read and clear the reset cause, so the next reset reports only its own
+  uint32_t resetFlags = RCC->CSR;
+  RCC->CSR |= RCC_CSR_RMVF;
+  APM::warm::init();
+
+  // Paint the stack before anything can use much of it.  Done after IO::init()
+  // so it runs at the full core clock.
+  APM::stack::paint();
+
   IO::GPIO &accessorySW_GPIO =
       IO::getGPIO<APM::APMManager::ACCESSORY_SW>(IO::GPIO::Direction::OUTPUT);
   IO::GPIO &chargeSW_GPIO =
@@ -134,36 +812,225 @@ int main() {
           IO::GPIO::Direction::OUTPUT);
   IO::GPIO &mcOnSw_GPIO = IO::getGPIO<APM::APMManager::MC_ON>(
       EVT::core::IO::GPIO::Direction::OUTPUT);
+  APM::boot::mark(APM::boot::BootPhase::GPIO_SETUP);
+
+  IO::UART &uart = IO::getUART<APM::UART_TX, APM::UART_RX>(APM::BAUD_RATE);
+  APM::boot::mark(APM::boot::BootPhase::UART_SETUP);
 
   IO::CAN &can = IO::getCAN<APM::CAN_TX, APM::CAN_RX>();
+  APM::boot::mark(APM::boot::BootPhase::CAN_SETUP);
 
   auto apmUart = APM::APMUart(&uart);
-  auto sim100 = APM::DEV::SIM100(can);
+  // Measure the bus from the first frame, and time the SIM100 responses
+  auto sim100A = APM::DEV::SIM100(can);
+  APM::busMonitor.addPair("SIM100 A", APM::DEV::SIM100::CAN_REQUEST_ID,
+                          APM::DEV::SIM100::CAN_RESPONSE_ID);
+#ifdef APM_REDUNDANT_GFD
+  auto sim100B = APM::DEV::SIM100(can, APM::SIM100_B_REQUEST_ID,
+                                  APM::SIM100_B_RESPONSE_ID);
+  APM::busMonitor.addPair("SIM100 B", APM::SIM100_B_REQUEST_ID,
+                          APM::SIM100_B_RESPONSE_ID);
+  APM::DEV::SIM100 *sim100Units[] = {&sim100A, &sim100B};
+
+  // Require both units to agree on a fault.  If one unit goes stale the other
+  // keeps protecting the bike on its own.
+  auto gfdVoter =
+      APM::GFDVoter(can, sim100Units, 2, APM::GFDVoter::VotingPolicy::TWO_OF_N);
+#else
+  APM::DEV::SIM100 *sim100Units[] = {&sim100A};
+
+  // DEV1 has a single SIM100, which trips on any fault it reports
+  auto gfdVoter = APM::GFDVoter(can, sim100Units, 1);
+#endif
+  APM::busMonitor.start();
+  busMonitorPtr = &APM::busMonitor;
 
   auto apmTimer = EVT::core::DEV::Timerf302x8(TIM2, 5000);
+  auto keyTimer =
+      EVT::core::DEV::Timerf302x8(TIM15, APM::KeyInput::DEBOUNCE_PERIOD);
+  auto keyInput =
+      APM::KeyInput(keyOnSw_GPIO, APM::APMManager::KEY_ON_UC, keyTimer);
 
   // Create Data Objects
   APM::APMManager apmManager = APM::APMManager(
-      apmUart, sim100, accessorySW_GPIO, chargeSW_GPIO, vicorSW_GPIO, apmTimer,
-      accessoryIndicator_GPIO, onIndicator_GPIO, mcOnSw_GPIO);
+      apmUart, gfdVoter, accessorySW_GPIO, chargeSW_GPIO, vicorSW_GPIO,
+      apmTimer, accessoryIndicator_GPIO, onIndicator_GPIO, mcOnSw_GPIO);
   apmManagerPtr = &apmManager;
 
-  apmUart.setDebugPrint(true);
-  apmUart.startupMessage();
+  // Confirms the boards set by handshake_nodes follow each mode transition
+  auto handshake = APM::Handshake(can);
+  apmManager.setHandshake(&handshake);
 
-  // Initially Load Device into Accessory Mode on Power On
-  apmManagerPtr->offToAccessoryMode();
+  // Catches switches that do not follow a transition, or change on their own
+#ifdef APM_SWITCH_SENSE
+  IO::getGPIO<APM::SwitchMonitor::MC_SENSE>(IO::GPIO::Direction::INPUT);
+  IO::getGPIO<APM::SwitchMonitor::ACCESSORY_SENSE>(IO::GPIO::Direction::INPUT);
+  IO::getGPIO<APM::SwitchMonitor::CHARGE_SENSE>(IO::GPIO::Direction::INPUT);
+  IO::getGPIO<APM::SwitchMonitor::VICOR_SENSE>(IO::GPIO::Direction::INPUT);
+#endif
+  apmManager.setSwitchMonitor(&APM::switchMonitor);
 
-  // By default do not perform GFD Isolation Checking yet
-  apmManagerPtr->setCheckGFDIsolationState(false);
+#ifdef APM_PRECHARGE_SENSE
+  // Ends precharge as soon as the bus reaches precharge_percent of the pack
+  IO::ADC &hvBusSense = IO::getADC<APM::HV_BUS_SENSE>();
+  IO::ADC &hvPackSense = IO::getADC<APM::HV_PACK_SENSE>();
+  auto prechargeMonitor = APM::PrechargeMonitor(hvBusSense, hvPackSense);
+  apmManager.setPrechargeMonitor(&prechargeMonitor);
+#endif
+
+  // Charges the backup battery while ON without any main loop polling
+  APM::ChargeController *charger = nullptr;
+#ifdef APM_CHARGE_CONTROL
+  IO::GPIO &chargeLimiter_GPIO =
+      IO::getGPIO<APM::APMManager::CHARGE_LIMITER_ENABLE>(
+          IO::GPIO::Direction::OUTPUT);
+  IO::ADC &backupVoltageSense = IO::getADC<APM::BACKUP_VOLTAGE_SENSE>();
+  IO::ADC &backupCurrentSense = IO::getADC<APM::BACKUP_CURRENT_SENSE>();
+  auto chargeTimer = EVT::core::DEV::Timerf302x8(
+      TIM16, APM::ChargeController::MONITOR_PERIOD);
+  auto chargeController = APM::ChargeController(
+      backupVoltageSense, backupCurrentSense, chargeSW_GPIO, chargeLimiter_GPIO,
+      chargeTimer, APM::BACKUP_VOLTAGE_FULL_SCALE,
+      APM::BACKUP_CURRENT_FULL_SCALE);
+  chargeController.start();
+  apmManager.setChargeController(&chargeController);
+  charger = &chargeController;
+#endif
+
+  // Use the tuned settings if any have been committed.  Mounted before the
+  // mode step, which needs the tuned settings when ON mode is resumed.  A
+  // commit erases a page, so the defaults are used if the image has grown
+  // into the pages.
+  if (!APM::configFlash.overlapsImage()) {
+    APM::config::mount(APM::configFlash);
+  }
+  APM::boot::mark(APM::boot::BootPhase::MANAGER_SETUP);
+
+  // Initially Load Device into Accessory Mode on Power On.  After a watchdog,
+  // software or reset pin reset in ON mode, carry on in ON instead of
+  // dropping HV, as long as the key is still on.  The key is sampled before
+  // the switches close, since no edge is seen for a key turned off during
+  // the reset.  Nothing is printed before this so the switches are not held
+  // up by the console.
+  APM::warm::Snapshot snapshot = {};
+  bool keyOn = keyOnSw_GPIO.readPin() == IO::GPIO::State::HIGH;
+  bool resumed = keyOn && (resetFlags & RCC_CSR_PORRSTF) == 0 &&
+                 APM::warm::load(snapshot) == 0 &&
+                 apmManagerPtr->resumeOnMode(snapshot) == 0;
+  if (!resumed) {
+    apmManagerPtr->offToAccessoryMode();
+  }
+  APM::boot::mark(APM::boot::BootPhase::ACCESSORY);
+  APM::metrics::set(APM::metrics::Metric::ACCESSORY_BOOT_TIME,
+                    APM::boot::getTime(APM::boot::BootPhase::ACCESSORY));
+
+#ifdef APM_TRACE_CAPTURE
+  traceRecorderPtr = &APM::traceRecorder;
+  APM::traceRecorder.start();
+#endif
+
+  // Recover the event log left by the last power cycle.  Mounting may erase
+  // pages, so it is skipped if the image has grown into them.
+  bool eventLogMounted = !APM::eventLogFlash.overlapsImage() &&
+                         APM::eventLog.mount() == 0;
+  uint8_t resumedMode =
+      resumed ? static_cast<uint8_t>(apmManagerPtr->getCurrentMode()) : 0;
+  APM::logEvent(APM::EventType::BOOT, resumedMode, resetFlags >> 24,
+                EVT::core::time::millis());
+  APM::boot::mark(APM::boot::BootPhase::STORAGE);
+
+  // GFD Isolation Checking is off by default, unless configured otherwise.  A
+  // resumed ON mode keeps the setting it had before the reset.
+  if (!resumed) {
+    apmManagerPtr->setCheckGFDIsolationState(
+        APM::config::get().gfdCheckDefault != 0);
+  }
 
   // Set up interrupt for key signal
-  keyOnSw_GPIO.registerIRQ(IO::GPIO::TriggerEdge::RISING,
-                           APM::handleOnButtonInterrupt);
+  keyInput.start();
+
+  // No edge is seen for a key turned off since it was sampled
+  if (resumed && !keyInput.isOn()) {
+    apmManagerPtr->onToAccessoryMode();
+  }
+
+  // Account CPU time from here on
+  loadMonitorPtr = &APM::loadMonitor;
+  APM::loadMonitor.start();
+  APM::addTask(&apmUart, APM::sampleLoad, nullptr,
+               APM::LoadMonitor::SAMPLE_PERIOD);
+  APM::addTask(&apmUart, APM::sampleBus, nullptr,
+               APM::BusMonitor::SAMPLE_PERIOD);
+
+  // Report fleet health over CAN without a debugger attached
+  APM::addTask(&apmUart, APM::exportMetrics, &can,
+               APM::metrics::EXPORT_PERIOD);
+
+  // Keep checking the switches follow their commands between transitions
+  APM::addTask(&apmUart, APM::checkSwitches, &apmManager,
+               APM::SwitchMonitor::SAMPLE_PERIOD);
 
-  // Display Prompt to user
-  apmUart.setDebugPrint(false);
+  // High rate binary logging, started from the console
+  auto telemetry = APM::TelemetryStream(apmManager, uart, can);
+  APM::addTask(&apmUart, APM::sendTelemetry, &telemetry, 0);
+
+  // Switch to ACCESSORY if ON mode goes without isolation readings, and reset
+  // if the main loop stops.  The watchdog starts last so nothing in start up
+  // has to feed it.
+  auto watchdog =
+      EVT::core::DEV::IWDGf302x8(APM::GFDSupervisor::WATCHDOG_TIMEOUT);
+  auto gfdSupervisor = APM::GFDSupervisor(apmManager, watchdog);
+  gfdSupervisorPtr = &gfdSupervisor;
+  APM::addTask(&apmUart, APM::superviseGFD, &gfdSupervisor,
+               APM::GFDSupervisor::CHECK_PERIOD);
+  APM::boot::mark(APM::boot::BootPhase::READY);
+
+  // The banner streams out a line per loop so key presses are handled while
+  // it prints.  Production builds skip it.
+#ifdef APM_STARTUP_BANNER
+  bool booting = true;
+#else
+  bool booting = false;
+  APM::printBootSummary(&apmUart, eventLogMounted, resumed);
+#endif
+
+  APM::powerManager.resetIdleStats();
   while (true) {
-    userPrompt(*apmManagerPtr, &apmUart);
+    APM::serviceKeyInput(keyInput);
+    APM::recordEvents();
+
+    if (booting) {
+      gfdSupervisor.check();
+      if (apmUart.printStartupLine()) {
+        booting = false;
+        APM::boot::mark(APM::boot::BootPhase::BANNER);
+        APM::printBootSummary(&apmUart, eventLogMounted, resumed);
+      }
+      continue;
+    }
+
+    APM::reportIsolationWarning(&apmUart, can);
+
+    // Flash commits stall the core, so settings only change outside ON mode
+    if (apmManagerPtr->getCurrentMode() != APM::APMMode::ON) {
+      APM::serviceConfigRequests(can);
+    }
+
+    if (APM::consoleHasInput()) {
+      if (telemetry.getLink() == APM::TelemetryLink::UART) {
+        APM::stopUartTelemetry(&apmUart, telemetry);
+      } else {
+        userPrompt(*apmManagerPtr, &apmUart, keyInput, handshake, charger, can,
+                   telemetry);
+      }
+
+      // Nothing else goes on the UART while it carries the stream
+      if (telemetry.getLink() != APM::TelemetryLink::UART) {
+        APM::printPrompt(&apmUart);
+      }
+    }
+
+    // Sleep until the next console byte, key press or periodic task
+    APM::powerManager.idle(apmManagerPtr->getCurrentMode());
   }
 }
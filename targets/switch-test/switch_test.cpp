@@ -1,12 +1,23 @@
 /**
- * This code will allow for an easy testing of the APM MOSFET switches
+ * This code will allow for an easy testing of the APM MOSFET switches.
+ *
+ * Besides toggling each switch by hand, it can replay the ACCESSORY -> ON and
+ * ON -> ACCESSORY switching orders of APMManager hundreds of times.  After
+ * each write the switch readback is sampled in a tight loop against the cycle
+ * counter, and min/mean/max tables of each step's latency and of the time
+ * between consecutive steps are printed, to tune the switching order and dead
+ * times from measured data.
  */
 
 #include <APM/APMManager.hpp>
 #include <APM/APMUart.hpp>
+#include <APM/utils/cycles.hpp>
+#include <APM/utils/parse.hpp>
+#include <APM/utils/pins.hpp>
 #include <EVT/io/UART.hpp>
 #include <EVT/io/manager.hpp>
 #include <EVT/io/pin.hpp>
+#include <HALf3/stm32f3xx.h>
 #include <cstring>
 #include <string>
 
@@ -28,8 +39,271 @@ constexpr IO::Pin UART_TX = IO::Pin::PB_10;
 constexpr IO::Pin UART_RX = IO::Pin::PB_11;
 #endif
 
+// Readback input of each switch.  The board has no switch sense lines, so
+// by default the input buffer of the output pin itself is sampled, which sees
+// the pin edge as loaded by the MOSFET gate.  Point these at inputs wired to
+// the switch outputs to measure the MOSFETs themselves.
+constexpr IO::Pin ACCESSORY_READBACK = APMManager::ACCESSORY_SW;
+constexpr IO::Pin CHARGE_READBACK = APMManager::CHARGE_SW;
+constexpr IO::Pin VICOR_READBACK = APMManager::VICOR_SW;
+
+// Number of times each transition is run by default
+constexpr uint32_t DEFAULT_RUNS = 200;
+
+// Most runs a single timing command accepts
+constexpr uint32_t MAX_RUNS = 100000;
+
+// Time in us to wait for the readback of a step before counting it as a
+// timeout
+constexpr uint32_t STEP_TIMEOUT = 1000;
+
+// Time in us the outputs are held between transitions, so every switch has
+// settled before the next transition starts
+constexpr uint32_t HOLD_TIME = 10000;
+
+// Most steps in a timed transition
+constexpr uint8_t MAX_STEPS = 3;
+
 char buf[BUF_SIZE];
 
+/**
+ * A switch, with the output driving it and the input reading it back
+ */
+struct Switch {
+  const char *name;
+  IO::GPIO &output;
+  IO::Pin readback;
+};
+
+/**
+ * One write of a timed transition
+ */
+struct Step {
+  Switch *target;
+  IO::GPIO::State state;
+};
+
+/**
+ * Running min/mean/max of a duration, in cycles
+ */
+struct Stats {
+  uint32_t count;
+  uint32_t minCycles;
+  uint32_t maxCycles;
+  uint64_t totalCycles;
+};
+
+/**
+ * Timing results of one step over every run
+ */
+struct StepStats {
+  // Time from the write until the readback matched
+  Stats latency;
+  // Time from the previous step's readback matching until this one's did
+  Stats sincePrevious;
+  // Runs in which the readback did not match within STEP_TIMEOUT
+  uint32_t timeouts;
+};
+
+/**
+ * A switching order to time, with its results
+ */
+struct Transition {
+  const char *name;
+  Step steps[MAX_STEPS];
+  StepStats stats[MAX_STEPS];
+};
+
+/**
+ * Adds a duration to a running min/mean/max
+ * @param stats the statistics to update
+ * @param cycles the duration in cycles
+ */
+void addSample(Stats &stats, uint32_t cycles) {
+  if (stats.count == 0 || cycles < stats.minCycles) {
+    stats.minCycles = cycles;
+  }
+  if (cycles > stats.maxCycles) {
+    stats.maxCycles = cycles;
+  }
+  stats.totalCycles += cycles;
+  stats.count++;
+}
+
+/**
+ * Converts cycles to nanoseconds, the resolution the readback is sampled at
+ * @param cycles the duration in cycles
+ * @return the duration in ns
+ */
+uint32_t toNanos(uint64_t cycles) {
+  uint64_t cyclesPerMicro = SystemCoreClock / 1000000;
+  if (cyclesPerMicro == 0) {
+    return 0;
+  }
+  return static_cast<uint32_t>(cycles * 1000 / cyclesPerMicro);
+}
+
+/**
+ * Configures a readback pin as an input, unless it is the output pin itself
+ * @tparam OUTPUT the pin driving the switch
+ * @tparam READBACK the pin reading the switch back
+ */
+template <IO::Pin OUTPUT, IO::Pin READBACK>
+void setupReadback() {
+  if constexpr (READBACK != OUTPUT) {
+    IO::getGPIO<READBACK>(IO::GPIO::Direction::INPUT);
+  }
+}
+
+/**
+ * Busy waits for a number of microseconds
+ * @param micros the time to wait
+ */
+void waitMicros(uint32_t micros) {
+  uint32_t start = cycles::now();
+  uint32_t period = SystemCoreClock / 1000000 * micros;
+  while (cycles::now() - start < period) {
+  }
+}
+
+/**
+ * Runs every step of a transition once and adds the timings to its results
+ * @param transition the transition to run
+ * @param deadTime time in us to wait between steps
+ */
+void runTransition(Transition &transition, uint32_t deadTime) {
+  uint32_t timeout = SystemCoreClock / 1000000 * STEP_TIMEOUT;
+  uint32_t previousSettled = 0;
+  bool previousValid = false;
+
+  for (uint8_t i = 0; i < MAX_STEPS; i++) {
+    const Step &step = transition.steps[i];
+    StepStats &stats = transition.stats[i];
+    volatile uint32_t &input = pins::getRegisters(step.target->readback)->IDR;
+    uint32_t mask = pins::getMask(step.target->readback);
+    uint32_t expected = step.state == IO::GPIO::State::HIGH ? mask : 0;
+
+    // Interrupts off, so the samples are not stretched by a handler
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t start = cycles::now();
+    step.target->output.writePin(step.state);
+    uint32_t now = start;
+    bool settled = false;
+    while (now - start < timeout) {
+      bool match = (input & mask) == expected;
+      now = cycles::now();
+      if (match) {
+        settled = true;
+        break;
+      }
+    }
+
+    __set_PRIMASK(primask);
+
+    if (settled) {
+      addSample(stats.latency, now - start);
+      if (previousValid) {
+        addSample(stats.sincePrevious, now - previousSettled);
+      }
+    } else {
+      stats.timeouts++;
+    }
+    previousSettled = now;
+    previousValid = settled;
+
+    if (deadTime > 0) {
+      waitMicros(deadTime);
+    }
+  }
+}
+
+/**
+ * Prints one duration as min/mean/max columns
+ * @param apmUart the UART to print on
+ * @param stats the duration
+ */
+void printStats(APMUart &apmUart, const Stats &stats) {
+  if (stats.count == 0) {
+    apmUart.printString("       -       -       -");
+    return;
+  }
+  apmUart.print(APM_FORMAT(" {7} {7} {7}"), toNanos(stats.minCycles),
+                toNanos(stats.totalCycles / stats.count),
+                toNanos(stats.maxCycles));
+}
+
+/**
+ * Prints the results of a transition as a table
+ * @param apmUart the UART to print on
+ * @param transition the transition
+ * @param runs the number of runs the results are over
+ */
+void printTransition(APMUart &apmUart, const Transition &transition,
+                     uint32_t runs) {
+  apmUart.print(APM_FORMAT("{} ({} runs, times in ns)\n\r"), transition.name,
+                runs);
+  apmUart.printString("                      latency              "
+                      "after previous\n\r");
+  apmUart.printString("step               min    mean     max     min"
+                      "    mean     max timeouts\n\r");
+  for (uint8_t i = 0; i < MAX_STEPS; i++) {
+    const Step &step = transition.steps[i];
+    const StepStats &stats = transition.stats[i];
+    apmUart.print(APM_FORMAT("{<9} {<4}"), step.target->name,
+                  step.state == IO::GPIO::State::HIGH ? "on" : "off");
+    printStats(apmUart, stats.latency);
+    printStats(apmUart, stats.sincePrevious);
+    apmUart.print(APM_FORMAT(" {8}\n\r"), stats.timeouts);
+  }
+}
+
+/**
+ * Times the ACCESSORY -> ON and ON -> ACCESSORY switching orders of
+ * APMManager.  MC_ON and the precharge wait are left out, so the test can run
+ * without HV.  Charging is started without the limiter, as in BULK.
+ * @param apmUart the UART to print on
+ * @param accessorySw the accessory switch
+ * @param chargeSw the charge switch
+ * @param vicorSw the Vicor switch
+ * @param runs number of times to run each transition
+ * @param deadTime time in us to wait between steps
+ */
+void timeTransitions(APMUart &apmUart, Switch &accessorySw, Switch &chargeSw,
+                     Switch &vicorSw, uint32_t runs, uint32_t deadTime) {
+  constexpr auto ON = IO::GPIO::State::HIGH;
+  constexpr auto OFF = IO::GPIO::State::LOW;
+
+  // The switching orders of accessoryToOnMode and onToAccessoryMode.  The
+  // time after the previous step of the second step is the overlap with both
+  // VICOR_SW and ACCESSORY_SW closed.
+  Transition toOn = {"ACCESSORY -> ON",
+                     {{&vicorSw, ON}, {&accessorySw, OFF}, {&chargeSw, ON}},
+                     {}};
+  Transition toAccessory = {
+      "ON -> ACCESSORY",
+      {{&chargeSw, OFF}, {&accessorySw, ON}, {&vicorSw, OFF}},
+      {}};
+
+  // Start from ACCESSORY
+  chargeSw.output.writePin(OFF);
+  vicorSw.output.writePin(OFF);
+  accessorySw.output.writePin(ON);
+  waitMicros(HOLD_TIME);
+
+  for (uint32_t run = 0; run < runs; run++) {
+    runTransition(toOn, deadTime);
+    waitMicros(HOLD_TIME);
+    runTransition(toAccessory, deadTime);
+    waitMicros(HOLD_TIME);
+  }
+
+  printTransition(apmUart, toOn, runs);
+  apmUart.printString("\n\r");
+  printTransition(apmUart, toAccessory, runs);
+}
+
 } // namespace APM
 
 /**
@@ -68,6 +342,19 @@ int main() {
 
   auto apmUart = APM::APMUart(&uart);
 
+  APM::cycles::init();
+  APM::setupReadback<APM::APMManager::ACCESSORY_SW,
+                     APM::ACCESSORY_READBACK>();
+  APM::setupReadback<APM::APMManager::CHARGE_SW, APM::CHARGE_READBACK>();
+  APM::setupReadback<APM::APMManager::VICOR_SW, APM::VICOR_READBACK>();
+  APM::Switch accessorySw = {"Accessory", accessorySW_GPIO,
+                             APM::ACCESSORY_READBACK};
+  APM::Switch chargeSw = {"Charge", chargeSW_GPIO, APM::CHARGE_READBACK};
+  APM::Switch vicorSw = {"Vicor", vicorSW_GPIO, APM::VICOR_READBACK};
+
+  // Time in us waited between the steps of a timed transition
+  uint32_t deadTime = 0;
+
   while (true) {
     apmUart.printString("\n\rPlease enter a command\n\r");
     apmUart.printString("Enter 'h' for help\n\r");
@@ -84,46 +371,76 @@ int main() {
       apmUart.printString("\t'v' - Read Vicor Switch\n\r");
       apmUart.printString("\t'C' - Toggle Charging Switch\n\r");
       apmUart.printString("\t'c' - Read Charging Switch\n\r");
+      apmUart.print(APM_FORMAT("\t'T' - Time the ON and ACCESSORY transitions "
+                               "{} times\n\r"),
+                    APM::DEFAULT_RUNS);
+      apmUart.printString(
+          "\t'T <runs>' - Time the transitions <runs> times\n\r");
+      apmUart.print(APM_FORMAT("\t'D <us>' - Set the dead time between "
+                               "transition steps, now {} us\n\r"),
+                    deadTime);
     } else if (strncmp("A", APM::buf, APM::BUF_SIZE) == 0) {
       auto state = getToggle(accessorySW_GPIO.readPin());
       accessorySW_GPIO.writePin(state);
       accessoryIndicator_GPIO.writePin(state);
-      sprintf(APM::buf, "Accessory Switch: %d\n\r",
-              static_cast<unsigned int>(accessorySW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Accessory Switch: {}\n\r"),
+                    static_cast<unsigned int>(accessorySW_GPIO.readPin()));
     } else if (strncmp("a", APM::buf, APM::BUF_SIZE) == 0) {
-      sprintf(APM::buf, "Accessory Switch: %d\n\r",
-              static_cast<unsigned int>(accessorySW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Accessory Switch: {}\n\r"),
+                    static_cast<unsigned int>(accessorySW_GPIO.readPin()));
     } else if (strncmp("V", APM::buf, APM::BUF_SIZE) == 0) {
       auto state = getToggle(vicorSW_GPIO.readPin());
       vicorSW_GPIO.writePin(state);
       vicorIndicator_GPIO.writePin(state);
-      sprintf(APM::buf, "Vicor Switch: %d\n\r",
-              static_cast<unsigned int>(vicorSW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Vicor Switch: {}\n\r"),
+                    static_cast<unsigned int>(vicorSW_GPIO.readPin()));
     } else if (strncmp("v", APM::buf, APM::BUF_SIZE) == 0) {
-      sprintf(APM::buf, "Vicor Switch: %d\n\r",
-              static_cast<unsigned int>(vicorSW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Vicor Switch: {}\n\r"),
+                    static_cast<unsigned int>(vicorSW_GPIO.readPin()));
     } else if (strncmp("C", APM::buf, APM::BUF_SIZE) == 0) {
       auto state = getToggle(chargeSW_GPIO.readPin());
       chargeSW_GPIO.writePin(state);
       chargeEnable_GPIO.writePin(state);
       chargeIndicator_GPIO.writePin(state);
-      sprintf(APM::buf, "Charge Switch: %d\n\r",
-              static_cast<unsigned int>(chargeSW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
-      sprintf(APM::buf, "Charge Enable: %d\n\r",
-              static_cast<unsigned int>(chargeEnable_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Charge Switch: {}\n\r"),
+                    static_cast<unsigned int>(chargeSW_GPIO.readPin()));
+      apmUart.print(APM_FORMAT("Charge Enable: {}\n\r"),
+                    static_cast<unsigned int>(chargeEnable_GPIO.readPin()));
     } else if (strncmp("c", APM::buf, APM::BUF_SIZE) == 0) {
-      sprintf(APM::buf, "Charge Switch: %d\n\r",
-              static_cast<unsigned int>(chargeSW_GPIO.readPin()));
-      apmUart.printString(APM::buf);
-      sprintf(APM::buf, "Charge Enable: %d\n\r",
-              static_cast<unsigned int>(chargeEnable_GPIO.readPin()));
-      apmUart.printString(APM::buf);
+      apmUart.print(APM_FORMAT("Charge Switch: {}\n\r"),
+                    static_cast<unsigned int>(chargeSW_GPIO.readPin()));
+      apmUart.print(APM_FORMAT("Charge Enable: {}\n\r"),
+                    static_cast<unsigned int>(chargeEnable_GPIO.readPin()));
+    } else if (strncmp("T", APM::buf, APM::BUF_SIZE) == 0 ||
+               strncmp("T ", APM::buf, 2) == 0) {
+      uint32_t runs = APM::DEFAULT_RUNS;
+      if (APM::buf[1] != '\0' &&
+          (!APM::parse::toUnsigned(&APM::buf[2], runs) || runs == 0 ||
+           runs > APM::MAX_RUNS)) {
+        apmUart.print(APM_FORMAT("Usage: T <runs>, 1 to {}\n\r"),
+                      APM::MAX_RUNS);
+        continue;
+      }
+
+      // The charge limiter is not part of the timed transitions
+      chargeEnable_GPIO.writePin(IO::GPIO::State::LOW);
+      APM::timeTransitions(apmUart, accessorySw, chargeSw, vicorSw, runs,
+                           deadTime);
+
+      // Left in ACCESSORY
+      accessoryIndicator_GPIO.writePin(IO::GPIO::State::HIGH);
+      chargeIndicator_GPIO.writePin(IO::GPIO::State::LOW);
+      vicorIndicator_GPIO.writePin(IO::GPIO::State::LOW);
+    } else if (strncmp("D ", APM::buf, 2) == 0) {
+      uint32_t micros;
+      if (!APM::parse::toUnsigned(&APM::buf[2], micros) ||
+          micros > APM::STEP_TIMEOUT) {
+        apmUart.print(APM_FORMAT("Usage: D <us>, 0 to {}\n\r"),
+                      APM::STEP_TIMEOUT);
+        continue;
+      }
+      deadTime = micros;
+      apmUart.print(APM_FORMAT("Dead time: {} us\n\r"), deadTime);
     }
   }
 }
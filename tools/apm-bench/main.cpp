@@ -0,0 +1,624 @@
+/**
+ * Benchmarks the APM hot paths on the host simulator: SIM100 request building
+ * and response decoding, isolation state classification, GFD voting, mode
+ * transitions, UART logging and CAN queue operations.
+ *
+ * Usage: apm_bench [--filter text] [--baseline file] [--threshold percent]
+ *
+ * For each benchmark the following are printed as <benchmark>.<key>=value
+ * lines, so a saved run can be passed back in as a baseline:
+ *   ns_per_op            host wall time per operation
+ *   instructions_per_op  host instructions retired per operation, when the
+ *                        kernel allows performance counters
+ *   sim_us_per_op        virtual time the operation takes on the APM, for
+ *                        operations that wait on the bus or a timer
+ *   bytes_per_op         UART bytes sent per operation
+ *   wire_us_per_op       time those bytes take on the wire at 115200 baud
+ *
+ * With a baseline, any value that grew by more than the threshold is reported
+ * and the exit status is non-zero.  Wall times use the given threshold.
+ * Instruction counts and virtual times are nearly deterministic, so they use
+ * a tight fixed threshold.
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/APMUart.hpp>
+#include <APM/GFDVoter.hpp>
+#include <APM/dev/SIM100.hpp>
+#include <APM/utils/cycles.hpp>
+#include <SIM100Model.hpp>
+#include <SimBoard.hpp>
+#include <SimIO.hpp>
+#include <Simulator.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+namespace IO = EVT::core::IO;
+using APM::DEV::SIM100;
+using APM::sim::SIM100Model;
+using APM::sim::Simulator;
+
+// Each measured run lasts at least this long
+constexpr double MIN_RUN_NS = 20e6;
+
+// Measured runs per benchmark.  The median is reported.
+constexpr int REPETITIONS = 5;
+
+// Cap on the iterations of a single run
+constexpr uint64_t MAX_ITERATIONS = 100000000;
+
+// Default allowed growth of wall times over the baseline, in percent
+constexpr double DEFAULT_THRESHOLD = 15.0;
+
+// Allowed growth of instruction counts and virtual times, in percent
+constexpr double DETERMINISTIC_THRESHOLD = 1.0;
+
+// Debug UART of dev1_apm: 115200 baud, 10 bits per byte
+constexpr double UART_BYTE_US = 10.0 * 1e6 / 115200.0;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Counts instructions retired in user space by the calling thread
+ */
+class InstructionCounter {
+public:
+  InstructionCounter() {
+    perf_event_attr attr = {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  ~InstructionCounter() {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+
+  InstructionCounter(const InstructionCounter &) = delete;
+
+  InstructionCounter &operator=(const InstructionCounter &) = delete;
+
+  /**
+   * Returns whether the kernel allowed the counter to be opened
+   * @return true if read() returns real counts
+   */
+  [[nodiscard]] bool isAvailable() const { return fd >= 0; }
+
+  /**
+   * Returns the instructions retired so far
+   * @return instruction count, or 0 if unavailable
+   */
+  [[nodiscard]] uint64_t read() const {
+    uint64_t count = 0;
+    if (fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count)) {
+      return 0;
+    }
+    return count;
+  }
+
+private:
+  int fd;
+};
+
+/**
+ * Controls one run of a benchmark.  Timing starts on the first call to
+ * keepRunning() and stops once the iterations are used up, so set up before
+ * the loop is not measured.
+ */
+class State {
+public:
+  State(uint64_t iterations, const InstructionCounter &counter)
+      : iterations(iterations), remaining(iterations), counter(counter) {}
+
+  /**
+   * Returns whether another iteration should run
+   * @return true while iterations remain
+   */
+  bool keepRunning() {
+    if (!started) {
+      started = true;
+      resumeTiming();
+    }
+    if (remaining == 0) {
+      pauseTiming();
+      return false;
+    }
+    remaining--;
+    return true;
+  }
+
+  /**
+   * Stops timing, for set up inside the loop
+   */
+  void pauseTiming() {
+    elapsedNs += std::chrono::duration<double, std::nano>(Clock::now() -
+                                                          resumedAt)
+                     .count();
+    instructions += counter.read() - resumedInstructions;
+  }
+
+  /**
+   * Restarts timing after pauseTiming()
+   */
+  void resumeTiming() {
+    resumedInstructions = counter.read();
+    resumedAt = Clock::now();
+  }
+
+  /**
+   * Adds virtual time taken by the operations
+   * @param micros virtual time in us
+   */
+  void addSimTime(uint64_t micros) { simMicros += micros; }
+
+  /**
+   * Sets the UART bytes sent by all iterations
+   * @param bytes number of bytes
+   */
+  void setBytes(uint64_t bytes) { this->bytes = bytes; }
+
+  const uint64_t iterations;
+  double elapsedNs = 0;
+  uint64_t instructions = 0;
+  uint64_t simMicros = 0;
+  uint64_t bytes = 0;
+
+private:
+  uint64_t remaining;
+  bool started = false;
+  Clock::time_point resumedAt;
+  uint64_t resumedInstructions = 0;
+  const InstructionCounter &counter;
+};
+
+/**
+ * Keeps a value alive so the compiler cannot remove the work producing it
+ * @param value the value
+ */
+template <typename T>
+void keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/**
+ * Builds an isolation state response as sent by a SIM100
+ * @param status the status byte
+ * @param length the data length
+ * @return the response frame
+ */
+IO::CANMessage isolationResponse(uint8_t status, uint8_t length = 8) {
+  uint8_t payload[8] = {0xE0, status, 0, 0, 0, 0, 0, 0};
+  return IO::CANMessage(SIM100::CAN_RESPONSE_ID, length, payload, true);
+}
+
+void benchRequestIsolationState(State &state) {
+  Simulator simulator;
+  APM::sim::SimCAN can;
+  SIM100 unit(can);
+
+  while (state.keepRunning()) {
+    keep(unit.requestIsolationState());
+  }
+}
+
+void benchDecodeIsolationState(State &state) {
+  // One of each outcome, so branch prediction does not flatter the result
+  IO::CANMessage responses[] = {
+      isolationResponse(SIM100Model::STATUS_OK),
+      isolationResponse(SIM100Model::STATUS_ISOLATION_FAULT),
+      isolationResponse(SIM100Model::STATUS_HARDWARE_ERROR),
+      isolationResponse(SIM100Model::STATUS_NO_NEW_ESTIMATES),
+      isolationResponse(0x08),
+      isolationResponse(0x04),
+      isolationResponse(0x20),
+      isolationResponse(SIM100Model::STATUS_OK, 2),
+  };
+  constexpr size_t count = sizeof(responses) / sizeof(responses[0]);
+
+  size_t index = 0;
+  while (state.keepRunning()) {
+    bool queryAgain;
+    keep(SIM100::decodeIsolationState(responses[index], queryAgain));
+    keep(queryAgain);
+    index = index + 1 == count ? 0 : index + 1;
+  }
+}
+
+void benchGetIsolationState(State &state) {
+  Simulator simulator;
+  APM::sim::SimCAN can;
+  SIM100 unit(can);
+  SIM100Model model(simulator, SIM100::CAN_REQUEST_ID,
+                    SIM100::CAN_RESPONSE_ID);
+
+  while (state.keepRunning()) {
+    uint64_t start = simulator.getTime();
+    keep(unit.getIsolationState());
+    state.addSimTime(simulator.getTime() - start);
+  }
+}
+
+/**
+ * Runs GFDVoter::poll() over two units
+ * @param state the benchmark state
+ * @param silentUnit true to stop the second unit responding
+ */
+void benchVoterPoll(State &state, bool silentUnit) {
+  Simulator simulator;
+  APM::sim::SimCAN can;
+  SIM100 unitA(can);
+  SIM100 unitB(can, APM::sim::SimBoard::SIM100_B_REQUEST_ID,
+               APM::sim::SimBoard::SIM100_B_RESPONSE_ID);
+  SIM100 *units[] = {&unitA, &unitB};
+  APM::GFDVoter voter(can, units, 2, APM::GFDVoter::VotingPolicy::TWO_OF_N);
+  SIM100Model modelA(simulator, SIM100::CAN_REQUEST_ID,
+                     SIM100::CAN_RESPONSE_ID);
+  SIM100Model modelB(simulator, APM::sim::SimBoard::SIM100_B_REQUEST_ID,
+                     APM::sim::SimBoard::SIM100_B_RESPONSE_ID);
+  modelB.setSilent(silentUnit);
+
+  while (state.keepRunning()) {
+    uint64_t start = simulator.getTime();
+    keep(voter.poll());
+    state.addSimTime(simulator.getTime() - start);
+  }
+}
+
+void benchVoterPollHealthy(State &state) { benchVoterPoll(state, false); }
+
+void benchVoterPollOneSilent(State &state) { benchVoterPoll(state, true); }
+
+/**
+ * A booted board with both SIM100 units answering
+ */
+struct BoardFixture {
+  Simulator simulator;
+  SIM100Model modelA{simulator, SIM100::CAN_REQUEST_ID,
+                     SIM100::CAN_RESPONSE_ID};
+  SIM100Model modelB{simulator, APM::sim::SimBoard::SIM100_B_REQUEST_ID,
+                     APM::sim::SimBoard::SIM100_B_RESPONSE_ID};
+  APM::sim::SimBoard board;
+
+  BoardFixture() { board.boot(); }
+};
+
+void benchAccessoryToOn(State &state) {
+  BoardFixture fixture;
+  APM::APMManager &manager = fixture.board.getManager();
+
+  while (state.keepRunning()) {
+    uint64_t start = fixture.simulator.getTime();
+    manager.accessoryToOnMode();
+    state.addSimTime(fixture.simulator.getTime() - start);
+
+    state.pauseTiming();
+    manager.onToAccessoryMode();
+    state.resumeTiming();
+  }
+}
+
+void benchOnToAccessory(State &state) {
+  BoardFixture fixture;
+  APM::APMManager &manager = fixture.board.getManager();
+
+  while (state.keepRunning()) {
+    state.pauseTiming();
+    manager.accessoryToOnMode();
+    state.resumeTiming();
+
+    uint64_t start = fixture.simulator.getTime();
+    manager.onToAccessoryMode();
+    state.addSimTime(fixture.simulator.getTime() - start);
+  }
+}
+
+void benchTripToAccessory(State &state) {
+  BoardFixture fixture;
+  APM::APMManager &manager = fixture.board.getManager();
+
+  while (state.keepRunning()) {
+    state.pauseTiming();
+    manager.accessoryToOnMode();
+    state.resumeTiming();
+
+    manager.tripToAccessoryMode(SIM100::IsolationStateResponse::IsolationError,
+                                APM::cycles::now());
+  }
+}
+
+/**
+ * Prints a typical transition log line
+ * @param state the benchmark state
+ * @param debug whether debug printing is enabled
+ * @param alwaysPrint use printString rather than printDebugString
+ */
+void benchUart(State &state, bool debug, bool alwaysPrint) {
+  APM::sim::SimUART uart;
+  APM::APMUart apmUart(&uart, debug);
+  const char *message = "Transitioning from ACCESSORY -> ON\n\r";
+
+  while (state.keepRunning()) {
+    if (alwaysPrint) {
+      apmUart.printString(message);
+    } else {
+      apmUart.printDebugString(message);
+    }
+  }
+
+  state.setBytes(uart.getBytesWritten());
+}
+
+void benchUartPrintString(State &state) { benchUart(state, false, true); }
+
+void benchUartDebugEnabled(State &state) { benchUart(state, true, false); }
+
+void benchUartDebugDisabled(State &state) { benchUart(state, false, false); }
+
+/**
+ * Prints a log line with a string, an enum and an integer
+ * @param state the benchmark state
+ * @param useFormat use APMUart::print rather than snprintf
+ */
+void benchUartFormat(State &state, bool useFormat) {
+  APM::sim::SimUART uart;
+  APM::APMUart apmUart(&uart);
+  char buf[128];
+  uint32_t count = 0;
+
+  while (state.keepRunning()) {
+    APM::APMMode mode = (count & 1) ? APM::APMMode::ON : APM::APMMode::OFF;
+    if (useFormat) {
+      apmUart.print(APM_FORMAT("{} mode: {}, trips: {5}\n\r"), "GFD", mode,
+                    count);
+    } else {
+      snprintf(buf, sizeof(buf), "%s mode: %s, trips: %5lu\n\r", "GFD",
+               APM::getName(mode), static_cast<unsigned long>(count));
+      apmUart.printString(buf);
+    }
+    count++;
+  }
+
+  state.setBytes(uart.getBytesWritten());
+}
+
+void benchUartFormatPrint(State &state) { benchUartFormat(state, true); }
+
+void benchUartFormatSnprintf(State &state) { benchUartFormat(state, false); }
+
+void benchCANEnqueueDequeue(State &state) {
+  Simulator simulator;
+  APM::sim::SimCAN can;
+
+  APM::sim::SimInput input;
+  input.type = APM::sim::SimInput::Type::CAN;
+  input.message = isolationResponse(SIM100Model::STATUS_OK);
+
+  IO::CANMessage received;
+  while (state.keepRunning()) {
+    // The simulator delivers the frame to the receive queue as the CAN
+    // interrupt would, then the APM takes it off
+    input.time = simulator.getTime();
+    simulator.schedule(input);
+    simulator.advanceTo(input.time);
+    keep(can.receive(&received, false));
+  }
+}
+
+struct Benchmark {
+  const char *name;
+  void (*run)(State &state);
+};
+
+const Benchmark BENCHMARKS[] = {
+    {"sim100.request_isolation_state", benchRequestIsolationState},
+    {"sim100.decode_isolation_state", benchDecodeIsolationState},
+    {"sim100.get_isolation_state", benchGetIsolationState},
+    {"voter.poll", benchVoterPollHealthy},
+    {"voter.poll_one_silent", benchVoterPollOneSilent},
+    {"manager.accessory_to_on", benchAccessoryToOn},
+    {"manager.on_to_accessory", benchOnToAccessory},
+    {"manager.trip_to_accessory", benchTripToAccessory},
+    {"uart.print_string", benchUartPrintString},
+    {"uart.print_debug_enabled", benchUartDebugEnabled},
+    {"uart.print_debug_disabled", benchUartDebugDisabled},
+    {"uart.format_print", benchUartFormatPrint},
+    {"uart.format_snprintf", benchUartFormatSnprintf},
+    {"can.enqueue_dequeue", benchCANEnqueueDequeue},
+};
+
+/**
+ * Runs a benchmark and records its results
+ * @param benchmark the benchmark
+ * @param counter the instruction counter
+ * @param results filled with <name>.<key> results
+ */
+void runBenchmark(const Benchmark &benchmark,
+                  const InstructionCounter &counter,
+                  std::map<std::string, double> &results) {
+  // Grow the iteration count until a run is long enough to time
+  uint64_t iterations = 1;
+  while (true) {
+    State state(iterations, counter);
+    benchmark.run(state);
+    if (state.elapsedNs >= MIN_RUN_NS || iterations >= MAX_ITERATIONS) {
+      break;
+    }
+    double scale = state.elapsedNs > 0 ? MIN_RUN_NS / state.elapsedNs : 10;
+    scale = std::clamp(scale * 1.2, 2.0, 10.0);
+    iterations = std::min(MAX_ITERATIONS,
+                          static_cast<uint64_t>(iterations * scale) + 1);
+  }
+
+  std::vector<std::unique_ptr<State>> runs;
+  for (int i = 0; i < REPETITIONS; i++) {
+    runs.push_back(std::make_unique<State>(iterations, counter));
+    benchmark.run(*runs.back());
+  }
+  std::sort(runs.begin(), runs.end(), [](const auto &a, const auto &b) {
+    return a->elapsedNs < b->elapsedNs;
+  });
+  const State &median = *runs[REPETITIONS / 2];
+
+  auto perOp = [&median](double total) { return total / median.iterations; };
+  std::string prefix = std::string(benchmark.name) + ".";
+  results[prefix + "ns_per_op"] = perOp(median.elapsedNs);
+  if (counter.isAvailable()) {
+    results[prefix + "instructions_per_op"] =
+        perOp(static_cast<double>(median.instructions));
+  }
+  if (median.simMicros != 0) {
+    results[prefix + "sim_us_per_op"] =
+        perOp(static_cast<double>(median.simMicros));
+  }
+  if (median.bytes != 0) {
+    double bytes = perOp(static_cast<double>(median.bytes));
+    results[prefix + "bytes_per_op"] = bytes;
+    results[prefix + "wire_us_per_op"] = bytes * UART_BYTE_US;
+  }
+}
+
+/**
+ * Reads the key=value lines of a previous run
+ * @param path the file to read
+ * @param results filled with the values
+ * @return true on success
+ */
+bool readBaseline(const char *path, std::map<std::string, double> &results) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char *separator = strchr(line, '=');
+    if (separator == nullptr) {
+      continue;
+    }
+    *separator = '\0';
+    results[line] = strtod(separator + 1, nullptr);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Returns whether a key ends with the given suffix
+ * @param key the key
+ * @param suffix the suffix
+ * @return true on a match
+ */
+bool endsWith(const std::string &key, const char *suffix) {
+  size_t length = strlen(suffix);
+  return key.size() >= length &&
+         key.compare(key.size() - length, length, suffix) == 0;
+}
+
+/**
+ * Reports results that grew past the threshold
+ * @param baseline the baseline results
+ * @param results the current results
+ * @param threshold allowed growth of wall times in percent
+ * @return the number of regressions
+ */
+int compare(const std::map<std::string, double> &baseline,
+            const std::map<std::string, double> &results, double threshold) {
+  int regressions = 0;
+  for (const auto &[key, value] : results) {
+    auto base = baseline.find(key);
+    if (base == baseline.end() || base->second <= 0) {
+      continue;
+    }
+
+    double limit = endsWith(key, ".ns_per_op") ? threshold
+                                               : DETERMINISTIC_THRESHOLD;
+    double change = (value - base->second) / base->second * 100.0;
+    if (change > limit) {
+      fprintf(stderr, "REGRESSION %s: %.2f -> %.2f (+%.1f%%)\n", key.c_str(),
+              base->second, value, change);
+      regressions++;
+    }
+  }
+  return regressions;
+}
+
+/**
+ * Prints the usage message
+ */
+void usage() {
+  fprintf(stderr, "Usage: apm_bench [--filter text] [--baseline file] "
+                  "[--threshold percent]\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *filter = nullptr;
+  const char *baselinePath = nullptr;
+  double threshold = DEFAULT_THRESHOLD;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "--filter") == 0) {
+      filter = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "--baseline") == 0) {
+      baselinePath = argv[++i];
+    } else if (i + 1 < argc && strcmp(argv[i], "--threshold") == 0) {
+      threshold = strtod(argv[++i], nullptr);
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  std::map<std::string, double> baseline;
+  if (baselinePath != nullptr && !readBaseline(baselinePath, baseline)) {
+    fprintf(stderr, "Failed to read %s\n", baselinePath);
+    return 1;
+  }
+
+  InstructionCounter counter;
+  if (!counter.isAvailable()) {
+    fprintf(stderr, "Instruction counter unavailable, check "
+                    "/proc/sys/kernel/perf_event_paranoid\n");
+  }
+
+  std::map<std::string, double> results;
+  for (const Benchmark &benchmark : BENCHMARKS) {
+    if (filter != nullptr && strstr(benchmark.name, filter) == nullptr) {
+      continue;
+    }
+    std::map<std::string, double> benchmarkResults;
+    runBenchmark(benchmark, counter, benchmarkResults);
+    for (const auto &[key, value] : benchmarkResults) {
+      printf("%s=%.2f\n", key.c_str(), value);
+    }
+    fflush(stdout);
+    results.insert(benchmarkResults.begin(), benchmarkResults.end());
+  }
+
+  if (baselinePath == nullptr) {
+    return 0;
+  }
+
+  int regressions = compare(baseline, results, threshold);
+  printf("regressions=%d\n", regressions);
+  return regressions == 0 ? 0 : 1;
+}
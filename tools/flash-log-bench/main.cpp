@@ -0,0 +1,218 @@
+/**
+ * Benchmarks the APM EventLog on a host machine using a memory mapped file in
+ * place of the STM32F302x8 flash.  Measures append throughput, mount time and
+ * page wear, and checks recovery from power losses at every point of an
+ * append.
+ *
+ * Usage: flash_log_bench [file] [appends]
+ *
+ * Results are printed as key=value lines so they can be compared between
+ * commits.  Exits non-zero if a recovery check fails.
+ */
+
+#include <APM/EventLog.hpp>
+#include <MappedFileFlash.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Flash geometry matching the dev1_apm event log
+constexpr uint32_t PAGE_SIZE = 2048;
+constexpr uint32_t NUM_PAGES = 4;
+
+// Approximate STM32F302x8 timings, used to estimate on-target cost
+constexpr double HALF_WORD_PROGRAM_US = 53.5;
+constexpr double PAGE_ERASE_US = 40000.0;
+
+// Rated erase cycles per page of the STM32F302x8 flash
+constexpr double RATED_ERASE_CYCLES = 10000.0;
+
+// Number of times the log is mounted to average the mount time
+constexpr int MOUNT_ITERATIONS = 1000;
+
+// Half words programmed by one append (16 byte record)
+constexpr uint64_t RECORD_HALF_WORDS = sizeof(APM::EventRecord) / 2;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Returns the time elapsed since start in microseconds
+ * @param start the start of the measurement
+ * @return elapsed microseconds
+ */
+double elapsedMicros(Clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+/**
+ * Checks that every record reads back intact or torn, in sequence order
+ * @param log the mounted log
+ * @param torn filled with the number of torn records
+ * @return true if the log is consistent
+ */
+bool verifyLog(const APM::EventLog &log, size_t &torn) {
+  uint32_t lastSequence = 0;
+  bool first = true;
+  torn = 0;
+
+  for (size_t i = 0; i < log.getNumRecords(); i++) {
+    APM::EventRecord record;
+    int status = log.readRecord(i, record);
+    if (status == 2) {
+      torn++;
+      continue;
+    }
+    if (status != 0 || (!first && record.sequence <= lastSequence)) {
+      return false;
+    }
+    lastSequence = record.sequence;
+    first = false;
+  }
+
+  return true;
+}
+
+/**
+ * Cuts power part way through an append, then mounts the log again and
+ * checks that it recovers and accepts new records
+ * @param flash the flash holding the log
+ * @param operations flash operations allowed before power is lost
+ * @return true if the log recovered
+ */
+bool tearAndRecover(APM::host::MappedFileFlash &flash, uint64_t operations) {
+  APM::EventLog before(flash);
+  if (before.mount() != 0) {
+    return false;
+  }
+
+  flash.setPowerLossAfter(operations);
+  before.append(APM::EventType::FAULT, 0xEE, 0, 0);
+  flash.clearPowerLoss();
+
+  APM::EventLog after(flash);
+  size_t torn;
+  if (after.mount() != 0 || !verifyLog(after, torn)) {
+    return false;
+  }
+
+  // A new record must land after the torn one, never on top of it.  The
+  // count can shrink here if the append recycles the oldest page.
+  if (after.append(APM::EventType::BOOT, 0xB0, 0, 0) != 0) {
+    return false;
+  }
+
+  APM::EventRecord record;
+  return after.readRecord(after.getNumRecords() - 1, record) == 0 &&
+         record.code == 0xB0 && verifyLog(after, torn);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *path = argc > 1 ? argv[1] : "flash_log_bench.bin";
+  long appends = argc > 2 ? strtol(argv[2], nullptr, 10) : 100000;
+
+  if (appends <= 0) {
+    fprintf(stderr, "appends must be positive\n");
+    return 1;
+  }
+
+  APM::host::MappedFileFlash flash(path, PAGE_SIZE, NUM_PAGES, true);
+  if (!flash.isOpen()) {
+    fprintf(stderr, "Failed to map %s\n", path);
+    return 1;
+  }
+
+  APM::EventLog log(flash);
+  if (log.mount() != 0) {
+    fprintf(stderr, "Failed to mount the log\n");
+    return 1;
+  }
+
+  // Append throughput
+  auto start = Clock::now();
+  for (long i = 0; i < appends; i++) {
+    auto type = (i % 2 == 0) ? APM::EventType::MODE_TRANSITION
+                             : APM::EventType::SIM100_RESPONSE;
+    if (log.append(type, static_cast<uint8_t>(i), static_cast<uint32_t>(i),
+                   static_cast<uint32_t>(i)) != 0) {
+      fprintf(stderr, "Append %ld failed\n", i);
+      return 1;
+    }
+  }
+  double appendMicros = elapsedMicros(start);
+
+  uint32_t minErases = flash.getEraseCount(0);
+  uint32_t maxErases = minErases;
+  uint32_t totalErases = 0;
+  for (uint32_t page = 0; page < NUM_PAGES; page++) {
+    uint32_t erases = flash.getEraseCount(page);
+    minErases = erases < minErases ? erases : minErases;
+    maxErases = erases > maxErases ? erases : maxErases;
+    totalErases += erases;
+  }
+
+  double targetMicros =
+      static_cast<double>(flash.getHalfWordsProgrammed()) *
+          HALF_WORD_PROGRAM_US +
+      totalErases * PAGE_ERASE_US;
+  double appendsPerErase =
+      static_cast<double>(appends) / (totalErases > 0 ? totalErases : 1);
+
+  printf("appends=%ld\n", appends);
+  printf("host_append_ns=%.1f\n", appendMicros * 1000.0 / appends);
+  printf("host_appends_per_sec=%.0f\n", appends / (appendMicros / 1e6));
+  printf("target_est_append_us=%.1f\n", targetMicros / appends);
+  printf("records_per_page=%u\n", log.getRecordsPerPage());
+  printf("records_held=%zu\n", log.getNumRecords());
+  printf("erases_min=%u\n", minErases);
+  printf("erases_max=%u\n", maxErases);
+  printf("lifetime_appends_est=%.0f\n",
+         RATED_ERASE_CYCLES * NUM_PAGES * appendsPerErase);
+
+  // Mount time on a full log
+  start = Clock::now();
+  for (int i = 0; i < MOUNT_ITERATIONS; i++) {
+    APM::EventLog remounted(flash);
+    if (remounted.mount() != 0) {
+      fprintf(stderr, "Remount failed\n");
+      return 1;
+    }
+  }
+  printf("mount_us=%.3f\n", elapsedMicros(start) / MOUNT_ITERATIONS);
+
+  // Power loss at every half word of a record append
+  int recoveryFailures = 0;
+  for (uint64_t ops = 0; ops <= RECORD_HALF_WORDS; ops++) {
+    if (!tearAndRecover(flash, ops)) {
+      recoveryFailures++;
+    }
+  }
+
+  // Power loss while starting a new page: fill the active page, then cut
+  // power during the erase and during each half word of the page header
+  for (uint64_t ops = 0; ops <= 4; ops++) {
+    APM::EventLog filler(flash);
+    filler.mount();
+    while (filler.getNumRecords() % filler.getRecordsPerPage() != 0) {
+      filler.append(APM::EventType::MODE_TRANSITION, 0, 0, 0);
+    }
+    if (!tearAndRecover(flash, ops)) {
+      recoveryFailures++;
+    }
+  }
+
+  APM::EventLog finalLog(flash);
+  size_t torn = 0;
+  bool consistent = finalLog.mount() == 0 && verifyLog(finalLog, torn);
+  flash.sync();
+
+  printf("power_loss_failures=%d\n", recoveryFailures);
+  printf("records_torn=%zu\n", torn);
+  printf("log_consistent=%d\n", consistent ? 1 : 0);
+
+  return (recoveryFailures == 0 && consistent) ? 0 : 1;
+}
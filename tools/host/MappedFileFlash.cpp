@@ -0,0 +1,153 @@
+/**
+ * Source code for MappedFileFlash class
+ */
+
+#include <MappedFileFlash.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace APM::host {
+
+MappedFileFlash::MappedFileFlash(const char *path, uint32_t pageSize,
+                                 uint32_t numPages, bool truncate)
+    : pageSize(pageSize), numPages(numPages), eraseCounts(numPages, 0) {
+  size_t size = static_cast<size_t>(pageSize) * numPages;
+
+  fd = open(path, O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0), 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat fileStat {};
+  fstat(fd, &fileStat);
+  bool fresh = static_cast<size_t>(fileStat.st_size) != size;
+  if (fresh && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    close(fd);
+    fd = -1;
+    return;
+  }
+
+  void *mapping =
+      mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED) {
+    close(fd);
+    fd = -1;
+    return;
+  }
+  data = static_cast<uint8_t *>(mapping);
+
+  // A new file behaves like erased flash
+  if (fresh) {
+    memset(data, ERASED_BYTE, size);
+  }
+}
+
+MappedFileFlash::~MappedFileFlash() {
+  if (data != nullptr) {
+    munmap(data, static_cast<size_t>(pageSize) * numPages);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool MappedFileFlash::isOpen() const { return data != nullptr; }
+
+uint32_t MappedFileFlash::getPageSize() const { return pageSize; }
+
+uint32_t MappedFileFlash::getNumPages() const { return numPages; }
+
+const uint8_t *MappedFileFlash::getAddress() const { return data; }
+
+int MappedFileFlash::read(uint32_t offset, void *out, size_t size) const {
+  if (!isOpen() || !inRange(offset, size)) {
+    return 1;
+  }
+  memcpy(out, data + offset, size);
+  return 0;
+}
+
+int MappedFileFlash::write(uint32_t offset, const void *in, size_t size) {
+  if (!isOpen() || !inRange(offset, size) || (offset % 2) != 0 ||
+      (size % 2) != 0) {
+    return 1;
+  }
+
+  auto *bytes = static_cast<const uint8_t *>(in);
+  for (size_t i = 0; i < size; i += 2) {
+    uint16_t current;
+    uint16_t halfWord;
+    memcpy(&current, data + offset + i, sizeof(current));
+    memcpy(&halfWord, bytes + i, sizeof(halfWord));
+
+    // The F3 raises PGERR when programming a half word that is not erased
+    if (current != 0xFFFF && halfWord != 0x0000) {
+      return 2;
+    }
+
+    if (!hasPower()) {
+      return 2;
+    }
+
+    memcpy(data + offset + i, &halfWord, sizeof(halfWord));
+    halfWordsProgrammed++;
+  }
+
+  return 0;
+}
+
+int MappedFileFlash::erasePage(uint32_t page) {
+  if (!isOpen() || page >= numPages) {
+    return 1;
+  }
+
+  if (!hasPower()) {
+    return 2;
+  }
+
+  memset(data + static_cast<size_t>(page) * pageSize, ERASED_BYTE, pageSize);
+  eraseCounts[page]++;
+  return 0;
+}
+
+uint32_t MappedFileFlash::getEraseCount(uint32_t page) const {
+  return page < numPages ? eraseCounts[page] : 0;
+}
+
+uint64_t MappedFileFlash::getHalfWordsProgrammed() const {
+  return halfWordsProgrammed;
+}
+
+void MappedFileFlash::setPowerLossAfter(uint64_t operations) {
+  powerLossArmed = true;
+  operationsLeft = operations;
+}
+
+void MappedFileFlash::clearPowerLoss() { powerLossArmed = false; }
+
+bool MappedFileFlash::hasPower() {
+  if (!powerLossArmed) {
+    return true;
+  }
+  if (operationsLeft == 0) {
+    return false;
+  }
+  operationsLeft--;
+  return true;
+}
+
+void MappedFileFlash::sync() {
+  if (isOpen()) {
+    msync(data, static_cast<size_t>(pageSize) * numPages, MS_SYNC);
+  }
+}
+
+bool MappedFileFlash::inRange(uint32_t offset, size_t size) const {
+  size_t regionSize = static_cast<size_t>(pageSize) * numPages;
+  return offset <= regionSize && size <= regionSize - offset;
+}
+
+} // namespace APM::host
@@ -0,0 +1,124 @@
+/**
+ * Flash implementation backed by a memory mapped file, used to run flash
+ * based APM code on a host machine
+ */
+
+#ifndef APM_HOST_MAPPEDFILEFLASH_HPP
+#define APM_HOST_MAPPEDFILEFLASH_HPP
+
+#include <APM/dev/Flash.hpp>
+#include <vector>
+
+namespace APM::host {
+
+/**
+ * Emulates a region of STM32F3 flash in a file.  Programming follows the same
+ * rules as the hardware: only erased half words may be programmed, except
+ * for writing 0x0000.  Erase and program operations are counted so that wear
+ * and on-target timing can be estimated.
+ */
+class MappedFileFlash : public DEV::Flash {
+public:
+  /**
+   * Opens or creates the backing file.  A new file starts out erased.
+   * @param path the file to map
+   * @param pageSize the size of one page in bytes
+   * @param numPages the number of pages in the region
+   * @param truncate discard any existing contents of the file
+   */
+  MappedFileFlash(const char *path, uint32_t pageSize, uint32_t numPages,
+                  bool truncate = false);
+
+  ~MappedFileFlash();
+
+  MappedFileFlash(const MappedFileFlash &) = delete;
+  MappedFileFlash &operator=(const MappedFileFlash &) = delete;
+
+  /**
+   * Checks whether the file was mapped successfully
+   * @return true if the flash can be used
+   */
+  [[nodiscard]] bool isOpen() const;
+
+  [[nodiscard]] uint32_t getPageSize() const override;
+
+  [[nodiscard]] uint32_t getNumPages() const override;
+
+  [[nodiscard]] const uint8_t *getAddress() const override;
+
+  int read(uint32_t offset, void *data, size_t size) const override;
+
+  int write(uint32_t offset, const void *data, size_t size) override;
+
+  int erasePage(uint32_t page) override;
+
+  /**
+   * Returns the number of times a page has been erased through this object
+   * @param page the page index
+   * @return the erase count
+   */
+  [[nodiscard]] uint32_t getEraseCount(uint32_t page) const;
+
+  /**
+   * Returns the number of half words programmed through this object
+   * @return the program count
+   */
+  [[nodiscard]] uint64_t getHalfWordsProgrammed() const;
+
+  /**
+   * Simulates a power loss: after the given number of further half word
+   * programs and page erases every operation fails without touching the file
+   * @param operations operations allowed before power is lost
+   */
+  void setPowerLossAfter(uint64_t operations);
+
+  /**
+   * Restores power after setPowerLossAfter()
+   */
+  void clearPowerLoss();
+
+  /**
+   * Flushes the mapping to the backing file
+   */
+  void sync();
+
+private:
+  // Backing file descriptor, -1 if not open
+  int fd = -1;
+
+  // Start of the mapping
+  uint8_t *data = nullptr;
+
+  uint32_t pageSize;
+  uint32_t numPages;
+
+  // Erase counts per page
+  std::vector<uint32_t> eraseCounts;
+
+  // Number of half words programmed
+  uint64_t halfWordsProgrammed = 0;
+
+  // Whether a power loss is being simulated
+  bool powerLossArmed = false;
+
+  // Operations left before the simulated power loss
+  uint64_t operationsLeft = 0;
+
+  /**
+   * Consumes one operation from the power loss budget
+   * @return true if the operation may go ahead
+   */
+  bool hasPower();
+
+  /**
+   * Checks that a range lies within the region
+   * @param offset the start of the range
+   * @param size the length of the range
+   * @return true if the whole range is inside the region
+   */
+  [[nodiscard]] bool inRange(uint32_t offset, size_t size) const;
+};
+
+} // namespace APM::host
+
+#endif // APM_HOST_MAPPEDFILEFLASH_HPP
@@ -0,0 +1,707 @@
+/**
+ * Monte Carlo fault injection for the APM on the host simulator.
+ *
+ * Usage:
+ *   apm_monte_carlo [--scenarios <n>] [--threads <n>] [--seed <seed>]
+ *   apm_monte_carlo --scenario <index> [--seed <seed>]
+ *
+ * Each scenario runs the dev1_apm firmware on its own simulated board against
+ * two modelled SIM100 units with random response latency, jitter, lost and
+ * corrupted frames.  The key is cycled one to three times with contact bounce,
+ * and isolation faults on one or both units, both units answering without an
+ * estimate and unit dropouts are injected at random points of each drive.
+ * Scenarios are spread over one worker thread per core.
+ *
+ * Every output change is checked against the switch invariants, and each key
+ * cycle is checked for trips that should not have happened, faults that did
+ * not trip in time and the state the APM is left in.  Results, including the
+ * distribution of fault to trip latency, are printed as key=value lines.
+ * Exits non-zero if any invariant was violated.
+ *
+ * Scenario n is seeded from the run seed and n alone, so a failing scenario
+ * can be rerun on its own with --scenario to see its plan and console output.
+ */
+
+#include <APM/APMManager.hpp>
+#include <APM/GFDVoter.hpp>
+#include <SIM100Model.hpp>
+#include <SimBoard.hpp>
+#include <Simulator.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using APM::APMManager;
+using APM::sim::SIM100Model;
+using APM::sim::SimInput;
+using APM::sim::Simulator;
+using IsolationStateResponse = APM::DEV::SIM100::IsolationStateResponse;
+
+constexpr uint64_t MILLISECOND = 1000;
+constexpr uint64_t SECOND = 1000000;
+
+// Time from key on until the GFD poll is certain to be running: debounce,
+// the precharge wait, the SIM100 start up period and some margin
+constexpr uint64_t GFD_ACTIVE_DELAY = 12 * SECOND;
+
+// Longest time a fault on both units, or both units going without an
+// estimate, may take to trip the APM
+constexpr uint64_t TRIP_DEADLINE = 5 * SECOND;
+
+// Time the firmware runs after the key is turned off before the cycle is
+// checked.  Covers a key off during the precharge wait.
+constexpr uint64_t SETTLE_TIME = 10 * SECOND;
+
+// Width of the latency histogram buckets printed
+constexpr uint64_t HISTOGRAM_BUCKET = 250 * MILLISECOND;
+
+// Violations kept to print as examples
+constexpr size_t MAX_EXAMPLES = 10;
+
+constexpr uint64_t DEFAULT_SCENARIOS = 100000;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Properties that must hold in every scenario
+ */
+enum class Violation : uint8_t {
+  // Neither ACCESSORY_SW nor VICOR_SW is closed, so the electronics are
+  // unpowered
+  NO_SUPPLY = 0u,
+  // CHARGE_SW and ACCESSORY_SW are closed together, charging the backup
+  // battery from itself
+  CHARGE_WITH_ACCESSORY = 1u,
+  // CHARGE_SW or VICOR_SW is closed with the MC relay open
+  PACK_WITHOUT_MC = 2u,
+  // A trip when no fault was injected and both units were healthy
+  SPURIOUS_TRIP = 3u,
+  // A trip whose reason does not match what was injected
+  WRONG_TRIP_REASON = 4u,
+  // A fault on a single unit tripped although the other unit was healthy and
+  // disagreed
+  SINGLE_FAULT_TRIP = 5u,
+  // A fault on both units, or both units going without an estimate, did not
+  // trip within TRIP_DEADLINE
+  MISSED_DEADLINE = 6u,
+  // The APM was not in ACCESSORY with matching outputs after key off
+  FINAL_STATE = 7u
+};
+
+constexpr size_t NUM_VIOLATIONS = 8;
+
+const char *const VIOLATION_NAMES[NUM_VIOLATIONS] = {
+    "no_supply",         "charge_with_accessory", "pack_without_mc",
+    "spurious_trip",     "wrong_trip_reason",     "single_fault_trip",
+    "missed_deadline",   "final_state",
+};
+
+/**
+ * Where a key cycle injects an isolation fault
+ */
+enum class Fault : uint8_t {
+  NONE = 0u,
+  SINGLE = 1u,
+  BOTH = 2u,
+  // Both units keep answering, but never with a new estimate, so neither can
+  // vote and the APM must trip on a CANError
+  MUTE = 3u
+};
+
+/**
+ * Results of any number of scenarios
+ */
+struct Totals {
+  uint64_t scenarios = 0;
+  uint64_t keyCycles = 0;
+  uint64_t faults = 0;
+  uint64_t mutes = 0;
+  uint64_t trips = 0;
+  uint64_t singleFaultTrips = 0;
+  uint64_t dropouts = 0;
+  uint64_t simulatedMicros = 0;
+  uint64_t violations[NUM_VIOLATIONS] = {};
+  // Fault to trip latency of every fault on both units, in us
+  std::vector<uint64_t> tripLatencies;
+  // The first violations seen, with the scenario they occurred in
+  std::vector<std::pair<uint64_t, std::string>> examples;
+
+  /**
+   * Adds the results of other scenarios
+   * @param other the results to add
+   */
+  void merge(const Totals &other) {
+    scenarios += other.scenarios;
+    keyCycles += other.keyCycles;
+    faults += other.faults;
+    mutes += other.mutes;
+    trips += other.trips;
+    singleFaultTrips += other.singleFaultTrips;
+    dropouts += other.dropouts;
+    simulatedMicros += other.simulatedMicros;
+    for (size_t i = 0; i < NUM_VIOLATIONS; i++) {
+      violations[i] += other.violations[i];
+    }
+    tripLatencies.insert(tripLatencies.end(), other.tripLatencies.begin(),
+                         other.tripLatencies.end());
+    examples.insert(examples.end(), other.examples.begin(),
+                    other.examples.end());
+  }
+};
+
+/**
+ * Records a violation
+ * @param totals the totals to add it to
+ * @param scenario index of the scenario
+ * @param time simulated time of the violation in us
+ * @param violation the violated property
+ * @param log stream to report it on, or nullptr
+ */
+void addViolation(Totals &totals, uint64_t scenario, uint64_t time,
+                  Violation violation, FILE *log) {
+  const char *name = VIOLATION_NAMES[static_cast<uint8_t>(violation)];
+  totals.violations[static_cast<uint8_t>(violation)]++;
+
+  char description[96];
+  snprintf(description, sizeof(description), "t:%llu %s",
+           static_cast<unsigned long long>(time), name);
+  if (totals.examples.size() < MAX_EXAMPLES) {
+    totals.examples.emplace_back(scenario, description);
+  }
+  if (log != nullptr) {
+    fprintf(log, "VIOLATION %s\n", description);
+  }
+}
+
+/**
+ * Checks the switch invariants every time the APM changes its outputs, and
+ * notes when the MC relay opens
+ */
+class SwitchMonitor : public APM::sim::OutputListener {
+public:
+  SwitchMonitor(Simulator &simulator, Totals &totals, uint64_t scenario,
+                FILE *log)
+      : simulator(simulator), totals(totals), scenario(scenario), log(log) {
+    simulator.addOutputListener(this);
+  }
+
+  /**
+   * Starts checking.  Before boot the outputs have not been driven yet.
+   */
+  void arm() { armed = true; }
+
+  void onOutputChange(uint64_t time) override {
+    bool accessory = simulator.readPin(APMManager::ACCESSORY_SW);
+    bool charge = simulator.readPin(APMManager::CHARGE_SW);
+    bool vicor = simulator.readPin(APMManager::VICOR_SW);
+    bool mcOn = simulator.readPin(APMManager::MC_ON);
+
+    if (mcWasOn && !mcOn) {
+      mcOffTimes.push_back(time);
+    }
+    mcWasOn = mcOn;
+
+    if (!armed) {
+      return;
+    }
+    if (!accessory && !vicor) {
+      addViolation(totals, scenario, time, Violation::NO_SUPPLY, log);
+    }
+    if (charge && accessory) {
+      addViolation(totals, scenario, time, Violation::CHARGE_WITH_ACCESSORY,
+                   log);
+    }
+    if ((charge || vicor) && !mcOn) {
+      addViolation(totals, scenario, time, Violation::PACK_WITHOUT_MC, log);
+    }
+  }
+
+  /**
+   * Returns the first time the MC relay opened at or after a given time
+   * @param after the earliest time of interest in us
+   * @return the time in us, or Simulator::NEVER
+   */
+  [[nodiscard]] uint64_t getMCOffTime(uint64_t after) const {
+    for (uint64_t time : mcOffTimes) {
+      if (time >= after) {
+        return time;
+      }
+    }
+    return Simulator::NEVER;
+  }
+
+private:
+  Simulator &simulator;
+  Totals &totals;
+  uint64_t scenario;
+  FILE *log;
+  bool armed = false;
+  bool mcWasOn = false;
+  std::vector<uint64_t> mcOffTimes;
+};
+
+/**
+ * Something done to a SIM100 model at a point in a drive
+ */
+struct Action {
+  uint64_t time;
+  std::function<void()> apply;
+};
+
+/**
+ * Schedules a key change with contact bounce
+ * @param simulator the simulator
+ * @param rng random source
+ * @param time time of the first edge in us
+ * @param level the final level
+ */
+void scheduleKey(Simulator &simulator, std::mt19937 &rng, uint64_t time,
+                 bool level) {
+  std::uniform_int_distribution<int> bounces(0, 4);
+  std::uniform_int_distribution<uint64_t> gap(100, 1500);
+
+  SimInput input;
+  input.type = SimInput::Type::GPIO;
+  input.pin = APMManager::KEY_ON_UC;
+
+  int count = bounces(rng);
+  for (int i = 0; i < count; i++) {
+    input.time = time;
+    input.level = level;
+    simulator.schedule(input);
+    time += gap(rng);
+    input.time = time;
+    input.level = !level;
+    simulator.schedule(input);
+    time += gap(rng);
+  }
+
+  input.time = time;
+  input.level = level;
+  simulator.schedule(input);
+}
+
+/**
+ * Returns a uniformly distributed time
+ * @param rng random source
+ * @param low the earliest time
+ * @param high the latest time
+ * @return the time
+ */
+uint64_t randomTime(std::mt19937 &rng, uint64_t low, uint64_t high) {
+  return std::uniform_int_distribution<uint64_t>(low, high)(rng);
+}
+
+/**
+ * Runs one scenario
+ * @param seed the seed of the run
+ * @param index the scenario index
+ * @param totals the totals to add the results to
+ * @param log stream to describe the scenario and print the firmware console
+ * on, or nullptr for silence
+ */
+void runScenario(uint64_t seed, uint64_t index, Totals &totals, FILE *log) {
+  std::seed_seq seedSequence{
+      static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+      static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32)};
+  std::mt19937 rng(seedSequence);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+  Simulator simulator;
+  SIM100Model unitA(simulator, APM::DEV::SIM100::CAN_REQUEST_ID,
+                    APM::DEV::SIM100::CAN_RESPONSE_ID);
+  SIM100Model unitB(simulator, APM::sim::SimBoard::SIM100_B_REQUEST_ID,
+                    APM::sim::SimBoard::SIM100_B_RESPONSE_ID);
+  SIM100Model *units[2] = {&unitA, &unitB};
+
+  // A unit is unreliable if some of its answers miss a poll, which lets the
+  // voter fall back to any-fault or trip on a CANError
+  bool unreliable[2];
+  for (size_t i = 0; i < 2; i++) {
+    uint64_t latency = randomTime(rng, 500, 120 * MILLISECOND);
+    uint64_t jitter =
+        chance(rng) < 0.3 ? randomTime(rng, 0, 100 * MILLISECOND) : 0;
+    double dropRate = 0;
+    double corruptRate = 0;
+    if (chance(rng) < 0.3) {
+      dropRate = chance(rng) * 0.05;
+      corruptRate = chance(rng) * 0.05;
+    }
+    units[i]->setLatency(latency);
+    units[i]->setLatencyJitter(jitter);
+    units[i]->setBusErrors(dropRate, corruptRate, rng());
+
+    uint64_t timeout = APM::GFDVoter::POLL_TIMEOUT * MILLISECOND;
+    unreliable[i] =
+        dropRate > 0 || corruptRate > 0 || latency + jitter >= timeout;
+    if (log != nullptr) {
+      fprintf(log,
+              "unit %zu: latency %llu us, jitter %llu us, drop %.4f, "
+              "corrupt %.4f\n",
+              i, static_cast<unsigned long long>(latency),
+              static_cast<unsigned long long>(jitter), dropRate, corruptRate);
+    }
+  }
+
+  APM::sim::SimBoard board(log);
+  SwitchMonitor monitor(simulator, totals, index, log);
+  APMManager &manager = board.getManager();
+  board.boot();
+  monitor.arm();
+
+  int keyCycles = std::uniform_int_distribution<int>(1, 3)(rng);
+  for (int cycle = 0; cycle < keyCycles; cycle++) {
+    uint64_t keyOn = simulator.getTime() + randomTime(rng, SECOND, 10 * SECOND);
+    // Some drives end before the GFD starts, some during the precharge wait
+    bool shortDrive = chance(rng) < 0.1;
+    uint64_t keyOff =
+        keyOn + (shortDrive
+                     ? randomTime(rng, 100 * MILLISECOND, GFD_ACTIVE_DELAY)
+                     : randomTime(rng, 20 * SECOND, 120 * SECOND));
+    scheduleKey(simulator, rng, keyOn, true);
+
+    std::vector<Action> actions;
+    bool silenced[2] = {false, false};
+
+    Fault fault = Fault::NONE;
+    size_t faultUnit = 0;
+    uint64_t faultTime = Simulator::NEVER;
+    double faultRoll = chance(rng);
+    if (!shortDrive && faultRoll < 0.55) {
+      if (faultRoll < 0.35) {
+        fault = Fault::BOTH;
+      } else if (faultRoll < 0.5) {
+        fault = Fault::SINGLE;
+      } else {
+        fault = Fault::MUTE;
+      }
+      faultUnit = rng() % 2;
+      faultTime = randomTime(rng, keyOn + GFD_ACTIVE_DELAY,
+                             keyOff - TRIP_DEADLINE - SECOND);
+      uint8_t status = fault == Fault::MUTE
+                           ? SIM100Model::STATUS_NO_NEW_ESTIMATES
+                           : SIM100Model::STATUS_ISOLATION_FAULT;
+      actions.push_back({faultTime, [&, fault, faultUnit, status] {
+                           for (size_t i = 0; i < 2; i++) {
+                             if (fault != Fault::SINGLE || i == faultUnit) {
+                               units[i]->setStatus(status);
+                             }
+                           }
+                         }});
+      if (fault == Fault::MUTE) {
+        totals.mutes++;
+      } else {
+        totals.faults++;
+      }
+    }
+
+    if (!shortDrive && chance(rng) < 0.15) {
+      // One unit drops off the bus for a while
+      size_t unit = rng() % 2;
+      uint64_t start = randomTime(rng, keyOn, keyOff);
+      uint64_t end = std::min(start + randomTime(rng, 500 * MILLISECOND,
+                                                 5 * SECOND),
+                              keyOff);
+      actions.push_back({start, [&, unit] { units[unit]->setSilent(true); }});
+      actions.push_back({end, [&, unit] { units[unit]->setSilent(false); }});
+      silenced[unit] = true;
+      totals.dropouts++;
+    }
+
+    if (log != nullptr) {
+      fprintf(log,
+              "cycle %d: key on %llu us, key off %llu us, fault %d on unit "
+              "%zu at %llu us, silenced %d %d\n",
+              cycle, static_cast<unsigned long long>(keyOn),
+              static_cast<unsigned long long>(keyOff),
+              static_cast<int>(fault), faultUnit,
+              static_cast<unsigned long long>(faultTime), silenced[0],
+              silenced[1]);
+    }
+
+    std::stable_sort(actions.begin(), actions.end(),
+                     [](const Action &a, const Action &b) {
+                       return a.time < b.time;
+                     });
+    uint32_t tripsBefore = manager.getLastTrip().count;
+    for (Action &action : actions) {
+      board.runUntil(std::max(action.time, simulator.getTime()));
+      action.apply();
+    }
+    board.runUntil(std::max(keyOff, simulator.getTime()));
+    scheduleKey(simulator, rng, simulator.getTime(), false);
+    board.runUntil(simulator.getTime() + SETTLE_TIME);
+
+    for (SIM100Model *unit : units) {
+      unit->setStatus(SIM100Model::STATUS_OK);
+      unit->setSilent(false);
+    }
+
+    // Judge the cycle.  After a trip the APM stays in ACCESSORY until the
+    // next key on, so there is at most one trip per cycle.
+    bool tripped = manager.getLastTrip().count != tripsBefore;
+    uint64_t tripTime =
+        tripped ? monitor.getMCOffTime(keyOn) : Simulator::NEVER;
+    bool faultTripped = tripped && tripTime >= faultTime;
+    bool unreliableA = unreliable[0] || silenced[0];
+    bool unreliableB = unreliable[1] || silenced[1];
+    IsolationStateResponse reason = manager.getLastTrip().reason;
+
+    if (tripped) {
+      totals.trips++;
+      if (!faultTripped) {
+        // Only losing both units may trip without a fault
+        if (!unreliableA && !unreliableB) {
+          addViolation(totals, index, tripTime, Violation::SPURIOUS_TRIP, log);
+        } else if (reason != IsolationStateResponse::CANError) {
+          addViolation(totals, index, tripTime, Violation::WRONG_TRIP_REASON,
+                       log);
+        }
+      } else {
+        bool otherUnreliable = faultUnit == 0 ? unreliableB : unreliableA;
+        if (fault == Fault::SINGLE) {
+          totals.singleFaultTrips++;
+          if (!otherUnreliable) {
+            addViolation(totals, index, tripTime,
+                         Violation::SINGLE_FAULT_TRIP, log);
+          }
+        } else if (fault == Fault::BOTH) {
+          totals.tripLatencies.push_back(tripTime - faultTime);
+        }
+        // Units without an estimate can only be tripped on as lost
+        bool isolationReason =
+            reason == IsolationStateResponse::IsolationError &&
+            fault != Fault::MUTE;
+        if (!isolationReason && reason != IsolationStateResponse::CANError) {
+          addViolation(totals, index, tripTime, Violation::WRONG_TRIP_REASON,
+                       log);
+        }
+      }
+    }
+
+    if ((fault == Fault::BOTH || fault == Fault::MUTE) &&
+        (!faultTripped || tripTime - faultTime > TRIP_DEADLINE)) {
+      addViolation(totals, index, faultTime + TRIP_DEADLINE,
+                   Violation::MISSED_DEADLINE, log);
+    }
+
+    bool finalState = manager.getCurrentMode() == APM::APMMode::ACCESSORY &&
+                      simulator.readPin(APMManager::ACCESSORY_SW) &&
+                      !simulator.readPin(APMManager::CHARGE_SW) &&
+                      !simulator.readPin(APMManager::VICOR_SW) &&
+                      !simulator.readPin(APMManager::MC_ON) &&
+                      simulator.readPin(APMManager::ACCESSORY_INDICATOR) &&
+                      !simulator.readPin(APMManager::ON_INDICATOR);
+    if (!finalState) {
+      addViolation(totals, index, simulator.getTime(), Violation::FINAL_STATE,
+                   log);
+    }
+  }
+
+  totals.scenarios++;
+  totals.keyCycles += keyCycles;
+  totals.simulatedMicros += simulator.getTime();
+}
+
+/**
+ * Returns a percentile of sorted values
+ * @param sorted the values in ascending order, not empty
+ * @param fraction the percentile as a fraction, 0-1
+ * @return the value
+ */
+uint64_t percentile(const std::vector<uint64_t> &sorted, double fraction) {
+  auto rank =
+      static_cast<size_t>(fraction * static_cast<double>(sorted.size()));
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+/**
+ * Prints the results of a run
+ * @param totals the merged results, with tripLatencies sorted
+ * @param wallSeconds time the run took
+ * @param threads the number of worker threads
+ */
+void printTotals(const Totals &totals, double wallSeconds, unsigned threads) {
+  uint64_t violations = 0;
+  for (uint64_t count : totals.violations) {
+    violations += count;
+  }
+
+  printf("threads=%u\n", threads);
+  printf("scenarios=%llu\n",
+         static_cast<unsigned long long>(totals.scenarios));
+  printf("key_cycles=%llu\n",
+         static_cast<unsigned long long>(totals.keyCycles));
+  printf("faults=%llu\n", static_cast<unsigned long long>(totals.faults));
+  printf("mutes=%llu\n", static_cast<unsigned long long>(totals.mutes));
+  printf("dropouts=%llu\n", static_cast<unsigned long long>(totals.dropouts));
+  printf("trips=%llu\n", static_cast<unsigned long long>(totals.trips));
+  printf("single_fault_trips=%llu\n",
+         static_cast<unsigned long long>(totals.singleFaultTrips));
+  printf("simulated_h=%.1f\n",
+         static_cast<double>(totals.simulatedMicros) / SECOND / 3600.0);
+  printf("wall_s=%.3f\n", wallSeconds);
+  printf("scenarios_per_hour=%.0f\n",
+         static_cast<double>(totals.scenarios) / wallSeconds * 3600.0);
+
+  const std::vector<uint64_t> &latencies = totals.tripLatencies;
+  printf("trip_latency_us.count=%zu\n", latencies.size());
+  if (!latencies.empty()) {
+    double sum = 0;
+    for (uint64_t latency : latencies) {
+      sum += static_cast<double>(latency);
+    }
+    printf("trip_latency_us.mean=%.0f\n",
+           sum / static_cast<double>(latencies.size()));
+    printf("trip_latency_us.p50=%llu\n",
+           static_cast<unsigned long long>(percentile(latencies, 0.5)));
+    printf("trip_latency_us.p90=%llu\n",
+           static_cast<unsigned long long>(percentile(latencies, 0.9)));
+    printf("trip_latency_us.p99=%llu\n",
+           static_cast<unsigned long long>(percentile(latencies, 0.99)));
+    printf("trip_latency_us.p999=%llu\n",
+           static_cast<unsigned long long>(percentile(latencies, 0.999)));
+    printf("trip_latency_us.max=%llu\n",
+           static_cast<unsigned long long>(latencies.back()));
+
+    size_t position = 0;
+    while (position < latencies.size()) {
+      uint64_t bucket = latencies[position] / HISTOGRAM_BUCKET;
+      size_t count = 0;
+      while (position < latencies.size() &&
+             latencies[position] / HISTOGRAM_BUCKET == bucket) {
+        position++;
+        count++;
+      }
+      printf("trip_latency_hist.%llu_ms=%zu\n",
+             static_cast<unsigned long long>(bucket * HISTOGRAM_BUCKET /
+                                             MILLISECOND),
+             count);
+    }
+  }
+
+  for (size_t i = 0; i < NUM_VIOLATIONS; i++) {
+    printf("violations.%s=%llu\n", VIOLATION_NAMES[i],
+           static_cast<unsigned long long>(totals.violations[i]));
+  }
+  printf("violations=%llu\n", static_cast<unsigned long long>(violations));
+  for (const auto &[scenario, description] : totals.examples) {
+    printf("violation_example=scenario:%llu %s\n",
+           static_cast<unsigned long long>(scenario), description.c_str());
+  }
+}
+
+/**
+ * Runs scenarios on a pool of worker threads
+ * @param seed the seed of the run
+ * @param scenarios the number of scenarios
+ * @param threads the number of worker threads
+ * @return 0 if no invariant was violated
+ */
+int run(uint64_t seed, uint64_t scenarios, unsigned threads) {
+  std::atomic<uint64_t> nextScenario{0};
+  std::mutex totalsMutex;
+  Totals totals;
+
+  auto worker = [&] {
+    Totals local;
+    uint64_t index;
+    while ((index = nextScenario.fetch_add(1)) < scenarios) {
+      runScenario(seed, index, local, nullptr);
+    }
+
+    std::lock_guard<std::mutex> lock(totalsMutex);
+    totals.merge(local);
+  };
+
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back(worker);
+  }
+  for (std::thread &thread : workers) {
+    thread.join();
+  }
+  double wallSeconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::sort(totals.tripLatencies.begin(), totals.tripLatencies.end());
+  std::sort(totals.examples.begin(), totals.examples.end());
+  if (totals.examples.size() > MAX_EXAMPLES) {
+    totals.examples.resize(MAX_EXAMPLES);
+  }
+  printTotals(totals, wallSeconds, threads);
+
+  for (uint64_t count : totals.violations) {
+    if (count != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Prints the usage message
+ */
+void usage() {
+  fprintf(stderr, "Usage:\n"
+                  "  apm_monte_carlo [--scenarios <n>] [--threads <n>]"
+                  " [--seed <seed>]\n"
+                  "  apm_monte_carlo --scenario <index> [--seed <seed>]\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  uint64_t scenarios = DEFAULT_SCENARIOS;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t seed = 1;
+  bool single = false;
+  uint64_t scenario = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 < argc && strcmp(argv[i], "--scenarios") == 0) {
+      scenarios = strtoull(argv[++i], nullptr, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0) {
+      threads = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+    } else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0) {
+      seed = strtoull(argv[++i], nullptr, 10);
+    } else if (i + 1 < argc && strcmp(argv[i], "--scenario") == 0) {
+      scenario = strtoull(argv[++i], nullptr, 10);
+      single = true;
+    } else {
+      usage();
+      return 1;
+    }
+  }
+
+  if (threads == 0) {
+    fprintf(stderr, "threads must be positive\n");
+    return 1;
+  }
+
+  if (single) {
+    Totals totals;
+    runScenario(seed, scenario, totals, stdout);
+    uint64_t violations = 0;
+    for (uint64_t count : totals.violations) {
+      violations += count;
+    }
+    printf("violations=%llu\n", static_cast<unsigned long long>(violations));
+    return violations == 0 ? 0 : 1;
+  }
+
+  return run(seed, scenarios, threads);
+}
@@ -0,0 +1,100 @@
+/**
+ * Source code for the SIM100 model
+ */
+
+#include <SIM100Model.hpp>
+
+namespace APM::sim {
+
+namespace {
+
+// Request multiplexer values from the SIM100 CAN interface
+constexpr uint8_t MUX_ISOLATION_STATE = 0xE0;
+constexpr uint8_t MUX_SET_MAX_BATTERY_VOLTAGE = 0xF0;
+
+} // namespace
+
+SIM100Model::SIM100Model(Simulator &simulator, uint32_t requestId,
+                         uint32_t responseId)
+    : simulator(simulator), requestId(requestId), responseId(responseId) {
+  simulator.addCANListener(this);
+}
+
+void SIM100Model::onTransmit(IO::CANMessage &message) {
+  if (silent || message.getId() != requestId ||
+      message.getDataLength() < 1) {
+    return;
+  }
+
+  uint8_t *request = message.getPayload();
+  switch (request[0]) {
+  case MUX_ISOLATION_STATE: {
+    // Mux, status and resistance, then uncertainty and stored energy which
+    // the APM ignores
+    uint8_t payload[8] = {MUX_ISOLATION_STATE, status,
+                          static_cast<uint8_t>(resistance >> 8),
+                          static_cast<uint8_t>(resistance), 0x0F, 0xFF, 0x05,
+                          0x05};
+    respond(payload, 8);
+    break;
+  }
+  case MUX_SET_MAX_BATTERY_VOLTAGE:
+    if (message.getDataLength() >= 3) {
+      uint8_t payload[3] = {MUX_SET_MAX_BATTERY_VOLTAGE, request[1],
+                            request[2]};
+      respond(payload, 3);
+    }
+    break;
+  default:
+    // Restart and the identification requests are not modelled
+    break;
+  }
+}
+
+void SIM100Model::setStatus(uint8_t status) { this->status = status; }
+
+void SIM100Model::setResistance(uint16_t resistance) {
+  this->resistance = resistance;
+}
+
+void SIM100Model::setSilent(bool silent) { this->silent = silent; }
+
+void SIM100Model::setLatency(uint64_t latency) { this->latency = latency; }
+
+void SIM100Model::setLatencyJitter(uint64_t jitter) { latencyJitter = jitter; }
+
+void SIM100Model::setBusErrors(double dropRate, double corruptRate,
+                               uint32_t seed) {
+  this->dropRate = dropRate;
+  this->corruptRate = corruptRate;
+  random.seed(seed);
+}
+
+uint64_t SIM100Model::getResponseCount() const { return responseCount; }
+
+void SIM100Model::respond(uint8_t *payload, uint8_t length) {
+  responseCount++;
+
+  if (dropRate > 0 || corruptRate > 0) {
+    double roll = std::uniform_real_distribution<double>(0.0, 1.0)(random);
+    if (roll < dropRate) {
+      return;
+    }
+    if (roll < dropRate + corruptRate && length > 2) {
+      length = 2;
+    }
+  }
+
+  uint64_t delay = latency;
+  if (latencyJitter > 0) {
+    delay += std::uniform_int_distribution<uint64_t>(0, latencyJitter)(random);
+  }
+
+  SimInput input;
+  input.type = SimInput::Type::CAN;
+  input.time = simulator.getTime() + delay;
+  input.message = IO::CANMessage(responseId, length, payload, true);
+  simulator.schedule(input);
+}
+
+} // namespace APM::sim
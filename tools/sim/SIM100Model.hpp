@@ -0,0 +1,112 @@
+/**
+ * Behavioural model of a SIM100 isolation monitor on the simulated CAN bus
+ */
+
+#ifndef APM_SIM_SIM100MODEL_HPP
+#define APM_SIM_SIM100MODEL_HPP
+
+#include <Simulator.hpp>
+#include <random>
+
+namespace APM::sim {
+
+/**
+ * Answers the SIM100 requests sent by the APM after a latency.  The
+ * status byte and isolation resistance of isolation state responses are set
+ * by the test, and the unit can be made to stop responding.
+ */
+class SIM100Model : public CANListener {
+public:
+  // Status bits of the isolation state response
+  static constexpr uint8_t STATUS_OK = 0x00;
+  static constexpr uint8_t STATUS_ISOLATION_FAULT = 0x03;
+  static constexpr uint8_t STATUS_NO_NEW_ESTIMATES = 0x40;
+  static constexpr uint8_t STATUS_HARDWARE_ERROR = 0x80;
+
+  // Isolation resistance reported until one is set, in kOhm
+  static constexpr uint16_t DEFAULT_RESISTANCE = 4095;
+
+  // Time from request to response in us
+  static constexpr uint64_t DEFAULT_LATENCY = 2000;
+
+  /**
+   * Creates the model and attaches it to the simulated bus
+   * @param simulator the simulator to attach to
+   * @param requestId CAN ID the unit listens on
+   * @param responseId CAN ID the unit responds on
+   */
+  SIM100Model(Simulator &simulator, uint32_t requestId, uint32_t responseId);
+
+  void onTransmit(IO::CANMessage &message) override;
+
+  /**
+   * Sets the status byte sent in isolation state responses
+   * @param status the status bits
+   */
+  void setStatus(uint8_t status);
+
+  /**
+   * Sets the isolation resistance sent in isolation state responses
+   * @param resistance the resistance in kOhm
+   */
+  void setResistance(uint16_t resistance);
+
+  /**
+   * Stops or resumes responses, as if the unit lost power or bus connection
+   * @param silent true to stop responding
+   */
+  void setSilent(bool silent);
+
+  /**
+   * Sets the response latency
+   * @param latency time from request to response in us
+   */
+  void setLatency(uint64_t latency);
+
+  /**
+   * Adds a random delay to each response on top of the latency
+   * @param jitter the largest extra delay in us
+   */
+  void setLatencyJitter(uint64_t jitter);
+
+  /**
+   * Makes the unit lose or corrupt a share of its responses, as errors on the
+   * bus would.  Corrupted responses arrive truncated to two bytes.
+   * @param dropRate probability a response is lost, 0-1
+   * @param corruptRate probability a response is corrupted, 0-1
+   * @param seed seed for the random source deciding which responses fail
+   */
+  void setBusErrors(double dropRate, double corruptRate, uint32_t seed);
+
+  /**
+   * Returns the number of requests answered, including responses lost to
+   * bus errors
+   * @return number of responses
+   */
+  [[nodiscard]] uint64_t getResponseCount() const;
+
+private:
+  Simulator &simulator;
+  uint32_t requestId;
+  uint32_t responseId;
+  uint8_t status = STATUS_OK;
+  uint16_t resistance = DEFAULT_RESISTANCE;
+  bool silent = false;
+  uint64_t latency = DEFAULT_LATENCY;
+  uint64_t latencyJitter = 0;
+  double dropRate = 0;
+  double corruptRate = 0;
+  std::mt19937 random;
+  uint64_t responseCount = 0;
+
+  /**
+   * Schedules a response frame
+   * @param payload the payload
+   * @param length the payload length
+   */
+  void respond(uint8_t *payload, uint8_t length);
+};
+
+} // namespace APM::sim
+
+#endif // APM_SIM_SIM100MODEL_HPP
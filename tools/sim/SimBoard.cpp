@@ -0,0 +1,64 @@
+/**
+ * Source code for the simulated dev1_apm board
+ */
+
+#include <SimBoard.hpp>
+
+namespace APM::sim {
+
+using Direction = IO::GPIO::Direction;
+
+SimBoard::SimBoard(FILE *console)
+    : uart(console), apmUart(&uart),
+      accessorySw(APMManager::ACCESSORY_SW, Direction::OUTPUT),
+      chargeSw(APMManager::CHARGE_SW, Direction::OUTPUT),
+      vicorSw(APMManager::VICOR_SW, Direction::OUTPUT),
+      keyOn(APMManager::KEY_ON_UC, Direction::INPUT),
+      onIndicator(APMManager::ON_INDICATOR, Direction::OUTPUT),
+      accessoryIndicator(APMManager::ACCESSORY_INDICATOR, Direction::OUTPUT),
+      mcOn(APMManager::MC_ON, Direction::OUTPUT), gfdTimer(TIM2, 5000),
+      keyTimer(TIM15, KeyInput::DEBOUNCE_PERIOD), sim100A(can),
+      sim100B(can, SIM100_B_REQUEST_ID, SIM100_B_RESPONSE_ID),
+      sim100Units{&sim100A, &sim100B},
+      gfdVoter(can, sim100Units, 2, GFDVoter::VotingPolicy::TWO_OF_N),
+      keyInput(keyOn, APMManager::KEY_ON_UC, keyTimer),
+      manager(apmUart, gfdVoter, accessorySw, chargeSw, vicorSw, gfdTimer,
+              accessoryIndicator, onIndicator, mcOn) {}
+
+void SimBoard::boot() {
+  manager.setSwitchMonitor(&switchMonitor);
+  manager.offToAccessoryMode();
+  manager.setCheckGFDIsolationState(true);
+  keyInput.start();
+}
+
+void SimBoard::runUntil(uint64_t time) {
+  Simulator &simulator = Simulator::current();
+
+  while (simulator.getTime() < time) {
+    KeyEvent event;
+    while (keyInput.popEvent(event)) {
+      if (manager.handleKeyEvent(event)) {
+        keyInput.recordActionLatency(event);
+      }
+    }
+
+    if (simulator.getTime() >= nextSwitchCheck) {
+      nextSwitchCheck =
+          simulator.getTime() + SwitchMonitor::SAMPLE_PERIOD * 1000;
+      manager.checkSwitches();
+    }
+
+    simulator.idle(time < nextSwitchCheck ? time : nextSwitchCheck);
+  }
+}
+
+APMManager &SimBoard::getManager() { return manager; }
+
+KeyInput &SimBoard::getKeyInput() { return keyInput; }
+
+GFDVoter &SimBoard::getGFDVoter() { return gfdVoter; }
+
+SwitchMonitor &SimBoard::getSwitchMonitor() { return switchMonitor; }
+
+} // namespace APM::sim
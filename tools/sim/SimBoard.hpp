@@ -0,0 +1,95 @@
+/**
+ * The dev1_apm firmware wired up to simulated hardware
+ */
+
+#ifndef APM_SIM_SIMBOARD_HPP
+#define APM_SIM_SIMBOARD_HPP
+
+#include <APM/APMManager.hpp>
+#include <APM/APMUart.hpp>
+#include <APM/GFDVoter.hpp>
+#include <APM/KeyInput.hpp>
+#include <APM/SwitchMonitor.hpp>
+#include <APM/dev/SIM100.hpp>
+#include <EVT/dev/platform/f3xx/f302x8/Timerf302x8.hpp>
+#include <SimIO.hpp>
+#include <Simulator.hpp>
+
+namespace APM::sim {
+
+/**
+ * Builds the same objects as the dev1_apm target built with
+ * APM_REDUNDANT_GFD on simulated drivers and runs its main loop.  A Simulator
+ * must be current on the calling thread before the board is created.
+ *
+ * The APM interrupt handlers reach the firmware through global pointers.
+ * These are thread local in the simulation, so one board can exist per thread
+ * at a time.
+ */
+class SimBoard {
+public:
+  // CAN IDs of the redundant SIM100, as configured in dev1_apm built with
+  // APM_REDUNDANT_GFD
+  static constexpr uint32_t SIM100_B_REQUEST_ID = 0x0A100201;
+  static constexpr uint32_t SIM100_B_RESPONSE_ID = 0x0A100200;
+
+  /**
+   * Creates the board
+   * @param console stream for the debug UART, or nullptr to discard it
+   */
+  explicit SimBoard(FILE *console = nullptr);
+
+  /**
+   * Runs the dev1_apm start up: enters ACCESSORY and enables the key input.
+   * Unlike dev1_apm, GFD isolation checking is left enabled.
+   */
+  void boot();
+
+  /**
+   * Runs the main loop, handling key events, checking the switches every
+   * SwitchMonitor::SAMPLE_PERIOD and sleeping until the next input or
+   * interrupt
+   * @param time virtual time in us to run until
+   */
+  void runUntil(uint64_t time);
+
+  [[nodiscard]] APMManager &getManager();
+
+  [[nodiscard]] KeyInput &getKeyInput();
+
+  [[nodiscard]] GFDVoter &getGFDVoter();
+
+  [[nodiscard]] SwitchMonitor &getSwitchMonitor();
+
+private:
+  SimUART uart;
+  APMUart apmUart;
+  SimCAN can;
+
+  SimGPIO accessorySw;
+  SimGPIO chargeSw;
+  SimGPIO vicorSw;
+  SimGPIO keyOn;
+  SimGPIO onIndicator;
+  SimGPIO accessoryIndicator;
+  SimGPIO mcOn;
+
+  EVT::core::DEV::Timerf302x8 gfdTimer;
+  EVT::core::DEV::Timerf302x8 keyTimer;
+
+  DEV::SIM100 sim100A;
+  DEV::SIM100 sim100B;
+  DEV::SIM100 *sim100Units[2];
+  GFDVoter gfdVoter;
+
+  KeyInput keyInput;
+  SwitchMonitor switchMonitor;
+  APMManager manager;
+
+  // Time of the next switch check in us
+  uint64_t nextSwitchCheck = 0;
+};
+
+} // namespace APM::sim
+
+#endif // APM_SIM_SIMBOARD_HPP
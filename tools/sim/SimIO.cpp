@@ -0,0 +1,211 @@
+/**
+ * Source code for the simulated EVT-core drivers.  Also provides the host
+ * definitions of the EVT-core functions and registers the APM code uses.
+ */
+
+#include <EVT/dev/platform/f3xx/f302x8/Timerf302x8.hpp>
+#include <EVT/utils/time.hpp>
+#include <HALf3/stm32f3xx.h>
+#include <SimIO.hpp>
+#include <Simulator.hpp>
+#include <cstdarg>
+#include <cstring>
+
+GPIO_TypeDef simGPIOA = {{0}, {0}, {0}};
+GPIO_TypeDef simGPIOB = {{1}, {1}, {1}};
+GPIO_TypeDef simGPIOC = {{2}, {2}, {2}};
+thread_local DWT_Type simDWT = {};
+thread_local CoreDebug_Type simCoreDebug = {};
+thread_local RCC_TypeDef simRCC = {};
+thread_local PWR_TypeDef simPWR = {};
+thread_local RTC_TypeDef simRTC = {};
+thread_local CAN_TypeDef simCANRegisters = {};
+TIM_TypeDef simTIM2 = {};
+TIM_TypeDef simTIM15 = {};
+TIM_TypeDef simTIM16 = {};
+
+uint32_t SystemCoreClock = APM::sim::Simulator::CORE_CLOCK;
+
+namespace APM::sim {
+
+uint32_t readCycleCounter() { return Simulator::current().getCycles(); }
+
+void writePortBSRR(uint8_t port, uint32_t bsrr) {
+  Simulator::current().writePortBSRR(port, bsrr);
+}
+
+uint32_t readPort(uint8_t port) { return Simulator::current().readPort(port); }
+
+uint32_t readInputPort(uint8_t port) {
+  return Simulator::current().readInputPort(port);
+}
+
+SimGPIO::SimGPIO(IO::Pin pin, Direction direction) : GPIO(pin, direction) {}
+
+void SimGPIO::setDirection(Direction direction) {
+  this->direction = direction;
+}
+
+void SimGPIO::writePin(State state) {
+  Simulator::current().writePin(pin, state == State::HIGH);
+}
+
+IO::GPIO::State SimGPIO::readPin() {
+  return Simulator::current().readInput(pin) ? State::HIGH : State::LOW;
+}
+
+void SimGPIO::registerIRQ(TriggerEdge edge, void (*irqHandler)(GPIO *pin)) {
+  Simulator::current().registerIRQ(pin, edge, irqHandler, this);
+}
+
+IO::CAN::CANStatus SimCAN::connect() { return CANStatus::OK; }
+
+IO::CAN::CANStatus SimCAN::transmit(IO::CANMessage &message) {
+  Simulator::current().transmit(message);
+  return CANStatus::OK;
+}
+
+IO::CANMessage *SimCAN::receive(IO::CANMessage *message, bool blocking) {
+  if (!Simulator::current().receive(*message, blocking)) {
+    return nullptr;
+  }
+  return message;
+}
+
+void SimCAN::addIRQHandler(void (*handler)(IO::CANMessage &, void *),
+                           void *priv) {
+  Simulator::current().setCANHandler(handler, priv);
+}
+
+SimUART::SimUART(FILE *output) : output(output) {}
+
+void SimUART::putc(char c) {
+  bytesWritten++;
+  if (output != nullptr) {
+    fputc(c, output);
+  }
+}
+
+void SimUART::puts(const char *s) {
+  bytesWritten += strlen(s);
+  if (output != nullptr) {
+    fputs(s, output);
+  }
+}
+
+char SimUART::getc() { return '\0'; }
+
+char *SimUART::gets(char *buf, size_t size) {
+  if (size > 0) {
+    buf[0] = '\0';
+  }
+  return buf;
+}
+
+void SimUART::printf(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int length;
+  if (output != nullptr) {
+    length = vfprintf(output, format, args);
+  } else {
+    length = vsnprintf(nullptr, 0, format, args);
+  }
+  va_end(args);
+
+  if (length > 0) {
+    bytesWritten += static_cast<uint64_t>(length);
+  }
+}
+
+void SimUART::write(uint8_t byte) { putc(static_cast<char>(byte)); }
+
+uint8_t SimUART::read() { return 0; }
+
+void SimUART::writeBytes(uint8_t *bytes, size_t size) {
+  bytesWritten += size;
+  if (output != nullptr) {
+    fwrite(bytes, 1, size, output);
+  }
+}
+
+void SimUART::readBytes(uint8_t *bytes, size_t size) { memset(bytes, 0, size); }
+
+uint64_t SimUART::getBytesWritten() const { return bytesWritten; }
+
+} // namespace APM::sim
+
+namespace EVT::core::IO {
+
+CANMessage::CANMessage(uint32_t id, uint8_t dataLength, uint8_t *payload,
+                       bool isExtended)
+    : id(id), dataLength(dataLength > CAN_MAX_PAYLOAD_SIZE
+                             ? CAN_MAX_PAYLOAD_SIZE
+                             : dataLength),
+      payload{}, isExtended(isExtended) {
+  memcpy(this->payload, payload, this->dataLength);
+}
+
+CANMessage::CANMessage() : id(0), dataLength(0), payload{}, isExtended(false) {}
+
+uint32_t CANMessage::getId() { return id; }
+
+uint8_t CANMessage::getDataLength() { return dataLength; }
+
+uint8_t *CANMessage::getPayload() { return payload; }
+
+bool CANMessage::isCANExtended() { return isExtended; }
+
+} // namespace EVT::core::IO
+
+namespace EVT::core::time {
+
+void wait(uint32_t ms) {
+  APM::sim::Simulator::current().advanceBy(static_cast<uint64_t>(ms) * 1000);
+}
+
+uint32_t millis() {
+  return static_cast<uint32_t>(APM::sim::Simulator::current().getTime() /
+                               1000);
+}
+
+} // namespace EVT::core::time
+
+namespace EVT::core::DEV {
+
+Timerf302x8::Timerf302x8(TIM_TypeDef *timerPeripheral, uint32_t clockPeriod)
+    : state(new APM::sim::TimerState) {
+  state->period = static_cast<uint64_t>(clockPeriod) * 1000;
+  state->context = this;
+  APM::sim::Simulator::current().addTimer(state);
+}
+
+Timerf302x8::~Timerf302x8() {
+  APM::sim::Simulator::current().removeTimer(state);
+  delete state;
+}
+
+void Timerf302x8::startTimer(void (*irqHandler)(void *htim)) {
+  state->handler = irqHandler;
+  startTimer();
+}
+
+void Timerf302x8::startTimer() {
+  state->running = true;
+  state->nextFire = APM::sim::Simulator::current().getTime() + state->period;
+}
+
+void Timerf302x8::stopTimer() { state->running = false; }
+
+void Timerf302x8::reloadTimer() {
+  state->nextFire = APM::sim::Simulator::current().getTime() + state->period;
+}
+
+void Timerf302x8::setPeriod(uint32_t clockPeriod) {
+  state->period = static_cast<uint64_t>(clockPeriod) * 1000;
+  if (state->running) {
+    reloadTimer();
+  }
+}
+
+} // namespace EVT::core::DEV
@@ -0,0 +1,94 @@
+/**
+ * Simulated implementations of the EVT-core IO drivers, backed by the current
+ * Simulator
+ */
+
+#ifndef APM_SIM_SIMIO_HPP
+#define APM_SIM_SIMIO_HPP
+
+#include <EVT/io/CAN.hpp>
+#include <EVT/io/GPIO.hpp>
+#include <EVT/io/UART.hpp>
+#include <cstdint>
+#include <cstdio>
+
+namespace APM::sim {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * GPIO on a simulated pin
+ */
+class SimGPIO : public IO::GPIO {
+public:
+  SimGPIO(IO::Pin pin, Direction direction);
+
+  void setDirection(Direction direction) override;
+
+  void writePin(State state) override;
+
+  State readPin() override;
+
+  void registerIRQ(TriggerEdge edge, void (*irqHandler)(GPIO *pin)) override;
+};
+
+/**
+ * CAN interface on the simulated bus.  Frames transmitted are passed to the
+ * simulator's CAN listeners, frames received come from its inputs.
+ */
+class SimCAN : public IO::CAN {
+public:
+  CANStatus connect() override;
+
+  CANStatus transmit(IO::CANMessage &message) override;
+
+  IO::CANMessage *receive(IO::CANMessage *message,
+                          bool blocking = false) override;
+
+  void addIRQHandler(void (*handler)(IO::CANMessage &, void *),
+                     void *priv) override;
+};
+
+/**
+ * UART that writes to a host stream, or discards output when none is given
+ */
+class SimUART : public IO::UART {
+public:
+  /**
+   * Creates the UART
+   * @param output stream to print to, or nullptr to discard output
+   */
+  explicit SimUART(FILE *output = nullptr);
+
+  void putc(char c) override;
+
+  void puts(const char *s) override;
+
+  char getc() override;
+
+  char *gets(char *buf, size_t size) override;
+
+  void printf(const char *format, ...) override;
+
+  void write(uint8_t byte) override;
+
+  uint8_t read() override;
+
+  void writeBytes(uint8_t *bytes, size_t size) override;
+
+  void readBytes(uint8_t *bytes, size_t size) override;
+
+  /**
+   * Returns the number of bytes sent, whether or not they were discarded
+   * @return number of bytes
+   */
+  [[nodiscard]] uint64_t getBytesWritten() const;
+
+private:
+  FILE *output;
+  uint64_t bytesWritten = 0;
+};
+
+} // namespace APM::sim
+
+#endif // APM_SIM_SIMIO_HPP
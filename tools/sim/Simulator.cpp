@@ -0,0 +1,373 @@
+/**
+ * Source code for the APM hardware simulator
+ */
+
+#include <Simulator.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace APM::sim {
+
+namespace {
+
+// Simulator current for this thread
+thread_local Simulator *currentSimulator = nullptr;
+
+/**
+ * Returns the index of a pin in the per pin tables
+ * @param pin the pin
+ * @return port * 16 + pin number
+ */
+size_t pinIndex(IO::Pin pin) {
+  auto value = static_cast<uint8_t>(pin);
+  return (value >> 4) * 16 + (value & 0x0F);
+}
+
+} // namespace
+
+Simulator::Simulator() : previous(currentSimulator) {
+  currentSimulator = this;
+}
+
+Simulator::~Simulator() { currentSimulator = previous; }
+
+Simulator &Simulator::current() {
+  if (currentSimulator == nullptr) {
+    fprintf(stderr, "APM simulated hardware used without a Simulator\n");
+    abort();
+  }
+  return *currentSimulator;
+}
+
+uint64_t Simulator::getTime() const { return now; }
+
+void Simulator::advanceTo(uint64_t time) {
+  while (true) {
+    bool interruptsEnabled = interruptDepth == 0;
+
+    // Pin interrupts held off by a running handler go first
+    if (interruptsEnabled && runPendingPinIRQ()) {
+      continue;
+    }
+
+    uint64_t inputTime = getNextInputTime();
+    TimerState *timer = interruptsEnabled ? getNextTimer() : nullptr;
+    uint64_t timerTime =
+        timer != nullptr ? std::max(timer->nextFire, now) : NEVER;
+
+    if (inputTime != NEVER && inputTime <= time && inputTime <= timerTime) {
+      now = std::max(now, inputTime);
+      dispatchInput();
+      continue;
+    }
+
+    if (timer != nullptr && timerTime <= time) {
+      now = timerTime;
+      // Keep the phase of the timer even if the interrupt was held off
+      if (timer->period == 0) {
+        timer->running = false;
+      }
+      while (timer->running && timer->nextFire <= now) {
+        timer->nextFire += timer->period;
+      }
+      runInterrupt([timer] { timer->handler(timer->context); });
+      continue;
+    }
+
+    break;
+  }
+
+  now = std::max(now, time);
+}
+
+void Simulator::advanceBy(uint64_t micros) { advanceTo(now + micros); }
+
+void Simulator::idle(uint64_t limit) {
+  advanceTo(std::min(getNextEventTime(), limit));
+}
+
+uint64_t Simulator::getNextEventTime() {
+  uint64_t next = getNextInputTime();
+  TimerState *timer = getNextTimer();
+  if (timer != nullptr) {
+    next = std::min(next, std::max(timer->nextFire, now));
+  }
+  for (const PinIRQ &irq : pinIRQs) {
+    if (irq.pending) {
+      next = now;
+    }
+  }
+  return next;
+}
+
+void Simulator::setInputSource(InputSource *source) {
+  this->source = source;
+  hasLookahead = false;
+}
+
+void Simulator::schedule(const SimInput &input) {
+  scheduled.push({input, scheduleSequence++});
+}
+
+void Simulator::addCANListener(CANListener *listener) {
+  canListeners.push_back(listener);
+}
+
+void Simulator::addOutputListener(OutputListener *listener) {
+  outputListeners.push_back(listener);
+}
+
+const std::vector<OutputChange> &Simulator::getOutputChanges() const {
+  return outputChanges;
+}
+
+uint64_t Simulator::getInterruptCount() const { return interruptCount; }
+
+uint64_t Simulator::getTransmitCount() const { return transmitCount; }
+
+uint64_t Simulator::getCANDroppedCount() const { return canDroppedCount; }
+
+uint32_t Simulator::getCycles() const {
+  return static_cast<uint32_t>(now * (CORE_CLOCK / 1000000));
+}
+
+bool Simulator::readPin(IO::Pin pin) const {
+  auto value = static_cast<uint8_t>(pin);
+  return (levels[value >> 4] >> (value & 0x0F)) & 1u;
+}
+
+void Simulator::writePin(IO::Pin pin, bool level) {
+  if (setOutput(pin, level)) {
+    notifyOutputChange();
+  }
+}
+
+void Simulator::writePortBSRR(uint8_t port, uint32_t bsrr) {
+  // Every pin of the port changes at once, so listeners are told afterwards
+  bool changed = false;
+  for (uint8_t bit = 0; bit < 16; bit++) {
+    auto pin = static_cast<IO::Pin>((port << 4) | bit);
+    if (bsrr & (1u << bit)) {
+      changed |= setOutput(pin, true);
+    } else if (bsrr & (1u << (bit + 16))) {
+      changed |= setOutput(pin, false);
+    }
+  }
+
+  if (changed) {
+    notifyOutputChange();
+  }
+}
+
+uint32_t Simulator::readPort(uint8_t port) const {
+  return port < NUM_PORTS ? levels[port] : 0;
+}
+
+bool Simulator::readInput(IO::Pin pin) const {
+  auto value = static_cast<uint8_t>(pin);
+  return (readInputPort(value >> 4) >> (value & 0x0F)) & 1u;
+}
+
+uint32_t Simulator::readInputPort(uint8_t port) const {
+  if (port >= NUM_PORTS) {
+    return 0;
+  }
+  return (levels[port] & ~held[port]) | (heldLevels[port] & held[port]);
+}
+
+void Simulator::holdInput(IO::Pin pin, bool level) {
+  auto value = static_cast<uint8_t>(pin);
+  uint8_t port = value >> 4;
+  auto mask = static_cast<uint16_t>(1u << (value & 0x0F));
+  held[port] |= mask;
+  if (level) {
+    heldLevels[port] |= mask;
+  } else {
+    heldLevels[port] &= static_cast<uint16_t>(~mask);
+  }
+}
+
+void Simulator::releaseInput(IO::Pin pin) {
+  auto value = static_cast<uint8_t>(pin);
+  held[value >> 4] &= static_cast<uint16_t>(~(1u << (value & 0x0F)));
+}
+
+void Simulator::registerIRQ(IO::Pin pin, IO::GPIO::TriggerEdge edge,
+                            void (*handler)(IO::GPIO *), IO::GPIO *gpio) {
+  PinIRQ &irq = pinIRQs[pinIndex(pin)];
+  irq.edge = edge;
+  irq.handler = handler;
+  irq.gpio = gpio;
+  irq.pending = false;
+}
+
+void Simulator::addTimer(TimerState *timer) { timers.push_back(timer); }
+
+void Simulator::removeTimer(TimerState *timer) {
+  timers.erase(std::remove(timers.begin(), timers.end(), timer), timers.end());
+}
+
+void Simulator::transmit(IO::CANMessage &message) {
+  transmitCount++;
+  for (CANListener *listener : canListeners) {
+    listener->onTransmit(message);
+  }
+}
+
+bool Simulator::receive(IO::CANMessage &message, bool blocking) {
+  while (canQueue.empty()) {
+    uint64_t next = getNextInputTime();
+    if (blocking && next == NEVER) {
+      // Nothing will ever arrive
+      return false;
+    }
+
+    // Step to the next arrival so busy loops make progress without
+    // skipping past it
+    uint64_t target = std::min(next, now + RECEIVE_POLL_STEP);
+    advanceTo(std::max(target, now + 1));
+
+    if (!blocking) {
+      break;
+    }
+  }
+
+  if (canQueue.empty()) {
+    return false;
+  }
+
+  message = canQueue.front();
+  canQueue.pop_front();
+  return true;
+}
+
+bool Simulator::setOutput(IO::Pin pin, bool level) {
+  auto value = static_cast<uint8_t>(pin);
+  uint8_t port = value >> 4;
+  auto mask = static_cast<uint16_t>(1u << (value & 0x0F));
+
+  // The first write is always reported since the level before it is unknown,
+  // matching TraceRecorder
+  if ((written[port] & mask) != 0 && readPin(pin) == level) {
+    return false;
+  }
+  written[port] |= mask;
+
+  if (level) {
+    levels[port] |= mask;
+  } else {
+    levels[port] &= static_cast<uint16_t>(~mask);
+  }
+  outputChanges.push_back({now, pin, level});
+  return true;
+}
+
+void Simulator::notifyOutputChange() {
+  for (OutputListener *listener : outputListeners) {
+    listener->onOutputChange(now);
+  }
+}
+
+void Simulator::setCANHandler(void (*handler)(IO::CANMessage &, void *),
+                              void *priv) {
+  canHandler = handler;
+  canHandlerPriv = priv;
+}
+
+uint64_t Simulator::getNextInputTime() {
+  if (!hasLookahead && source != nullptr) {
+    hasLookahead = source->next(lookahead);
+  }
+
+  uint64_t next = hasLookahead ? lookahead.time : NEVER;
+  if (!scheduled.empty()) {
+    next = std::min(next, scheduled.top().input.time);
+  }
+  return next;
+}
+
+void Simulator::dispatchInput() {
+  SimInput input;
+  bool fromSource = hasLookahead && (scheduled.empty() ||
+                                     lookahead.time <=
+                                         scheduled.top().input.time);
+  if (fromSource) {
+    input = lookahead;
+    hasLookahead = false;
+  } else {
+    input = scheduled.top().input;
+    scheduled.pop();
+  }
+
+  if (input.type == SimInput::Type::GPIO) {
+    drivePin(input.pin, input.level, input.forceInterrupt);
+    return;
+  }
+
+  if (canHandler != nullptr) {
+    runInterrupt([this, &input] { canHandler(input.message, canHandlerPriv); });
+  } else if (canQueue.size() < CAN_QUEUE_SIZE) {
+    canQueue.push_back(input.message);
+  } else {
+    canDroppedCount++;
+  }
+}
+
+void Simulator::drivePin(IO::Pin pin, bool level, bool forceInterrupt) {
+  auto value = static_cast<uint8_t>(pin);
+  uint8_t port = value >> 4;
+  auto mask = static_cast<uint16_t>(1u << (value & 0x0F));
+  bool previousLevel = readPin(pin);
+
+  if (level) {
+    levels[port] |= mask;
+  } else {
+    levels[port] &= static_cast<uint16_t>(~mask);
+  }
+
+  PinIRQ &irq = pinIRQs[pinIndex(pin)];
+  if (irq.handler == nullptr) {
+    return;
+  }
+
+  auto edgeBits = static_cast<uint32_t>(irq.edge);
+  bool rising = !previousLevel && level;
+  bool falling = previousLevel && !level;
+  bool triggered = forceInterrupt || (rising && (edgeBits & 1u)) ||
+                   (falling && (edgeBits & 2u));
+  if (!triggered) {
+    return;
+  }
+
+  // A second edge while the interrupt is pending is merged into it, as the
+  // EXTI pending bit does
+  irq.pending = true;
+  if (interruptDepth == 0) {
+    runPendingPinIRQ();
+  }
+}
+
+bool Simulator::runPendingPinIRQ() {
+  for (PinIRQ &irq : pinIRQs) {
+    if (irq.pending) {
+      irq.pending = false;
+      runInterrupt([&irq] { irq.handler(irq.gpio); });
+      return true;
+    }
+  }
+  return false;
+}
+
+TimerState *Simulator::getNextTimer() {
+  TimerState *next = nullptr;
+  for (TimerState *timer : timers) {
+    if (timer->running && timer->handler != nullptr &&
+        (next == nullptr || timer->nextFire < next->nextFire)) {
+      next = timer;
+    }
+  }
+  return next;
+}
+
+} // namespace APM::sim
@@ -0,0 +1,400 @@
+/**
+ * Discrete event simulation of the APM hardware on a virtual clock.  Backs the
+ * host versions of the EVT-core drivers so the APM library runs unmodified,
+ * faster than real time.
+ */
+
+#ifndef APM_SIM_SIMULATOR_HPP
+#define APM_SIM_SIMULATOR_HPP
+
+#include <EVT/io/GPIO.hpp>
+#include <EVT/io/types/CANMessage.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <queue>
+#include <vector>
+
+namespace APM::sim {
+
+namespace IO = EVT::core::IO;
+
+/**
+ * A stimulus applied to the simulated hardware at a given time
+ */
+struct SimInput {
+  enum class Type { CAN = 0u, GPIO = 1u };
+
+  Type type = Type::CAN;
+  // Time in us the input is applied
+  uint64_t time = 0;
+  // Frame to deliver, for CAN inputs
+  IO::CANMessage message;
+  // Pin and level to drive, for GPIO inputs
+  IO::Pin pin = IO::Pin::PA_0;
+  bool level = false;
+  // Run the pin interrupt even if the level does not change.  Used when
+  // replaying a trace, which records interrupts rather than raw levels.
+  bool forceInterrupt = false;
+};
+
+/**
+ * Supplies inputs in time order, for example from a trace file
+ */
+class InputSource {
+public:
+  virtual ~InputSource() = default;
+
+  /**
+   * Returns the next input
+   * @param input filled with the input
+   * @return false once there are no more inputs
+   */
+  virtual bool next(SimInput &input) = 0;
+};
+
+/**
+ * Device model notified of every frame the APM transmits
+ */
+class CANListener {
+public:
+  virtual ~CANListener() = default;
+
+  /**
+   * Called when the APM transmits a frame
+   * @param message the frame
+   */
+  virtual void onTransmit(IO::CANMessage &message) = 0;
+};
+
+/**
+ * Notified whenever the APM changes its outputs, for checking invariants
+ */
+class OutputListener {
+public:
+  virtual ~OutputListener() = default;
+
+  /**
+   * Called after a pin write or port write changed at least one level.  All
+   * pins of a port write have changed by the time this is called.
+   * @param time the time of the change in us
+   */
+  virtual void onOutputChange(uint64_t time) = 0;
+};
+
+/**
+ * State of a simulated hardware timer
+ */
+struct TimerState {
+  bool running = false;
+  // Period in us
+  uint64_t period = 0;
+  // Time of the next interrupt in us
+  uint64_t nextFire = 0;
+  void (*handler)(void *htim) = nullptr;
+  void *context = nullptr;
+};
+
+/**
+ * A level change of an output pin
+ */
+struct OutputChange {
+  // Time of the change in us
+  uint64_t time;
+  IO::Pin pin;
+  bool level;
+};
+
+/**
+ * The virtual clock and hardware shared by the simulated drivers.
+ *
+ * Time only moves when the APM code waits: time::wait(), a receive on an empty
+ * CAN queue, or the main loop idling.  Whenever it moves, every input and
+ * timer interrupt that falls due is dispatched in time order.  Interrupts do
+ * not nest: while one runs, CAN frames and pin levels still arrive, but other
+ * interrupts stay pending until it returns, as on the target.
+ *
+ * Each thread has its own current simulator, so independent simulations can
+ * run in parallel.
+ */
+class Simulator {
+public:
+  // Core clock used to derive the DWT cycle counter
+  static constexpr uint32_t CORE_CLOCK = 72000000;
+
+  // Time a receive on an empty CAN queue advances the clock by, at most, in us
+  static constexpr uint64_t RECEIVE_POLL_STEP = 1000;
+
+  // Frames the CAN receive queue holds before new frames are dropped
+  static constexpr size_t CAN_QUEUE_SIZE = 32;
+
+  // Value returned for times that will never come
+  static constexpr uint64_t NEVER = UINT64_MAX;
+
+  /**
+   * Creates a simulator and makes it current for the calling thread
+   */
+  Simulator();
+
+  ~Simulator();
+
+  Simulator(const Simulator &) = delete;
+
+  Simulator &operator=(const Simulator &) = delete;
+
+  /**
+   * Returns the simulator current for the calling thread
+   * @return the current simulator
+   */
+  static Simulator &current();
+
+  /**
+   * Returns the virtual time
+   * @return time in us since the simulation started
+   */
+  [[nodiscard]] uint64_t getTime() const;
+
+  /**
+   * Advances the clock, dispatching everything that falls due on the way
+   * @param time the time to advance to, in us
+   */
+  void advanceTo(uint64_t time);
+
+  /**
+   * Advances the clock by a duration
+   * @param micros the duration in us
+   */
+  void advanceBy(uint64_t micros);
+
+  /**
+   * Advances to the next input or interrupt, as the main loop does when it
+   * sleeps
+   * @param limit the latest time to advance to
+   */
+  void idle(uint64_t limit);
+
+  /**
+   * Returns the time of the next input or timer interrupt
+   * @return time in us, or NEVER
+   */
+  [[nodiscard]] uint64_t getNextEventTime();
+
+  /**
+   * Sets the source of inputs.  Inputs from the source are merged with those
+   * given to schedule().
+   * @param source the input source, or nullptr
+   */
+  void setInputSource(InputSource *source);
+
+  /**
+   * Schedules a single input
+   * @param input the input
+   */
+  void schedule(const SimInput &input);
+
+  /**
+   * Registers a device model to receive transmitted frames
+   * @param listener the model
+   */
+  void addCANListener(CANListener *listener);
+
+  /**
+   * Registers a listener for output changes
+   * @param listener the listener
+   */
+  void addOutputListener(OutputListener *listener);
+
+  /**
+   * Holds the level read back from a pin, whatever drives it, as a welded
+   * or stuck open switch would.  Only inputs see it.
+   * @param pin the pin
+   * @param level the level read back
+   */
+  void holdInput(IO::Pin pin, bool level);
+
+  /**
+   * Reads a pin back at the level it is driven to again
+   * @param pin the pin
+   */
+  void releaseInput(IO::Pin pin);
+
+  /**
+   * Returns every output level change since the simulation started
+   * @return the output changes in time order
+   */
+  [[nodiscard]] const std::vector<OutputChange> &getOutputChanges() const;
+
+  /**
+   * Returns the number of interrupts dispatched
+   * @return number of interrupts
+   */
+  [[nodiscard]] uint64_t getInterruptCount() const;
+
+  /**
+   * Returns the number of frames transmitted by the APM
+   * @return number of frames
+   */
+  [[nodiscard]] uint64_t getTransmitCount() const;
+
+  /**
+   * Returns the number of frames lost to a full receive queue
+   * @return number of frames
+   */
+  [[nodiscard]] uint64_t getCANDroppedCount() const;
+
+  // Interface for the simulated drivers
+
+  [[nodiscard]] uint32_t getCycles() const;
+
+  [[nodiscard]] bool readPin(IO::Pin pin) const;
+
+  void writePin(IO::Pin pin, bool level);
+
+  void writePortBSRR(uint8_t port, uint32_t bsrr);
+
+  [[nodiscard]] uint32_t readPort(uint8_t port) const;
+
+  [[nodiscard]] bool readInput(IO::Pin pin) const;
+
+  [[nodiscard]] uint32_t readInputPort(uint8_t port) const;
+
+  void registerIRQ(IO::Pin pin, IO::GPIO::TriggerEdge edge,
+                   void (*handler)(IO::GPIO *), IO::GPIO *gpio);
+
+  void addTimer(TimerState *timer);
+
+  void removeTimer(TimerState *timer);
+
+  void transmit(IO::CANMessage &message);
+
+  bool receive(IO::CANMessage &message, bool blocking);
+
+  void setCANHandler(void (*handler)(IO::CANMessage &, void *), void *priv);
+
+private:
+  // Number of simulated GPIO ports
+  static constexpr uint8_t NUM_PORTS = 3;
+
+  /**
+   * Interrupt attached to an input pin
+   */
+  struct PinIRQ {
+    IO::GPIO::TriggerEdge edge = IO::GPIO::TriggerEdge::RISING;
+    void (*handler)(IO::GPIO *) = nullptr;
+    IO::GPIO *gpio = nullptr;
+    bool pending = false;
+  };
+
+  /**
+   * Orders scheduled inputs by time, then by the order they were scheduled
+   */
+  struct ScheduledInput {
+    SimInput input;
+    uint64_t sequence;
+    bool operator>(const ScheduledInput &other) const {
+      if (input.time != other.input.time) {
+        return input.time > other.input.time;
+      }
+      return sequence > other.sequence;
+    }
+  };
+
+  uint64_t now = 0;
+
+  // Depth of interrupt handlers currently running
+  int interruptDepth = 0;
+
+  uint16_t levels[NUM_PORTS] = {};
+  // Pins written by the APM at least once
+  uint16_t written[NUM_PORTS] = {};
+  // Pins held by holdInput(), and the levels they are held at
+  uint16_t held[NUM_PORTS] = {};
+  uint16_t heldLevels[NUM_PORTS] = {};
+  PinIRQ pinIRQs[NUM_PORTS * 16];
+
+  std::vector<TimerState *> timers;
+
+  std::priority_queue<ScheduledInput, std::vector<ScheduledInput>,
+                      std::greater<ScheduledInput>>
+      scheduled;
+  uint64_t scheduleSequence = 0;
+
+  InputSource *source = nullptr;
+  SimInput lookahead;
+  bool hasLookahead = false;
+
+  std::deque<IO::CANMessage> canQueue;
+  void (*canHandler)(IO::CANMessage &, void *) = nullptr;
+  void *canHandlerPriv = nullptr;
+  std::vector<CANListener *> canListeners;
+
+  std::vector<OutputChange> outputChanges;
+  std::vector<OutputListener *> outputListeners;
+
+  uint64_t interruptCount = 0;
+  uint64_t transmitCount = 0;
+  uint64_t canDroppedCount = 0;
+
+  // Simulator that was current before this one was created
+  Simulator *previous;
+
+  /**
+   * Returns the time of the next input, pulling from the source if needed
+   * @return time in us, or NEVER
+   */
+  uint64_t getNextInputTime();
+
+  /**
+   * Removes and applies the next input
+   */
+  void dispatchInput();
+
+  /**
+   * Sets an output level and records the change
+   * @param pin the pin
+   * @param level the new level
+   * @return true if the level changed or the pin was written for the first
+   * time
+   */
+  bool setOutput(IO::Pin pin, bool level);
+
+  /**
+   * Tells the output listeners about a change
+   */
+  void notifyOutputChange();
+
+  /**
+   * Sets a pin level, running its interrupt on a matching edge
+   * @param pin the pin
+   * @param level the new level
+   * @param forceInterrupt run the interrupt even without an edge
+   */
+  void drivePin(IO::Pin pin, bool level, bool forceInterrupt);
+
+  /**
+   * Runs the first pending pin interrupt
+   * @return true if one was run
+   */
+  bool runPendingPinIRQ();
+
+  /**
+   * Returns the running timer that fires first
+   * @return the timer, or nullptr
+   */
+  TimerState *getNextTimer();
+
+  /**
+   * Runs an interrupt handler with other interrupts held off
+   */
+  template <typename F>
+  void runInterrupt(F handler) {
+    interruptDepth++;
+    interruptCount++;
+    handler();
+    interruptDepth--;
+  }
+};
+
+} // namespace APM::sim
+
+#endif // APM_SIM_SIMULATOR_HPP
@@ -0,0 +1,19 @@
+/**
+ * Host simulation of the EVT-core independent watchdog interface
+ */
+
+#ifndef EVT_IWDG_
+#define EVT_IWDG_
+
+namespace EVT::core::DEV {
+
+class IWDG {
+public:
+  virtual ~IWDG() = default;
+
+  virtual void refresh() = 0;
+};
+
+} // namespace EVT::core::DEV
+
+#endif // EVT_IWDG_
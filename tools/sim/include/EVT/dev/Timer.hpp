@@ -0,0 +1,29 @@
+/**
+ * Host simulation of the EVT-core timer interface
+ */
+
+#ifndef EVT_TIMER_
+#define EVT_TIMER_
+
+#include <cstdint>
+
+namespace EVT::core::DEV {
+
+class Timer {
+public:
+  virtual ~Timer() = default;
+
+  virtual void startTimer(void (*irqHandler)(void *htim)) = 0;
+
+  virtual void startTimer() = 0;
+
+  virtual void stopTimer() = 0;
+
+  virtual void reloadTimer() = 0;
+
+  virtual void setPeriod(uint32_t clockPeriod) = 0;
+};
+
+} // namespace EVT::core::DEV
+
+#endif // EVT_TIMER_
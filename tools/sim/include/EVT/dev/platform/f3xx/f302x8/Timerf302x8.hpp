@@ -0,0 +1,44 @@
+/**
+ * Host simulation of the STM32F302x8 timer.  Interrupts are scheduled on the
+ * virtual clock of the current APM::sim::Simulator.
+ */
+
+#ifndef EVT_TIMERF302X8_
+#define EVT_TIMERF302X8_
+
+#include <EVT/dev/Timer.hpp>
+#include <HALf3/stm32f3xx.h>
+
+namespace APM::sim {
+struct TimerState;
+} // namespace APM::sim
+
+namespace EVT::core::DEV {
+
+class Timerf302x8 : public Timer {
+public:
+  Timerf302x8(TIM_TypeDef *timerPeripheral, uint32_t clockPeriod);
+
+  ~Timerf302x8() override;
+
+  Timerf302x8(const Timerf302x8 &) = delete;
+
+  Timerf302x8 &operator=(const Timerf302x8 &) = delete;
+
+  void startTimer(void (*irqHandler)(void *htim)) override;
+
+  void startTimer() override;
+
+  void stopTimer() override;
+
+  void reloadTimer() override;
+
+  void setPeriod(uint32_t clockPeriod) override;
+
+private:
+  APM::sim::TimerState *state;
+};
+
+} // namespace EVT::core::DEV
+
+#endif // EVT_TIMERF302X8_
@@ -0,0 +1,31 @@
+/**
+ * Host simulation of the EVT-core ADC interface
+ */
+
+#ifndef EVT_ADC_
+#define EVT_ADC_
+
+#include <EVT/io/pin.hpp>
+#include <cstdint>
+
+namespace EVT::core::IO {
+
+class ADC {
+public:
+  explicit ADC(Pin pin) : pin(pin) {}
+
+  virtual ~ADC() = default;
+
+  virtual float read() = 0;
+
+  virtual uint32_t readRaw() = 0;
+
+  virtual float readPercentage() = 0;
+
+protected:
+  Pin pin;
+};
+
+} // namespace EVT::core::IO
+
+#endif // EVT_ADC_
@@ -0,0 +1,31 @@
+/**
+ * Host simulation of the EVT-core CAN interface
+ */
+
+#ifndef EVT_CAN_
+#define EVT_CAN_
+
+#include <EVT/io/pin.hpp>
+#include <EVT/io/types/CANMessage.hpp>
+
+namespace EVT::core::IO {
+
+class CAN {
+public:
+  enum class CANStatus { OK = 0, TIMEOUT = 1, ERROR = 2 };
+
+  virtual ~CAN() = default;
+
+  virtual CANStatus connect() = 0;
+
+  virtual CANStatus transmit(CANMessage &message) = 0;
+
+  virtual CANMessage *receive(CANMessage *message, bool blocking = false) = 0;
+
+  virtual void addIRQHandler(void (*handler)(CANMessage &, void *),
+                             void *priv) = 0;
+};
+
+} // namespace EVT::core::IO
+
+#endif // EVT_CAN_
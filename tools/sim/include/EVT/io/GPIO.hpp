@@ -0,0 +1,39 @@
+/**
+ * Host simulation of the EVT-core GPIO interface
+ */
+
+#ifndef EVT_GPIO_
+#define EVT_GPIO_
+
+#include <EVT/io/pin.hpp>
+
+namespace EVT::core::IO {
+
+class GPIO {
+public:
+  enum class Direction { INPUT = 0u, OUTPUT = 1u };
+
+  enum class State { LOW = 0u, HIGH = 1u };
+
+  enum class TriggerEdge { RISING = 1u, FALLING = 2u, RISING_FALLING = 3u };
+
+  GPIO(Pin pin, Direction direction) : pin(pin), direction(direction) {}
+
+  virtual ~GPIO() = default;
+
+  virtual void setDirection(Direction direction) = 0;
+
+  virtual void writePin(State state) = 0;
+
+  virtual State readPin() = 0;
+
+  virtual void registerIRQ(TriggerEdge edge, void (*irqHandler)(GPIO *pin)) = 0;
+
+protected:
+  Pin pin;
+  Direction direction;
+};
+
+} // namespace EVT::core::IO
+
+#endif // EVT_GPIO_
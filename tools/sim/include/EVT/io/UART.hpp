@@ -0,0 +1,39 @@
+/**
+ * Host simulation of the EVT-core UART interface
+ */
+
+#ifndef EVT_UART_
+#define EVT_UART_
+
+#include <EVT/io/GPIO.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace EVT::core::IO {
+
+class UART {
+public:
+  virtual ~UART() = default;
+
+  virtual void putc(char c) = 0;
+
+  virtual void puts(const char *s) = 0;
+
+  virtual char getc() = 0;
+
+  virtual char *gets(char *buf, size_t size) = 0;
+
+  virtual void printf(const char *format, ...) = 0;
+
+  virtual void write(uint8_t byte) = 0;
+
+  virtual uint8_t read() = 0;
+
+  virtual void writeBytes(uint8_t *bytes, size_t size) = 0;
+
+  virtual void readBytes(uint8_t *bytes, size_t size) = 0;
+};
+
+} // namespace EVT::core::IO
+
+#endif // EVT_UART_
@@ -0,0 +1,39 @@
+/**
+ * Host simulation of the EVT-core CAN message
+ */
+
+#ifndef EVT_CANMESSAGE_
+#define EVT_CANMESSAGE_
+
+#include <cstdint>
+
+namespace EVT::core::IO {
+
+class CANMessage {
+public:
+  // Largest CAN payload in bytes
+  static constexpr uint8_t CAN_MAX_PAYLOAD_SIZE = 8;
+
+  CANMessage(uint32_t id, uint8_t dataLength, uint8_t *payload,
+             bool isExtended);
+
+  CANMessage();
+
+  uint32_t getId();
+
+  uint8_t getDataLength();
+
+  uint8_t *getPayload();
+
+  bool isCANExtended();
+
+private:
+  uint32_t id;
+  uint8_t dataLength;
+  uint8_t payload[CAN_MAX_PAYLOAD_SIZE];
+  bool isExtended;
+};
+
+} // namespace EVT::core::IO
+
+#endif // EVT_CANMESSAGE_
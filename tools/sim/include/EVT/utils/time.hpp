@@ -0,0 +1,19 @@
+/**
+ * Host simulation of the EVT-core time utilities.  Time is the virtual clock
+ * of the current APM::sim::Simulator.
+ */
+
+#ifndef EVT_TIME_
+#define EVT_TIME_
+
+#include <cstdint>
+
+namespace EVT::core::time {
+
+void wait(uint32_t ms);
+
+uint32_t millis();
+
+} // namespace EVT::core::time
+
+#endif // EVT_TIME_
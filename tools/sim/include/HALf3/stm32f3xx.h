@@ -0,0 +1,151 @@
+/**
+ * Host simulation of the parts of the STM32F3 CMSIS header used by the APM.
+ * Registers the APM writes directly are proxies onto the virtual hardware of
+ * the current APM::sim::Simulator.
+ */
+
+#ifndef APM_SIM_STM32F3XX_H
+#define APM_SIM_STM32F3XX_H
+
+#include <cstdint>
+
+namespace APM::sim {
+
+/**
+ * Returns the virtual DWT cycle counter
+ */
+uint32_t readCycleCounter();
+
+/**
+ * Applies a BSRR write to the virtual GPIO port
+ */
+void writePortBSRR(uint8_t port, uint32_t bsrr);
+
+/**
+ * Returns the levels a virtual GPIO port is driven to
+ */
+uint32_t readPort(uint8_t port);
+
+/**
+ * Returns the levels read back from a virtual GPIO port
+ */
+uint32_t readInputPort(uint8_t port);
+
+} // namespace APM::sim
+
+/**
+ * DWT->CYCCNT, derived from the virtual clock
+ */
+struct SimCycleCounter {
+  operator uint32_t() const { return APM::sim::readCycleCounter(); }
+  SimCycleCounter &operator=(uint32_t) { return *this; }
+};
+
+/**
+ * GPIOx->BSRR, applied to the virtual pins
+ */
+struct SimBSRR {
+  uint8_t port;
+  SimBSRR &operator=(uint32_t value) {
+    APM::sim::writePortBSRR(port, value);
+    return *this;
+  }
+};
+
+/**
+ * GPIOx->IDR, read back from the virtual pins
+ */
+struct SimPortInputs {
+  uint8_t port;
+  operator uint32_t() const { return APM::sim::readInputPort(port); }
+};
+
+/**
+ * GPIOx->ODR, the levels the virtual pins are driven to
+ */
+struct SimPortLevels {
+  uint8_t port;
+  operator uint32_t() const { return APM::sim::readPort(port); }
+};
+
+typedef struct {
+  SimPortInputs IDR;
+  SimPortLevels ODR;
+  SimBSRR BSRR;
+} GPIO_TypeDef;
+
+typedef struct {
+  uint32_t CTRL;
+  SimCycleCounter CYCCNT;
+} DWT_Type;
+
+typedef struct {
+  uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+  uint32_t CR1;
+} TIM_TypeDef;
+
+typedef struct {
+  uint32_t APB1ENR;
+  uint32_t CSR;
+} RCC_TypeDef;
+
+typedef struct {
+  uint32_t CR;
+} PWR_TypeDef;
+
+typedef struct {
+  uint32_t BKP0R, BKP1R, BKP2R, BKP3R, BKP4R, BKP5R, BKP6R, BKP7R;
+  uint32_t BKP8R, BKP9R, BKP10R, BKP11R, BKP12R, BKP13R, BKP14R, BKP15R;
+} RTC_TypeDef;
+
+typedef struct {
+  uint32_t ESR;
+} CAN_TypeDef;
+
+extern GPIO_TypeDef simGPIOA;
+extern GPIO_TypeDef simGPIOB;
+extern GPIO_TypeDef simGPIOC;
+// Registers holding state are per thread, like the simulated boards
+extern thread_local DWT_Type simDWT;
+extern thread_local CoreDebug_Type simCoreDebug;
+extern thread_local RCC_TypeDef simRCC;
+extern thread_local PWR_TypeDef simPWR;
+extern thread_local RTC_TypeDef simRTC;
+extern thread_local CAN_TypeDef simCANRegisters;
+extern TIM_TypeDef simTIM2;
+extern TIM_TypeDef simTIM15;
+extern TIM_TypeDef simTIM16;
+
+#define GPIOA (&simGPIOA)
+#define GPIOB (&simGPIOB)
+#define GPIOC (&simGPIOC)
+#define DWT (&simDWT)
+#define CoreDebug (&simCoreDebug)
+#define RCC (&simRCC)
+#define PWR (&simPWR)
+#define RTC (&simRTC)
+#define TIM2 (&simTIM2)
+#define TIM15 (&simTIM15)
+#define TIM16 (&simTIM16)
+#define CAN_BASE (reinterpret_cast<uintptr_t>(&simCANRegisters))
+
+#define DWT_CTRL_CYCCNTENA_Msk (1u)
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define RCC_APB1ENR_PWREN (1u << 28)
+#define PWR_CR_DBP (1u << 8)
+#define CAN_ESR_BOFF (1u << 2)
+#define CAN_ESR_LEC (7u << 4)
+
+extern uint32_t SystemCoreClock;
+
+// Interrupts are dispatched by the simulator between calls into the APM code,
+// so masking them has nothing to do
+inline uint32_t __get_PRIMASK() { return 0; }
+inline void __set_PRIMASK(uint32_t) {}
+inline void __disable_irq() {}
+inline void __enable_irq() {}
+
+#endif // APM_SIM_STM32F3XX_H
@@ -0,0 +1,208 @@
+/**
+ * Decodes a telemetry stream captured from the APM into CSV.
+ *
+ * Usage:
+ *   telemetry_decode <capture> [csv]
+ *       Decodes the bytes received from the debug UART after 'y uart'.
+ *
+ *   telemetry_decode --candump <log> [csv]
+ *       Decodes the frames on the telemetry CAN ID in a candump -L log, as
+ *       recorded after 'y can'.
+ *
+ * The CSV has a row per sample with the packet sequence number, the time in
+ * ms since the APM powered on and a column per streamed signal.  A new header
+ * row is written whenever the streamed signals change.  It goes to stdout
+ * unless a file is given.  Totals are printed to stderr as key=value lines.
+ */
+
+#include <APM/Telemetry.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using APM::NUM_TELEMETRY_SIGNALS;
+using APM::TelemetryDecoder;
+using APM::TelemetryPacket;
+using APM::TelemetryStream;
+
+/**
+ * Prints how to use the tool
+ */
+void usage() {
+  fprintf(stderr, "Usage:\n"
+                  "  telemetry_decode <capture> [csv]\n"
+                  "  telemetry_decode --candump <log> [csv]\n");
+}
+
+/**
+ * Reads a whole file
+ * @param path the file to read
+ * @param data filled with the contents
+ * @return true on success
+ */
+bool readFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + read);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Extracts the data of the telemetry frames from a candump -L log, whose
+ * lines look like "(1700000000.000000) can0 0A1FF006#0102030405060708"
+ * @param path the log to read
+ * @param data filled with the data bytes in the order received
+ * @return true on success
+ */
+bool readCandump(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    char *hash = strchr(line, '#');
+    if (hash == nullptr) {
+      continue;
+    }
+
+    // The ID is the word before the '#'
+    char *id = hash;
+    while (id > line && id[-1] != ' ') {
+      id--;
+    }
+    if (strtoul(id, nullptr, 16) != TelemetryStream::CAN_ID) {
+      continue;
+    }
+
+    for (char *hex = hash + 1; hex[0] != '\0' && hex[1] != '\0'; hex += 2) {
+      char byte[3] = {hex[0], hex[1], '\0'};
+      char *end;
+      unsigned long value = strtoul(byte, &end, 16);
+      if (end != byte + 2) {
+        break;
+      }
+      data.push_back(static_cast<uint8_t>(value));
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Writes the header row for a set of signals
+ * @param csv the file to write
+ * @param signals the streamed signals, one bit per TelemetrySignal
+ */
+void writeHeader(FILE *csv, uint32_t signals) {
+  fprintf(csv, "sequence,time_ms");
+  for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+    if ((signals & (1u << i)) != 0) {
+      fprintf(csv, ",%s", APM::TELEMETRY_SIGNALS[i]);
+    }
+  }
+  fprintf(csv, "\n");
+}
+
+/**
+ * Writes a row per sample of a packet
+ * @param csv the file to write
+ * @param packet the packet
+ */
+void writeRows(FILE *csv, const TelemetryPacket &packet) {
+  for (size_t sample = 0; sample < packet.numSamples; sample++) {
+    fprintf(csv, "%u,%u", packet.sequence, packet.times[sample]);
+    for (size_t i = 0; i < NUM_TELEMETRY_SIGNALS; i++) {
+      if ((packet.signals & (1u << i)) != 0) {
+        fprintf(csv, ",%u", packet.values[sample][i]);
+      }
+    }
+    fprintf(csv, "\n");
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool candump = argc > 1 && strcmp(argv[1], "--candump") == 0;
+  int first = candump ? 2 : 1;
+  if (argc <= first || argc > first + 2) {
+    usage();
+    return 1;
+  }
+
+  const char *path = argv[first];
+  std::vector<uint8_t> data;
+  if (!(candump ? readCandump(path, data) : readFile(path, data))) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    return 1;
+  }
+
+  FILE *csv = stdout;
+  if (argc > first + 1) {
+    csv = fopen(argv[first + 1], "w");
+    if (csv == nullptr) {
+      fprintf(stderr, "Failed to open %s\n", argv[first + 1]);
+      return 1;
+    }
+  }
+
+  // Heap allocated, the decoder holds a whole packet of samples
+  auto *decoder = new TelemetryDecoder();
+  uint32_t signals = 0;
+  uint64_t samples = 0;
+  uint32_t firstTime = 0;
+  uint32_t lastTime = 0;
+  for (uint8_t byte : data) {
+    if (!decoder->push(byte)) {
+      continue;
+    }
+
+    const TelemetryPacket &packet = decoder->getPacket();
+    if (packet.signals != signals) {
+      signals = packet.signals;
+      writeHeader(csv, signals);
+    }
+    writeRows(csv, packet);
+
+    if (samples == 0) {
+      firstTime = packet.times[0];
+    }
+    lastTime = packet.times[packet.numSamples - 1];
+    samples += packet.numSamples;
+  }
+
+  if (csv != stdout) {
+    fclose(csv);
+  }
+
+  fprintf(stderr, "bytes=%zu\n", data.size());
+  fprintf(stderr, "packets=%u\n", decoder->getPacketCount());
+  fprintf(stderr, "samples=%llu\n", static_cast<unsigned long long>(samples));
+  fprintf(stderr, "bad_frames=%u\n", decoder->getBadFrameCount());
+  fprintf(stderr, "lost_packets=%u\n", decoder->getLostPacketCount());
+  if (samples != 0) {
+    fprintf(stderr, "bytes_per_sample=%.2f\n",
+            static_cast<double>(data.size()) / static_cast<double>(samples));
+  }
+  if (lastTime != firstTime) {
+    fprintf(stderr, "bytes_per_second=%.1f\n",
+            static_cast<double>(data.size()) * 1000.0 /
+                static_cast<double>(lastTime - firstTime));
+  }
+
+  delete decoder;
+  return 0;
+}
@@ -0,0 +1,497 @@
+/**
+ * Records and replays APM traces on the host simulator.
+ *
+ * Usage:
+ *   trace_replay record <trace> [hours] [seed]
+ *       Runs the dev1_apm firmware against two modelled SIM100 units and a
+ *       scripted key, with random isolation faults and unit dropouts, and
+ *       records the trace the firmware would capture on the bike.
+ *
+ *   trace_replay replay <trace> [expected]
+ *       Feeds the CAN frames and key interrupts of a trace back into the
+ *       firmware on a virtual clock and compares the switch outputs with those
+ *       recorded in the trace, or in a separate expected trace.  Accepts
+ *       binary traces and the hex dump printed by the 'r' console command.
+ *
+ * Results are printed as key=value lines.  replay exits non-zero if the
+ * outputs differ.
+ */
+
+#include <APM/Trace.hpp>
+#include <SIM100Model.hpp>
+#include <SimBoard.hpp>
+#include <Simulator.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+namespace IO = EVT::core::IO;
+using APM::TraceEvent;
+using APM::TraceEventType;
+using APM::sim::SimInput;
+using APM::sim::Simulator;
+
+// Largest trace record will write.  About 150 hours of driving.
+constexpr size_t RECORD_BUFFER_SIZE = 64 * 1024 * 1024;
+
+// Time the firmware keeps running after the last input of a replay, in us
+constexpr uint64_t REPLAY_TAIL = 10000000;
+
+// Largest difference in time between matching outputs, in us.  Traces from
+// the bike are timed by real code, so allow for slow UART prints.
+constexpr uint64_t OUTPUT_TOLERANCE = 50000;
+
+constexpr uint64_t SECOND = 1000000;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Returns the seconds elapsed since start
+ * @param start the start of the measurement
+ * @return elapsed seconds
+ */
+double elapsedSeconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Reads a whole file
+ * @param path the file to read
+ * @param data filled with the contents
+ * @return true on success
+ */
+bool readFile(const char *path, std::vector<uint8_t> &data) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return false;
+  }
+
+  uint8_t chunk[4096];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data.insert(data.end(), chunk, chunk + read);
+  }
+  fclose(file);
+  return true;
+}
+
+/**
+ * Converts the hex dump printed by the dev1_apm 'r' command back to binary
+ * @param text the captured console text
+ * @param trace filled with the trace
+ * @return true if a complete dump was found
+ */
+bool parseHexDump(const std::vector<uint8_t> &text,
+                  std::vector<uint8_t> &trace) {
+  std::string contents(text.begin(), text.end());
+  size_t begin = contents.find("TRACE BEGIN");
+  size_t end = contents.find("TRACE END", begin);
+  if (begin == std::string::npos || end == std::string::npos) {
+    return false;
+  }
+
+  // Skip the rest of the BEGIN line
+  size_t position = contents.find('\n', begin);
+  int high = -1;
+  for (; position < end; position++) {
+    char c = contents[position];
+    int nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else {
+      continue;
+    }
+
+    if (high < 0) {
+      high = nibble;
+    } else {
+      trace.push_back(static_cast<uint8_t>((high << 4) | nibble));
+      high = -1;
+    }
+  }
+  return high < 0;
+}
+
+/**
+ * Loads a binary trace or a console hex dump
+ * @param path the file to load
+ * @param trace filled with the binary trace
+ * @return true on success
+ */
+bool loadTrace(const char *path, std::vector<uint8_t> &trace) {
+  std::vector<uint8_t> data;
+  if (!readFile(path, data)) {
+    fprintf(stderr, "Failed to read %s\n", path);
+    return false;
+  }
+
+  APM::TraceReader reader(data.data(), data.size());
+  if (reader.start() == 0) {
+    trace = std::move(data);
+    return true;
+  }
+
+  if (!parseHexDump(data, trace)) {
+    fprintf(stderr, "%s is not a trace\n", path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Summary of a trace
+ */
+struct TraceContents {
+  std::vector<APM::sim::OutputChange> outputs;
+  uint64_t inputs = 0;
+  uint64_t transmits = 0;
+  uint64_t timers = 0;
+  uint64_t lastTime = 0;
+};
+
+/**
+ * Reads every event of a trace
+ * @param trace the binary trace
+ * @param contents filled with the summary
+ * @return true if the trace decoded without error
+ */
+bool scanTrace(const std::vector<uint8_t> &trace, TraceContents &contents) {
+  APM::TraceReader reader(trace.data(), trace.size());
+  if (reader.start() != 0) {
+    return false;
+  }
+
+  TraceEvent event;
+  int status;
+  while ((status = reader.next(event)) == 0) {
+    contents.lastTime = event.time;
+    switch (event.type) {
+    case TraceEventType::CAN_RX:
+    case TraceEventType::GPIO_INPUT:
+      contents.inputs++;
+      break;
+    case TraceEventType::CAN_TX:
+      contents.transmits++;
+      break;
+    case TraceEventType::GPIO_OUTPUT:
+      contents.outputs.push_back(
+          {event.time, static_cast<IO::Pin>(event.id), event.level});
+      break;
+    case TraceEventType::TIMER:
+      contents.timers++;
+      break;
+    }
+  }
+  return status == 1;
+}
+
+/**
+ * Feeds the received frames and key interrupts of a trace to the simulator
+ */
+class TraceInputSource : public APM::sim::InputSource {
+public:
+  explicit TraceInputSource(const std::vector<uint8_t> &trace)
+      : reader(trace.data(), trace.size()) {
+    reader.start();
+  }
+
+  bool next(SimInput &input) override {
+    TraceEvent event;
+    while (reader.next(event) == 0) {
+      input.time = event.time;
+      if (event.type == TraceEventType::CAN_RX) {
+        input.type = SimInput::Type::CAN;
+        input.message = IO::CANMessage(event.id, event.length, event.data,
+                                       event.extended);
+        return true;
+      }
+      if (event.type == TraceEventType::GPIO_INPUT) {
+        input.type = SimInput::Type::GPIO;
+        input.pin = static_cast<IO::Pin>(event.id);
+        input.level = event.level;
+        input.forceInterrupt = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+private:
+  APM::TraceReader reader;
+};
+
+/**
+ * Schedules a key change with contact bounce
+ * @param simulator the simulator
+ * @param rng random source
+ * @param time time of the first edge in us
+ * @param level the final level
+ */
+void scheduleKey(Simulator &simulator, std::mt19937 &rng, uint64_t time,
+                 bool level) {
+  std::uniform_int_distribution<int> bounces(0, 4);
+  std::uniform_int_distribution<uint64_t> gap(100, 1500);
+
+  SimInput input;
+  input.type = SimInput::Type::GPIO;
+  input.pin = APM::APMManager::KEY_ON_UC;
+
+  int count = bounces(rng);
+  for (int i = 0; i < count; i++) {
+    input.time = time;
+    input.level = level;
+    simulator.schedule(input);
+    time += gap(rng);
+    input.time = time;
+    input.level = !level;
+    simulator.schedule(input);
+    time += gap(rng);
+  }
+
+  input.time = time;
+  input.level = level;
+  simulator.schedule(input);
+}
+
+/**
+ * Records a synthetic drive of the given length
+ */
+int record(const char *path, double hours, uint32_t seed) {
+  std::vector<uint8_t> buffer(RECORD_BUFFER_SIZE);
+  APM::TraceRecorder recorder(buffer.data(), buffer.size());
+
+  Simulator simulator;
+  APM::sim::SIM100Model unitA(simulator, APM::DEV::SIM100::CAN_REQUEST_ID,
+                              APM::DEV::SIM100::CAN_RESPONSE_ID);
+  APM::sim::SIM100Model unitB(simulator,
+                              APM::sim::SimBoard::SIM100_B_REQUEST_ID,
+                              APM::sim::SimBoard::SIM100_B_RESPONSE_ID);
+  APM::sim::SimBoard board;
+
+  traceRecorderPtr = &recorder;
+  recorder.start();
+  board.boot();
+
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint64_t> accessoryTime(2 * SECOND,
+                                                        30 * SECOND);
+  std::uniform_int_distribution<uint64_t> onTime(20 * SECOND, 600 * SECOND);
+  std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+  auto end = static_cast<uint64_t>(hours * 3600.0 * SECOND);
+  uint64_t drives = 0;
+  uint64_t faults = 0;
+  uint64_t dropouts = 0;
+
+  auto start = Clock::now();
+  while (simulator.getTime() < end) {
+    uint64_t keyOn = simulator.getTime() + accessoryTime(rng);
+    uint64_t keyOff = keyOn + onTime(rng);
+    scheduleKey(simulator, rng, keyOn, true);
+    drives++;
+
+    // Events happen after the SIM100 start up period so they reach the vote
+    std::uniform_int_distribution<uint64_t> during(keyOn + 8 * SECOND, keyOff);
+
+    if (chance(rng) < 0.1) {
+      // One unit drops off the bus for a while
+      uint64_t dropout = during(rng);
+      auto &unit = chance(rng) < 0.5 ? unitA : unitB;
+      board.runUntil(dropout);
+      unit.setSilent(true);
+      board.runUntil(std::min(dropout + 5 * SECOND, keyOff));
+      unit.setSilent(false);
+      dropouts++;
+    }
+
+    if (chance(rng) < 0.2) {
+      // Both units see an isolation fault and the APM trips
+      uint64_t fault = during(rng);
+      board.runUntil(std::max(fault, simulator.getTime()));
+      unitA.setStatus(APM::sim::SIM100Model::STATUS_ISOLATION_FAULT);
+      unitB.setStatus(APM::sim::SIM100Model::STATUS_ISOLATION_FAULT);
+      faults++;
+    }
+
+    board.runUntil(std::max(keyOff, simulator.getTime()));
+    scheduleKey(simulator, rng, simulator.getTime(), false);
+    board.runUntil(simulator.getTime() + SECOND);
+    unitA.setStatus(APM::sim::SIM100Model::STATUS_OK);
+    unitB.setStatus(APM::sim::SIM100Model::STATUS_OK);
+  }
+  double wallSeconds = elapsedSeconds(start);
+
+  recorder.stop();
+  traceRecorderPtr = nullptr;
+
+  if (recorder.getDroppedCount() != 0) {
+    fprintf(stderr, "Trace buffer full, recording is incomplete\n");
+    return 1;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == nullptr ||
+      fwrite(recorder.getData(), 1, recorder.getSize(), file) !=
+          recorder.getSize()) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    if (file != nullptr) {
+      fclose(file);
+    }
+    return 1;
+  }
+  fclose(file);
+
+  double simulatedSeconds = static_cast<double>(simulator.getTime()) / SECOND;
+  printf("simulated_s=%.0f\n", simulatedSeconds);
+  printf("wall_s=%.3f\n", wallSeconds);
+  printf("drives=%llu\n", static_cast<unsigned long long>(drives));
+  printf("faults=%llu\n", static_cast<unsigned long long>(faults));
+  printf("dropouts=%llu\n", static_cast<unsigned long long>(dropouts));
+  printf("trips=%lu\n",
+         static_cast<unsigned long>(board.getManager().getLastTrip().count));
+  printf("trace_bytes=%zu\n", recorder.getSize());
+  printf("trace_bytes_per_hour=%.0f\n",
+         recorder.getSize() / (simulatedSeconds / 3600.0));
+  return 0;
+}
+
+/**
+ * Replays a trace and compares the outputs
+ */
+int replay(const char *path, const char *expectedPath) {
+  std::vector<uint8_t> trace;
+  TraceContents contents;
+  if (!loadTrace(path, trace) || !scanTrace(trace, contents)) {
+    fprintf(stderr, "Failed to decode %s\n", path);
+    return 1;
+  }
+
+  std::vector<APM::sim::OutputChange> expected = contents.outputs;
+  if (expectedPath != nullptr) {
+    std::vector<uint8_t> expectedTrace;
+    TraceContents expectedContents;
+    if (!loadTrace(expectedPath, expectedTrace) ||
+        !scanTrace(expectedTrace, expectedContents)) {
+      fprintf(stderr, "Failed to decode %s\n", expectedPath);
+      return 1;
+    }
+    expected = expectedContents.outputs;
+  }
+
+  Simulator simulator;
+  TraceInputSource source(trace);
+  simulator.setInputSource(&source);
+  APM::sim::SimBoard board;
+
+  auto start = Clock::now();
+  board.boot();
+  board.runUntil(contents.lastTime + REPLAY_TAIL);
+  double wallSeconds = elapsedSeconds(start);
+
+  const auto &actual = simulator.getOutputChanges();
+  size_t mismatches = 0;
+  size_t firstMismatch = 0;
+  uint64_t maxSkew = 0;
+  size_t common = std::min(actual.size(), expected.size());
+
+  for (size_t i = 0; i < common; i++) {
+    uint64_t skew = actual[i].time > expected[i].time
+                        ? actual[i].time - expected[i].time
+                        : expected[i].time - actual[i].time;
+    bool match = actual[i].pin == expected[i].pin &&
+                 actual[i].level == expected[i].level &&
+                 skew <= OUTPUT_TOLERANCE;
+    maxSkew = std::max(maxSkew, skew);
+    if (!match && mismatches++ == 0) {
+      firstMismatch = i;
+    }
+  }
+  if (actual.size() != expected.size()) {
+    if (mismatches == 0) {
+      firstMismatch = common;
+    }
+    mismatches += std::max(actual.size(), expected.size()) - common;
+  }
+
+  double simulatedSeconds = static_cast<double>(simulator.getTime()) / SECOND;
+  printf("inputs=%llu\n", static_cast<unsigned long long>(contents.inputs));
+  printf("simulated_s=%.1f\n", simulatedSeconds);
+  printf("wall_s=%.3f\n", wallSeconds);
+  printf("speedup=%.0f\n", simulatedSeconds / wallSeconds);
+  printf("interrupts=%llu\n",
+         static_cast<unsigned long long>(simulator.getInterruptCount()));
+  printf("tx_recorded=%llu\n",
+         static_cast<unsigned long long>(contents.transmits));
+  printf("tx_replayed=%llu\n",
+         static_cast<unsigned long long>(simulator.getTransmitCount()));
+  printf("outputs_expected=%zu\n", expected.size());
+  printf("outputs_replayed=%zu\n", actual.size());
+  printf("max_skew_us=%llu\n", static_cast<unsigned long long>(maxSkew));
+  printf("mismatches=%zu\n", mismatches);
+
+  if (mismatches != 0) {
+    auto describe = [](const char *name,
+                       const std::vector<APM::sim::OutputChange> &changes,
+                       size_t index) {
+      if (index >= changes.size()) {
+        printf("%s=<none>\n", name);
+        return;
+      }
+      printf("%s=t:%llu pin:0x%02X level:%d\n", name,
+             static_cast<unsigned long long>(changes[index].time),
+             static_cast<unsigned int>(changes[index].pin),
+             changes[index].level ? 1 : 0);
+    };
+    printf("first_mismatch=%zu\n", firstMismatch);
+    describe("expected", expected, firstMismatch);
+    describe("replayed", actual, firstMismatch);
+  }
+
+  return mismatches == 0 ? 0 : 1;
+}
+
+/**
+ * Prints the usage message
+ */
+void usage() {
+  fprintf(stderr, "Usage:\n"
+                  "  trace_replay record <trace> [hours] [seed]\n"
+                  "  trace_replay replay <trace> [expected]\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    usage();
+    return 1;
+  }
+
+  if (strcmp(argv[1], "record") == 0) {
+    double hours = argc > 3 ? strtod(argv[3], nullptr) : 1.0;
+    auto seed = static_cast<uint32_t>(argc > 4 ? strtoul(argv[4], nullptr, 10)
+                                               : 1);
+    if (hours <= 0) {
+      fprintf(stderr, "hours must be positive\n");
+      return 1;
+    }
+    return record(argv[2], hours, seed);
+  }
+
+  if (strcmp(argv[1], "replay") == 0) {
+    return replay(argv[2], argc > 3 ? argv[3] : nullptr);
+  }
+
+  usage();
+  return 1;
+}